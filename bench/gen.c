@@ -0,0 +1,176 @@
+/*
+ * VICEL - Visual Cell editor
+ * Copyright (C) 2025  Hugo Coto Florez
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * For questions or support, contact: me@hugocoto.com
+ */
+
+/* Synthetic workbook generator for the benchmarks. Writes a CSV to stdout.
+ *
+ *   -r, --rows N        rows (10000)
+ *   -c, --cols N        columns (10)
+ *   -t, --text F        fraction of data cells that are text (0.1)
+ *   -f, --formulas F    fraction of columns that hold formulas (0.3)
+ *   -d, --depth N       length of the dependency chains (8)
+ *   -R, --range N       rows summed by range formulas (16)
+ *   -F, --fanout N      fan-out of the diamonds (4)
+ *   -s, --seed N        random seed (1)
+ *
+ * Column A is always numeric: every formula depends on it, so editing a cell
+ * in A is what single-edit recalc benchmarks measure. Other columns are either
+ * data or formula columns. Formula columns cycle through three shapes:
+ *
+ *   chain    X[y] = X[y-1] + 1, restarting from A every DEPTH rows
+ *   range    X[y] = sum(A[y-RANGE+1]:A[y])
+ *   diamond  FANOUT cells read the same A cell and the next one sums them
+ */
+
+#include "src/flag.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+enum ColKind {
+        COL_DATA,
+        COL_CHAIN,
+        COL_RANGE,
+        COL_DIAMOND,
+};
+
+static uint64_t seed = 1;
+
+static uint64_t
+rnd()
+{
+        seed ^= seed << 13;
+        seed ^= seed >> 7;
+        seed ^= seed << 17;
+        return seed;
+}
+
+static double
+rndf()
+{
+        return (rnd() >> 11) * 0x1.0p-53;
+}
+
+/* Same encoding parse_coords() reads */
+static char *
+col_name(int c)
+{
+        static char buf[8];
+        char tmp[8];
+        int n = 0, i = 0;
+        do {
+                tmp[n++] = 'A' + c % 26;
+                c /= 26;
+        } while (c);
+        while (n) buf[i++] = tmp[--n];
+        buf[i] = 0;
+        return buf;
+}
+
+static int
+get_int(const char *f1, const char *f2, int def)
+{
+        char *v;
+        return flag_get_value(&v, (char *) f1, (char *) f2) ? atoi(v) : def;
+}
+
+static double
+get_double(const char *f1, const char *f2, double def)
+{
+        char *v;
+        return flag_get_value(&v, (char *) f1, (char *) f2) ? atof(v) : def;
+}
+
+static void
+print_data(double text)
+{
+        static const char *words[] = { "north", "south", "east", "west", "rain", "sun", "wind", "snow" };
+        if (rndf() < text)
+                printf("%s%d,", words[rnd() % 8], (int) (rnd() % 100));
+        else
+                printf("%d.%02d,", (int) (rnd() % 1000), (int) (rnd() % 100));
+}
+
+static void
+print_formula(enum ColKind kind, int x, int y, int depth, int range, int fanout)
+{
+        char *self = col_name(x);
+        int first;
+
+        switch (kind) {
+        case COL_CHAIN:
+                if (y % depth == 0)
+                        printf("=A%d+1,", y);
+                else
+                        printf("=%s%d+1,", self, y - 1);
+                break;
+        case COL_RANGE:
+                first = y - range + 1 < 0 ? 0 : y - range + 1;
+                printf("=sum(A%d:A%d),", first, y);
+                break;
+        case COL_DIAMOND:
+                first = y - y % (fanout + 1);
+                if (y % (fanout + 1) == fanout)
+                        printf("=sum(%s%d:%s%d),", self, first, self, y - 1);
+                else
+                        printf("=A%d*%d,", first, y % (fanout + 1) + 1);
+                break;
+        case COL_DATA:
+                break;
+        }
+}
+
+int
+main(int argc, char *argv[])
+{
+        flag_set(&argc, &argv);
+        int rows = get_int("-r", "--rows", 10000);
+        int cols = get_int("-c", "--cols", 10);
+        double text = get_double("-t", "--text", 0.1);
+        double formulas = get_double("-f", "--formulas", 0.3);
+        int depth = get_int("-d", "--depth", 8);
+        int range = get_int("-R", "--range", 16);
+        int fanout = get_int("-F", "--fanout", 4);
+        seed = get_int("-s", "--seed", 1) * 2654435761u + 1;
+
+        if (rows < 1 || cols < 1 || depth < 1 || range < 1 || fanout < 1) {
+                fprintf(stderr, "gen: rows, cols, depth, range and fanout must be positive\n");
+                return 1;
+        }
+
+        enum ColKind *kind = calloc(cols, sizeof *kind);
+        int nformula = 0;
+        for (int x = 1; x < cols; x++) {
+                if (rndf() < formulas) kind[x] = COL_CHAIN + nformula++ % 3;
+        }
+
+        for (int y = 0; y < rows; y++) {
+                printf("%d,", (int) (rnd() % 1000));
+                for (int x = 1; x < cols; x++) {
+                        if (kind[x] == COL_DATA)
+                                print_data(text);
+                        else
+                                print_formula(kind[x], x, y, depth, range, fanout);
+                }
+                putchar('\n');
+        }
+
+        free(kind);
+        return 0;
+}
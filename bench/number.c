@@ -0,0 +1,145 @@
+/*
+ * VICEL - Visual Cell editor
+ * Copyright (C) 2025  Hugo Coto Florez
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * For questions or support, contact: me@hugocoto.com
+ */
+
+/* Microbenchmark: num_format and num_parse against the snprintf and strtod
+ * calls they replace. Build and run with `make bench`. Prints one JSON object
+ * per line. */
+
+#include "src/number.h"
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define N 1000000
+
+static double values[N];
+static volatile size_t sink;
+
+static double
+now()
+{
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static uint64_t
+rnd()
+{
+        static uint64_t x = 88172645463325252ull;
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        return x;
+}
+
+static void
+fill(const char *kind)
+{
+        for (int i = 0; i < N; i++) {
+                if (!strcmp(kind, "integer"))
+                        values[i] = (double) (rnd() % 1000000);
+                else if (!strcmp(kind, "decimal6"))
+                        values[i] = (double) (rnd() % 2000000) / 1e6; // like weatherdata.csv
+                else {
+                        uint64_t r = rnd();
+                        memcpy(values + i, &r, sizeof r);
+                        if (!isfinite(values[i])) values[i] = 1.0;
+                }
+        }
+}
+
+static void
+run(const char *kind, const char *name, int which)
+{
+        char buf[NUM_BUFSIZE];
+        int bad = 0;
+        double t = now();
+
+        for (int i = 0; i < N; i++) {
+                switch (which) {
+                case 0: sink += snprintf(buf, sizeof buf, "%g", values[i]); break;
+                case 1: sink += snprintf(buf, sizeof buf, "%.17g", values[i]); break;
+                case 2: sink += num_format(values[i], buf); break;
+                }
+        }
+        t = now() - t;
+
+        for (int i = 0; i < N; i++) {
+                switch (which) {
+                case 0: snprintf(buf, sizeof buf, "%g", values[i]); break;
+                case 1: snprintf(buf, sizeof buf, "%.17g", values[i]); break;
+                case 2: num_format(values[i], buf); break;
+                }
+                bad += strtod(buf, NULL) != values[i];
+        }
+
+        printf("{\"bench\": \"number\", \"case\": \"%s\", \"impl\": \"%s\", "
+               "\"ns_per_op\": %.1f, \"round_trip_failures\": %d}\n",
+               kind, name, t * 1e9 / N, bad);
+}
+
+static void
+run_parse(const char *kind, const char *name, int which)
+{
+        static char text[N][NUM_BUFSIZE];
+        static int len[N];
+        int bad = 0;
+        double d, t;
+
+        for (int i = 0; i < N; i++)
+                len[i] = num_format(values[i], text[i]);
+
+        t = now();
+        for (int i = 0; i < N; i++) {
+                if (which == 0)
+                        d = strtod(text[i], NULL);
+                else
+                        num_parse(text[i], len[i], &d);
+                sink += d != 0;
+        }
+        t = now() - t;
+
+        for (int i = 0; i < N; i++) {
+                if (!num_parse(text[i], len[i], &d) || d != values[i]) ++bad;
+        }
+
+        printf("{\"bench\": \"number_parse\", \"case\": \"%s\", \"impl\": \"%s\", "
+               "\"ns_per_op\": %.1f, \"failures\": %d}\n",
+               kind, name, t * 1e9 / N, bad);
+}
+
+int
+main()
+{
+        const char *kinds[] = { "integer", "decimal6", "random_bits" };
+        for (int k = 0; k < 3; k++) {
+                fill(kinds[k]);
+                run(kinds[k], "snprintf_g", 0);
+                run(kinds[k], "snprintf_17g", 1);
+                run(kinds[k], "num_format", 2);
+                run_parse(kinds[k], "strtod", 0);
+                run_parse(kinds[k], "num_parse", 1);
+        }
+        return 0;
+}
@@ -0,0 +1,292 @@
+#define _GNU_SOURCE
+/*
+ * VICEL - Visual Cell editor
+ * Copyright (C) 2025  Hugo Coto Florez
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * For questions or support, contact: me@hugocoto.com
+ */
+
+/* Keystroke replay latency harness. Runs vicel on a pseudo-terminal (same
+ * forkpty() approach as web/launcher.c) and sends the actions of a script.
+ * Each action is timed from the write of its last key to the last byte of
+ * output, once the output has been quiet for a while. Prints one JSON line per action with
+ * percentiles, a log2 histogram and output bytes per action.
+ *
+ *   bench/replay [-b BIN] [-s SCRIPT] [-q QUIET_MS] [-w WAIT_MS] FILE
+ *
+ * FILE is copied to a temporary file first, as vicel saves on exit. */
+
+#include "src/flag.h"
+#include <poll.h>
+#include <pty.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/wait.h>
+#include <time.h>
+
+#define HIST_BUCKETS 32
+
+typedef struct Action {
+        char name[64];
+        char keys[256];
+        int keylen;
+        int count;
+        int64_t *latency_ns;
+        int samples;
+        int silent;
+        size_t bytes;
+} Action;
+
+static int master = -1;
+static int quiet_ms = 30;
+static int wait_ms = 1000;
+
+static int64_t
+now_ns()
+{
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec * 1000000000ll + ts.tv_nsec;
+}
+
+/* Read until there is no output for QUIET ms (or the first byte did not
+ * arrive in WAIT ms). Answers cursor position requests, as vicel asks for
+ * them and would wait for the reply. Returns the bytes read and sets LAST to
+ * the time of the last one. */
+static size_t
+drain(int wait, int quiet, int64_t *last)
+{
+        static char tail[3];
+        char buf[65536];
+        size_t total = 0;
+        ssize_t n;
+        struct pollfd pfd = { .fd = master, .events = POLLIN };
+
+        while (poll(&pfd, 1, total ? quiet : wait) > 0) {
+                if ((n = read(master, buf + 3, sizeof buf - 3)) <= 0) break;
+                *last = now_ns();
+                total += n;
+                /* look for ESC [ 6 n, even if split between reads */
+                memcpy(buf, tail, 3);
+                if (memmem(buf, n + 3, "\033[6n", 4) && write(master, "\033[1;1R", 6) != 6)
+                        perror("write");
+                memcpy(tail, buf + n, 3);
+        }
+        return total;
+}
+
+static void
+unescape(Action *a, const char *s)
+{
+        unsigned int x;
+        a->keylen = 0;
+        for (; *s && a->keylen < (int) sizeof a->keys; s++) {
+                char c = *s;
+                if (c == '\\' && s[1]) {
+                        switch (*++s) {
+                        case 'r': c = '\r'; break;
+                        case 'n': c = '\n'; break;
+                        case 't': c = '\t'; break;
+                        case 'e': c = '\033'; break;
+                        case 's': c = ' '; break;
+                        case 'x':
+                                if (sscanf(s + 1, "%2x", &x) == 1) {
+                                        c = x;
+                                        s += 2;
+                                }
+                                break;
+                        default: c = *s; break;
+                        }
+                }
+                a->keys[a->keylen++] = c;
+        }
+}
+
+static Action *
+load_script(const char *path, int *n)
+{
+        char line[512], name[64], keys[256];
+        Action *actions = NULL;
+        FILE *f;
+        int count;
+
+        if (!(f = fopen(path, "r"))) {
+                perror(path);
+                exit(1);
+        }
+        *n = 0;
+        while (fgets(line, sizeof line, f)) {
+                count = 1;
+                if (*line == '#' || sscanf(line, "%63s %255s %d", name, keys, &count) < 2)
+                        continue;
+                actions = realloc(actions, sizeof *actions * (*n + 1));
+                Action *a = actions + (*n)++;
+                *a = (Action) { .count = count > 0 ? count : 1 };
+                strcpy(a->name, name);
+                unescape(a, keys);
+                a->latency_ns = calloc(a->count, sizeof *a->latency_ns);
+        }
+        fclose(f);
+        return actions;
+}
+
+/* Keys are sent one at a time, as typed, waiting for the output of each one.
+ * Only the last key, the one that completes the action, is timed. It may take
+ * longer than QUIET ms to draw anything, so its first byte is waited for up
+ * to WAIT ms before the sample is counted as silent */
+static void
+run(Action *a)
+{
+        int64_t t = 0, last = 0;
+        size_t bytes;
+
+        for (int i = 0; i < a->count; i++) {
+                bytes = 0;
+                for (int k = 0; k < a->keylen; k++) {
+                        t = now_ns();
+                        if (write(master, a->keys + k, 1) != 1) {
+                                perror("write");
+                                return;
+                        }
+                        bytes += drain(k == a->keylen - 1 ? wait_ms : quiet_ms, quiet_ms, &last);
+                }
+                a->bytes += bytes;
+                if (last < t)
+                        ++a->silent;
+                else
+                        a->latency_ns[a->samples++] = last - t;
+        }
+}
+
+static int
+cmp_i64(const void *a, const void *b)
+{
+        int64_t x = *(int64_t *) a, y = *(int64_t *) b;
+        return (x > y) - (x < y);
+}
+
+static double
+percentile(int64_t *v, int n, double p)
+{
+        if (n == 0) return 0;
+        int i = (int) (p * n + 0.999999) - 1;
+        return v[i < 0 ? 0 : i >= n ? n - 1 : i] / 1e3;
+}
+
+static void
+print_action(const char *name, int64_t *v, int n, int silent, size_t bytes, int count)
+{
+        int hist[HIST_BUCKETS] = { 0 };
+        bool first = true;
+
+        qsort(v, n, sizeof *v, cmp_i64);
+        for (int i = 0; i < n; i++) {
+                int b = 0;
+                while (b < HIST_BUCKETS - 1 && v[i] / 1000 >= 1ll << b) ++b;
+                ++hist[b];
+        }
+
+        printf("{\"bench\": \"replay\", \"action\": \"%s\", \"count\": %d, \"silent\": %d, "
+               "\"p50_us\": %.1f, \"p90_us\": %.1f, \"p99_us\": %.1f, \"max_us\": %.1f, "
+               "\"bytes_per_action\": %.1f, \"hist_us\": {",
+               name, count, silent, percentile(v, n, 0.5), percentile(v, n, 0.9),
+               percentile(v, n, 0.99), percentile(v, n, 1), count ? (double) bytes / count : 0);
+        for (int b = 0; b < HIST_BUCKETS; b++) {
+                if (!hist[b]) continue;
+                printf("%s\"<%lld\": %d", first ? "" : ", ", 1ll << b, hist[b]);
+                first = false;
+        }
+        printf("}}\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+        char *bin = "./vicel", *script = "bench/scripts/edit.keys", *v;
+        char path[] = "/tmp/vicel_replay_XXXXXX.csv";
+        struct winsize ws = { .ws_row = 50, .ws_col = 200 };
+        int n, pid, status, fd;
+        int64_t last;
+        char buf[65536];
+        FILE *in;
+        size_t len;
+
+        flag_set(&argc, &argv);
+        if (flag_get_value(&v, "-b", "--bin")) bin = v;
+        if (flag_get_value(&v, "-s", "--script")) script = v;
+        if (flag_get_value(&v, "-q", "--quiet")) quiet_ms = atoi(v);
+        if (flag_get_value(&v, "-w", "--wait")) wait_ms = atoi(v);
+        if (argc < 2) {
+                fprintf(stderr, "usage: %s [-b BIN] [-s SCRIPT] [-q QUIET_MS] [-w WAIT_MS] FILE\n", argv[0]);
+                return 1;
+        }
+
+        Action *actions = load_script(script, &n);
+
+        if (!(in = fopen(argv[1], "r")) || (fd = mkstemps(path, 4)) < 0) {
+                perror(argv[1]);
+                return 1;
+        }
+        while ((len = fread(buf, 1, sizeof buf, in)) > 0) {
+                if (write(fd, buf, len) != (ssize_t) len) perror(path);
+        }
+        fclose(in);
+        close(fd);
+
+        if ((pid = forkpty(&master, NULL, NULL, &ws)) == 0) {
+                execl(bin, bin, path, (char *) NULL);
+                perror(bin);
+                _exit(1);
+        }
+        if (pid < 0) {
+                perror("forkpty");
+                return 1;
+        }
+
+        /* Wait for the sheet to load and the first frame to be drawn */
+        drain(60000, 200, &last);
+
+        for (int i = 0; i < n; i++)
+                run(actions + i);
+
+        if (write(master, "q", 1) != 1) perror("write");
+        drain(5000, 200, &last);
+        if (waitpid(pid, &status, WNOHANG) == 0) {
+                kill(pid, SIGTERM);
+                waitpid(pid, &status, 0);
+        }
+        unlink(path);
+
+        int64_t *all = NULL;
+        int nall = 0, silent = 0, count = 0;
+        size_t bytes = 0;
+        for (int i = 0; i < n; i++) {
+                Action *a = actions + i;
+                all = realloc(all, sizeof *all * (nall + a->samples));
+                memcpy(all + nall, a->latency_ns, sizeof *all * a->samples);
+                nall += a->samples;
+                silent += a->silent;
+                count += a->count;
+                bytes += a->bytes;
+                print_action(a->name, a->latency_ns, a->samples, a->silent, a->bytes, a->count);
+                free(a->latency_ns);
+        }
+        print_action("all", all, nall, silent, bytes, count);
+
+        free(all);
+        free(actions);
+        return 0;
+}
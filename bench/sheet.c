@@ -0,0 +1,178 @@
+#define _GNU_SOURCE
+/*
+ * VICEL - Visual Cell editor
+ * Copyright (C) 2025  Hugo Coto Florez
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * For questions or support, contact: me@hugocoto.com
+ */
+
+/* Workbook benchmark. Loads FILE (see bench/gen.c) and times load(), a full
+ * recalc, single-cell edits, render() into a null terminal, save() and a sort
+ * of every row. Prints one JSON object. Build and run with `make bench`.
+ *
+ *   bench/sheet FILE [NAME] */
+
+#include "src/color.h"
+#include "src/formula.h"
+#include "src/keyboard.h"
+#include "src/mappings.h"
+#include "src/mem.h"
+#include "src/options.h"
+#include "src/saving.h"
+#include "src/sort.h"
+#include "src/window.h"
+#include <sys/resource.h>
+
+#define EDITS 100
+#define FRAMES 200
+
+static size_t term_bytes;
+
+static double
+now()
+{
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* The null terminal: count what render() writes and drop it */
+static ssize_t
+null_write(void *cookie, const char *buf, size_t size)
+{
+        (void) cookie;
+        (void) buf;
+        term_bytes += size;
+        return size;
+}
+
+static double
+full_recalc(int *formulas)
+{
+        double t = now();
+        *formulas = 0;
+        for_da_each(row, *active_ctx.body)
+        {
+                for_da_each(c, *row)
+                {
+                        if (VAL_TYPE(c->value) != TYPE_FORMULA) continue;
+                        refresh_formula_value(c);
+                        ++*formulas;
+                }
+        }
+        return now() - t;
+}
+
+/* Edit cells of column A, which every generated formula depends on */
+static double
+edits(double *worst)
+{
+        double t, total = 0;
+        int rows = active_ctx.body->size;
+        *worst = 0;
+        srand(1);
+        for (int i = 0; i < EDITS; i++) {
+                Cell *c = cm_get_cell_ptr(active_ctx.body, 0, rand() % rows);
+                char *text;
+                asprintf(&text, "%d", rand() % 1000);
+                t = now();
+                set_cell_text(c, text);
+                t = now() - t;
+                total += t;
+                *worst = max(*worst, t);
+        }
+        return total / EDITS;
+}
+
+static double
+frames(double *first, size_t *bytes)
+{
+        double t;
+        active_ctx.ws = (struct winsize) { .ws_row = 50, .ws_col = 200 };
+        term_bytes = 0;
+        t = now();
+        render_full();
+        *first = now() - t;
+
+        t = now();
+        for (int i = 0; i < FRAMES; i++) {
+                a_move_cursor_down();
+                render();
+        }
+        *bytes = term_bytes / FRAMES;
+        return (now() - t) / FRAMES;
+}
+
+int
+main(int argc, char *argv[])
+{
+        FILE *out;
+        struct rusage ru;
+        double t, load_s, recalc_s, edit_s, edit_max_s, render_first_s, render_s, save_s, sort_s;
+        size_t render_bytes;
+        int formulas;
+        char save_path[] = "/tmp/vicel_bench_XXXXXX";
+
+        if (argc < 2) {
+                fprintf(stderr, "usage: %s FILE [NAME]\n", argv[0]);
+                return 1;
+        }
+
+        /* stdout is the terminal render() draws on */
+        out = fdopen(dup(STDOUT_FILENO), "w");
+        stdout = fopencookie(NULL, "w", (cookie_io_functions_t) { .write = null_write });
+
+        parse_options_init();
+        options_init(.filename = argv[1]);
+        set_default_colors();
+
+        t = now();
+        load(argv[1], &active_ctx);
+        load_s = now() - t;
+
+        recalc_s = full_recalc(&formulas);
+        edit_s = edits(&edit_max_s);
+        render_s = frames(&render_first_s, &render_bytes);
+
+        close(mkstemp(save_path));
+        active_ctx.filename = save_path;
+        t = now();
+        save(&active_ctx);
+        save_s = now() - t;
+        unlink(save_path);
+
+        /* Last, it moves every row */
+        t = now();
+        sort_rows(active_ctx.body, 0, active_ctx.body->size - 1, &(SortKey) { .col = 0 }, 1);
+        sort_s = now() - t;
+
+        getrusage(RUSAGE_SELF, &ru);
+        cm_mem_census(active_ctx.body);
+        fprintf(out, "{\"bench\": \"sheet\", \"case\": \"%s\", \"rows\": %d, \"cols\": %d, "
+                     "\"formulas\": %d, \"load_s\": %.6f, \"recalc_s\": %.6f, "
+                     "\"edit_us\": %.1f, \"edit_max_us\": %.1f, \"render_first_us\": %.1f, "
+                     "\"render_us\": %.1f, \"render_bytes\": %zu, \"save_s\": %.6f, \"sort_s\": %.6f, "
+                     "\"max_rss_kb\": %ld, \"mem_kb\": {",
+                argc > 2 ? argv[2] : argv[1], active_ctx.body->size,
+                active_ctx.body->size ? active_ctx.body->data->size : 0, formulas,
+                load_s, recalc_s, edit_s * 1e6, edit_max_s * 1e6, render_first_s * 1e6,
+                render_s * 1e6, render_bytes, save_s, sort_s, ru.ru_maxrss);
+        for (int i = 0; i < MEM_LEN; i++)
+                fprintf(out, "%s\"%s\": %zu", i ? ", " : "", mem_cat_name(i), mem_stat(i).live / 1024);
+        fprintf(out, "}}\n");
+        fclose(out);
+        return 0;
+}
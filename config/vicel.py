@@ -70,6 +70,11 @@ func_a_delete_down_row = "gdj"
 func_a_delete_right_col = "gdl"
 func_a_col_increase = "+"
 func_a_col_decrease = "-"
+func_a_col_autofit = "="
+func_a_profile_next = "gp"
+func_a_mem_stats = "gm"
+func_a_sort_asc = "go"
+func_a_sort_desc = "gO"
 func_a_scroll_up = "ej"
 func_a_scroll_down = "ek"
 func_a_scroll_left = "el"
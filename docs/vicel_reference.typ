@@ -94,7 +94,20 @@ The options supported are the following:
   table.hline(),
   [`-m`, `--use-mouse`  ], [Enable mouse support],
   [`-D`, `--debug`      ], [Enable debug output ],
+  [`--log-level`        ], [Log messages of this level and above to
+                            #smallcaps("report.log"): `trace` (needs a build
+                            with `-DLOG_MIN_LEVEL=0`), `debug` (default),
+                            `info`, `warn` or `error`],
+  [`--log-categories`   ], [Only log these categories, comma separated:
+                            `core`, `cell`, `formula`, `render`, `input`,
+                            `io`],
   [`-c`, `--config-file`], [Set custom file path],
+  [`--profile`          ], [Profile formulas from the start (see `gp`)],
+  [`--stats`            ], [Print memory usage by category at exit (see `gm`)],
+  [`--trace`            ], [Record where time is spent (load, formulas,
+                            render, save) and write it at exit to the given
+                            file, in Chrome trace format (open it with
+                            #smallcaps("ui.perfetto.dev"))],
   // [`--dump-options`], [Print in stdout the default options and exit],
 )
 
@@ -188,6 +201,7 @@ equal sign. The function body have to contain a valid expression.
   [Text], [Alphas or text surrounded by `'`], [hello, '5.9'],
   [Identifier], [Cell reference by name as #smallcaps("ColRow")], [A0, b5, ZZ98],
   [Range], [Cell range as #smallcaps("ID:ID")], [A0:A2, A7:C8],
+  [Open range], [Columns to the last row, as #smallcaps("Col:Col") or #smallcaps("ID:Col")], [A:A, A5:A, B2:C],
   [Arithmetic operators], [Evaluate arithmetic expressions], [+, -, /, \*, ^],
   [Comparison operators], [Compare two expressions], [>, <, >=, <=, ==, !=, !],
   [functions], [Reserved names that convert some input in some output, with the form #smallcaps("name(args,...)")],
@@ -196,6 +210,10 @@ equal sign. The function body have to contain a valid expression.
   [Todo: expand formula reference], [], [],
 )
 
+Open ranges grow with the sheet: rows added later are part of them. sum, avg,
+count, min, max and the statistics below only go through the cells of these
+columns that have a value.
+
 === Builtin functions
 Builtin functions can be called in formulas. It takes numbers, text or cells as
 arguments and return a value.
@@ -212,6 +230,94 @@ arguments and return a value.
   cells
 - *literal(v)*: Evaluates to v, literally. Can be used to store numbers as
   strings.
+- *vlookup(key, range, n [, sorted])*: Find key in the first column of range
+  and get the value of column n (from 1) in the same row. If sorted is true the
+  first column has to be in ascending order, and the last value not greater
+  than key is found instead.
+- *hlookup(key, range, n [, sorted])*: As vlookup, but searching the first row
+  of range and getting the value of its row n.
+- *match(key, range [, type])*: Position (from 1) of key in a range of one
+  column or one row. With type 1 the range is in ascending order and the last
+  value not greater than key is found. With type -1 it is in descending order
+  and the last value not less than key is found.
+- *xlookup(key, range, results [, default])*: Find key in range and get the
+  value at the same position of results, which has the same size. If key is
+  not found, get default.
+
+- *sumif(range, criterion [, values])*: Sum the cells of values (or of range
+  if not given) whose cell in range meets the criterion.
+- *averageif(range, criterion [, values])*: As sumif, but the average.
+- *countif(range, criterion)*: Number of cells of range that meet the
+  criterion.
+- *sumifs(values, range, criterion [, range, criterion ...])*: Sum the cells
+  of values whose cells in every range meet its criterion.
+- *countifs(range, criterion [, range, criterion ...])*: Number of positions
+  where the cells of every range meet its criterion.
+
+A criterion is a number, or text with an optional comparison before it: `'>10'`,
+`'<=0'`, `'<>done'`, `'=a*'`. Text compares ignoring case, and `*` matches any
+text and `?` any character. `''` matches empty cells and `'<>'` non empty ones.
+All ranges of a call have the same size. After the first evaluation, changing
+a cell only updates what that cell adds, instead of going through the ranges
+again.
+
+- *pivot(range, keys, values [, aggregations])*: Group the rows of range by
+  the columns keys and aggregate the columns values of each group. Columns are
+  counted from 1 inside range, and more than one can be given as text:
+  `pivot(A0:F999, '1,2', 4, 'sum,max')`. Aggregations are `sum` (default),
+  `count` (non empty cells), `avg`, `min` and `max`: one for every value
+  column, one for all of them, or many for a single value column.
+
+The result of pivot has a row per group, in the order their keys first appear,
+with the keys and then the aggregations. It starts at the formula cell and
+fills the cells on its right and below it, that have to be empty (if not, the
+formula gets `ERROR`). These cells are saved empty and filled again when the
+sheet is loaded. Changing a cell of range only moves its row from one group to
+other, and big ranges are grouped in parallel.
+
+- *var(...)*: Sample variance of the numbers of the arguments.
+- *stdev(...)*: Sample standard deviation of the numbers of the arguments.
+- *median(...)*: Number in the middle of the numbers of the arguments, or the
+  mean of the two in the middle.
+- *percentile(range, k)*: Percentile k (from 0 to 1) of the numbers of range,
+  interpolating between the two closest ones.
+- *quartile(range, q)*: Quartile q of the numbers of range: 0 is the min, 2 the
+  median and 4 the max.
+- *mode(...)*: Number that repeats the most, or the first one of them if more
+  than one does. `ERROR` if none repeats.
+- *correl(xs, ys)*: Correlation between two ranges of the same size, using
+  the positions that have a number in both.
+
+Statistics ignore text, booleans and empty cells. Median, percentile and
+quartile find the numbers they need without sorting the range.
+
+- *approx_distinct(range)*: Approximate number of different values in range.
+- *approx_percentile(range, k)*: Approximate percentile k (from 0 to 1) of the
+  numbers of range.
+- *approx_topk(range, k)*: The k (up to 64) most frequent values of range, with
+  the times they appear. As pivot, the result is a block of two columns that
+  starts at the formula cell.
+
+Approximate functions are meant for ranges of millions of cells, where they
+use little memory and time. Their error is about 2%, and on small ranges they
+are exact. Changing a cell of range only adds its new value.
+
+- *rolling_sum(range, k)*: For every row of a range of one column, the sum of
+  the numbers of the last k rows up to it.
+- *rolling_avg(range, k)*, *rolling_min(range, k)*, *rolling_max(range, k)*:
+  As rolling_sum, but the average, min or max.
+- *ewma(range, alpha)*: Exponentially weighted moving average of the numbers
+  of a range of one column, with alpha from 0 to 1 (the weight of each new
+  number).
+
+Rolling functions and ewma give a column as tall as range, that starts at the
+formula cell and fills the cells below it as pivot does. A result is empty
+until its window has k rows. The column is computed at once, so
+`rolling_avg(E0:E999, 30)` replaces a thousand `avg(E0:E29)` filled down, and
+changing a cell of range only computes again the results whose window has it.
+
+Lookups compare text ignoring case. Searching a value that is not sorted builds
+an index of the range the first time, so later searches in it are immediate.
 
 Functions accepts ranges as parameters. They are two valid cells separated by
 a `:`. For example, `sum(A0:A9)` is the same as sum the first 10 numbers in
@@ -256,6 +362,33 @@ identifier would not change on row/col insertion/deletion.
   [`gdh`], [ Delete column and move left],
 )
 
+== Sort rows
+Rows can be sorted by the values of the cursor column. If some cells are
+selected (see `v`), the rows from the first to the last with selected cells are
+sorted, and the columns of the selected cells break the ties, from left to
+right. Otherwise sorting starts at the cursor row, so rows above it (a header)
+stay where they are, and ends at the last row. Numbers go before text
+(compared ignoring case) and booleans, and empty cells always go last. Rows
+with the same value keep their order.
+
+#table(
+  columns: 2,
+  stroke: none,
+  table.header("Command", "Description"),
+  table.hline(),
+  [`go`], [ Sort rows by the cursor column, ascending],
+  [`gO`], [ Sort rows by the cursor column, descending],
+)
+
+Formulas keep referring to the same cells, not to the values that moved: after
+sorting, `=B5` is whatever ends up in `B5`. Formulas in the sorted rows move
+with their row. Their relative references to the sorted rows move the same
+rows, so `=B3*B0` in row 3 still reads its own row wherever it ends up, while
+references to other rows, like `B0` in a header, and references frozen with
+`$` keep their address. A range moves only if it is all inside the sorted
+rows. If a reference would be moved out of the sheet, it is kept as it was and
+the formula is an error until it is edited.
+
 == Expand cells
 There is a feature to fill the next cell value based on the previous one and a
 direction. Numbers add 1 and formula identifiers recalculate depending on the
@@ -299,9 +432,27 @@ There are another useful commands, described below.
   [w], [Write (save)],
   [r], [Re-render the screen],
   [Ctrl-c], [Quit without save],
-  [+/-], [Increase/decrease column width],
+  [+/-], [Increase/decrease cursor column width],
+  [=], [Fit cursor column width to its content],
+  [gp], [Jump to the next of the 10 slowest formulas (see below)],
+  [gm], [Show memory usage, one category each time (see below)],
 )
 
+If a sheet is slow to recalculate, the formula profiler can tell which
+formulas to blame. Start vicel with `--profile`, or press `gp` once to start
+profiling. While profiling, every formula counts how many times it was
+evaluated, the time it took, how many times a change in another cell made it
+recalculate and the largest range it went through. Each `gp` moves the cursor
+to the next of the 10 most expensive formulas and shows these numbers.
+
+Memory is accounted by category: `cells` (rows and cell metadata), `strings`
+(cell text as shown and as typed), `subscribers` (which formulas depend on
+each cell), `formulas` (parsed formulas), `indexes` (used by lookups),
+`colors`, `python` (the interpreter that reads the config file) and `misc`.
+For each one, `gm` shows the bytes in use, the peak and the number of
+allocations and frees. The first `gm` shows the total. Start vicel with
+`--stats` to get the same numbers for every category when it exits.
+
 == Mouse support
 Despite the early development idea was to create a fully mouseless experience,
 some users may find convenient to do some actions with their mouse. It can be
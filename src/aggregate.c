@@ -0,0 +1,377 @@
+/*
+ * VICEL - Visual Cell editor
+ * Copyright (C) 2025  Hugo Coto Florez
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * For questions or support, contact: me@hugocoto.com
+ */
+
+#define LOG_CAT LOG_FORMULA
+
+#include "aggregate.h"
+#include "builtin.h"
+#include "common.h"
+#include "debug.h"
+#include "eval.h"
+#include "mem.h"
+#include "number.h"
+#include "profile.h"
+#include "trace.h"
+#include "window.h"
+#include <ctype.h>
+
+typedef struct CondAgg {
+        BuiltinState base;
+        int ncrit;
+        struct Range *ranges; // criteria ranges, then the aggregated one
+        Criterion *crit;
+        Value *src; // criteria as given, to notice when they change
+        bool has_values;
+        int w, h;
+        double *val;        // what each cell adds to sum
+        unsigned char *hit; // whether each cell passes (and is a number)
+        NumSum sum;
+        long count;
+        /* The cached result is only valid for this sheet layout */
+        CellMat *mat;
+        unsigned version;
+        unsigned missed;
+} CondAgg;
+
+static char *
+lower_dup(const char *s)
+{
+        char *d = mem_strdup(MEM_FORMULAS, s);
+        for (char *c = d; *c; c++)
+                *c = tolower(*c);
+        return d;
+}
+
+void
+criterion_compile(Criterion *c, Value v)
+{
+        static const struct {
+                const char *s;
+                int op;
+        } ops[] = {
+                { ">=", CRIT_GE }, { "<=", CRIT_LE }, { "<>", CRIT_NE }, { "!=", CRIT_NE },
+                { "==", CRIT_EQ }, { ">", CRIT_GT },  { "<", CRIT_LT },  { "=", CRIT_EQ },
+        };
+        char *s;
+
+        *c = (Criterion) { .kind = CRIT_EMPTY, .op = CRIT_EQ };
+        switch (VAL_TYPE(v)) {
+        case TYPE_NUMBER:
+                c->kind = CRIT_NUMBER;
+                c->num = VAL_NUM(v);
+                return;
+        case TYPE_BOOL:
+                c->kind = CRIT_BOOL;
+                c->bol = VAL_BOOL(v);
+                return;
+        case TYPE_TEXT:
+                break;
+        default:
+                return;
+        }
+
+        s = VAL_TEXT(v) ?: "";
+        for (size_t i = 0; i < sizeof ops / sizeof *ops; i++) {
+                if (!strncmp(s, ops[i].s, strlen(ops[i].s))) {
+                        c->op = ops[i].op;
+                        s += strlen(ops[i].s);
+                        break;
+                }
+        }
+
+        if (*s == 0)
+                c->kind = CRIT_EMPTY;
+        else if (num_parse(s, strlen(s), &c->num))
+                c->kind = CRIT_NUMBER;
+        else {
+                c->text = lower_dup(s);
+                c->kind = (strpbrk(s, "*?") && (c->op == CRIT_EQ || c->op == CRIT_NE)) ?
+                          CRIT_WILDCARD :
+                          CRIT_TEXT;
+        }
+}
+
+void
+criterion_free(Criterion *c)
+{
+        mem_free(MEM_FORMULAS, c->text);
+        c->text = NULL;
+}
+
+/* P is lower case. * matches any text and ? any character */
+static bool
+wildcard_match(const char *p, const char *s)
+{
+        const char *star = NULL, *back = NULL;
+
+        while (*s) {
+                if (*p == '*') {
+                        star = ++p;
+                        back = s;
+                } else if (*p == '?' || *p == tolower(*s)) {
+                        ++p;
+                        ++s;
+                } else if (star) {
+                        p = star;
+                        s = ++back;
+                } else
+                        return false;
+        }
+        while (*p == '*')
+                ++p;
+        return *p == 0;
+}
+
+static bool
+apply_op(int op, int cmp)
+{
+        switch (op) {
+        case CRIT_EQ: return cmp == 0;
+        case CRIT_NE: return cmp != 0;
+        case CRIT_LT: return cmp < 0;
+        case CRIT_LE: return cmp <= 0;
+        case CRIT_GT: return cmp > 0;
+        case CRIT_GE: return cmp >= 0;
+        }
+        return false;
+}
+
+bool
+criterion_match(Criterion *c, Value v)
+{
+        bool empty = VAL_TYPE(v) == TYPE_EMPTY || (VAL_TYPE(v) == TYPE_TEXT && (!VAL_TEXT(v) || !*VAL_TEXT(v)));
+
+        switch (c->kind) {
+        case CRIT_NUMBER:
+                if (VAL_TYPE(v) != TYPE_NUMBER) return c->op == CRIT_NE;
+                return apply_op(c->op, (VAL_NUM(v) > c->num) - (VAL_NUM(v) < c->num));
+        case CRIT_TEXT:
+                if (VAL_TYPE(v) != TYPE_TEXT) return c->op == CRIT_NE;
+                return apply_op(c->op, strcasecmp(VAL_TEXT(v) ?: "", c->text));
+        case CRIT_WILDCARD:
+                if (VAL_TYPE(v) != TYPE_TEXT) return c->op == CRIT_NE;
+                return wildcard_match(c->text, VAL_TEXT(v) ?: "") == (c->op == CRIT_EQ);
+        case CRIT_EMPTY:
+                return c->op == CRIT_NE ? !empty : empty;
+        case CRIT_BOOL:
+                return VAL_TYPE(v) == TYPE_BOOL && apply_op(c->op, VAL_BOOL(v) - c->bol);
+        }
+        return false;
+}
+
+static bool
+same_value(Value a, Value b)
+{
+        if (VAL_TYPE(a) != VAL_TYPE(b)) return false;
+        switch (VAL_TYPE(a)) {
+        case TYPE_NUMBER: return VAL_NUM(a) == VAL_NUM(b);
+        case TYPE_BOOL: return VAL_BOOL(a) == VAL_BOOL(b);
+        case TYPE_TEXT: return !strcmp(VAL_TEXT(a) ?: "", VAL_TEXT(b) ?: "");
+        default: return true;
+        }
+}
+
+static Value
+value_at(struct Range *r, int x, int y)
+{
+        Cell *c = cm_get_cell_ptr(active_ctx.body, r->startx + x, r->starty + y);
+        if (c == NULL) return VALUE_EMPTY;
+        if (VAL_TYPE(c->value) == TYPE_FORMULA) return VAL_FORMULA(c->value)->value;
+        return c->value;
+}
+
+static void
+destroy_cond_agg(BuiltinState *s)
+{
+        CondAgg *a = (CondAgg *) s;
+        for (int k = 0; k < a->ncrit; k++) {
+                criterion_free(a->crit + k);
+                if (VAL_TYPE(a->src[k]) == TYPE_TEXT) mem_free(MEM_FORMULAS, VAL_TEXT(a->src[k]));
+        }
+        mem_free(MEM_FORMULAS, a->ranges);
+        mem_free(MEM_FORMULAS, a->crit);
+        mem_free(MEM_FORMULAS, a->src);
+        mem_free(MEM_FORMULAS, a->val);
+        mem_free(MEM_FORMULAS, a->hit);
+        mem_free(MEM_FORMULAS, a);
+}
+
+static CondAgg *
+new_cond_agg(int ncrit, struct Range *ranges, Value *src, bool has_values)
+{
+        CondAgg *a = mem_calloc(MEM_FORMULAS, 1, sizeof *a);
+        int n, nranges = ncrit + has_values;
+
+        a->base.destroy = destroy_cond_agg;
+        a->ncrit = ncrit;
+        a->has_values = has_values;
+        a->w = ranges[0].endx - ranges[0].startx + 1;
+        a->h = ranges[0].endy - ranges[0].starty + 1;
+        n = a->w * a->h;
+        a->ranges = mem_malloc(MEM_FORMULAS, sizeof *a->ranges * nranges);
+        memcpy(a->ranges, ranges, sizeof *a->ranges * nranges);
+        a->crit = mem_malloc(MEM_FORMULAS, sizeof *a->crit * ncrit);
+        a->src = mem_malloc(MEM_FORMULAS, sizeof *a->src * ncrit);
+        for (int k = 0; k < ncrit; k++) {
+                a->src[k] = src[k];
+                if (VAL_TYPE(src[k]) == TYPE_TEXT)
+                        a->src[k] = AS_TEXT(mem_strdup(MEM_FORMULAS, VAL_TEXT(src[k]) ?: ""));
+                criterion_compile(a->crit + k, src[k]);
+        }
+        a->val = mem_malloc(MEM_FORMULAS, sizeof *a->val * n);
+        a->hit = mem_malloc(MEM_FORMULAS, sizeof *a->hit * n);
+        return a;
+}
+
+static bool
+is_current(CondAgg *a, int ncrit, struct Range *ranges, Value *src, bool has_values)
+{
+        if (a->ncrit != ncrit || a->has_values != has_values) return false;
+        if (memcmp(a->ranges, ranges, sizeof *ranges * (ncrit + has_values))) return false;
+        for (int k = 0; k < ncrit; k++)
+                if (!same_value(a->src[k], src[k])) return false;
+        return a->mat == active_ctx.body && a->version == cm_layout_version &&
+               a->missed == formula_missed;
+}
+
+/* Test every cell, one range at a time */
+static void
+full_scan(CondAgg *a)
+{
+        TRACE_SPAN("aggregate: scan", "formula");
+        int n = a->w * a->h, i;
+        Value v;
+
+        if (profile_enabled) profile_range(n * (a->ncrit + a->has_values));
+        memset(a->hit, 1, n);
+        for (int k = 0; k < a->ncrit; k++) {
+                i = 0;
+                for (int y = 0; y < a->h; y++)
+                        for (int x = 0; x < a->w; x++, i++)
+                                if (a->hit[i] && !criterion_match(a->crit + k, value_at(a->ranges + k, x, y)))
+                                        a->hit[i] = 0;
+        }
+
+        a->sum = (NumSum) { 0 };
+        a->count = 0;
+        i = 0;
+        for (int y = 0; y < a->h; y++) {
+                for (int x = 0; x < a->w; x++, i++) {
+                        a->val[i] = 0;
+                        if (a->has_values && a->hit[i]) {
+                                v = value_at(a->ranges + a->ncrit, x, y);
+                                if (VAL_TYPE(v) == TYPE_NUMBER)
+                                        a->val[i] = VAL_NUM(v);
+                                else
+                                        a->hit[i] = 0;
+                        }
+                        num_sum_add(&a->sum, a->val[i]);
+                        a->count += a->hit[i];
+                }
+        }
+        a->mat = active_ctx.body;
+        a->version = cm_layout_version;
+        a->missed = formula_missed;
+}
+
+/* Recompute the cell at offset I */
+static void
+update_offset(CondAgg *a, int i)
+{
+        int x = i % a->w, y = i / a->w;
+        unsigned char hit = 1;
+        double val = 0;
+        Value v;
+
+        for (int k = 0; k < a->ncrit && hit; k++)
+                hit = criterion_match(a->crit + k, value_at(a->ranges + k, x, y));
+        if (a->has_values && hit) {
+                v = value_at(a->ranges + a->ncrit, x, y);
+                if (VAL_TYPE(v) == TYPE_NUMBER)
+                        val = VAL_NUM(v);
+                else
+                        hit = 0;
+        }
+        num_sum_add(&a->sum, val);
+        num_sum_add(&a->sum, -a->val[i]);
+        a->count += hit - a->hit[i];
+        a->val[i] = val;
+        a->hit[i] = hit;
+}
+
+/* Only the cell that notified the formula has changed since the last
+ * evaluation */
+static void
+update_notifier(CondAgg *a)
+{
+        struct Range *r;
+        int x, y;
+
+        if (!cm_get_cell_pos(active_ctx.body, formula_notifier, &x, &y)) return;
+        for (int k = 0; k < a->ncrit + a->has_values; k++) {
+                r = a->ranges + k;
+                if (x < r->startx || x > r->endx || y < r->starty || y > r->endy) continue;
+                update_offset(a, (y - r->starty) * a->w + (x - r->startx));
+        }
+}
+
+Value
+aggregate_if(AggKind kind, Expr *values, Expr *args, int npairs)
+{
+        BuiltinState **state = builtin_state();
+        CondAgg *a = (CondAgg *) *state;
+        struct Range ranges[16];
+        Value src[16], v;
+        int ncrit = 0;
+
+        for (; args && ncrit != npairs; args = args->next->next) {
+                if (args->next == NULL || ncrit == 15) return VALUE_ERROR;
+                if (VAL_TYPE(v = eval_expr(args)) != TYPE_RANGE) return VALUE_ERROR;
+                ranges[ncrit] = *VAL_RANGE(v);
+                src[ncrit++] = eval_expr(args->next);
+        }
+        if (values) {
+                if (VAL_TYPE(v = eval_expr(values)) != TYPE_RANGE) return VALUE_ERROR;
+                ranges[ncrit] = *VAL_RANGE(v);
+        }
+        if (ncrit == 0) return VALUE_ERROR;
+        for (int k = 1; k < ncrit + (values != NULL); k++) {
+                if (ranges[k].endx - ranges[k].startx != ranges[0].endx - ranges[0].startx ||
+                    ranges[k].endy - ranges[k].starty != ranges[0].endy - ranges[0].starty)
+                        return VALUE_ERROR;
+        }
+
+        if (a && is_current(a, ncrit, ranges, src, values != NULL) && formula_notifier &&
+            builtin_state_followed(&a->base))
+                update_notifier(a);
+        else {
+                if (a) a->base.destroy(&a->base);
+                *state = &(a = new_cond_agg(ncrit, ranges, src, values != NULL))->base;
+                full_scan(a);
+        }
+        a->base.change = formula_change;
+
+        switch (kind) {
+        case AGG_SUM: return AS_NUMBER(num_sum_value(&a->sum));
+        case AGG_COUNT: return AS_NUMBER(a->count);
+        case AGG_AVG: return a->count ? AS_NUMBER(num_sum_value(&a->sum) / a->count) : VALUE_EMPTY;
+        }
+        return VALUE_ERROR;
+}
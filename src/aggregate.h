@@ -0,0 +1,69 @@
+/*
+ * VICEL - Visual Cell editor
+ * Copyright (C) 2025  Hugo Coto Florez
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * For questions or support, contact: me@hugocoto.com
+ */
+
+#ifndef AGGREGATE_H_
+#define AGGREGATE_H_
+
+#include "cellmap.h"
+#include "formula.h"
+
+/* Conditional aggregates (sumif, countif, ...). Criteria are compiled once
+ * per call into a typed predicate. The first evaluation tests every cell,
+ * one criterion range at a time, and keeps what each cell adds to the
+ * result. After that, a change in one cell only recomputes that cell. */
+
+typedef enum AggKind {
+        AGG_SUM,
+        AGG_COUNT,
+        AGG_AVG,
+} AggKind;
+
+typedef struct Criterion {
+        enum {
+                CRIT_NUMBER,
+                CRIT_TEXT,
+                CRIT_WILDCARD, // text with * and ?
+                CRIT_EMPTY,
+                CRIT_BOOL,
+        } kind;
+        enum {
+                CRIT_EQ,
+                CRIT_NE,
+                CRIT_LT,
+                CRIT_LE,
+                CRIT_GT,
+                CRIT_GE,
+        } op;
+        double num;
+        char *text;
+        bool bol;
+} Criterion;
+
+/* Compile V (a number, or text as ">10", "<>foo", "=a*") into C */
+void criterion_compile(Criterion *c, Value v);
+bool criterion_match(Criterion *c, Value v);
+void criterion_free(Criterion *c);
+
+/* Evaluate a conditional aggregate call. ARGS are NPAIRS (-1 for all of
+ * them) pairs of range and criterion. VALUES is the range aggregated, NULL
+ * to count */
+Value aggregate_if(AggKind kind, Expr *values, Expr *args, int npairs);
+
+#endif // !AGGREGATE_H_
@@ -18,7 +18,10 @@
  * For questions or support, contact: me@hugocoto.com
  */
 
+#define LOG_CAT LOG_FORMULA
+
 #include "builtin.h"
+#include "aggregate.h"
 #include "cellmap.h"
 #include "color.h"
 #include "common.h"
@@ -26,6 +29,11 @@
 #include "debug.h"
 #include "eval.h"
 #include "formula.h"
+#include "lookup.h"
+#include "pivot.h"
+#include "rolling.h"
+#include "sketch.h"
+#include "stats.h"
 #include "window.h"
 #include <unistd.h>
 
@@ -49,6 +57,27 @@ builtin_get(char *name)
         return NULL;
 }
 
+BuiltinState **
+builtin_state()
+{
+        return &builtin_call->as.func.state;
+}
+
+bool
+builtin_state_followed(BuiltinState *state)
+{
+        return formula_cell && state->change == VAL_FORMULA(formula_cell->value)->change;
+}
+
+void
+builtin_unspill(int *w, int *h)
+{
+        int x, y;
+        /* Not destroyed by destroy_formula, the block is left as it is */
+        if (formula_cell == NULL || !cm_get_cell_pos(active_ctx.body, formula_cell, &x, &y)) return;
+        cm_spill_block(active_ctx.body, x, y, NULL, 0, 0, w, h);
+}
+
 void
 builtin_add(char *name, Func f)
 {
@@ -63,7 +92,7 @@ builtin_sum(Expr *e)
 {
         Value v;
         if (e == NULL) {
-                report("Null first expr at sum");
+                log_warn("Null first expr at sum");
                 return VALUE_EMPTY;
         }
         v = vadd(eval_expr(e), AS_NUMBER(0)); // for ranges
@@ -101,8 +130,8 @@ builtin_avg(Expr *e)
 {
         Value a = builtin_sum(e);
         Value b = builtin_count(e);
-        if (a.type == TYPE_NUMBER && a.as.num == 0.0 &&
-            b.type == TYPE_NUMBER && b.as.num == 0.0) return VALUE_EMPTY;
+        if (VAL_TYPE(a) == TYPE_NUMBER && VAL_NUM(a) == 0.0 &&
+            VAL_TYPE(b) == TYPE_NUMBER && VAL_NUM(b) == 0.0) return VALUE_EMPTY;
         return vdiv(a, b);
 }
 
@@ -114,7 +143,7 @@ builtin_min(Expr *e)
         while ((e = e->next)) {
                 min = vmin(min, eval_expr(e));
         }
-        return min.type == TYPE_NUMBER ? min : VALUE_EMPTY;
+        return VAL_TYPE(min) == TYPE_NUMBER ? min : VALUE_EMPTY;
 }
 
 Value
@@ -125,7 +154,7 @@ builtin_max(Expr *e)
         while ((e = e->next)) {
                 max = vmax(max, eval_expr(e));
         }
-        return max.type == TYPE_NUMBER ? max : VALUE_EMPTY;
+        return VAL_TYPE(max) == TYPE_NUMBER ? max : VALUE_EMPTY;
 }
 
 Value
@@ -133,9 +162,9 @@ builtin_if(Expr *e)
 {
         if (e == NULL) return VALUE_EMPTY;
         Value cond = eval_expr(e);
-        if (cond.type != TYPE_BOOL) return VALUE_EMPTY;
+        if (VAL_TYPE(cond) != TYPE_BOOL) return VALUE_EMPTY;
 
-        if (cond.as.bol) {
+        if (VAL_BOOL(cond)) {
                 if (e->next == NULL) return VALUE_EMPTY;
                 return eval_expr(e->next);
         } else {
@@ -157,7 +186,7 @@ set_color(Cell *cell, char *col)
         char *name = cm_get_cell_name(active_ctx.body, cell);
         report("changing color for `%s` to `%s`", name, c == NULL ? col : c);
         free(name);
-        cell->color = (Color) {
+        cm_meta(cell)->color = (Color) {
                 .active = true,
                 .scolor = c,
         };
@@ -167,7 +196,7 @@ set_color(Cell *cell, char *col)
 static void
 set_color_b(Cell *cell, char *col)
 {
-        if (cell->color.active) return;
+        if (cm_has_color(cell)) return;
 
         char *c = get_color(col);
         if (c == NULL) {
@@ -178,7 +207,7 @@ set_color_b(Cell *cell, char *col)
         char *name = cm_get_cell_name(active_ctx.body, cell);
         report("changing color for `%s` to `%s`", name, c == NULL ? col : c);
         free(name);
-        cell->color = (Color) {
+        cm_meta(cell)->color = (Color) {
                 .active = true,
                 .scolor = c,
         };
@@ -199,17 +228,17 @@ builtin_colorb(Expr *e)
         char *col = NULL;
         Value v = eval_expr(e);
 
-        if (v.type == TYPE_TEXT || v.type == TYPE_NUMBER) col = get_repr(v);
+        if (VAL_TYPE(v) == TYPE_TEXT || VAL_TYPE(v) == TYPE_NUMBER) col = get_repr(v);
 
         while ((e = e->next)) {
                 if (e->type == EXPR_IDENTIFIER) {
                         set_color_b(e->as.identifier.cell, col);
                 }
                 if (e->type == EXPR_LITERAL) {
-                        if (e->as.literal.value.type == TYPE_RANGE) {
+                        if (VAL_TYPE(e->as.literal.value) == TYPE_RANGE) {
                                 int x, y;
                                 Cell *c;
-                                __auto_type r = e->as.literal.value.as.range;
+                                __auto_type r = *VAL_RANGE(e->as.literal.value);
 
                                 for (x = r.startx; x <= r.endx; x++) {
                                         for (y = r.starty; y <= r.endy; y++) {
@@ -233,17 +262,17 @@ builtin_color(Expr *e)
         char *col = NULL;
         Value v = eval_expr(e);
 
-        if (v.type == TYPE_TEXT || v.type == TYPE_NUMBER) col = get_repr(v);
+        if (VAL_TYPE(v) == TYPE_TEXT || VAL_TYPE(v) == TYPE_NUMBER) col = get_repr(v);
 
         while ((e = e->next)) {
                 if (e->type == EXPR_IDENTIFIER) {
                         set_color(e->as.identifier.cell, col);
                 }
                 if (e->type == EXPR_LITERAL) {
-                        if (e->as.literal.value.type == TYPE_RANGE) {
+                        if (VAL_TYPE(e->as.literal.value) == TYPE_RANGE) {
                                 int x, y;
                                 Cell *c;
-                                __auto_type r = e->as.literal.value.as.range;
+                                __auto_type r = *VAL_RANGE(e->as.literal.value);
 
                                 for (x = r.startx; x <= r.endx; x++) {
                                         for (y = r.starty; y <= r.endy; y++) {
@@ -259,6 +288,250 @@ builtin_color(Expr *e)
         return VALUE_EMPTY;
 }
 
+static bool
+is_true(Value v)
+{
+        if (VAL_TYPE(v) == TYPE_BOOL) return VAL_BOOL(v);
+        if (VAL_TYPE(v) == TYPE_NUMBER) return VAL_NUM(v) != 0;
+        return false;
+}
+
+/* vlookup and hlookup: search KEY in the first column (or row) of a table and
+ * return the value in the same row (or column) N of the table. The table has
+ * to be sorted if the fourth argument is true */
+static Value
+table_lookup(Expr *e, bool vertical)
+{
+        Value key, table, n, sorted = AS_BOOL(false);
+        struct Range *r, line;
+        int i, x, y;
+
+        if (!e || !e->next || !e->next->next) return VALUE_ERROR;
+        key = eval_expr(e);
+        table = eval_expr(e->next);
+        n = eval_expr(e->next->next);
+        if (e->next->next->next) sorted = eval_expr(e->next->next->next);
+        if (VAL_TYPE(table) != TYPE_RANGE || VAL_TYPE(n) != TYPE_NUMBER) return VALUE_ERROR;
+
+        r = VAL_RANGE(table);
+        line = *r;
+        if (vertical)
+                line.endx = line.startx;
+        else
+                line.endy = line.starty;
+        i = is_true(sorted) ? lookup_sorted(&line, key, 1) : lookup_exact(&line, key);
+        if (i < 0) return VALUE_ERROR;
+
+        x = vertical ? r->startx + (int) VAL_NUM(n) - 1 : r->startx + i;
+        y = vertical ? r->starty + i : r->starty + (int) VAL_NUM(n) - 1;
+        if (x < r->startx || x > r->endx || y < r->starty || y > r->endy) return VALUE_ERROR;
+        line = (struct Range) { x, y, x, y, 0 };
+        return lookup_value_at(&line, 0);
+}
+
+Value
+builtin_vlookup(Expr *e)
+{
+        return table_lookup(e, true);
+}
+
+Value
+builtin_hlookup(Expr *e)
+{
+        return table_lookup(e, false);
+}
+
+/* match(key, line [, type]): position (from 1) of KEY in LINE. Type 0 is an
+ * exact match, 1 the last value <= KEY in an ascending line and -1 the last
+ * value >= KEY in a descending one */
+Value
+builtin_match(Expr *e)
+{
+        Value key, line, type = AS_NUMBER(0);
+        int i;
+
+        if (!e || !e->next) return VALUE_ERROR;
+        key = eval_expr(e);
+        line = eval_expr(e->next);
+        if (e->next->next) type = eval_expr(e->next->next);
+        if (VAL_TYPE(line) != TYPE_RANGE || VAL_TYPE(type) != TYPE_NUMBER) return VALUE_ERROR;
+        if (lookup_line_len(VAL_RANGE(line)) < 0) return VALUE_ERROR;
+
+        if (VAL_NUM(type) == 0)
+                i = lookup_exact(VAL_RANGE(line), key);
+        else
+                i = lookup_sorted(VAL_RANGE(line), key, VAL_NUM(type) > 0 ? 1 : -1);
+        return i < 0 ? VALUE_ERROR : AS_NUMBER(i + 1);
+}
+
+/* xlookup(key, line, results [, if_not_found]): value of RESULTS at the
+ * position of KEY in LINE */
+Value
+builtin_xlookup(Expr *e)
+{
+        Value key, line, results;
+        int i;
+
+        if (!e || !e->next || !e->next->next) return VALUE_ERROR;
+        key = eval_expr(e);
+        line = eval_expr(e->next);
+        results = eval_expr(e->next->next);
+        if (VAL_TYPE(line) != TYPE_RANGE || VAL_TYPE(results) != TYPE_RANGE) return VALUE_ERROR;
+        if (lookup_line_len(VAL_RANGE(line)) < 0 ||
+            lookup_line_len(VAL_RANGE(line)) != lookup_line_len(VAL_RANGE(results)))
+                return VALUE_ERROR;
+
+        if ((i = lookup_exact(VAL_RANGE(line), key)) < 0)
+                return e->next->next->next ? eval_expr(e->next->next->next) : VALUE_ERROR;
+        return lookup_value_at(VAL_RANGE(results), i);
+}
+
+/* sumif(range, criterion [, values]) */
+Value
+builtin_sumif(Expr *e)
+{
+        if (e == NULL || e->next == NULL) return VALUE_ERROR;
+        return aggregate_if(AGG_SUM, e->next->next ?: e, e, 1);
+}
+
+/* averageif(range, criterion [, values]) */
+Value
+builtin_averageif(Expr *e)
+{
+        if (e == NULL || e->next == NULL) return VALUE_ERROR;
+        return aggregate_if(AGG_AVG, e->next->next ?: e, e, 1);
+}
+
+/* countif(range, criterion) */
+Value
+builtin_countif(Expr *e)
+{
+        return aggregate_if(AGG_COUNT, NULL, e, 1);
+}
+
+/* sumifs(values, range, criterion [, range, criterion ...]) */
+Value
+builtin_sumifs(Expr *e)
+{
+        if (e == NULL) return VALUE_ERROR;
+        return aggregate_if(AGG_SUM, e, e->next, -1);
+}
+
+/* countifs(range, criterion [, range, criterion ...]) */
+Value
+builtin_countifs(Expr *e)
+{
+        return aggregate_if(AGG_COUNT, NULL, e, -1);
+}
+
+/* pivot(range, keys, values [, aggregations]) */
+Value
+builtin_pivot(Expr *e)
+{
+        return pivot_eval(e);
+}
+
+Value
+builtin_var(Expr *e)
+{
+        return stats_var(e);
+}
+
+Value
+builtin_stdev(Expr *e)
+{
+        return stats_stdev(e);
+}
+
+Value
+builtin_median(Expr *e)
+{
+        return stats_median(e);
+}
+
+/* percentile(range, k) */
+Value
+builtin_percentile(Expr *e)
+{
+        return stats_percentile(e);
+}
+
+/* quartile(range, q) */
+Value
+builtin_quartile(Expr *e)
+{
+        return stats_quartile(e);
+}
+
+Value
+builtin_mode(Expr *e)
+{
+        return stats_mode(e);
+}
+
+/* correl(xs, ys) */
+Value
+builtin_correl(Expr *e)
+{
+        return stats_correl(e);
+}
+
+/* approx_distinct(range) */
+Value
+builtin_approx_distinct(Expr *e)
+{
+        return sketch_distinct(e);
+}
+
+/* approx_percentile(range, k) */
+Value
+builtin_approx_percentile(Expr *e)
+{
+        return sketch_percentile(e);
+}
+
+/* approx_topk(range, k) */
+Value
+builtin_approx_topk(Expr *e)
+{
+        return sketch_topk(e);
+}
+
+/* rolling_sum(range, k) */
+Value
+builtin_rolling_sum(Expr *e)
+{
+        return rolling_eval(ROLL_SUM, e);
+}
+
+/* rolling_avg(range, k) */
+Value
+builtin_rolling_avg(Expr *e)
+{
+        return rolling_eval(ROLL_AVG, e);
+}
+
+/* rolling_min(range, k) */
+Value
+builtin_rolling_min(Expr *e)
+{
+        return rolling_eval(ROLL_MIN, e);
+}
+
+/* rolling_max(range, k) */
+Value
+builtin_rolling_max(Expr *e)
+{
+        return rolling_eval(ROLL_MAX, e);
+}
+
+/* ewma(range, alpha) */
+Value
+builtin_ewma(Expr *e)
+{
+        return rolling_eval(ROLL_EWMA, e);
+}
+
 static __attribute__((constructor)) void
 __setup__()
 {
@@ -272,4 +545,29 @@ __setup__()
         builtin_add("color", builtin_color);
         builtin_add("colorb", builtin_colorb);
         builtin_add("literal", builtin_literal);
+        builtin_add("vlookup", builtin_vlookup);
+        builtin_add("hlookup", builtin_hlookup);
+        builtin_add("match", builtin_match);
+        builtin_add("xlookup", builtin_xlookup);
+        builtin_add("sumif", builtin_sumif);
+        builtin_add("averageif", builtin_averageif);
+        builtin_add("countif", builtin_countif);
+        builtin_add("sumifs", builtin_sumifs);
+        builtin_add("countifs", builtin_countifs);
+        builtin_add("pivot", builtin_pivot);
+        builtin_add("var", builtin_var);
+        builtin_add("stdev", builtin_stdev);
+        builtin_add("median", builtin_median);
+        builtin_add("percentile", builtin_percentile);
+        builtin_add("quartile", builtin_quartile);
+        builtin_add("mode", builtin_mode);
+        builtin_add("correl", builtin_correl);
+        builtin_add("approx_distinct", builtin_approx_distinct);
+        builtin_add("approx_percentile", builtin_approx_percentile);
+        builtin_add("approx_topk", builtin_approx_topk);
+        builtin_add("rolling_sum", builtin_rolling_sum);
+        builtin_add("rolling_avg", builtin_rolling_avg);
+        builtin_add("rolling_min", builtin_rolling_min);
+        builtin_add("rolling_max", builtin_rolling_max);
+        builtin_add("ewma", builtin_ewma);
 }
@@ -26,7 +26,24 @@
 
 typedef Value (*Func)(Expr *);
 
+/* What a builtin keeps between evaluations of the same call, freed with the
+ * formula. Embed it as the first member of the real state */
+typedef struct BuiltinState {
+        void (*destroy)(struct BuiltinState *);
+        unsigned change; // formula_change of the last evaluation that used it
+} BuiltinState;
+
 Func builtin_get(char *);
 void builtin_add(char *name, Func f);
+/* State of the call being evaluated, NULL until the builtin sets it */
+BuiltinState **builtin_state();
+/* True if STATE was used by the previous evaluation of its formula, so it has
+ * seen every change but the one being notified now. Set STATE->change to
+ * formula_change each time it is used */
+bool builtin_state_followed(BuiltinState *state);
+/* Empty the *W x *H block spilled by the formula of a state being destroyed
+ * with it. A state replaced by a new one that keeps the block has to set its
+ * size to 0 first */
+void builtin_unspill(int *w, int *h);
 
 #endif //! BUILTIN_H_
@@ -18,15 +18,40 @@
  * For questions or support, contact: me@hugocoto.com
  */
 
+#define LOG_CAT LOG_CELL
+#define DA_MEM_CAT MEM_CELLS
+
 #include "cellmap.h"
 #include "common.h"
 #include "da.h"
 #include "debug.h"
 #include "formula.h"
+#include "lookup.h"
+#include "number.h"
+#include "utf8.h"
 #include "window.h"
+#include <malloc.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <unistd.h>
 
+/* Rows sorted by the address of their cells, to find the position of a cell
+ * from its pointer with a binary search. Rows move when they grow or when
+ * rows are inserted or deleted, so every hit is checked against the matrix
+ * and the index is rebuilt on a miss. */
+struct RowRef {
+        Cell *data;
+        int row;
+};
+
+static struct {
+        CellMat *mat;
+        struct RowRef *data;
+        int size;
+} row_index = { 0 };
+
+unsigned cm_layout_version = 0;
+
 bool
 cm_is_valid_pos(CellMat *mat, int x, int y)
 {
@@ -49,7 +74,7 @@ cm_type_repr(CellType ct)
 {
         if (ct >= 0 && ct < TYPE_LEN)
                 return lookup[ct];
-        report("Invalid access to type lookup: %d", ct);
+        log_warn("Invalid access to type lookup: %d", ct);
         exit(1);
 }
 
@@ -57,7 +82,7 @@ cm_type_repr(CellType ct)
 CellMat *
 cm_init()
 {
-        CellMat *cm = calloc(1, sizeof(CellMat));
+        CellMat *cm = mem_calloc(MEM_CELLS, 1, sizeof(CellMat));
         CellArr ca = { 0 };
         da_append(&ca, EMPTY_CELL);
         da_append(cm, ca);
@@ -72,6 +97,7 @@ cm_add_row(CellMat *mat)
         for (int i = 0; i < s; i++)
                 da_append(&ca, EMPTY_CELL);
         da_append(mat, ca);
+        ++cm_layout_version;
 }
 
 void
@@ -79,6 +105,7 @@ cm_add_col(CellMat *mat)
 {
         for (int i = 0; i < mat->size; i++)
                 da_append(&mat->data[i], EMPTY_CELL);
+        ++cm_layout_version;
 }
 
 void
@@ -89,6 +116,7 @@ cm_insert_row(CellMat *mat, int index)
         for (int i = 0; i < s; i++)
                 da_append(&ca, EMPTY_CELL);
         da_insert(mat, ca, index);
+        ++cm_layout_version;
 }
 
 void
@@ -96,6 +124,7 @@ cm_insert_col(CellMat *mat, int index)
 {
         for (int i = 0; i < mat->size; i++)
                 da_insert(&mat->data[i], EMPTY_CELL, index);
+        ++cm_layout_version;
 }
 
 
@@ -107,9 +136,11 @@ cm_delete_row(CellMat *mat, int index)
         {
                 assert(cel);
                 cm_clear_cell(cel);
+                cm_free_meta(cel);
         }
         da_destroy(&mat->data[index]);
         da_remove(mat, index);
+        ++cm_layout_version;
 }
 
 void
@@ -120,35 +151,181 @@ cm_delete_col(CellMat *mat, int index)
         assert(index < mat->data->size);
         for (; i < size; i++) {
                 cm_clear_cell((mat->data + i)->data + index);
+                cm_free_meta((mat->data + i)->data + index);
                 da_remove((mat->data + i), index);
         }
+        ++cm_layout_version;
 }
 
 
 void
 cm_subscribe(Cell *actor, Cell *observer)
 {
-        report("Add subscriber %p to %p", observer, actor);
-        da_append(&actor->subscribers, observer);
-        da_append(&observer->value.as.formula->subscribed, actor);
+        log_trace("Add subscriber %p to %p", observer, actor);
+        da_append_cat(MEM_SUBSCRIBERS, &cm_meta(actor)->subscribers, observer);
+        da_append_cat(MEM_SUBSCRIBERS, &VAL_FORMULA(observer->value)->subscribed, actor);
 }
 
 void
 cm_unsubscribe(Cell *actor, Cell *observer)
 {
         int i = 0;
-        if (!actor || !actor->subscribers.data) return;
+        if (!actor || !actor->meta || !actor->meta->subscribers.data) return;
 
-        for (; i < actor->subscribers.size; i++) {
-                if (actor->subscribers.data[i] == observer) {
-                        da_remove(&actor->subscribers, i);
-                        report("Remove subscriber %p to %p", observer, actor);
+        for (; i < actor->meta->subscribers.size; i++) {
+                if (actor->meta->subscribers.data[i] == observer) {
+                        da_remove(&actor->meta->subscribers, i);
+                        log_trace("Remove subscriber %p to %p", observer, actor);
                         return;
                 }
         }
         report("Fail to remove subscriber %p to %p", observer, actor);
 }
 
+WatcherArr cm_watchers = { 0 };
+/* Watchers of each column, so that a change to any other one does not have
+ * to look at them */
+static DA(int) watch_counts = { 0 };
+
+static void
+count_watcher(Watcher w, int n)
+{
+        while (watch_counts.size <= w.endx)
+                da_append_cat(MEM_SUBSCRIBERS, &watch_counts, 0);
+        for (int x = w.startx; x <= w.endx; x++)
+                watch_counts.data[x] += n;
+}
+
+void
+cm_watch(Cell *observer, int startx, int endx, int starty, int endy)
+{
+        Watcher w = { .observer = observer, .startx = startx, .endx = endx, .starty = starty, .endy = endy };
+
+        log_trace("Add watcher %p to columns %d-%d", observer, startx, endx);
+        da_append_cat(MEM_SUBSCRIBERS, &cm_watchers, w);
+        count_watcher(w, 1);
+}
+
+void
+cm_unwatch(Cell *observer)
+{
+        int i = 0, j = 0;
+        for (; i < cm_watchers.size; i++) {
+                if (cm_watchers.data[i].observer != observer)
+                        cm_watchers.data[j++] = cm_watchers.data[i];
+                else
+                        count_watcher(cm_watchers.data[i], -1);
+        }
+        cm_watchers.size = j;
+        if (j == 0) {
+                da_destroy_cat(MEM_SUBSCRIBERS, &cm_watchers);
+                da_destroy_cat(MEM_SUBSCRIBERS, &watch_counts);
+        }
+}
+
+void
+cm_recount_watchers()
+{
+        for_da_each(n, watch_counts) *n = 0;
+        for_da_each(w, cm_watchers) count_watcher(*w, 1);
+}
+
+/* Rows of each column that have had a value since the last layout change.
+ * A column is scanned the first time it is read, then cm_notify_subscribers
+ * adds the rows that get a value. Emptied cells are not removed */
+struct ColumnRows {
+        int *data;
+        int size, capacity;
+        bool built;
+};
+
+static struct {
+        CellMat *mat;
+        unsigned version;
+        struct ColumnRows *cols;
+        int ncols;
+} column_index = { 0 };
+
+static void
+column_index_reset(CellMat *mat)
+{
+        for (int x = 0; x < column_index.ncols; x++)
+                mem_free(MEM_CELLS, column_index.cols[x].data);
+        mem_free(MEM_CELLS, column_index.cols);
+        column_index.cols = NULL;
+        column_index.ncols = 0;
+        column_index.mat = mat;
+        column_index.version = cm_layout_version;
+        if (mat == NULL || mat->size == 0) return;
+        column_index.ncols = mat->data->size;
+        column_index.cols = mem_calloc(MEM_CELLS, column_index.ncols, sizeof *column_index.cols);
+}
+
+static void
+column_rows_insert(struct ColumnRows *col, int i, int y)
+{
+        if (col->size == col->capacity) {
+                col->capacity = col->capacity ? col->capacity * 2 : 64;
+                col->data = mem_realloc(MEM_CELLS, col->data, sizeof *col->data * col->capacity);
+        }
+        memmove(col->data + i + 1, col->data + i, sizeof *col->data * (col->size - i));
+        col->data[i] = y;
+        ++col->size;
+}
+
+/* First offset of COL whose row is >= Y */
+static int
+column_rows_find(struct ColumnRows *col, int y)
+{
+        int lo = 0, hi = col->size;
+        while (lo < hi) {
+                int mid = lo + (hi - lo) / 2;
+                if (col->data[mid] < y)
+                        lo = mid + 1;
+                else
+                        hi = mid;
+        }
+        return lo;
+}
+
+/* C, at X, Y, may have a value now */
+static void
+column_rows_note(Cell *c, int x, int y)
+{
+        struct ColumnRows *col;
+        int i;
+
+        if (VAL_TYPE(c->value) == TYPE_EMPTY || x >= column_index.ncols) return;
+        if (column_index.version != cm_layout_version) return;
+        col = column_index.cols + x;
+        if (!col->built) return;
+        i = column_rows_find(col, y);
+        if (i < col->size && col->data[i] == y) return;
+        column_rows_insert(col, i, y);
+}
+
+int
+cm_column_rows(CellMat *mat, int x, int y0, int y1, const int **rows)
+{
+        struct ColumnRows *col;
+        int i;
+
+        if (column_index.mat != mat || column_index.version != cm_layout_version)
+                column_index_reset(mat);
+        if (x < 0 || x >= column_index.ncols) return 0;
+
+        col = column_index.cols + x;
+        if (!col->built) {
+                for (int y = 0; y < mat->size; y++)
+                        if (VAL_TYPE(mat->data[y].data[x].value) != TYPE_EMPTY)
+                                column_rows_insert(col, col->size, y);
+                col->built = true;
+        }
+        i = column_rows_find(col, y0);
+        *rows = col->data + i;
+        return column_rows_find(col, y1 + 1) - i;
+}
+
 /* Return NULL on overflow */
 Cell *
 cm_get_cell_ptr(CellMat *mat, int c, int r)
@@ -168,40 +345,54 @@ cm_get_cell(CellMat *mat, int x, int y)
 char *
 get_num_repr(double d)
 {
-        char buf[16];
-        buf[snprintf(buf, sizeof buf - 1, "%g", d)] = 0;
+        char buf[NUM_BUFSIZE];
+        num_format(d, buf);
         return strdup(buf);
 }
 
+/* A5:B7, or A5:B and A:B if it is open */
+static char *
+range_repr(struct Range *r)
+{
+        char buffer[32] = "";
+        char *c1, *c2;
+        c1 = create_id(r->starty, r->startx, false, false);
+        c2 = create_id(r->endy, r->endx, false, false);
+        if (r->open) {
+                /* Keep the column */
+                if (r->starty == 0) *strpbrk(c1, "0123456789") = 0;
+                *strpbrk(c2, "0123456789") = 0;
+        }
+        snprintf(buffer, sizeof buffer, "%s:%s", c1, c2);
+        free(c1);
+        free(c2);
+        return strdup(buffer);
+}
+
 char *
 get_input_repr(Value v)
 {
-        switch (v.type) {
+        switch (VAL_TYPE(v)) {
         case TYPE_NUMBER:
-                return get_num_repr(v.as.num);
+                return get_num_repr(VAL_NUM(v));
         case TYPE_TEXT:
-                return strdup(v.as.text);
+                return strdup(VAL_TEXT(v));
         case TYPE_BOOL:
-                return strdup(v.as.bol ? "true" : "false");
+                return strdup(VAL_BOOL(v) ? "true" : "false");
         case TYPE_FORMULA: {
-                char buffer[128] = "= ";
-                get_ast_repr(v.as.formula->body, buffer, sizeof buffer - 1);
-                return strdup(buffer);
-        }
-        case TYPE_RANGE: {
-                char buffer[16] = "";
-                char *c1, *c2;
-                snprintf(buffer, sizeof buffer, "%s:%s",
-                         c1 = create_id(v.as.range.starty, v.as.range.startx, false, false),
-                         c2 = create_id(v.as.range.endy, v.as.range.endx, false, false));
-                free(c1);
-                free(c2);
-                return strdup(buffer);
+                /* The source has no length limit */
+                const char *src = formula_src(VAL_FORMULA(v));
+                size_t len = strlen(src) + 3;
+                char *s = malloc(len);
+                if (s) snprintf(s, len, "= %s", src);
+                return s;
         }
+        case TYPE_RANGE:
+                return range_repr(VAL_RANGE(v));
         case TYPE_EMPTY:
                 return strdup("");
         default:
-                report("No yet implemented: get_input_repr for %s", cm_type_repr(v.type));
+                log_warn("No yet implemented: get_input_repr for %s", cm_type_repr(VAL_TYPE(v)));
                 return strdup("Err");
         }
 }
@@ -209,63 +400,120 @@ get_input_repr(Value v)
 char *
 get_repr(Value v)
 {
-        report("get_repr for v: %s", cm_type_repr(v.type));
-        switch (v.type) {
+        log_trace("get_repr for v: %s", cm_type_repr(VAL_TYPE(v)));
+        switch (VAL_TYPE(v)) {
         case TYPE_NUMBER:
-                return get_num_repr(v.as.num);
+                return get_num_repr(VAL_NUM(v));
         case TYPE_TEXT:
-                return strdup(v.as.text ?: "");
+                return strdup(VAL_TEXT(v) ?: "");
         case TYPE_BOOL:
-                return strdup(v.as.bol ? "true" : "false");
+                return strdup(VAL_BOOL(v) ? "true" : "false");
         case TYPE_FORMULA:
-                return get_repr(v.as.formula->value);
+                return get_repr(VAL_FORMULA(v)->value);
         case TYPE_EMPTY:
                 return strdup("");
-        case TYPE_RANGE: {
-                char buffer[16] = "";
-                char *c1, *c2;
-                snprintf(buffer, sizeof buffer, "%s:%s",
-                         c1 = create_id(v.as.range.starty, v.as.range.startx, false, false),
-                         c2 = create_id(v.as.range.endy, v.as.range.endx, false, false));
-                free(c1);
-                free(c2);
-                report("Range for (%d,%d => %d,%d), ",
-                       v.as.range.startx, v.as.range.starty,
-                       v.as.range.endx, v.as.range.endy,
-                       buffer);
-                return strdup(buffer);
-        }
+        case TYPE_RANGE:
+                log_trace("Range for (%d,%d => %d,%d)",
+                          VAL_RANGE(v)->startx, VAL_RANGE(v)->starty,
+                          VAL_RANGE(v)->endx, VAL_RANGE(v)->endy);
+                return range_repr(VAL_RANGE(v));
         default:
-                report("No yet implemented: get_repr for %s", cm_type_repr(v.type));
+                log_warn("No yet implemented: get_repr for %s", cm_type_repr(VAL_TYPE(v)));
                 return strdup("Err");
         }
 }
 
+/* Set the string representation of C (it takes ownership of REPR, the old one
+ * has to be freed by the caller) and cache its display width */
+void
+cm_set_repr(Cell *c, char *repr)
+{
+        c->repr = repr;
+        c->width = utf8_width(repr);
+        if (c->meta) c->meta->cut.w = -1;
+        c->repr_dirty = false;
+}
+
+/* String representations are generated when they are read (render, save,
+ * status bar...), not each time the value changes, so a recalc does no
+ * string work. */
+char *
+cm_repr(Cell *c)
+{
+        char *old = c->repr;
+        if (c->repr_dirty) {
+                /* Text values may point to the old repr */
+                cm_set_repr(c, get_repr(c->value));
+                free(old);
+        }
+        return c->repr;
+}
+
+/* Text and empty cells are their own input, nothing is stored for them */
+char *
+cm_input_repr(Cell *c)
+{
+        CellMeta *m;
+        char *old;
+
+        switch (VAL_TYPE(c->value)) {
+        case TYPE_TEXT:
+                return VAL_TEXT(c->value) ?: "";
+        case TYPE_EMPTY:
+                return "";
+        default:
+                break;
+        }
+
+        m = cm_meta(c);
+        if (c->input_repr_dirty || m->input_repr == NULL) {
+                old = m->input_repr;
+                m->input_repr = get_input_repr(c->value);
+                c->input_repr_dirty = false;
+                free(old);
+        }
+        return m->input_repr;
+}
+
+/* Value of C changed. Old strings are kept until they are generated again */
+void
+cm_invalidate_repr(Cell *c)
+{
+        c->repr_dirty = true;
+        c->input_repr_dirty = true;
+}
+
+/* Bytes of repr that fit in W columns. The columns they use are stored in
+ * COLS. The result is cached until repr or W change. */
+int
+cm_repr_cut(Cell *c, int w, int *cols)
+{
+        CellMeta *m = cm_meta(c);
+        if (m->cut.w != w) {
+                m->cut.w = w;
+                m->cut.len = utf8_cut(c->repr, w, &m->cut.cols);
+        }
+        *cols = m->cut.cols;
+        return m->cut.len;
+}
+
 void
 cm_convert(Cell *c, CellType tnew)
 {
         // report("Call convert with %s -> %s", cm_type_repr(c->value.type), cm_type_repr(tnew));
-        if (c->value.type == tnew) return;
+        if (VAL_TYPE(c->value) == tnew) return;
 
         if (tnew == TYPE_EMPTY) {
-                __auto_type s = c->subscribers;
-                if (c->value.type == TYPE_FORMULA) {
-                        destroy_formula(c);
-                } else {
-                }
-                free(c->repr);
-                free(c->input_repr);
-                *c = EMPTY_CELL;
-                c->subscribers = s;
+                cm_clear_cell(c);
+                cm_reset_cell(c);
                 goto notify;
         }
 
-        switch (c->value.type) {
+        switch (VAL_TYPE(c->value)) {
         case TYPE_NUMBER:
                 switch (tnew) {
                 case TYPE_TEXT:
-                        c->value.type = tnew;
-                        c->value.as.text = c->repr;
+                        c->value = AS_TEXT(cm_repr(c));
                         break;
                 default:
                         goto no_yet_implemented;
@@ -274,16 +522,16 @@ cm_convert(Cell *c, CellType tnew)
 
         case TYPE_TEXT:
                 switch (tnew) {
-                case TYPE_NUMBER:
-                        c->value.type = tnew;
-                        c->value.as.num = strtod(c->repr, NULL);
+                case TYPE_NUMBER: {
+                        double n = strtod(cm_repr(c), NULL);
                         free(c->repr);
-                        free(c->input_repr);
-                        c->repr = get_repr(c->value);
-                        c->input_repr = get_input_repr(c->value);
+                        c->value = AS_NUMBER(n);
+                        cm_set_repr(c, get_repr(c->value));
+                        c->input_repr_dirty = true;
                         break;
+                }
                 case TYPE_FORMULA: {
-                        build_formula(c->value.as.text, c);
+                        build_formula(VAL_TEXT(c->value), c);
                         break;
                 }
                 default:
@@ -294,15 +542,13 @@ cm_convert(Cell *c, CellType tnew)
         case TYPE_EMPTY:
                 switch (tnew) {
                 case TYPE_NUMBER:
-                        c->value.type = tnew;
-                        c->value.as.num = 0.0;
+                        c->value = AS_NUMBER(0.0);
                         free(c->repr);
-                        free(c->input_repr);
-                        c->repr = get_repr(c->value);
-                        c->input_repr = get_input_repr(c->value);
+                        cm_set_repr(c, get_repr(c->value));
+                        c->input_repr_dirty = true;
                         break;
                 case TYPE_TEXT:
-                        c->value.type = tnew;
+                        c->value = AS_TEXT(NULL);
                         break;
                 default:
                         goto no_yet_implemented;
@@ -313,59 +559,154 @@ cm_convert(Cell *c, CellType tnew)
                 case TYPE_NUMBER: {
                         double n = 0.0f;
                         /* should be recursive */
-                        if (c->value.as.formula->value.type == TYPE_NUMBER)
-                                n = c->value.as.formula->value.as.num;
+                        if (VAL_TYPE(VAL_FORMULA(c->value)->value) == TYPE_NUMBER)
+                                n = VAL_NUM(VAL_FORMULA(c->value)->value);
                         destroy_formula(c);
-                        c->value.as.num = n;
-                        c->value.type = tnew;
+                        c->value = AS_NUMBER(n);
                         free(c->repr);
-                        free(c->input_repr);
-                        c->repr = get_repr(c->value);
-                        c->input_repr = get_input_repr(c->value);
+                        cm_set_repr(c, get_repr(c->value));
+                        c->input_repr_dirty = true;
                         break;
                 }
-                case TYPE_TEXT:
+                case TYPE_TEXT: {
+                        /* The formula text becomes the cell text */
+                        char *text;
+                        cm_input_repr(c);
+                        text = c->meta->input_repr;
+                        c->meta->input_repr = NULL;
                         destroy_formula(c);
-                        c->value.type = tnew;
-                        c->value.as.text = c->input_repr;
+                        c->value = AS_TEXT(text);
                         free(c->repr);
-                        c->repr = strdup(c->input_repr);
+                        cm_set_repr(c, text);
                         break;
+                }
                 default:
                         goto no_yet_implemented;
                 }
                 break;
         default:
         no_yet_implemented:
-                report("No yet implemented: Convert from %s to %s",
-                       cm_type_repr(c->value.type), cm_type_repr(tnew));
+                log_warn("No yet implemented: Convert from %s to %s",
+                         cm_type_repr(VAL_TYPE(c->value)), cm_type_repr(tnew));
                 return;
         }
 
 notify:
-        for_da_each(s, c->subscribers)
-        {
-                cm_notify(c, *s);
+        cm_notify_subscribers(c);
+}
+
+static bool
+same_spilled_value(Cell *c, Value v)
+{
+        if (c->meta == NULL || !c->meta->spilled || VAL_TYPE(c->value) != VAL_TYPE(v)) return false;
+        switch (VAL_TYPE(v)) {
+        case TYPE_NUMBER: return VAL_NUM(c->value) == VAL_NUM(v);
+        case TYPE_BOOL: return VAL_BOOL(c->value) == VAL_BOOL(v);
+        case TYPE_TEXT: return !strcmp(VAL_TEXT(c->value), VAL_TEXT(v) ?: "");
+        default: return false;
         }
 }
 
+bool
+cm_spillable(Cell *c)
+{
+        if (c->meta && c->meta->spilled) return true;
+        /* Empty cells of a sheet being loaded may still have their text */
+        return (VAL_TYPE(c->value) == TYPE_EMPTY && (!c->repr || !*c->repr)) ||
+               (VAL_TYPE(c->value) == TYPE_TEXT && (!VAL_TEXT(c->value) || !*VAL_TEXT(c->value)));
+}
+
+void
+cm_spill(Cell *c, Value v)
+{
+        if (same_spilled_value(c, v)) return;
+        if (VAL_TYPE(v) == TYPE_TEXT && (!VAL_TEXT(v) || !*VAL_TEXT(v))) v = VALUE_EMPTY;
+        if (VAL_TYPE(v) == TYPE_EMPTY && VAL_TYPE(c->value) == TYPE_EMPTY) return;
+
+        cm_clear_cell(c);
+        switch (VAL_TYPE(v)) {
+        case TYPE_TEXT:
+                c->value = AS_TEXT(strdup(VAL_TEXT(v)));
+                cm_set_repr(c, VAL_TEXT(c->value));
+                break;
+        case TYPE_NUMBER:
+        case TYPE_BOOL:
+                c->value = v;
+                cm_set_repr(c, get_repr(v));
+                break;
+        default:
+                /* Drops the spilled mark too */
+                cm_reset_cell(c);
+                goto notify;
+        }
+        c->input_repr_dirty = true;
+        cm_meta(c)->spilled = true;
+
+notify:
+        cm_notify_subscribers(c);
+}
+
+static void
+spill_shrink(CellMat *mat, int x0, int y0, int w, int h, int *old_w, int *old_h)
+{
+        Cell *c;
+        for (int y = 0; y < *old_h; y++) {
+                for (int x = 0; x < *old_w; x++) {
+                        if ((x < w && y < h) || (x == 0 && y == 0)) continue;
+                        c = cm_get_cell_ptr(mat, x0 + x, y0 + y);
+                        if (c && c->meta && c->meta->spilled) cm_spill(c, VALUE_EMPTY);
+                }
+        }
+        *old_w = w < *old_w ? w : *old_w;
+        *old_h = h < *old_h ? h : *old_h;
+}
+
+bool
+cm_spill_block(CellMat *mat, int x0, int y0, Value *vals, int w, int h, int *old_w, int *old_h)
+{
+        Cell *c;
+
+        for (int y = 0; y < h; y++) {
+                for (int x = 0; x < w; x++) {
+                        if (x == 0 && y == 0) continue;
+                        c = cm_get_cell_ptr(mat, x0 + x, y0 + y);
+                        if (c == NULL || !cm_spillable(c)) {
+                                spill_shrink(mat, x0, y0, 0, 0, old_w, old_h);
+                                return false;
+                        }
+                }
+        }
+        spill_shrink(mat, x0, y0, w, h, old_w, old_h);
+        for (int y = 0; y < h; y++)
+                for (int x = 0; x < w; x++)
+                        if (x || y) cm_spill(cm_get_cell_ptr(mat, x0 + x, y0 + y), vals[y * w + x]);
+        *old_w = w;
+        *old_h = h;
+        return true;
+}
+
+/* Free what C owns, except its metadata */
 void
 cm_clear_cell(Cell *c)
 {
         free(c->repr);
-        free(c->input_repr);
+        if (c->meta) {
+                free(c->meta->input_repr);
+                c->meta->input_repr = NULL;
+        }
 
-        switch (c->value.type) {
+        switch (VAL_TYPE(c->value)) {
         case TYPE_FORMULA:
                 destroy_formula(c);
                 break;
         case TYPE_TEXT:
+        case TYPE_BOOL:
         case TYPE_NUMBER:
         case TYPE_EMPTY:
                 break;
         default:
-                report("No yet implemented: cm_clear_cell for %s",
-                       cm_type_repr(c->value.type));
+                log_warn("No yet implemented: cm_clear_cell for %s",
+                         cm_type_repr(VAL_TYPE(c->value)));
         }
 }
 
@@ -373,11 +714,20 @@ cm_clear_cell(Cell *c)
 void
 cm_destroy(CellMat *mat)
 {
+        /* Spilled blocks are emptied as their formulas go, and that must
+         * not evaluate formulas destroyed before */
+        for_da_each(row, *mat)
+        {
+                for_da_each(c, *row)
+                {
+                        if (VAL_TYPE(c->value) == TYPE_FORMULA) formula_unsubscribe(c);
+                }
+        }
         for_da_each(row, *mat)
         {
                 for_da_each(c, *row)
                 {
-                        if (c->value.type == TYPE_FORMULA) {
+                        if (VAL_TYPE(c->value) == TYPE_FORMULA) {
                                 destroy_formula(c);
                         }
                 }
@@ -386,42 +736,148 @@ cm_destroy(CellMat *mat)
         {
                 for_da_each(c, *row)
                 {
-                        da_destroy(&c->subscribers);
                         free(c->repr);
-                        free(c->input_repr);
+                        cm_free_meta(c);
                 }
                 da_destroy(row);
         }
         da_destroy(mat);
+        if (column_index.mat == mat) column_index_reset(NULL);
+        if (row_index.mat == mat) {
+                mem_free(MEM_CELLS, row_index.data);
+                row_index.data = NULL;
+                row_index.mat = NULL;
+                row_index.size = 0;
+        }
+}
+
+CellMeta *
+cm_meta(Cell *c)
+{
+        if (c->meta == NULL) {
+                c->meta = mem_calloc(MEM_CELLS, 1, sizeof *c->meta);
+                c->meta->cut.w = -1;
+        }
+        return c->meta;
+}
+
+void
+cm_free_meta(Cell *c)
+{
+        if (c->meta == NULL) return;
+        da_destroy_cat(MEM_SUBSCRIBERS, &c->meta->subscribers);
+        free(c->meta->input_repr);
+        mem_free(MEM_CELLS, c->meta);
+        c->meta = NULL;
+}
+
+/* Make C an empty cell (call cm_clear_cell first). Cells subscribed to it
+ * are kept, any other metadata is dropped */
+void
+cm_reset_cell(Cell *c)
+{
+        CellMeta *m = c->meta;
+        *c = EMPTY_CELL;
+        if (m == NULL) return;
+        if (m->subscribers.size == 0) {
+                c->meta = m;
+                cm_free_meta(c);
+                return;
+        }
+        *m = (CellMeta) { .subscribers = m->subscribers, .cut = { -1, 0, 0 } };
+        c->meta = m;
+}
+
+static bool
+is_subscriber(Cell *c, Cell *observer)
+{
+        if (c->meta == NULL) return false;
+        for_da_each(o, c->meta->subscribers)
+                if (*o == observer) return true;
+        return false;
+}
+
+/* Notify the watchers of the column X and row Y that are not subscribed
+ * to C too. The watchers of a formula are next to each other */
+static void
+notify_watchers(Cell *c, int x, int y)
+{
+        Cell *last = NULL;
+
+        for (int i = 0; i < cm_watchers.size; i++) {
+                Watcher w = cm_watchers.data[i];
+                if (x < w.startx || x > w.endx || y < w.starty || y > w.endy) continue;
+                if (w.observer == last || is_subscriber(c, w.observer)) continue;
+                last = w.observer;
+                cm_notify(c, w.observer);
+        }
+}
+
+static bool
+is_watched(int x, int y)
+{
+        if (x >= watch_counts.size || watch_counts.data[x] == 0) return false;
+        for_da_each(w, cm_watchers)
+                if (x >= w->startx && x <= w->endx && y >= w->starty && y <= w->endy) return true;
+        return false;
+}
+
+void
+cm_notify_subscribers(Cell *c)
+{
+        bool watched = false;
+        int x, y;
+
+        if ((cm_watchers.size || column_index.ncols) &&
+            cm_get_cell_pos(active_ctx.body, c, &x, &y)) {
+                if (column_index.mat == active_ctx.body) column_rows_note(c, x, y);
+                watched = is_watched(x, y);
+        }
+        if (c->meta == NULL && !watched) return;
+        if (lookup_nindexes && (watched || c->meta->subscribers.size)) lookup_cell_changed(c);
+        /* A formula is subscribed once per reference to C, as the ends of a
+         * range, and they are next to each other. It is updated once */
+        if (c->meta) {
+                for_da_each(o, c->meta->subscribers)
+                {
+                        if (o > c->meta->subscribers.data && o[-1] == *o) continue;
+                        cm_notify(c, *o);
+                }
+        }
+        if (watched) notify_watchers(c, x, y);
+}
+
+bool
+cm_has_color(Cell *c)
+{
+        return c->meta && c->meta->color.active;
 }
 
 static Value
 extend_row(Cell *c, Value origin, Cell *oposite, int displ)
 {
-        switch (origin.type) {
+        switch (VAL_TYPE(origin)) {
         case TYPE_EMPTY:
+                return origin;
         case TYPE_TEXT:
-                return (Value) {
-                        .type = origin.type,
-                        .as.text = strdup(origin.as.text), // TODO: leak
-                };
+                return AS_TEXT(strdup(VAL_TEXT(origin))); // TODO: leak
         case TYPE_NUMBER: {
                 displ = abs(displ);
-                report("oposite: %-10p", oposite);
-                if (oposite && oposite->value.type == TYPE_NUMBER)
-                        displ *= origin.as.num - oposite->value.as.num;
-                return AS_NUMBER(origin.as.num + displ);
+                log_trace("oposite: %-10p", oposite);
+                if (oposite && VAL_TYPE(oposite->value) == TYPE_NUMBER)
+                        displ *= VAL_NUM(origin) - VAL_NUM(oposite->value);
+                return AS_NUMBER(VAL_NUM(origin) + displ);
         }
         case TYPE_FORMULA:
-                origin.as.formula = formula_extend(c, origin.as.formula, displ, 0);
-                if (origin.as.formula == NULL) {
+                origin = AS_FORMULA(formula_extend(c, VAL_FORMULA(origin), displ, 0));
+                if (VAL_FORMULA(origin) == NULL) {
                         clear_cell(c);
                         origin = c->value;
                 }
                 return origin;
         default:
-                report("No yet implemented: extend_row for %s",
-                       cm_type_repr(origin.type));
+                log_warn("No yet implemented: extend_row for %s",
+                         cm_type_repr(VAL_TYPE(origin)));
         }
         return origin;
 }
@@ -429,29 +885,27 @@ extend_row(Cell *c, Value origin, Cell *oposite, int displ)
 static Value
 extend_col(Cell *c, Value origin, Cell *oposite, int displ)
 {
-        switch (origin.type) {
+        switch (VAL_TYPE(origin)) {
         case TYPE_EMPTY:
+                return origin;
         case TYPE_TEXT:
-                return (Value) {
-                        .type = origin.type,
-                        .as.text = strdup(origin.as.text), // TODO: leak
-                };
+                return AS_TEXT(strdup(VAL_TEXT(origin))); // TODO: leak
         case TYPE_NUMBER:
                 displ = abs(displ);
-                report("oposite: %-10p", oposite);
-                if (oposite && oposite->value.type == TYPE_NUMBER)
-                        displ *= origin.as.num - oposite->value.as.num;
-                return AS_NUMBER(origin.as.num + displ);
+                log_trace("oposite: %-10p", oposite);
+                if (oposite && VAL_TYPE(oposite->value) == TYPE_NUMBER)
+                        displ *= VAL_NUM(origin) - VAL_NUM(oposite->value);
+                return AS_NUMBER(VAL_NUM(origin) + displ);
         case TYPE_FORMULA:
-                origin.as.formula = formula_extend(c, origin.as.formula, 0, displ);
-                if (origin.as.formula == NULL) {
+                origin = AS_FORMULA(formula_extend(c, VAL_FORMULA(origin), 0, displ));
+                if (VAL_FORMULA(origin) == NULL) {
                         clear_cell(c);
                         origin = c->value;
                 }
                 return origin;
         default:
-                report("No yet implemented: extend_col for %s",
-                       cm_type_repr(origin.type));
+                log_warn("No yet implemented: extend_col for %s",
+                         cm_type_repr(VAL_TYPE(origin)));
         }
         return origin;
 }
@@ -463,21 +917,18 @@ set_extended_value(Cell *c, Value v, Cell *vop, int displ_r, int displ_c)
         if (displ_r) vnew = extend_row(c, vnew, vop, displ_r);
         if (displ_c) vnew = extend_col(c, vnew, vop, displ_c);
         c->value = vnew;
-        free(c->repr);
-        free(c->input_repr);
-        c->repr = get_repr(c->value);
-        c->input_repr = get_input_repr(c->value);
+        cm_invalidate_repr(c);
 }
 
 void
 cm_extend(CellMat *mat, int base_x, int base_y, int next_x, int next_y)
 {
         if (!cm_is_valid_pos(mat, base_x, base_y)) {
-                report("Invalid position %d, %d in cell matrix", base_x, base_y);
+                log_warn("Invalid position %d, %d in cell matrix", base_x, base_y);
                 return;
         }
         if (!cm_is_valid_pos(mat, next_x, next_y)) {
-                report("Invalid position %d, %d in cell matrix", next_x, next_y);
+                log_warn("Invalid position %d, %d in cell matrix", next_x, next_y);
                 return;
         }
 
@@ -488,26 +939,100 @@ cm_extend(CellMat *mat, int base_x, int base_y, int next_x, int next_y)
         Cell *oppsite = cm_get_cell_ptr(mat, base_x - displ_c, base_y - displ_r);
         Cell *next_cell = cm_get_cell_ptr(mat, next_x, next_y);
 
-        report("next_cell at cm_extend: %p", next_cell);
+        log_trace("next_cell at cm_extend: %p", next_cell);
 
         clear_cell(next_cell);
         set_extended_value(next_cell, origin, oppsite, displ_r, displ_c);
 
-        for_da_each(o, next_cell->subscribers) cm_notify(next_cell, *o);
+        cm_notify_subscribers(next_cell);
+}
+
+static int
+cmp_row_ref(const void *a, const void *b)
+{
+        uintptr_t x = (uintptr_t) ((struct RowRef *) a)->data;
+        uintptr_t y = (uintptr_t) ((struct RowRef *) b)->data;
+        return (x > y) - (x < y);
+}
+
+static void
+build_row_index(CellMat *cm)
+{
+        row_index.mat = cm;
+        row_index.size = cm->size;
+        row_index.data = mem_realloc(MEM_CELLS, row_index.data, sizeof *row_index.data * cm->size);
+        for (int i = 0; i < cm->size; i++)
+                row_index.data[i] = (struct RowRef) { .data = cm->data[i].data, .row = i };
+        qsort(row_index.data, row_index.size, sizeof *row_index.data, cmp_row_ref);
+}
+
+static bool
+find_in_row_index(CellMat *cm, Cell *c, int *x, int *y)
+{
+        int lo = 0, hi = row_index.size - 1, mid, found = -1;
+        struct RowRef *ref;
+        CellArr *row;
+
+        if (row_index.mat != cm) return false;
+        while (lo <= hi) {
+                mid = lo + (hi - lo) / 2;
+                if ((uintptr_t) row_index.data[mid].data <= (uintptr_t) c) {
+                        found = mid;
+                        lo = mid + 1;
+                } else {
+                        hi = mid - 1;
+                }
+        }
+        if (found < 0) return false;
+
+        ref = row_index.data + found;
+        if (ref->row >= cm->size) return false;
+        row = cm->data + ref->row;
+        if (row->data != ref->data || c >= row->data + row->size) return false;
+        *x = c - row->data;
+        *y = ref->row;
+        return true;
+}
+
+/* Position of C in CM in O(log rows). Returns false if C is not in CM */
+bool
+cm_get_cell_pos(CellMat *cm, Cell *c, int *x, int *y)
+{
+        if (find_in_row_index(cm, c, x, y)) return true;
+        build_row_index(cm);
+        return find_in_row_index(cm, c, x, y);
 }
 
 char *
 cm_get_cell_name(CellMat *cm, Cell *c)
 {
-        int i;
-        int j;
+        int x, y;
+        if (!cm_get_cell_pos(cm, c, &x, &y)) return NULL;
+        return create_id(y, x, false, false);
+}
 
-        for (i = 0; i < cm->size; i++) {
-                for (j = 0; j < cm->data->size; j++) {
-                        if (&cm->data[i].data[j] == c) {
-                                return create_id(i, j, false, false);
-                        }
+static void
+census_add(char *s, size_t *bytes, size_t *blocks)
+{
+        if (s == NULL) return;
+        *bytes += malloc_usable_size(s);
+        ++*blocks;
+}
+
+/* Strings change owner too often to be counted on every allocation, so they
+ * are measured by walking the sheet. Text values share the repr */
+void
+cm_mem_census(CellMat *mat)
+{
+        size_t bytes = 0, blocks = 0;
+
+        for_da_each(row, *mat)
+        {
+                for_da_each(c, *row)
+                {
+                        census_add(c->repr, &bytes, &blocks);
+                        if (c->meta) census_add(c->meta->input_repr, &bytes, &blocks);
                 }
         }
-        return NULL;
+        mem_census(MEM_STRINGS, bytes, blocks);
 }
@@ -24,6 +24,7 @@
 #include "color.h"
 #include "common.h"
 #include "da.h"
+#include <stdint.h>
 
 typedef enum {
         TYPE_NUMBER = 0,
@@ -38,86 +39,108 @@ typedef enum {
 struct Range {
         int startx, starty;
         int endx, endy;
+        int open; // endy follows the last row of the sheet (A:A, A5:A)
 };
 
-typedef struct Value {
-        CellType type;
-        union {
-                double num;
-                bool bol;
-                char *text;
-                struct Formula *formula;
-                struct Range range;
-        } as;
+/* A value fits in 8 bytes. A number is stored as its double. The other types
+ * are quiet NaNs with the sign bit set and the type in bits 48 to 50, which
+ * arithmetic never produces, and the bool or the pointer in the low 48 bits.
+ * Read them with VAL_TYPE() and VAL_NUM() to VAL_RANGE(), and make them with
+ * AS_NUMBER() to AS_RANGE() */
+typedef union Value {
+        double num;
+        uint64_t bits;
 } Value;
 
-#define AS_TEXT(n)                 \
-        (Value)                    \
-        {                          \
-                .type = TYPE_TEXT, \
-                .as.text = (n),    \
-        }
-
-#define AS_NUMBER(n)                 \
-        (Value)                      \
-        {                            \
-                .type = TYPE_NUMBER, \
-                .as.num = (n),       \
-        }
-
-#define AS_BOOL(n)                 \
-        (Value)                    \
-        {                          \
-                .type = TYPE_BOOL, \
-                .as.bol = (n),     \
-        }
-
-
-typedef struct Cell {
-        int width, heigh;
+#define VALUE_BOX_TAG     0xFFF8000000000000ull
+#define VALUE_BOX_PAYLOAD 0x0000FFFFFFFFFFFFull
+
+#define VALUE_BOX(type, payload) \
+        ((Value) { .bits = VALUE_BOX_TAG | (uint64_t) (type) << 48 | (uint64_t) (payload) })
+
+#define VAL_TYPE(v)                                                    \
+        ({                                                             \
+                uint64_t _bits = (v).bits;                             \
+                (_bits & VALUE_BOX_TAG) == VALUE_BOX_TAG               \
+                ? (CellType) (_bits >> 48 & 7) /* 0 is a NaN number */ \
+                : TYPE_NUMBER;                                         \
+        })
+
+#define VAL_NUM(v)     ((v).num)
+#define VAL_BOOL(v)    ((bool) ((v).bits & 1))
+#define VAL_TEXT(v)    ((char *) (uintptr_t) ((v).bits & VALUE_BOX_PAYLOAD))
+#define VAL_FORMULA(v) ((struct Formula *) (uintptr_t) ((v).bits & VALUE_BOX_PAYLOAD))
+#define VAL_RANGE(v)   ((struct Range *) (uintptr_t) ((v).bits & VALUE_BOX_PAYLOAD)) // owned by the formula literal
+
+/* Every NaN is stored as the positive one, as a NaN with a payload (from
+ * strtod("-nan(...)")) could be read as another type */
+#define AS_NUMBER(n)                                                                               \
+        ({                                                                                         \
+                double _num = (n);                                                                 \
+                isnan(_num) ? (Value) { .bits = 0x7FF8000000000000ull } : (Value) { .num = _num }; \
+        })
+
+#define AS_BOOL(n)    VALUE_BOX(TYPE_BOOL, (n) != 0)
+#define AS_TEXT(n)    VALUE_BOX(TYPE_TEXT, (uintptr_t) (n))
+#define AS_FORMULA(n) VALUE_BOX(TYPE_FORMULA, (uintptr_t) (n))
+#define AS_RANGE(n)   VALUE_BOX(TYPE_RANGE, (uintptr_t) (n))
+
+/* Cell fields that most cells never use. Allocated by cm_meta() the first
+ * time one of them is written */
+typedef struct CellMeta {
         /* Cells that depend on the value of this cell */
         struct {
                 int capacity;
                 int size;
                 struct Cell **data;
         } subscribers;
-        Value value;
-        int selected;
-        bool updated;     // updated in this cicle
-        char *repr;       // string representation
-        char *input_repr; // input representation
+        char *input_repr; // input representation (not for text/empty cells)
         Color color;
+        bool spilled; // value written by a formula, see cm_spill
+        /* Last truncation of repr: the first len bytes use cols columns and
+         * fit in w columns */
+        struct {
+                int w, len, cols;
+        } cut;
+} CellMeta;
+
+/* Only what evaluation and rendering read for every cell lives here, so
+ * scans over rows and ranges touch 32 bytes per cell */
+typedef struct Cell {
+        Value value;
+        char *repr;     // string representation
+        CellMeta *meta; // NULL until needed
+        int width;      // display width of repr
+        bool selected;
+        bool updated; // updated in this cicle
+        /* repr or input_repr no longer match value. Read them with
+         * cm_repr() and cm_input_repr() so they are generated again */
+        bool repr_dirty;
+        bool input_repr_dirty;
 } Cell;
 
 typedef DA(Cell) CellArr;
 typedef DA(CellArr) CellMat;
 
-#define VALUE_EMPTY                 \
-        (Value)                     \
-        {                           \
-                .type = TYPE_EMPTY, \
+#define VALUE_EMPTY VALUE_BOX(TYPE_EMPTY, 0)
+#define VALUE_ERROR AS_TEXT("ERROR")
+
+#define EMPTY_CELL                         \
+        (struct Cell)                      \
+        {                                  \
+                .value = VALUE_EMPTY,      \
+                .repr = strdup(""),        \
+                .meta = NULL,              \
+                .width = 0,                \
+                .selected = false,         \
+                .updated = false,          \
+                .repr_dirty = false,       \
+                .input_repr_dirty = false, \
         }
 
-#define VALUE_ERROR                 \
-        (Value)                     \
-        {                           \
-                .type = TYPE_TEXT,  \
-                .as.text = "ERROR", \
-        }
-
-#define EMPTY_CELL                        \
-        (struct Cell)                     \
-        {                                 \
-                .width = 20,              \
-                .heigh = 1,               \
-                .value = VALUE_EMPTY,     \
-                .subscribers = { 0 },     \
-                .repr = strdup(""),       \
-                .input_repr = strdup(""), \
-                .updated = false,         \
-                .color = { 0 },           \
-        }
 
+/* Incremented when rows or columns are added, inserted or deleted */
+extern unsigned cm_layout_version;
 
 /* Create a 1x1 cell map */
 CellMat *cm_init();
@@ -134,18 +157,62 @@ void cm_subscribe(Cell *actor, Cell *observer);
 void cm_unsubscribe(Cell *actor, Cell *observer);
 void cm_notify(Cell *actor, Cell *observer); // implemented in observer
 
+/* Formulas that read open ranges watch their columns instead of subscribing
+ * to every cell, so they also see the rows added later. Lookups watch the
+ * block they search, as it can be as long as a column */
+typedef struct Watcher {
+        Cell *observer;
+        int startx, endx;
+        int starty, endy; // endy is INT_MAX for open ranges
+} Watcher;
+typedef DA(Watcher) WatcherArr;
+extern WatcherArr cm_watchers;
+
+void cm_watch(Cell *observer, int startx, int endx, int starty, int endy);
+void cm_unwatch(Cell *observer);
+/* After removing watchers from cm_watchers without cm_unwatch */
+void cm_recount_watchers();
+/* Rows Y0 to Y1 of column X that may have a value, in ascending order. They
+ * are left in *ROWS, owned by MAT until its next change. Returns how many */
+int cm_column_rows(CellMat *mat, int x, int y0, int y1, const int **rows);
+
 void cm_convert(Cell *c, CellType tnew);
+/* Set the value of C to V (text is copied) from a formula that spills its
+ * result over the cells next to it. Spilled cells are saved empty, the
+ * formula writes them again when the sheet is loaded */
+void cm_spill(Cell *c, Value v);
+/* Whether a spilling formula can write C */
+bool cm_spillable(Cell *c);
+/* Spill the W x H values of VALS, by rows, over the block that starts at the
+ * formula cell X, Y (its own value is skipped). *OLD_W x *OLD_H is the block
+ * written before, whose cells out of the new one are emptied. If the new
+ * block does not fit, the old one is emptied and returns false */
+bool cm_spill_block(CellMat *mat, int x, int y, Value *vals, int w, int h, int *old_w, int *old_h);
 
 void cm_destroy(CellMat *mat);
 void cm_clear_cell(Cell *c);
+void cm_reset_cell(Cell *c);
+void cm_free_meta(Cell *c);
+
+CellMeta *cm_meta(Cell *c);
+void cm_notify_subscribers(Cell *c);
+bool cm_has_color(Cell *c);
 
 char *get_repr(Value v);
+void cm_set_repr(Cell *c, char *repr);
+char *cm_repr(Cell *c);
+char *cm_input_repr(Cell *c);
+void cm_invalidate_repr(Cell *c);
+int cm_repr_cut(Cell *c, int w, int *cols);
 char *get_input_repr(Value v);
 
 void cm_extend(CellMat *mat, int base_x, int base_y, int next_x, int next_y);
 const char *cm_type_repr(CellType);
 
 char *cm_get_cell_name(CellMat *cm, Cell *c);
+bool cm_get_cell_pos(CellMat *cm, Cell *c, int *x, int *y);
+/* Measure the strings owned by the cells of MAT, see mem_census */
+void cm_mem_census(CellMat *mat);
 
 void cm_delete_col(CellMat *mat, int index);
 void cm_delete_row(CellMat *mat, int index);
@@ -18,11 +18,14 @@
  * For questions or support, contact: me@hugocoto.com
  */
 
+#define LOG_CAT LOG_RENDER
+
 #include "color.h"
 #include "common.h"
 #include "debug.h"
 #include "escape_code.h"
 #include "hm.h"
+#include "mem.h"
 #include "options.h"
 
 Hmap colors;
@@ -31,7 +34,7 @@ static void
 free_value(Hnode *n)
 {
         if (n == NULL) return;
-        if (n->value) free(n->value);
+        if (n->value) mem_free(MEM_COLORS, n->value);
 }
 
 static void
@@ -47,18 +50,18 @@ set_default_colors()
         hmnew(&colors, 32); // random size
         atexit(del_default_colors);
 
-        hmadd(&colors, "ui", strdup(col_opts.ui));
-        hmadd(&colors, "cell", strdup(col_opts.cell));
-        hmadd(&colors, "cell_over", strdup(col_opts.cell_over));
-        hmadd(&colors, "cell_selected", strdup(col_opts.cell_selected));
-        hmadd(&colors, "ln_over", strdup(col_opts.ln_over));
-        hmadd(&colors, "ln", strdup(col_opts.ln));
-        hmadd(&colors, "sheet_ui", strdup(col_opts.sheet_ui));
-        hmadd(&colors, "sheet_ui_over", strdup(col_opts.sheet_ui_over));
-        hmadd(&colors, "sheet_ui_selected", strdup(col_opts.sheet_ui_selected));
-        hmadd(&colors, "ui_cell_text", strdup(col_opts.ui_cell_text));
-        hmadd(&colors, "ui_report", strdup(col_opts.ui_report));
-        hmadd(&colors, "insert", strdup(col_opts.insert));
+        hmadd(&colors, "ui", mem_strdup(MEM_COLORS, col_opts.ui));
+        hmadd(&colors, "cell", mem_strdup(MEM_COLORS, col_opts.cell));
+        hmadd(&colors, "cell_over", mem_strdup(MEM_COLORS, col_opts.cell_over));
+        hmadd(&colors, "cell_selected", mem_strdup(MEM_COLORS, col_opts.cell_selected));
+        hmadd(&colors, "ln_over", mem_strdup(MEM_COLORS, col_opts.ln_over));
+        hmadd(&colors, "ln", mem_strdup(MEM_COLORS, col_opts.ln));
+        hmadd(&colors, "sheet_ui", mem_strdup(MEM_COLORS, col_opts.sheet_ui));
+        hmadd(&colors, "sheet_ui_over", mem_strdup(MEM_COLORS, col_opts.sheet_ui_over));
+        hmadd(&colors, "sheet_ui_selected", mem_strdup(MEM_COLORS, col_opts.sheet_ui_selected));
+        hmadd(&colors, "ui_cell_text", mem_strdup(MEM_COLORS, col_opts.ui_cell_text));
+        hmadd(&colors, "ui_report", mem_strdup(MEM_COLORS, col_opts.ui_report));
+        hmadd(&colors, "insert", mem_strdup(MEM_COLORS, col_opts.insert));
 }
 
 char *
@@ -68,7 +71,7 @@ get_color(char *key)
         if (key == NULL) return C(C_NORMAL);
         hmget(colors, key, (void *) &col);
         if (col == NULL) {
-                report("Invalid color key: %s", key);
+                log_warn("Invalid color key: %s", key);
                 return NULL;
         }
         return col;
@@ -79,8 +82,8 @@ add_color(char *c)
 {
         char buf[128];
         snprintf(buf, sizeof buf, T_CSI "%sm", c);
-        hmadd(&colors, buf, strdup(buf));
-        hmadd(&colors, c, strdup(buf));
+        hmadd(&colors, buf, mem_strdup(MEM_COLORS, buf));
+        hmadd(&colors, c, mem_strdup(MEM_COLORS, buf));
 }
 
 void
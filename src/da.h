@@ -21,18 +21,24 @@
 #ifndef DYNAMIC_ARRAY_H
 #define DYNAMIC_ARRAY_H
 
+#include "mem.h"
 #include <stdlib.h> // alloc
 
+/* Memory category of the arrays, see mem.h. Define it before including this
+ * file to account the arrays of a file in other category. */
+#ifndef DA_MEM_CAT
+#define DA_MEM_CAT MEM_MISC
+#endif
+
 #if defined(__cplusplus)
 #if defined(__GNUC__)
 /* Gnu dependent */
-#define DA_REALLOC(dest, size) (__typeof__(dest)) realloc((dest), (size))
+#define DA_REALLOC(cat, dest, size) (__typeof__(dest)) mem_realloc((cat), (dest), (size))
 #else
 #error "DA requires gnu extensions if using C++."
 #endif
 #else
-#define DA_REALLOC(dest, size) realloc((dest), (size));
-#define DA_MALLOC(size) malloc((size));
+#define DA_REALLOC(cat, dest, size) mem_realloc((cat), (dest), (size))
 #endif
 
 #ifdef __cplusplus
@@ -58,36 +64,42 @@
                 __VA_OPT__((da_ptr)->capacity = (__VA_ARGS__));                             \
                 (da_ptr)->size = 0;                                                         \
                 (da_ptr)->data = NULL;                                                      \
-                (da_ptr)->data = DA_REALLOC((da_ptr)->data,                                 \
+                (da_ptr)->data = DA_REALLOC(DA_MEM_CAT, (da_ptr)->data,                     \
                                             sizeof *((da_ptr)->data) * (da_ptr)->capacity); \
                 assert(da_ptr);                                                             \
                 da_ptr;                                                                     \
         })
 
 #include <assert.h>
-// add E to DA_PTR that is a pointer to a DA of the same type as E
-#define da_append(da_ptr, e)                                             \
+// add E (...) to DA_PTR that is a pointer to a DA of the same type as E
+#define da_append(da_ptr, ...) da_append_cat(DA_MEM_CAT, da_ptr, __VA_ARGS__)
+
+/* da_append accounting the memory in the category CAT */
+#define da_append_cat(cat, da_ptr, ...)                                  \
         ({                                                               \
                 if ((da_ptr)->size >= (da_ptr)->capacity) {              \
                         (da_ptr)->capacity += 3;                         \
                         (da_ptr)->data = DA_REALLOC(                     \
-                        (da_ptr)->data,                                  \
+                        (cat), (da_ptr)->data,                           \
                         sizeof(*((da_ptr)->data)) * (da_ptr)->capacity); \
                         assert(da_ptr);                                  \
                 }                                                        \
                 assert((da_ptr)->size < (da_ptr)->capacity);             \
-                (da_ptr)->data[(da_ptr)->size++] = (e);                  \
+                (da_ptr)->data[(da_ptr)->size++] = (__VA_ARGS__);        \
                 (da_ptr)->size - 1;                                      \
         })
 
 /* Destroy DA pointed by DA_PTR. DA can be initialized again but previous
  * values are not accessible anymore. */
-#define da_destroy(da_ptr)              \
-        ({                              \
-                (da_ptr)->capacity = 0; \
-                (da_ptr)->size = 0;     \
-                free((da_ptr)->data);   \
-                (da_ptr)->data = NULL;  \
+#define da_destroy(da_ptr) da_destroy_cat(DA_MEM_CAT, da_ptr)
+
+/* da_destroy for arrays appended with da_append_cat */
+#define da_destroy_cat(cat, da_ptr)                      \
+        ({                                               \
+                (da_ptr)->capacity = 0;                  \
+                (da_ptr)->size = 0;                      \
+                mem_free((cat), (da_ptr)->data);         \
+                (da_ptr)->data = NULL;                   \
         })
 
 /* Insert element E into DA pointed by DA_PTR at index I. */
@@ -129,7 +141,7 @@
 #define da_dup(da_ptr)                                                                          \
         ({                                                                                      \
                 __auto_type cpy = *(da_ptr);                                                    \
-                cpy.data = malloc((da_ptr)->capacity * sizeof(da_ptr)->data[0]);                \
+                cpy.data = mem_malloc(DA_MEM_CAT, (da_ptr)->capacity * sizeof(da_ptr)->data[0]);  \
                 memcpy(cpy.data, (da_ptr)->data, (da_ptr)->capacity * sizeof(da_ptr)->data[0]); \
                 cpy;                                                                            \
         })
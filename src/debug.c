@@ -19,35 +19,182 @@
  */
 
 #include "debug.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+
+#define LOG_RING_SIZE 4096 // power of two
+#define LOG_MSG_MAX 240
+#define LOG_FLUSH_NS 20000000 // writer wakes up every 20 ms
 
 /* default debug level
  * 0: do not report
  * 1: report if DEBUG is set
  */
 int debug_level = 0;
+int log_level = LOG_LEVELS;
+unsigned log_categories = ~0u;
+
+/* Bounded MPSC queue (Vyukov). SEQ == position: free for the producer that
+ * takes that position. SEQ == position + 1: written, ready for the writer */
+struct LogSlot {
+        _Atomic size_t seq;
+        struct timespec ts;
+        unsigned char level;
+        unsigned char cat;
+        char msg[LOG_MSG_MAX];
+};
+
+static struct LogSlot ring[LOG_RING_SIZE];
+static _Atomic size_t head = 0;
+static size_t tail = 0; // only used by the writer
+static _Atomic size_t dropped = 0;
+static _Atomic bool running = false;
+static pthread_t writer;
+static FILE *log_file = NULL;
+
+static const char *level_names[LOG_LEVELS] = {
+        [LOG_TRACE] = "trace",
+        [LOG_DEBUG] = "debug",
+        [LOG_INFO] = "info",
+        [LOG_WARN] = "warn",
+        [LOG_ERROR] = "error",
+};
+
+static const char *category_names[LOG_CATEGORIES] = {
+        [LOG_CORE] = "core",
+        [LOG_CELL] = "cell",
+        [LOG_FORMULA] = "formula",
+        [LOG_RENDER] = "render",
+        [LOG_INPUT] = "input",
+        [LOG_IO] = "io",
+};
 
-#if defined(DEBUG) && DEBUG
 void
-report(char *format, ...)
+log_write(int level, int cat, const char *format, ...)
 {
-        if (debug_level == 0) return;
+        struct LogSlot *slot;
+        size_t pos, seq;
         va_list arg;
-        FILE *file = fopen(DEBUG_LOG, "a");
+
+        if (!atomic_load_explicit(&running, memory_order_relaxed)) return;
+
+        pos = atomic_load_explicit(&head, memory_order_relaxed);
+        for (;;) {
+                slot = ring + (pos & (LOG_RING_SIZE - 1));
+                seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+                if (seq == pos) {
+                        if (atomic_compare_exchange_weak_explicit(&head, &pos, pos + 1,
+                                                                  memory_order_relaxed,
+                                                                  memory_order_relaxed))
+                                break;
+                } else if ((intptr_t) (seq - pos) < 0) {
+                        /* full: the writer is behind */
+                        atomic_fetch_add_explicit(&dropped, 1, memory_order_relaxed);
+                        return;
+                } else {
+                        pos = atomic_load_explicit(&head, memory_order_relaxed);
+                }
+        }
+
+        clock_gettime(CLOCK_REALTIME, &slot->ts);
+        slot->level = level;
+        slot->cat = cat;
         va_start(arg, format);
-        time_t t = time(0);
-        char *strt = ctime(&t);
-        *strchr(strt, 10) = 0;
-        fprintf(file, "[%s] ", strt);
-        vfprintf(file, format, arg);
-        putc(10, file);
+        vsnprintf(slot->msg, sizeof slot->msg, format, arg);
         va_end(arg);
-        fclose(file);
+        atomic_store_explicit(&slot->seq, pos + 1, memory_order_release);
+}
+
+/* Write every message that is ready. Returns how many */
+static int
+log_drain()
+{
+        struct LogSlot *slot;
+        struct tm tm;
+        char date[32];
+        size_t lost;
+        int n = 0;
+
+        for (;; ++tail, ++n) {
+                slot = ring + (tail & (LOG_RING_SIZE - 1));
+                if (atomic_load_explicit(&slot->seq, memory_order_acquire) != tail + 1)
+                        break;
+                localtime_r(&slot->ts.tv_sec, &tm);
+                strftime(date, sizeof date, "%Y-%m-%d %H:%M:%S", &tm);
+                fprintf(log_file, "[%s.%03ld] %-5s %-7s %s\n", date, slot->ts.tv_nsec / 1000000,
+                        level_names[slot->level], category_names[slot->cat], slot->msg);
+                atomic_store_explicit(&slot->seq, tail + LOG_RING_SIZE, memory_order_release);
+        }
+
+        if ((lost = atomic_exchange_explicit(&dropped, 0, memory_order_relaxed)))
+                fprintf(log_file, "[...] %zu messages dropped\n", lost);
+        if (n || lost) fflush(log_file);
+        return n;
+}
+
+static void *
+log_writer(void *arg)
+{
+        struct timespec ts = { .tv_nsec = LOG_FLUSH_NS };
+        (void) arg;
+        while (atomic_load_explicit(&running, memory_order_acquire)) {
+                if (log_drain() == 0) nanosleep(&ts, NULL);
+        }
+        return NULL;
+}
+
+int
+log_parse_level(const char *name)
+{
+        for (int i = 0; i < LOG_LEVELS; i++) {
+                if (!strcmp(name, level_names[i])) return i;
+        }
+        return -1;
+}
+
+static unsigned
+parse_categories(const char *list)
+{
+        unsigned mask = 0;
+        char *s = strdup(list), *save = NULL;
+        for (char *tok = strtok_r(s, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+                for (int i = 0; i < LOG_CATEGORIES; i++) {
+                        if (!strcmp(tok, category_names[i])) mask |= 1u << i;
+                }
+        }
+        free(s);
+        return mask;
 }
 
-#else
 void
-report(char *format, ...)
+log_init(int level, const char *categories)
 {
+        if (running) return;
+        if (!(log_file = fopen(DEBUG_LOG, "a"))) return;
+
+        for (size_t i = 0; i < LOG_RING_SIZE; i++)
+                atomic_init(&ring[i].seq, i);
+        log_categories = categories ? parse_categories(categories) : ~0u;
+
+        atomic_store(&running, true);
+        if (pthread_create(&writer, NULL, log_writer, NULL)) {
+                atomic_store(&running, false);
+                fclose(log_file);
+                log_file = NULL;
+                return;
+        }
+        log_level = level;
+        atexit(log_destroy);
 }
 
-#endif
+void
+log_destroy()
+{
+        if (!atomic_exchange(&running, false)) return;
+        log_level = LOG_LEVELS;
+        pthread_join(writer, NULL);
+        log_drain(); // whatever was written while stopping
+        fclose(log_file);
+        log_file = NULL;
+}
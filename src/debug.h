@@ -38,7 +38,78 @@ enum ErrorCode {
 };
 
 #define DEBUG_LOG "report.log"
-void report(char *format, ...);
+
+/* Set by -D: log, and do not use the alternate screen */
 extern int debug_level;
 
+/* Logging. Messages are formatted by the caller into a lock-free ring buffer
+ * and written to DEBUG_LOG in batches by a background thread. If the ring is
+ * full the message is dropped (and counted), the caller never blocks.
+ *
+ * Levels below LOG_MIN_LEVEL are removed at compile time. The rest are only
+ * formatted if the level and the category are enabled at run time (see
+ * log_init). The category of a message is LOG_CAT, which a source file can
+ * define before its includes. */
+
+enum LogLevel {
+        LOG_TRACE = 0, // hot paths: lexer, repr, subscriptions...
+        LOG_DEBUG,
+        LOG_INFO,
+        LOG_WARN,
+        LOG_ERROR,
+        LOG_LEVELS,
+};
+
+enum LogCategory {
+        LOG_CORE = 0,
+        LOG_CELL,
+        LOG_FORMULA,
+        LOG_RENDER,
+        LOG_INPUT,
+        LOG_IO,
+        LOG_CATEGORIES,
+};
+
+#ifndef LOG_MIN_LEVEL
+#if defined(DEBUG) && DEBUG
+#define LOG_MIN_LEVEL LOG_DEBUG
+#else
+#define LOG_MIN_LEVEL LOG_INFO
+#endif
+#endif
+
+#ifndef LOG_CAT
+#define LOG_CAT LOG_CORE
+#endif
+
+/* Run time filter: lowest enabled level (LOG_LEVELS disables logging) and a
+ * mask of enabled categories */
+extern int log_level;
+extern unsigned log_categories;
+
+#define log_enabled(level, cat) \
+        ((level) >= LOG_MIN_LEVEL && (level) >= log_level && (log_categories >> (cat) & 1))
+
+#define log_at(level, cat, ...)                                       \
+        do {                                                          \
+                if (log_enabled(level, cat)) log_write(level, cat, __VA_ARGS__); \
+        } while (0)
+
+#define log_trace(...) log_at(LOG_TRACE, LOG_CAT, __VA_ARGS__)
+#define log_debug(...) log_at(LOG_DEBUG, LOG_CAT, __VA_ARGS__)
+#define log_info(...) log_at(LOG_INFO, LOG_CAT, __VA_ARGS__)
+#define log_warn(...) log_at(LOG_WARN, LOG_CAT, __VA_ARGS__)
+#define log_error(...) log_at(LOG_ERROR, LOG_CAT, __VA_ARGS__)
+#define report(...) log_debug(__VA_ARGS__)
+
+/* Start the writer thread and enable messages of LEVEL and above in the
+ * categories of CATEGORIES, a comma separated list of names or NULL for all.
+ * Messages logged before it are dropped. Everything logged is flushed at
+ * exit. */
+void log_init(int level, const char *categories);
+void log_destroy();
+int log_parse_level(const char *name);
+void log_write(int level, int cat, const char *format, ...)
+__attribute__((format(printf, 3, 4)));
+
 #endif //! DEBUG_H
@@ -18,25 +18,39 @@
  * For questions or support, contact: me@hugocoto.com
  */
 
+#define LOG_CAT LOG_FORMULA
+
 #include "eval.h"
 #include "builtin.h"
 #include "cellmap.h"
 #include "common.h"
 #include "debug.h"
 #include "formula.h"
+#include "profile.h"
+#include "rpn.h"
+#include "trace.h"
 #include "window.h"
 
+/* Function call being evaluated, for builtin_state */
+Expr *builtin_call = NULL;
+
 Value
 eval_identifier(Expr *e)
 {
-        if (e->as.identifier.cell->value.type == TYPE_FORMULA)
-                return e->as.identifier.cell->value.as.formula->value;
+        if (VAL_TYPE(e->as.identifier.cell->value) == TYPE_FORMULA)
+                return VAL_FORMULA(e->as.identifier.cell->value)->value;
         return e->as.identifier.cell->value;
 }
 
 Value
 eval_literal(Expr *e)
 {
+        struct Range *r;
+        if (VAL_TYPE(e->as.literal.value) == TYPE_RANGE && VAL_RANGE(e->as.literal.value)->open) {
+                /* Open ranges end at the last row the sheet has now */
+                r = VAL_RANGE(e->as.literal.value);
+                r->endy = active_ctx.body->size - 1 > r->starty ? active_ctx.body->size - 1 : r->starty;
+        }
         return e->as.literal.value;
 }
 
@@ -44,17 +58,21 @@ Value
 eval_func(Expr *e)
 {
         Value name = eval_expr(e->as.func.name);
-        if (name.type != TYPE_TEXT) {
+        if (VAL_TYPE(name) != TYPE_TEXT) {
                 report("eval_func func name is not text");
                 return VALUE_ERROR;
         }
 
-        Func f = builtin_get(name.as.text);
+        Func f = builtin_get(VAL_TEXT(name));
         if (f == NULL) {
-                report("No builtin function for name %s", name.as.text);
+                report("No builtin function for name %s", VAL_TEXT(name));
                 return VALUE_ERROR;
         }
-        return f(e->as.func.args);
+        Expr *outer = builtin_call;
+        builtin_call = e;
+        Value v = f(e->as.func.args);
+        builtin_call = outer;
+        return v;
 }
 
 Value
@@ -62,35 +80,54 @@ eval_unop(Expr *e)
 {
         Value rhs = eval_expr(e->as.unop.rhs);
 
-        if (rhs.type != TYPE_NUMBER) {
-                report("No yet implemented: unop for %s",
-                       cm_type_repr(rhs.type));
+        /* x^2, see optimize_expr */
+        if (e->as.unop.op[0] == '^') return vsquare(rhs);
+
+        if (VAL_TYPE(rhs) != TYPE_NUMBER) {
+                log_warn("No yet implemented: unop for %s",
+                         cm_type_repr(VAL_TYPE(rhs)));
                 return VALUE_ERROR;
         }
 
         if (e->as.unop.op[1] == 0)
                 switch (*e->as.unop.op) {
                 case '-':
-                        return AS_NUMBER(-rhs.as.num);
+                        return AS_NUMBER(-VAL_NUM(rhs));
                 case '+':
-                        return AS_NUMBER(+rhs.as.num);
+                        return AS_NUMBER(+VAL_NUM(rhs));
                 }
 
-        report("No yet implemented: unop for `%s`", e->as.unop.op);
+        log_warn("No yet implemented: unop for `%s`", e->as.unop.op);
         return VALUE_ERROR;
 }
 
 Value
 rangemap(Value base, Value v, Value (*f)(Value, Value))
 {
-        report("CALL RANGEMAP");
-        assert(v.type == TYPE_RANGE);
-        int x, y;
+        TRACE_SPAN("rangemap", "formula");
+        log_trace("CALL RANGEMAP");
+        assert(VAL_TYPE(v) == TYPE_RANGE);
+        int x, y, n;
         Value val = base;
+        const int *rows;
         Cell *c;
 
-        for (x = v.as.range.startx; x <= v.as.range.endx; x++) {
-                for (y = v.as.range.starty; y <= v.as.range.endy; y++) {
+        if (profile_enabled)
+                profile_range((VAL_RANGE(v)->endx - VAL_RANGE(v)->startx + 1) *
+                              (VAL_RANGE(v)->endy - VAL_RANGE(v)->starty + 1));
+
+        if (VAL_RANGE(v)->open) {
+                /* Only the rows of each column that have a value */
+                for (x = VAL_RANGE(v)->startx; x <= VAL_RANGE(v)->endx; x++) {
+                        n = cm_column_rows(active_ctx.body, x, VAL_RANGE(v)->starty, VAL_RANGE(v)->endy, &rows);
+                        for (int i = 0; i < n; i++)
+                                val = f(val, active_ctx.body->data[rows[i]].data[x].value);
+                }
+                return val;
+        }
+
+        for (x = VAL_RANGE(v)->startx; x <= VAL_RANGE(v)->endx; x++) {
+                for (y = VAL_RANGE(v)->starty; y <= VAL_RANGE(v)->endy; y++) {
                         c = cm_get_cell_ptr(active_ctx.body, x, y);
                         if (!c) break;
                         val = f(val, c->value);
@@ -102,144 +139,152 @@ rangemap(Value base, Value v, Value (*f)(Value, Value))
 Value
 vadd(Value a, Value b)
 {
-        if (a.type == TYPE_FORMULA) return vadd(a.as.formula->value, b);
-        if (b.type == TYPE_FORMULA) return vadd(a, b.as.formula->value);
-        if (a.type == TYPE_RANGE) return vadd(rangemap(AS_NUMBER(0), a, vadd), b);
-        if (b.type == TYPE_RANGE) return vadd(a, rangemap(AS_NUMBER(0), b, vadd));
+        if (VAL_TYPE(a) == TYPE_FORMULA) return vadd(VAL_FORMULA(a)->value, b);
+        if (VAL_TYPE(b) == TYPE_FORMULA) return vadd(a, VAL_FORMULA(b)->value);
+        if (VAL_TYPE(a) == TYPE_RANGE) return vadd(rangemap(AS_NUMBER(0), a, vadd), b);
+        if (VAL_TYPE(b) == TYPE_RANGE) return vadd(a, rangemap(AS_NUMBER(0), b, vadd));
 
-        if (a.type == TYPE_NUMBER) {
-                if (b.type == TYPE_NUMBER) return AS_NUMBER(a.as.num + b.as.num);
+        if (VAL_TYPE(a) == TYPE_NUMBER) {
+                if (VAL_TYPE(b) == TYPE_NUMBER) return AS_NUMBER(VAL_NUM(a) + VAL_NUM(b));
                 return a;
         }
-        if (b.type == TYPE_NUMBER) return b;
+        if (VAL_TYPE(b) == TYPE_NUMBER) return b;
         return VALUE_EMPTY;
 }
 
 Value
 vsub(Value a, Value b)
 {
-        if (a.type == TYPE_FORMULA) return vsub(a.as.formula->value, b);
-        if (b.type == TYPE_FORMULA) return vsub(a, b.as.formula->value);
-        if (a.type == TYPE_RANGE) return vsub(rangemap(AS_NUMBER(0), a, vsub), b);
-        if (b.type == TYPE_RANGE) return vsub(a, rangemap(AS_NUMBER(0), b, vsub));
+        if (VAL_TYPE(a) == TYPE_FORMULA) return vsub(VAL_FORMULA(a)->value, b);
+        if (VAL_TYPE(b) == TYPE_FORMULA) return vsub(a, VAL_FORMULA(b)->value);
+        if (VAL_TYPE(a) == TYPE_RANGE) return vsub(rangemap(AS_NUMBER(0), a, vsub), b);
+        if (VAL_TYPE(b) == TYPE_RANGE) return vsub(a, rangemap(AS_NUMBER(0), b, vsub));
 
-        if (a.type == TYPE_NUMBER) {
-                if (b.type == TYPE_NUMBER) return AS_NUMBER(a.as.num - b.as.num);
+        if (VAL_TYPE(a) == TYPE_NUMBER) {
+                if (VAL_TYPE(b) == TYPE_NUMBER) return AS_NUMBER(VAL_NUM(a) - VAL_NUM(b));
                 return a;
         }
-        if (b.type == TYPE_NUMBER) return b;
+        if (VAL_TYPE(b) == TYPE_NUMBER) return b;
         return VALUE_EMPTY;
 }
 Value
 vdiv(Value a, Value b)
 {
-        if (a.type == TYPE_FORMULA) return vdiv(a.as.formula->value, b);
-        if (b.type == TYPE_FORMULA) return vdiv(a, b.as.formula->value);
-        if (a.type == TYPE_RANGE) return vdiv(rangemap(AS_NUMBER(1), a, vdiv), b);
-        if (b.type == TYPE_RANGE) return vdiv(a, rangemap(AS_NUMBER(1), b, vdiv));
+        if (VAL_TYPE(a) == TYPE_FORMULA) return vdiv(VAL_FORMULA(a)->value, b);
+        if (VAL_TYPE(b) == TYPE_FORMULA) return vdiv(a, VAL_FORMULA(b)->value);
+        if (VAL_TYPE(a) == TYPE_RANGE) return vdiv(rangemap(AS_NUMBER(1), a, vdiv), b);
+        if (VAL_TYPE(b) == TYPE_RANGE) return vdiv(a, rangemap(AS_NUMBER(1), b, vdiv));
 
-        if (a.type == TYPE_NUMBER) {
-                if (b.type == TYPE_NUMBER) return AS_NUMBER(a.as.num / b.as.num);
+        if (VAL_TYPE(a) == TYPE_NUMBER) {
+                if (VAL_TYPE(b) == TYPE_NUMBER) return AS_NUMBER(VAL_NUM(a) / VAL_NUM(b));
                 return a;
         }
-        if (b.type == TYPE_NUMBER) return b;
+        if (VAL_TYPE(b) == TYPE_NUMBER) return b;
         return VALUE_EMPTY;
 }
 
 Value
 vmul(Value a, Value b)
 {
-        if (a.type == TYPE_FORMULA) return vmul(a.as.formula->value, b);
-        if (b.type == TYPE_FORMULA) return vmul(a, b.as.formula->value);
-        if (a.type == TYPE_RANGE) return vmul(rangemap(AS_NUMBER(1), a, vmul), b);
-        if (b.type == TYPE_RANGE) return vmul(a, rangemap(AS_NUMBER(1), b, vmul));
+        if (VAL_TYPE(a) == TYPE_FORMULA) return vmul(VAL_FORMULA(a)->value, b);
+        if (VAL_TYPE(b) == TYPE_FORMULA) return vmul(a, VAL_FORMULA(b)->value);
+        if (VAL_TYPE(a) == TYPE_RANGE) return vmul(rangemap(AS_NUMBER(1), a, vmul), b);
+        if (VAL_TYPE(b) == TYPE_RANGE) return vmul(a, rangemap(AS_NUMBER(1), b, vmul));
 
-        if (a.type == TYPE_NUMBER) {
-                if (b.type == TYPE_NUMBER) return AS_NUMBER(a.as.num * b.as.num);
+        if (VAL_TYPE(a) == TYPE_NUMBER) {
+                if (VAL_TYPE(b) == TYPE_NUMBER) return AS_NUMBER(VAL_NUM(a) * VAL_NUM(b));
                 return a;
         }
-        if (b.type == TYPE_NUMBER) return b;
+        if (VAL_TYPE(b) == TYPE_NUMBER) return b;
         return VALUE_EMPTY;
 }
 
 Value
 vpow(Value a, Value b)
 {
-        if (a.type == TYPE_FORMULA) return vpow(a.as.formula->value, b);
-        if (b.type == TYPE_FORMULA) return vpow(a, b.as.formula->value);
-        if (a.type == TYPE_RANGE) return vpow(rangemap(AS_NUMBER(1), a, vpow), b);
-        if (b.type == TYPE_RANGE) return vpow(a, rangemap(AS_NUMBER(1), b, vpow));
+        if (VAL_TYPE(a) == TYPE_FORMULA) return vpow(VAL_FORMULA(a)->value, b);
+        if (VAL_TYPE(b) == TYPE_FORMULA) return vpow(a, VAL_FORMULA(b)->value);
+        if (VAL_TYPE(a) == TYPE_RANGE) return vpow(rangemap(AS_NUMBER(1), a, vpow), b);
+        if (VAL_TYPE(b) == TYPE_RANGE) return vpow(a, rangemap(AS_NUMBER(1), b, vpow));
 
-        if (a.type == TYPE_NUMBER) {
-                if (b.type == TYPE_NUMBER) return AS_NUMBER(pow(a.as.num, b.as.num));
+        if (VAL_TYPE(a) == TYPE_NUMBER) {
+                if (VAL_TYPE(b) == TYPE_NUMBER) return AS_NUMBER(pow(VAL_NUM(a), VAL_NUM(b)));
                 return a;
         }
-        if (b.type == TYPE_NUMBER) return b;
+        if (VAL_TYPE(b) == TYPE_NUMBER) return b;
         return VALUE_EMPTY;
 }
 
+Value
+vsquare(Value a)
+{
+        if (VAL_TYPE(a) == TYPE_FORMULA) return vsquare(VAL_FORMULA(a)->value);
+        if (VAL_TYPE(a) == TYPE_NUMBER) return AS_NUMBER(VAL_NUM(a) * VAL_NUM(a));
+        return vpow(a, AS_NUMBER(2));
+}
+
 Value
 vcountnum(Value start, Value a)
 {
-        if (a.type == TYPE_NUMBER) return vadd(start, AS_NUMBER(1));
-        if (a.type == TYPE_FORMULA) return vadd(start, a.as.formula->value);
-        if (a.type != TYPE_RANGE) return start;
+        if (VAL_TYPE(a) == TYPE_NUMBER) return vadd(start, AS_NUMBER(1));
+        if (VAL_TYPE(a) == TYPE_FORMULA) return vadd(start, VAL_FORMULA(a)->value);
+        if (VAL_TYPE(a) != TYPE_RANGE) return start;
         return vadd(start, rangemap(AS_NUMBER(0), a, vcountnum));
 }
 
 Value
 vmin(Value a, Value b)
 {
-        if (a.type == TYPE_FORMULA) return vmin(a.as.formula->value, b);
-        if (b.type == TYPE_FORMULA) return vmin(a, b.as.formula->value);
-        if (a.type == TYPE_RANGE) return rangemap(VALUE_EMPTY, a, vmin);
-        if (b.type == TYPE_RANGE) return rangemap(VALUE_EMPTY, b, vmin);
-        if (a.type == TYPE_NUMBER) {
-                if (b.type == TYPE_NUMBER) return a.as.num <= b.as.num ? a : b;
+        if (VAL_TYPE(a) == TYPE_FORMULA) return vmin(VAL_FORMULA(a)->value, b);
+        if (VAL_TYPE(b) == TYPE_FORMULA) return vmin(a, VAL_FORMULA(b)->value);
+        if (VAL_TYPE(a) == TYPE_RANGE) return rangemap(VALUE_EMPTY, a, vmin);
+        if (VAL_TYPE(b) == TYPE_RANGE) return rangemap(VALUE_EMPTY, b, vmin);
+        if (VAL_TYPE(a) == TYPE_NUMBER) {
+                if (VAL_TYPE(b) == TYPE_NUMBER) return VAL_NUM(a) <= VAL_NUM(b) ? a : b;
                 return a;
         }
-        if (b.type == TYPE_NUMBER) return b;
+        if (VAL_TYPE(b) == TYPE_NUMBER) return b;
         return VALUE_EMPTY;
 }
 
 Value
 vmax(Value a, Value b)
 {
-        if (a.type == TYPE_FORMULA) return vmax(a.as.formula->value, b);
-        if (b.type == TYPE_FORMULA) return vmax(a, b.as.formula->value);
-        if (a.type == TYPE_RANGE) return rangemap(VALUE_EMPTY, a, vmax);
-        if (b.type == TYPE_RANGE) return rangemap(VALUE_EMPTY, b, vmax);
-        if (a.type == TYPE_NUMBER) {
-                if (b.type == TYPE_NUMBER) return a.as.num >= b.as.num ? a : b;
+        if (VAL_TYPE(a) == TYPE_FORMULA) return vmax(VAL_FORMULA(a)->value, b);
+        if (VAL_TYPE(b) == TYPE_FORMULA) return vmax(a, VAL_FORMULA(b)->value);
+        if (VAL_TYPE(a) == TYPE_RANGE) return rangemap(VALUE_EMPTY, a, vmax);
+        if (VAL_TYPE(b) == TYPE_RANGE) return rangemap(VALUE_EMPTY, b, vmax);
+        if (VAL_TYPE(a) == TYPE_NUMBER) {
+                if (VAL_TYPE(b) == TYPE_NUMBER) return VAL_NUM(a) >= VAL_NUM(b) ? a : b;
                 return a;
         }
-        if (b.type == TYPE_NUMBER) return b;
+        if (VAL_TYPE(b) == TYPE_NUMBER) return b;
         return VALUE_EMPTY;
 }
 
 Value
 veq(Value a, Value b)
 {
-        if (a.type == TYPE_FORMULA) return veq(a.as.formula->value, b);
-        if (b.type == TYPE_FORMULA) return veq(a, b.as.formula->value);
-        if (a.type == TYPE_NUMBER) {
-                if (b.type == TYPE_NUMBER) return AS_BOOL(a.as.num == b.as.num);
+        if (VAL_TYPE(a) == TYPE_FORMULA) return veq(VAL_FORMULA(a)->value, b);
+        if (VAL_TYPE(b) == TYPE_FORMULA) return veq(a, VAL_FORMULA(b)->value);
+        if (VAL_TYPE(a) == TYPE_NUMBER) {
+                if (VAL_TYPE(b) == TYPE_NUMBER) return AS_BOOL(VAL_NUM(a) == VAL_NUM(b));
                 return AS_BOOL(true);
         }
-        if (b.type == TYPE_NUMBER) return AS_BOOL(false);
+        if (VAL_TYPE(b) == TYPE_NUMBER) return AS_BOOL(false);
         return VALUE_EMPTY;
 }
 
 Value
 vneq(Value a, Value b)
 {
-        if (a.type == TYPE_FORMULA) return vneq(a.as.formula->value, b);
-        if (b.type == TYPE_FORMULA) return vneq(a, b.as.formula->value);
-        if (a.type == TYPE_NUMBER) {
-                if (b.type == TYPE_NUMBER) return AS_BOOL(a.as.num != b.as.num);
+        if (VAL_TYPE(a) == TYPE_FORMULA) return vneq(VAL_FORMULA(a)->value, b);
+        if (VAL_TYPE(b) == TYPE_FORMULA) return vneq(a, VAL_FORMULA(b)->value);
+        if (VAL_TYPE(a) == TYPE_NUMBER) {
+                if (VAL_TYPE(b) == TYPE_NUMBER) return AS_BOOL(VAL_NUM(a) != VAL_NUM(b));
                 return AS_BOOL(true);
         }
-        if (b.type == TYPE_NUMBER) return AS_BOOL(false);
+        if (VAL_TYPE(b) == TYPE_NUMBER) return AS_BOOL(false);
         return VALUE_EMPTY;
 }
 
@@ -247,55 +292,71 @@ vneq(Value a, Value b)
 Value
 vlt(Value a, Value b)
 {
-        if (a.type == TYPE_FORMULA) return vlt(a.as.formula->value, b);
-        if (b.type == TYPE_FORMULA) return vlt(a, b.as.formula->value);
-        if (a.type == TYPE_NUMBER) {
-                if (b.type == TYPE_NUMBER) return AS_BOOL(a.as.num < b.as.num);
+        if (VAL_TYPE(a) == TYPE_FORMULA) return vlt(VAL_FORMULA(a)->value, b);
+        if (VAL_TYPE(b) == TYPE_FORMULA) return vlt(a, VAL_FORMULA(b)->value);
+        if (VAL_TYPE(a) == TYPE_NUMBER) {
+                if (VAL_TYPE(b) == TYPE_NUMBER) return AS_BOOL(VAL_NUM(a) < VAL_NUM(b));
                 return AS_BOOL(true);
         }
-        if (b.type == TYPE_NUMBER) return AS_BOOL(false);
+        if (VAL_TYPE(b) == TYPE_NUMBER) return AS_BOOL(false);
         return VALUE_EMPTY;
 }
 
 Value
 vleqt(Value a, Value b)
 {
-        if (a.type == TYPE_FORMULA) return vleqt(a.as.formula->value, b);
-        if (b.type == TYPE_FORMULA) return vleqt(a, b.as.formula->value);
-        if (a.type == TYPE_NUMBER) {
-                if (b.type == TYPE_NUMBER) return AS_BOOL(a.as.num <= b.as.num);
+        if (VAL_TYPE(a) == TYPE_FORMULA) return vleqt(VAL_FORMULA(a)->value, b);
+        if (VAL_TYPE(b) == TYPE_FORMULA) return vleqt(a, VAL_FORMULA(b)->value);
+        if (VAL_TYPE(a) == TYPE_NUMBER) {
+                if (VAL_TYPE(b) == TYPE_NUMBER) return AS_BOOL(VAL_NUM(a) <= VAL_NUM(b));
                 return AS_BOOL(true);
         }
-        if (b.type == TYPE_NUMBER) return AS_BOOL(false);
+        if (VAL_TYPE(b) == TYPE_NUMBER) return AS_BOOL(false);
         return VALUE_EMPTY;
 }
 
 Value
 vgt(Value a, Value b)
 {
-        if (a.type == TYPE_FORMULA) return vgt(a.as.formula->value, b);
-        if (b.type == TYPE_FORMULA) return vgt(a, b.as.formula->value);
-        if (a.type == TYPE_NUMBER) {
-                if (b.type == TYPE_NUMBER) return AS_BOOL(a.as.num > b.as.num);
+        if (VAL_TYPE(a) == TYPE_FORMULA) return vgt(VAL_FORMULA(a)->value, b);
+        if (VAL_TYPE(b) == TYPE_FORMULA) return vgt(a, VAL_FORMULA(b)->value);
+        if (VAL_TYPE(a) == TYPE_NUMBER) {
+                if (VAL_TYPE(b) == TYPE_NUMBER) return AS_BOOL(VAL_NUM(a) > VAL_NUM(b));
                 return AS_BOOL(true);
         }
-        if (b.type == TYPE_NUMBER) return AS_BOOL(false);
+        if (VAL_TYPE(b) == TYPE_NUMBER) return AS_BOOL(false);
         return VALUE_EMPTY;
 }
 
 Value
 vgeqt(Value a, Value b)
 {
-        if (a.type == TYPE_FORMULA) return vgeqt(a.as.formula->value, b);
-        if (b.type == TYPE_FORMULA) return vgeqt(a, b.as.formula->value);
-        if (a.type == TYPE_NUMBER) {
-                if (b.type == TYPE_NUMBER) return AS_BOOL(a.as.num >= b.as.num);
+        if (VAL_TYPE(a) == TYPE_FORMULA) return vgeqt(VAL_FORMULA(a)->value, b);
+        if (VAL_TYPE(b) == TYPE_FORMULA) return vgeqt(a, VAL_FORMULA(b)->value);
+        if (VAL_TYPE(a) == TYPE_NUMBER) {
+                if (VAL_TYPE(b) == TYPE_NUMBER) return AS_BOOL(VAL_NUM(a) >= VAL_NUM(b));
                 return AS_BOOL(true);
         }
-        if (b.type == TYPE_NUMBER) return AS_BOOL(false);
+        if (VAL_TYPE(b) == TYPE_NUMBER) return AS_BOOL(false);
         return VALUE_EMPTY;
 }
 
+/* Left to right, as the binary operators it replaces */
+Value
+eval_sum(Expr *e)
+{
+        Expr *t = e->as.sum.terms;
+        Value v = eval_expr(t);
+
+        for (int i = 1; (t = t->next); i++) {
+                if (e->as.sum.ops[i] == '-')
+                        v = vsub(v, eval_expr(t));
+                else
+                        v = vadd(v, eval_expr(t));
+        }
+        return v;
+}
+
 Value
 eval_binop(Expr *e)
 {
@@ -318,7 +379,7 @@ eval_binop(Expr *e)
         if (!strcmp(e->as.binop.op, "=")) return veq(lhs, rhs);
         if (!strcmp(e->as.binop.op, "!=")) return vneq(lhs, rhs);
 
-        report("No yet implemented: binop for %s", e->as.binop.op);
+        log_warn("No yet implemented: binop for %s", e->as.binop.op);
         return VALUE_ERROR;
 }
 
@@ -333,15 +394,18 @@ eval_expr(Expr *e)
         case EXPR_UN: return eval_unop(e);
         case EXPR_IDENTIFIER: return eval_identifier(e);
         case EXPR_FUNC: return eval_func(e);
+        case EXPR_SUM: return eval_sum(e);
         default:
-                report("No yet implemented: eval_expr for %d", e->type);
+                log_warn("No yet implemented: eval_expr for %d", e->type);
                 return VALUE_ERROR;
         }
 }
 
 Value
-eval_formula(Formula f)
+eval_formula(Formula *f)
 {
-        if (!f.body) return VALUE_ERROR;
-        return eval_expr(f.body);
+        double n;
+        if (!f->body || f->broken) return VALUE_ERROR;
+        if (f->rpn && rpn_run(f->rpn, &n)) return AS_NUMBER(n);
+        return eval_expr(f->body);
 }
@@ -24,9 +24,13 @@
 #include "cellmap.h"
 #include "formula.h"
 
-Value eval_formula(Formula f);
+/* Value of the body of F, by its numeric fast path if it has one */
+Value eval_formula(Formula *f);
 Value eval_expr(Expr *e);
 
+/* Function call being evaluated */
+extern Expr *builtin_call;
+
 
 /* basic operations on Values */
 Value vadd(Value a, Value b);
@@ -34,6 +38,7 @@ Value vsub(Value a, Value b);
 Value vdiv(Value a, Value b);
 Value vmul(Value a, Value b);
 Value vpow(Value a, Value b);
+Value vsquare(Value a); // a ^ 2
 Value vcountnum(Value start, Value a);
 Value vmin(Value a, Value b);
 Value vmax(Value a, Value b);
@@ -0,0 +1,128 @@
+/*
+ * VICEL - Visual Cell editor
+ * Copyright (C) 2025  Hugo Coto Florez
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * For questions or support, contact: me@hugocoto.com
+ */
+
+#include "fenwick.h"
+#include "common.h"
+
+/* Rebuild the tree from the plain values in O(n) */
+static void
+fw_build(Fenwick *f)
+{
+        int i, j;
+        for (i = 1; i <= f->size; i++)
+                f->tree[i] = f->val[i - 1];
+        for (i = 1; i <= f->size; i++) {
+                j = i + (i & -i);
+                if (j <= f->size) f->tree[j] += f->tree[i];
+        }
+}
+
+static void
+fw_reserve(Fenwick *f, int n)
+{
+        if (n <= f->capacity) return;
+        f->capacity = f->capacity ? f->capacity * 2 : 16;
+        if (f->capacity < n) f->capacity = n;
+        f->val = realloc(f->val, sizeof *f->val * f->capacity);
+        f->tree = realloc(f->tree, sizeof *f->tree * (f->capacity + 1));
+        assert(f->val && f->tree);
+}
+
+void
+fw_destroy(Fenwick *f)
+{
+        free(f->val);
+        free(f->tree);
+        *f = (Fenwick) { 0 };
+}
+
+void
+fw_resize(Fenwick *f, int n, int v)
+{
+        fw_reserve(f, n);
+        for (int i = f->size; i < n; i++)
+                f->val[i] = v;
+        f->size = n;
+        fw_build(f);
+}
+
+int
+fw_get(Fenwick *f, int i)
+{
+        assert(i >= 0 && i < f->size);
+        return f->val[i];
+}
+
+void
+fw_set(Fenwick *f, int i, int v)
+{
+        assert(i >= 0 && i < f->size);
+        int delta = v - f->val[i];
+        f->val[i] = v;
+        for (++i; i <= f->size; i += i & -i)
+                f->tree[i] += delta;
+}
+
+int
+fw_prefix(Fenwick *f, int n)
+{
+        int sum = 0;
+        if (n > f->size) n = f->size;
+        for (; n > 0; n -= n & -n)
+                sum += f->tree[n];
+        return sum;
+}
+
+int
+fw_search(Fenwick *f, int x)
+{
+        int pos = 0;
+        int step = 1;
+        if (x < 0) return 0;
+        while (step * 2 <= f->size)
+                step *= 2;
+        for (; step > 0; step /= 2) {
+                if (pos + step <= f->size && f->tree[pos + step] <= x) {
+                        pos += step;
+                        x -= f->tree[pos];
+                }
+        }
+        return pos;
+}
+
+void
+fw_insert(Fenwick *f, int i, int v)
+{
+        assert(i >= 0 && i <= f->size);
+        fw_reserve(f, f->size + 1);
+        memmove(f->val + i + 1, f->val + i, sizeof *f->val * (f->size - i));
+        f->val[i] = v;
+        ++f->size;
+        fw_build(f);
+}
+
+void
+fw_remove(Fenwick *f, int i)
+{
+        assert(i >= 0 && i < f->size);
+        memmove(f->val + i, f->val + i + 1, sizeof *f->val * (f->size - i - 1));
+        --f->size;
+        fw_build(f);
+}
@@ -0,0 +1,54 @@
+/*
+ * VICEL - Visual Cell editor
+ * Copyright (C) 2025  Hugo Coto Florez
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * For questions or support, contact: me@hugocoto.com
+ */
+
+#ifndef FENWICK_H_
+#define FENWICK_H_
+
+/* Fenwick (binary indexed) tree over an array of non negative ints. Used to
+ * get the prefix sums of column widths and to find the column at a given
+ * offset in O(log n). Indexes are 0-based. */
+
+typedef struct Fenwick {
+        int size;
+        int capacity;
+        int *val;  // plain values
+        int *tree; // 1-based partial sums
+} Fenwick;
+
+void fw_destroy(Fenwick *f);
+
+/* Set the size to N. New elements are set to V */
+void fw_resize(Fenwick *f, int n, int v);
+
+int fw_get(Fenwick *f, int i);
+void fw_set(Fenwick *f, int i, int v);
+
+/* Sum of the first N elements */
+int fw_prefix(Fenwick *f, int n);
+
+/* Index of the element that contains offset X, that is, the i such that
+ * fw_prefix(i) <= X < fw_prefix(i + 1). Returns size if X >= total sum */
+int fw_search(Fenwick *f, int x);
+
+/* Insert V before I or remove I, shifting the other elements. O(n) */
+void fw_insert(Fenwick *f, int i, int v);
+void fw_remove(Fenwick *f, int i);
+
+#endif // !FENWICK_H_
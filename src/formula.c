@@ -18,16 +18,32 @@
  * For questions or support, contact: me@hugocoto.com
  */
 
+#define LOG_CAT LOG_FORMULA
+
 #include "formula.h"
+#include "builtin.h"
 #include "cellmap.h"
 #include "common.h"
 #include "da.h"
 #include "debug.h"
 #include "eval.h"
+#include "mem.h"
+#include "number.h"
+#include "optimize.h"
+#include "profile.h"
+#include "rpn.h"
+#include "trace.h"
 #include "window.h"
+#include <limits.h>
 
 Cell *cell_self = NULL;
+Cell *formula_notifier = NULL;
+Cell *formula_cell = NULL;
+unsigned formula_missed = 0;
+unsigned formula_change = 0;
 jmp_buf parsing_error_env;
+/* Set while parsing the arguments of a lookup, see is_lookup() */
+static bool watch_ranges = false;
 
 _Noreturn void
 raise_parsing_error()
@@ -38,67 +54,113 @@ raise_parsing_error()
 Value
 build_range(Cell *cstart, Cell *cend)
 {
-        Value r = (Value) { .type = TYPE_RANGE };
+        struct Range *range = mem_calloc(MEM_FORMULAS, 1, sizeof *range);
+        Value r = AS_RANGE(range);
         char *cs;
         int x, y;
         Cell *c;
 
         cs = cm_get_cell_name(active_ctx.body, cstart);
-        if (cs == NULL) return VALUE_ERROR;
-        if (parse_coords(cs, &r.as.range.startx, &r.as.range.starty, 0, 0)) {
+        if (cs == NULL) goto error;
+        if (parse_coords(cs, &range->startx, &range->starty, 0, 0)) {
                 free(cs);
-                return VALUE_ERROR;
+                goto error;
         }
         free(cs);
 
         cs = cm_get_cell_name(active_ctx.body, cend);
-        if (cs == NULL) return VALUE_ERROR;
-        if (parse_coords(cs, &r.as.range.endx, &r.as.range.endy, 0, 0)) {
+        if (cs == NULL) goto error;
+        if (parse_coords(cs, &range->endx, &range->endy, 0, 0)) {
                 free(cs);
-                return VALUE_ERROR;
+                goto error;
         }
         free(cs);
 
-        for (x = r.as.range.startx; x <= r.as.range.endx; x++) {
-                for (y = r.as.range.starty; y <= r.as.range.endy; y++) {
+        assert(cell_self);
+        if (watch_ranges) {
+                cm_watch(cell_self, range->startx, range->endx, range->starty, range->endy);
+                return r;
+        }
+        for (x = range->startx; x <= range->endx; x++) {
+                for (y = range->starty; y <= range->endy; y++) {
                         c = cm_get_cell_ptr(active_ctx.body, x, y);
                         if (!c) break;
-                        assert(cell_self);
                         cm_subscribe(c, cell_self);
                 }
         }
 
         return r;
+
+error:
+        mem_free(MEM_FORMULAS, range);
+        return VALUE_ERROR;
+}
+
+/* Range from column STARTX, row STARTY to the last row of column ENDX. The
+ * formula watches these columns instead of subscribing to every cell */
+Value
+build_open_range(int startx, int starty, int endx)
+{
+        struct Range *range = mem_calloc(MEM_FORMULAS, 1, sizeof *range);
+
+        *range = (struct Range) {
+                .startx = startx,
+                .starty = starty,
+                .endx = endx,
+                .endy = starty,
+                .open = 1,
+        };
+        if (active_ctx.body->size - 1 > starty) range->endy = active_ctx.body->size - 1;
+        assert(cell_self);
+        cm_watch(cell_self, startx, endx, starty, INT_MAX);
+        return AS_RANGE(range);
 }
 
 void
 update_repr(Cell *cell)
 {
         free(cell->repr);
-        cell->repr = get_repr(cell->value);
-        free(cell->input_repr);
-        cell->input_repr = get_input_repr(cell->value);
+        cm_set_repr(cell, get_repr(cell->value));
+        cell->input_repr_dirty = true;
+}
+
+void
+formula_evaluate(Cell *cell)
+{
+        static unsigned changes = 0;
+        Cell *outer = formula_cell;
+        unsigned outer_change = formula_change;
+        formula_cell = cell;
+        formula_change = ++changes;
+        if (__builtin_expect(profile_enabled, 0))
+                VAL_FORMULA(cell->value)->value = profile_eval(cell);
+        else
+                VAL_FORMULA(cell->value)->value = eval_formula(VAL_FORMULA(cell->value));
+        VAL_FORMULA(cell->value)->change = formula_change;
+        formula_cell = outer;
+        formula_change = outer_change;
+        cell->repr_dirty = true;
 }
 
 void
 refresh_formula_value(Cell *cell)
 {
+        TRACE_SPAN("refresh_formula_value", "formula");
         if (cell->updated) {
-                cell->value.as.formula->value = VALUE_ERROR;
+                VAL_FORMULA(cell->value)->value = VALUE_ERROR;
+                ++formula_missed;
                 return;
         }
         cell->updated = true;
-        cell->value.as.formula->value = eval_expr(cell->value.as.formula->body);
-        update_repr(cell);
-
-        for_da_each(c, cell->subscribers) cm_notify(cell, *c);
+        formula_evaluate(cell);
+        cm_notify_subscribers(cell);
         cell->updated = false;
 }
 
 Expr *
 new_expr()
 {
-        return calloc(1, sizeof(Expr));
+        return mem_calloc(MEM_FORMULAS, 1, sizeof(Expr));
 }
 
 Expr *
@@ -137,7 +199,7 @@ new_literal_str(char *c)
 {
         Expr *e = new_expr();
         e->type = EXPR_LITERAL;
-        e->as.literal.value = AS_TEXT(strdup(c));
+        e->as.literal.value = AS_TEXT(mem_strdup(MEM_FORMULAS, c));
         return e;
 }
 
@@ -159,13 +221,22 @@ new_range(Cell *cstart, Cell *cend)
         return e;
 }
 
+Expr *
+new_open_range(int startx, int starty, int endx)
+{
+        Expr *e = new_expr();
+        e->type = EXPR_LITERAL;
+        e->as.literal.value = build_open_range(startx, starty, endx);
+        return e;
+}
+
 Expr *
 new_identifier(Cell *c, char *name)
 {
         Expr *e = new_expr();
         e->type = EXPR_IDENTIFIER;
         e->as.identifier.cell = c;
-        e->as.identifier.name = strdup(name);
+        e->as.identifier.name = mem_strdup(MEM_FORMULAS, name);
         return e;
 }
 
@@ -178,7 +249,7 @@ get_number(char **c)
 Token *
 new_tok()
 {
-        return calloc(1, sizeof(Token));
+        return mem_calloc(MEM_FORMULAS, 1, sizeof(Token));
 }
 
 Token *
@@ -189,10 +260,10 @@ TOK_AS_STR(char *c, int len)
         if (len > 0) {
                 char prev = c[len];
                 if (prev) c[len] = 0;
-                t->as.str = strdup(c);
+                t->as.str = mem_strdup(MEM_FORMULAS, c);
                 if (prev) c[len] = prev;
         } else
-                t->as.str = strdup("");
+                t->as.str = mem_strdup(MEM_FORMULAS, "");
         return t;
 }
 
@@ -208,7 +279,7 @@ TOK_AS_NUM(double n)
 Token *
 TOK_AS_IDENTIFIER(char *id)
 {
-        report("As id: %s", id);
+        log_trace("As id: %s", id);
         Token *t = new_tok();
         t->as.id = id;
         t->type = TOK_IDENTIFIER;
@@ -221,7 +292,7 @@ get_identifier(char **c)
         char *id = *c;
         char prev;
         if (**c == '$') ++*c;
-        while (isalpha(**c)) {
+        while (isalpha(**c) || **c == '_') {
                 ++*c;
         }
         if (**c == '$') ++*c;
@@ -230,7 +301,7 @@ get_identifier(char **c)
         }
         prev = **c;
         if (prev) **c = 0;
-        id = strdup(id);
+        id = mem_strdup(MEM_FORMULAS, id);
         if (prev) **c = prev;
         return id;
 }
@@ -240,17 +311,17 @@ free_token(Token *t)
 {
         switch (t->type) {
         case TOK_STRING:
-                free(t->as.str);
+                mem_free(MEM_FORMULAS, t->as.str);
                 break;
         case TOK_IDENTIFIER:
-                free(t->as.id);
+                mem_free(MEM_FORMULAS, t->as.id);
                 break;
         case TOK_NUMERIC:
                 break;
         default:
-                report("No yet implemented: free_tokens for %d", t->type);
+                log_warn("No yet implemented: free_tokens for %d", t->type);
         }
-        free(t);
+        mem_free(MEM_FORMULAS, t);
 }
 
 void
@@ -267,7 +338,7 @@ free_tokens(Token *t)
 Token *
 lexer(char *c)
 {
-        report("Lexer for `%s`", c);
+        log_trace("Lexer for `%s`", c);
         Token *last = new_tok();
         Token *zero = last;
         while (*c) {
@@ -304,6 +375,7 @@ lexer(char *c)
                         size_t len = strcspn(c + 1, "'");
                         last->next = TOK_AS_STR(c + 1, len);
                         last = last->next;
+                        last->quoted = true;
                         c += len + 1;
                         if (*c == '\'') ++c;
                         break;
@@ -315,7 +387,7 @@ lexer(char *c)
                         last = last->next;
                         if (c0 == c) {
                                 /* should never happen */
-                                report("Can not convert %*s to number", 5, c);
+                                log_warn("Can not convert %*s to number", 5, c);
                                 exit(19);
                         }
                         break;
@@ -331,8 +403,8 @@ lexer(char *c)
                         char *id;
                         if ((id = get_identifier(&c))) {
                                 if (*id == 0) {
-                                        free(id);
-                                        report("Couldn't get identifier from `%s`", c);
+                                        mem_free(MEM_FORMULAS, id);
+                                        log_warn("Couldn't get identifier from `%s`", c);
                                         last->next = TOK_AS_STR("Error", 5);
                                         last = last->next;
                                         ++c;
@@ -343,14 +415,14 @@ lexer(char *c)
                                 break;
                         }
 
-                        report("Invalid lexeme found: `%c`", *c);
+                        log_warn("Invalid lexeme found: `%c`", *c);
                         ++c;
                         break;
                 }
         }
 
         Token *r = zero->next;
-        free(zero);
+        mem_free(MEM_FORMULAS, zero);
         return r;
 }
 
@@ -368,7 +440,44 @@ match(Token **t, char *str)
         return NULL;
 }
 
-void free_expr(Expr *e);
+/* Column of ID if it is a whole column of the sheet (A, $B), -1 if not */
+static int
+get_column(char *id)
+{
+        int x = 0;
+
+        if (*id == '$') ++id;
+        if (!isalpha(*id)) return -1;
+        while (isalpha(*id)) {
+                x *= 'Z' - 'A' + 1;
+                x += toupper(*id) - 'A';
+                if (x >= active_ctx.body->data->size) return -1;
+                ++id;
+        }
+        return *id ? -1 : x;
+}
+
+/* Whether T is a whole column that ends a range */
+static bool
+is_column(Token *t)
+{
+        return t && t->type == TOK_IDENTIFIER && get_column(t->as.id) >= 0;
+}
+
+/* End of an open range (A:A, A5:A) that starts at STARTX, STARTY */
+static Expr *
+get_open_range(Token **t, int startx, int starty)
+{
+        int endx;
+
+        if (!is_column(*t)) {
+                log_warn("Invalid range");
+                raise_parsing_error();
+        }
+        endx = get_column((*t)->as.id);
+        *t = (*t)->next;
+        return new_open_range(startx, starty, endx);
+}
 
 Expr *
 get_literal(Token **t)
@@ -390,13 +499,23 @@ get_literal(Token **t)
         case TOK_IDENTIFIER: {
                 char *id = (*t)->as.id;
                 Cell *cell = get_cell_from_coords(id);
+                int x, y;
                 *t = (*t)->next;
-                if (cell == NULL) return new_literal_str(id);
+                if (cell == NULL) {
+                        /* A whole column only makes sense as a range */
+                        if ((x = get_column(id)) < 0 || !match(t, ":")) return new_literal_str(id);
+                        return get_open_range(t, x, 0);
+                }
 
                 if (match(t, ":")) {
+                        if (is_column(*t)) {
+                                parse_coords(id, &x, &y, 0, 0);
+                                return get_open_range(t, x, y);
+                        }
                         Expr *e = get_literal(t);
                         if (e->type != EXPR_IDENTIFIER) {
-                                report("Invalid range");
+                                log_warn("Invalid range");
+                                free_expr(e);
                                 raise_parsing_error();
                         }
                         Expr *ret = new_range(cell, e->as.identifier.cell);
@@ -408,22 +527,38 @@ get_literal(Token **t)
         }
 
         default:
-                report("No yet implemented: get_literal for %d", (*t)->type);
+                log_warn("No yet implemented: get_literal for %d", (*t)->type);
                 exit(ERR_GETLITERAL);
         }
 }
 
 Expr *get_comparison(Token **);
 
+/* Lookups can return a different value after a change to any cell of the
+ * ranges they search, which are often thousands of rows long. Instead of
+ * subscribing to each cell, these ranges are watched */
+static bool
+is_lookup(Expr *name)
+{
+        static const char *lookups[] = { "match", "xlookup", "vlookup", "hlookup" };
+
+        if (name->type != EXPR_LITERAL || VAL_TYPE(name->as.literal.value) != TYPE_TEXT) return false;
+        for (size_t i = 0; i < sizeof lookups / sizeof *lookups; i++)
+                if (!strcmp(VAL_TEXT(name->as.literal.value), lookups[i])) return true;
+        return false;
+}
+
 Expr *
 get_function(Token **t)
 {
-        report("get function");
+        log_trace("get function");
         Expr *e = get_literal(t);
         Expr *args = NULL;
         Expr *last;
+        bool outer_watch = watch_ranges;
 
         if (match(t, "(")) {
+                watch_ranges = watch_ranges || is_lookup(e);
                 while (!match(t, ")")) {
                         if (args == NULL) {
                                 args = get_comparison(t);
@@ -431,7 +566,7 @@ get_function(Token **t)
                                         free_expr(e);
                                         raise_parsing_error();
                                 }
-                                report("Adding argument");
+                                log_trace("Adding argument");
                                 last = args;
                                 continue;
                         }
@@ -441,14 +576,15 @@ get_function(Token **t)
                                         free_expr(args);
                                         args = last;
                                 }
-                                report("Expected parenthesis at formula");
+                                log_warn("Expected parenthesis at formula");
                                 free_expr(e);
                                 raise_parsing_error();
                         }
                         last->next = get_comparison(t);
-                        report("Adding argument");
+                        log_trace("Adding argument");
                         last = last->next;
                 }
+                watch_ranges = outer_watch;
                 return new_function(e, args);
         }
         return e;
@@ -460,7 +596,7 @@ get_group(Token **t)
         if (match(t, "(")) {
                 Expr *e = get_comparison(t);
                 if (!match(t, ")")) {
-                        report("Expected parenthesis at formula");
+                        log_warn("Expected parenthesis at formula");
                         free_expr(e);
                         raise_parsing_error();
                 }
@@ -546,20 +682,21 @@ get_ast_repr(Expr *e, char *buffer, size_t len)
 
         switch (e->type) {
         case EXPR_LITERAL:
-                switch (e->as.literal.value.type) {
+                switch (VAL_TYPE(e->as.literal.value)) {
                 case TYPE_NUMBER:
                         snprintf(buffer + strlen(buffer), len, "%g",
-                                 e->as.literal.value.as.num);
+                                 VAL_NUM(e->as.literal.value));
                         break;
 
                 case TYPE_TEXT:
                         snprintf(buffer + strlen(buffer),
                                  len,
                                  is_func_param && !is_name ? "'%s'" : "%s",
-                                 e->as.literal.value.as.text);
+                                 VAL_TEXT(e->as.literal.value));
                         break;
 
                 case TYPE_EMPTY:
+                case TYPE_BOOL:
                 case TYPE_FORMULA:
                 case TYPE_RANGE: {
                         char *c = get_input_repr(e->as.literal.value);
@@ -580,10 +717,25 @@ get_ast_repr(Expr *e, char *buffer, size_t len)
                 break;
 
         case EXPR_UN:
+                if (e->as.unop.op[0] == '^') {
+                        /* x^2 from optimize_expr */
+                        get_ast_repr(e->as.unop.rhs, buffer, len);
+                        snprintf(buffer + strlen(buffer), len, "%s", e->as.unop.op);
+                        break;
+                }
                 snprintf(buffer + strlen(buffer), len, "%s", e->as.unop.op);
                 get_ast_repr(e->as.unop.rhs, buffer, len);
                 break;
 
+        case EXPR_SUM: {
+                int i = 0;
+                for (Expr *t = e->as.sum.terms; t; t = t->next, i++) {
+                        if (i) snprintf(buffer + strlen(buffer), len, "%c", e->as.sum.ops[i]);
+                        get_ast_repr(t, buffer, len);
+                }
+                break;
+        }
+
         case EXPR_IDENTIFIER:
                 snprintf(buffer + strlen(buffer), len, "%s", e->as.identifier.name);
                 break;
@@ -607,7 +759,7 @@ get_ast_repr(Expr *e, char *buffer, size_t len)
                 break;
 
         default:
-                report("No yet implemented: get_ast_repr for %d", e->type);
+                log_warn("No yet implemented: get_ast_repr for %d", e->type);
                 exit(ERR_REPAST);
         }
 }
@@ -619,35 +771,101 @@ report_ast(Expr *e)
 
         char buffer[128] = { 0 };
         get_ast_repr(e, buffer, sizeof buffer - 1);
-        report("Ast: %s", buffer);
+        log_trace("Ast: %s", buffer);
         return e;
 }
 
+static void
+append(char **s, size_t *len, size_t *cap, const char *a)
+{
+        size_t n = strlen(a);
+        while (*len + n + 1 > *cap) {
+                *cap = *cap ? *cap * 2 : 64;
+                *s = mem_realloc(MEM_FORMULAS, *s, *cap);
+        }
+        memcpy(*s + *len, a, n + 1);
+        *len += n;
+}
+
+/* The tokens T written back, for formulas that were not typed */
+static char *
+tokens_repr(Token *t)
+{
+        char num[NUM_BUFSIZE], *s = NULL;
+        size_t len = 0, cap = 0;
+
+        append(&s, &len, &cap, "");
+        for (; t; t = t->next) {
+                switch (t->type) {
+                case TOK_STRING:
+                        if (t->quoted) append(&s, &len, &cap, "'");
+                        append(&s, &len, &cap, t->as.str);
+                        if (t->quoted) append(&s, &len, &cap, "'");
+                        break;
+                case TOK_IDENTIFIER:
+                        append(&s, &len, &cap, t->as.id);
+                        break;
+                case TOK_NUMERIC:
+                        num_format(t->as.num, num);
+                        append(&s, &len, &cap, num);
+                        break;
+                }
+        }
+        return s;
+}
+
+const char *
+formula_src(Formula *f)
+{
+        if (f->src == NULL) f->src = tokens_repr(f->tokens);
+        return f->src;
+}
+
+/* Optimize BODY of F */
+static Expr *
+compile(Formula *f, Expr *body)
+{
+        if (body == NULL) return NULL;
+        body = optimize_expr(body);
+        f->rpn = rpn_compile(body);
+        return body;
+}
+
 Expr *
 parse_formula(char *c, Cell *self)
 {
+        Formula *f = VAL_FORMULA(self->value);
+        char *end = c + strlen(c);
         cell_self = self;
+        watch_ranges = false;
         Token *t = lexer(c);
-        self->value.as.formula->tokens = t;
-        return report_ast(get_comparison(&t));
+        f->tokens = t;
+        /* As it was typed, parentheses and spaces included */
+        while (isspace(*c))
+                ++c;
+        while (end > c && isspace(end[-1]))
+                --end;
+        f->src = mem_malloc(MEM_FORMULAS, end - c + 1);
+        memcpy(f->src, c, end - c);
+        f->src[end - c] = 0;
+        return compile(f, report_ast(get_comparison(&t)));
 }
 
 void
 clear_cell(Cell *c)
 {
         cm_clear_cell(c);
-        __auto_type s = c->subscribers;
-        *c = EMPTY_CELL;
-        c->subscribers = s;
+        cm_reset_cell(c);
 }
 
 void
 build_formula(char *_str, Cell *self)
 {
+        TRACE_SPAN("build_formula", "formula");
         Expr *body = NULL;
 
         if (*_str != '=') {
-                report("Invalid formula: `%s` does not start with `=`", _str);
+                log_error("Invalid formula: `%s` does not start with `=`", _str);
                 exit(ERR_INVFORM);
         }
 
@@ -656,21 +874,20 @@ build_formula(char *_str, Cell *self)
         if (setjmp(parsing_error_env)) {
                 report("parsing error at formula");
                 clear_cell(self);
-                self->value.as.text = str;
-                self->value.type = TYPE_TEXT;
+                self->value = AS_TEXT(str);
                 update_repr(self);
-                self->value.as.text = self->repr;
+                self->value = AS_TEXT(self->repr);
                 free(str);
                 return;
         }
 
         clear_cell(self);
-        self->value.as.formula = calloc(1, sizeof(Formula));
-        self->value.type = TYPE_FORMULA;
+        self->value = AS_FORMULA(mem_calloc(MEM_FORMULAS, 1, sizeof(Formula)));
         body = parse_formula(str + 1, self);
-        self->value.as.formula->body = body;
+        VAL_FORMULA(self->value)->body = body;
+        cm_invalidate_repr(self);
         refresh_formula_value(self);
-        assert(self->value.type == TYPE_FORMULA);
+        assert(VAL_TYPE(self->value) == TYPE_FORMULA);
         free(str);
 }
 
@@ -678,12 +895,16 @@ void
 cm_notify(Cell *actor, Cell *observer)
 {
         if (actor == observer) return;
-        if (observer->value.type != TYPE_FORMULA) {
-                report("Invalid cm_notify for observer type %s",
-                       cm_type_repr(observer->value.type));
+        if (VAL_TYPE(observer->value) != TYPE_FORMULA) {
+                log_error("Invalid cm_notify for observer type %s",
+                          cm_type_repr(VAL_TYPE(observer->value)));
                 exit(ERR_OBSVAL);
         }
+        if (profile_enabled) ++profile_of(observer)->notifications;
+        Cell *outer = formula_notifier;
+        formula_notifier = actor;
         refresh_formula_value(observer);
+        formula_notifier = outer;
 }
 
 void
@@ -699,11 +920,13 @@ free_expr(Expr *e)
                 free_expr(e->as.unop.rhs);
                 break;
         case EXPR_LITERAL:
-                if (e->as.literal.value.type == TYPE_TEXT)
-                        free(e->as.literal.value.as.text);
+                if (VAL_TYPE(e->as.literal.value) == TYPE_TEXT)
+                        mem_free(MEM_FORMULAS, VAL_TEXT(e->as.literal.value));
+                if (VAL_TYPE(e->as.literal.value) == TYPE_RANGE)
+                        mem_free(MEM_FORMULAS, VAL_RANGE(e->as.literal.value));
                 break;
         case EXPR_IDENTIFIER:
-                free(e->as.identifier.name);
+                mem_free(MEM_FORMULAS, e->as.identifier.name);
                 break;
         case EXPR_FUNC: {
                 Expr *cur = e->as.func.args;
@@ -714,23 +937,49 @@ free_expr(Expr *e)
                         cur = next;
                 }
                 free_expr(e->as.func.name);
+                if (e->as.func.state) e->as.func.state->destroy(e->as.func.state);
+                break;
+        }
+        case EXPR_SUM: {
+                Expr *cur = e->as.sum.terms;
+                Expr *next;
+                while (cur) {
+                        next = cur->next;
+                        free_expr(cur);
+                        cur = next;
+                }
+                mem_free(MEM_FORMULAS, e->as.sum.ops);
                 break;
         }
         default:
-                report("No yet implemented: free_expr for %d", e->type);
+                log_warn("No yet implemented: free_expr for %d", e->type);
         }
-        free(e);
+        mem_free(MEM_FORMULAS, e);
+}
+
+void
+formula_unsubscribe(Cell *c)
+{
+        assert(VAL_TYPE(c->value) == TYPE_FORMULA);
+        for_da_each(a, VAL_FORMULA(c->value)->subscribed) cm_unsubscribe(*a, c);
+        if (cm_watchers.size) cm_unwatch(c);
+        da_destroy_cat(MEM_SUBSCRIBERS, &VAL_FORMULA(c->value)->subscribed);
 }
 
 void
 destroy_formula(Cell *c)
 {
-        assert(c->value.type == TYPE_FORMULA);
-        for_da_each(a, c->value.as.formula->subscribed) cm_unsubscribe(*a, c);
-        da_destroy(&c->value.as.formula->subscribed);
-        free_expr(c->value.as.formula->body);
-        free_tokens(c->value.as.formula->tokens);
-        free(c->value.as.formula);
+        Cell *outer = formula_cell;
+        formula_unsubscribe(c);
+        /* Builtin states empty the cells the formula spilled over */
+        formula_cell = c;
+        free_expr(VAL_FORMULA(c->value)->body);
+        formula_cell = outer;
+        free_tokens(VAL_FORMULA(c->value)->tokens);
+        mem_free(MEM_FORMULAS, VAL_FORMULA(c->value)->src);
+        rpn_free(VAL_FORMULA(c->value)->rpn);
+        mem_free(MEM_FORMULAS, VAL_FORMULA(c->value)->profile);
+        mem_free(MEM_FORMULAS, VAL_FORMULA(c->value));
 }
 
 static Token *
@@ -738,17 +987,18 @@ dup_tokens(Token *t)
 {
         if (t == NULL) return NULL;
 
-        Token *last = calloc(1, sizeof(Token));
+        Token *last = mem_calloc(MEM_FORMULAS, 1, sizeof(Token));
         Token *ret = last;
 
         while (t) {
                 last->type = t->type;
+                last->quoted = t->quoted;
                 switch (last->type) {
                 case TOK_STRING:
-                        last->as.str = strdup(t->as.str);
+                        last->as.str = mem_strdup(MEM_FORMULAS, t->as.str);
                         break;
                 case TOK_IDENTIFIER:
-                        last->as.id = strdup(t->as.id);
+                        last->as.id = mem_strdup(MEM_FORMULAS, t->as.id);
                         break;
                 default:
                         last->as = t->as;
@@ -756,7 +1006,7 @@ dup_tokens(Token *t)
                 }
                 t = t->next;
                 if (t)
-                        last = last->next = calloc(1, sizeof(Token));
+                        last = last->next = mem_calloc(MEM_FORMULAS, 1, sizeof(Token));
         }
         return ret;
 }
@@ -764,8 +1014,8 @@ dup_tokens(Token *t)
 char *
 create_id(int r, int c, bool freeze_r, bool freeze_c)
 {
-        char buf[10];
-        int start = 0;
+        char buf[24], digits[12];
+        int start = 0, n = 0;
         if (freeze_c) {
                 buf[start] = '$';
                 ++start;
@@ -780,7 +1030,14 @@ create_id(int r, int c, bool freeze_r, bool freeze_c)
                 buf[start] = '$';
                 ++start;
         }
-        snprintf(buf + start, sizeof buf - start, "%d", r);
+        /* Without snprintf, a sort can rewrite a reference per row */
+        if (r < 0) buf[start++] = '-';
+        do
+                digits[n++] = '0' + abs(r % 10);
+        while (r /= 10);
+        while (n)
+                buf[start++] = digits[--n];
+        buf[start] = 0;
         return strdup(buf);
 }
 
@@ -803,39 +1060,254 @@ test_create_id()
         free(c5);
 }
 
+static bool
+is_colon(Token *t)
+{
+        return t && t->type == TOK_STRING && !strcmp(t->as.str, ":");
+}
+
 static int
 extend_identifiers(Token *t, int r, int c)
 {
         int rr, cc;
         bool freeze_r, freeze_c;
+        Token *prev = NULL;
+        char *id;
         while (t) {
                 if (t->type == TOK_IDENTIFIER) {
                         if (!parse_coords(t->as.id, &cc, &rr, &freeze_r, &freeze_c)) {
                                 if (!freeze_c) cc += c;
                                 if (!freeze_r) rr += r;
-                                free(t->as.id);
-                                t->as.id = create_id(rr, cc, freeze_r, freeze_c);
+                                mem_free(MEM_FORMULAS, t->as.id);
+                                t->as.id = mem_adopt(MEM_FORMULAS, create_id(rr, cc, freeze_r, freeze_c));
+                        } else if (c && t->as.id[0] != '$' && (is_colon(prev) || is_colon(t->next)) &&
+                                   get_column(t->as.id) >= 0) {
+                                /* Whole column of an open range, it has no row */
+                                id = create_id(0, get_column(t->as.id) + c, false, false);
+                                id[strlen(id) - 1] = 0;
+                                mem_free(MEM_FORMULAS, t->as.id);
+                                t->as.id = mem_adopt(MEM_FORMULAS, id);
                         }
                 }
+                prev = t;
                 t = t->next;
         }
         return 0;
 }
 
+/* Move R rows the relative row of the reference T if ROW is in R0 to R1 */
+static bool
+move_row(Token *t, int r, int r0, int r1)
+{
+        int x, y;
+        bool freeze_r, freeze_c;
+
+        parse_coords(t->as.id, &x, &y, &freeze_r, &freeze_c);
+        if (freeze_r || y < r0 || y > r1) return true;
+        if (y + r < 0 || y + r >= active_ctx.body->size) return false;
+        mem_free(MEM_FORMULAS, t->as.id);
+        t->as.id = mem_adopt(MEM_FORMULAS, create_id(y + r, x, freeze_r, freeze_c));
+        return true;
+}
+
+static bool
+is_coords(Token *t)
+{
+        int x, y;
+        return t && t->type == TOK_IDENTIFIER && !parse_coords(t->as.id, &x, &y, 0, 0);
+}
+
+/* Move R rows the relative references of T to rows R0 to R1. A range is only
+ * moved if both ends are in these rows. Returns false if a reference would
+ * leave the sheet, the others are moved anyway */
+static bool
+move_identifiers(Token *t, int r, int r0, int r1)
+{
+        int x, y0, y1;
+        bool ok = true;
+
+        for (; t; t = t->next) {
+                if (!is_coords(t)) continue;
+                if (is_colon(t->next) && is_coords(t->next->next)) {
+                        parse_coords(t->as.id, &x, &y0, 0, 0);
+                        parse_coords(t->next->next->as.id, &x, &y1, 0, 0);
+                        if (y0 >= r0 && y0 <= r1 && y1 >= r0 && y1 <= r1) {
+                                ok &= move_row(t, r, r0, r1);
+                                ok &= move_row(t->next->next, r, r0, r1);
+                        }
+                        t = t->next->next;
+                        continue;
+                }
+                ok &= move_row(t, r, r0, r1);
+        }
+        return ok;
+}
+
+/* Parse the tokens T as the formula of SELF, without evaluating it */
+static Formula *
+formula_parse_tokens(Cell *self, Token *t)
+{
+        Formula *new = mem_calloc(MEM_FORMULAS, 1, sizeof *new);
+
+        new->tokens = t;
+        self->value = AS_FORMULA(new);
+        cell_self = self;
+        watch_ranges = false;
+        new->body = compile(new, report_ast(get_comparison(&t)));
+        return new;
+}
+
 Formula *
 formula_extend(Cell *self, Formula *f, int r, int c)
 {
-        Formula *new = calloc(1, sizeof *f);
-        Token *t = new->tokens = dup_tokens(f->tokens);
+        Token *t = dup_tokens(f->tokens);
+        Formula *new;
 
-        self->value.as.formula = new;
-        self->value.type = TYPE_FORMULA;
-        cell_self = self;
         if (extend_identifiers(t, r, c)) {
-                report("Can not extend formula");
+                log_warn("Can not extend formula");
+                free_tokens(t);
                 return NULL;
         }
-        new->body = report_ast(get_comparison(&t));
-        new->value = eval_formula(*new);
+        new = formula_parse_tokens(self, t);
+        new->value = eval_formula(new);
         return new;
 }
+
+void
+formula_reparse(Cell *c, int r, int r0, int r1)
+{
+        TRACE_SPAN("formula_reparse", "formula");
+        Formula *old = VAL_FORMULA(c->value);
+        Token *t;
+        bool broken;
+        char *text;
+
+        assert(VAL_TYPE(c->value) == TYPE_FORMULA && old->subscribed.size == 0);
+        if (setjmp(parsing_error_env)) {
+                /* Keep what the user wrote as text */
+                report("parsing error at formula");
+                if (VAL_FORMULA(c->value) != old) destroy_formula(c);
+                c->value = AS_FORMULA(old);
+                text = get_input_repr(c->value);
+                destroy_formula(c);
+                c->value = AS_TEXT(text);
+                free(c->repr);
+                cm_set_repr(c, text);
+                return;
+        }
+        t = dup_tokens(old->tokens);
+        broken = old->broken;
+        if (!move_identifiers(t, r, r0, r1)) {
+                report("A reference was moved out of the sheet");
+                broken = true;
+        }
+        formula_parse_tokens(c, t)->broken = broken;
+        free_expr(old->body);
+        free_tokens(old->tokens);
+        mem_free(MEM_FORMULAS, old->src);
+        rpn_free(old->rpn);
+        mem_free(MEM_FORMULAS, old->profile);
+        mem_free(MEM_FORMULAS, old);
+        cm_invalidate_repr(c);
+}
+
+/* Whether the reference T, at rows R0 to R1 moved by INV, still names the
+ * cell it points to once moved R rows */
+static bool
+keeps_cell(Token *t, int r, int r0, int r1, const int *inv)
+{
+        int x, y;
+        bool freeze_r;
+
+        parse_coords(t->as.id, &x, &y, &freeze_r, NULL);
+        if (y < r0 || y > r1) return true;
+        return (freeze_r ? y : y + r) == r0 + inv[y - r0];
+}
+
+/* Whether the references of T still point to the cells they name once moved
+ * as formula_reparse would */
+static bool
+can_move(Token *t, int r, int r0, int r1, const int *inv)
+{
+        int x, y0, y1, lo, hi;
+
+        for (; t; t = t->next) {
+                if (is_colon(t)) {
+                        /* Whole columns have every row */
+                        if (is_coords(t->next)) return false;
+                        continue;
+                }
+                if (!is_coords(t)) continue;
+                if (!is_colon(t->next)) {
+                        if (!keeps_cell(t, r, r0, r1, inv)) return false;
+                        continue;
+                }
+                if (!is_coords(t->next->next)) return false;
+                /* A range has to keep the same rows */
+                parse_coords(t->as.id, &x, &y0, 0, 0);
+                parse_coords(t->next->next->as.id, &x, &y1, 0, 0);
+                lo = min(y0, y1);
+                hi = max(y0, y1);
+                if (hi >= r0 && lo <= r1 && (lo > r0 || hi < r1 || (lo == r0 && hi == r1 && r))) return false;
+                t = t->next->next;
+        }
+        return true;
+}
+
+/* Move R rows the relative references of E to rows R0 to R1 */
+static void
+move_names(Expr *e, int r, int r0, int r1)
+{
+        int x, y;
+        bool freeze_r, freeze_c;
+
+        for (; e; e = e->next) {
+                switch (e->type) {
+                case EXPR_IDENTIFIER:
+                        if (parse_coords(e->as.identifier.name, &x, &y, &freeze_r, &freeze_c) || freeze_r ||
+                            y < r0 || y > r1)
+                                break;
+                        mem_free(MEM_FORMULAS, e->as.identifier.name);
+                        e->as.identifier.name = mem_adopt(MEM_FORMULAS, create_id(y + r, x, freeze_r, freeze_c));
+                        break;
+                case EXPR_BIN:
+                        move_names(e->as.binop.lhs, r, r0, r1);
+                        move_names(e->as.binop.rhs, r, r0, r1);
+                        break;
+                case EXPR_UN: move_names(e->as.unop.rhs, r, r0, r1); break;
+                case EXPR_FUNC: move_names(e->as.func.args, r, r0, r1); break;
+                case EXPR_SUM: move_names(e->as.sum.terms, r, r0, r1); break;
+                default: break;
+                }
+        }
+}
+
+bool
+formula_move(Cell *c, int r, int r0, int r1, const int *inv)
+{
+        Formula *f = VAL_FORMULA(c->value);
+        bool moved = false;
+        int x, y;
+        bool freeze_r;
+
+        if (!can_move(f->tokens, r, r0, r1, inv)) return false;
+        if (r == 0) return true;
+        for (Token *t = f->tokens; t; t = t->next) {
+                if (!is_coords(t)) continue;
+                if (is_colon(t->next)) {
+                        /* Ranges do not move, see can_move */
+                        t = t->next->next;
+                        continue;
+                }
+                parse_coords(t->as.id, &x, &y, &freeze_r, NULL);
+                if (freeze_r || y < r0 || y > r1) continue;
+                move_row(t, r, r0, r1);
+                moved = true;
+        }
+        if (!moved) return true;
+        move_names(f->body, r, r0, r1);
+        mem_free(MEM_FORMULAS, f->src);
+        f->src = NULL;
+        cm_invalidate_repr(c);
+        return true;
+}
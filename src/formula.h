@@ -30,6 +30,7 @@ typedef enum ExprType {
         EXPR_BIN,
         EXPR_UN,
         EXPR_FUNC,
+        EXPR_SUM, // a + b - c ..., built by optimize_expr
         EXPRLEN,
 } ExprType;
 
@@ -41,7 +42,8 @@ typedef struct Expr {
                 struct { struct Expr *lhs; char *op; struct Expr *rhs; } binop;
                 struct { char *op; struct Expr *rhs; } unop;
                 struct { Cell *cell; char* name; } identifier;
-                struct { struct Expr* name; struct Expr* args; } func;
+                struct { struct Expr* name; struct Expr* args; struct BuiltinState *state; } func;
+                struct { struct Expr *terms; char *ops; int n; } sum; // terms linked by next, ops[i] is '+' or '-'
         } as;
         struct Expr * next; 
 } Expr;
@@ -58,12 +60,15 @@ typedef struct Token {
                 TOK_IDENTIFIER,
                 TOK_NUMERIC,
         } type;
+        bool quoted; // TOK_STRING written between quotes
         struct Token *next;
 } Token;
 
 
 typedef struct Formula {
-        Expr *body;
+        Expr *body; // optimized, see optimize_expr
+        char *src;  // body as it was written, see formula_src
+        struct RpnProgram *rpn; // numeric fast path, see rpn.h
         Value value;
         Token *tokens;
         struct {
@@ -71,17 +76,53 @@ typedef struct Formula {
                 int size;
                 Cell **data;
         } subscribed;
+        struct FormulaProfile *profile; // see profile.h
+        unsigned change; // formula_change of its last evaluation
+        bool broken;     // a sort moved a reference out of the sheet
 } Formula;
 
+/* Cell whose change is being propagated to the formula being evaluated, NULL
+ * if the formula is evaluated for any other reason */
+extern Cell *formula_notifier;
+/* Cell whose formula is being evaluated */
+extern Cell *formula_cell;
+/* Incremented when a formula misses a change because of a cycle */
+extern unsigned formula_missed;
+/* Number of the formula evaluation in progress, each one gets a new number */
+extern unsigned formula_change;
+
 /* write formula stuff in SELF */
 void build_formula(char *, Cell *self);
+void refresh_formula_value(Cell *cell);
+/* Evaluate the formula of CELL without notifying its subscribers */
+void formula_evaluate(Cell *cell);
 Formula *formula_dup(Formula *f);
 
 void clear_cell(Cell *c);
 Expr *parse_formula(char *, Cell *self);
+Expr *new_expr();
+Expr *new_literal(double value);
+Expr *new_unop(char *op, Expr *rhs);
+void free_expr(Expr *e);
 void destroy_formula(Cell *c);
 
+/* Body of F as it was written. Formulas that were copied or moved by a sort
+ * write it back from their tokens the first time it is needed */
+const char *formula_src(Formula *f);
 Formula *formula_extend(Cell *self, Formula *f, int r, int c);
+/* Stop depending on the cells the formula of C depends on */
+void formula_unsubscribe(Cell *c);
+/* Parse the formula of C again, after a sort has moved it R rows, with
+ * formula_unsubscribe called before moving it. Its relative references to
+ * the sorted rows R0 to R1 move with it, the others keep their address. If
+ * one would leave the sheet it is kept and the formula evaluates to an
+ * error. It is not evaluated */
+void formula_reparse(Cell *c, int r, int r0, int r1);
+/* Rewrite the references of the formula of C as formula_reparse would, after
+ * a sort has moved it R rows and row R0 + I to R0 + INV[I], keeping what it
+ * is subscribed to. Returns false, and leaves it as it was, if they would no
+ * longer point to the cells they name: then it has to be parsed again */
+bool formula_move(Cell *c, int r, int r0, int r1, const int *inv);
 void get_ast_repr(Expr *e, char *buffer, size_t leng); 
 char * create_id(int r, int c, bool freeze_r, bool freeze_c);
 
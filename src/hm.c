@@ -20,11 +20,15 @@
 
 #include "hm.h"
 #include "common.h"
+#include "mem.h"
+
+/* Colors are the only thing stored in hash maps */
+#define HM_MEM_CAT MEM_COLORS
 
 void
 hmnew(Hmap *table, int size)
 {
-        table->node_arr = calloc(size, sizeof(Hnode));
+        table->node_arr = mem_calloc(HM_MEM_CAT, size, sizeof(Hnode));
         table->size = size;
 }
 
@@ -38,9 +42,9 @@ hmadd(Hmap *table, const char *key, void *value)
         node = table->node_arr + index;
         while (node->next)
                 node = node->next;
-        node->key = strdup(key);
+        node->key = mem_strdup(HM_MEM_CAT, key);
         node->value = value;
-        node->next = calloc(1, sizeof(Hnode));
+        node->next = mem_calloc(HM_MEM_CAT, 1, sizeof(Hnode));
 }
 
 void
@@ -67,7 +71,7 @@ hmpop(Hmap *table, const char *key)
         while (last->next)
                 last = last->next;
 
-        free(node->key);
+        mem_free(HM_MEM_CAT, node->key);
         node->key = last->key;
         node->value = last->value;
 
@@ -76,7 +80,7 @@ hmpop(Hmap *table, const char *key)
 
         node->next = NULL;
 
-        free(last);
+        mem_free(HM_MEM_CAT, last);
 }
 
 void *
@@ -134,18 +138,18 @@ hmdestroy(Hmap *table)
         for (int i = 0; i < table->size; i++) {
                 node = table->node_arr + i;
                 if (ondestroy) ondestroy(node);
-                free(node->key);
+                mem_free(HM_MEM_CAT, node->key);
                 next = node->next;
 
                 while ((node = next)) {
                         next = node->next;
                         if (ondestroy) ondestroy(node);
-                        free(node->key);
-                        free(node);
+                        mem_free(HM_MEM_CAT, node->key);
+                        mem_free(HM_MEM_CAT, node);
                 }
         }
 
-        free(table->node_arr);
+        mem_free(HM_MEM_CAT, table->node_arr);
         table->node_arr = NULL;
         table->size = 0;
 }
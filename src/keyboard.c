@@ -18,6 +18,8 @@
  * For questions or support, contact: me@hugocoto.com
  */
 
+#define LOG_CAT LOG_INPUT
+
 #include "keyboard.h"
 #include "action.h"
 #include "aptree.h"
@@ -28,20 +30,19 @@
 #include "debug.h"
 #include "escape_code.h"
 #include "formula.h"
+#include "loop.h"
 #include "mappings.h"
+#include "number.h"
 #include "options.h"
 #include "readlain.h"
 #include "window.h"
 
-bool quit = false;
-extern int should_autosave;
-
 void get_set_cell_input();
 
 void
 should_quit()
 {
-        quit = true;
+        loop_stop();
 }
 
 void
@@ -97,7 +98,7 @@ get_escape_sequence()
                 if (win_opts.use_mouse && sscanf(buf, "[M%c%c%c", &btn, &c, &r) == 3) {
                         static char hold = 0;
                         static int wheel_dir = 0;
-                        cellc = (c - 33 - win_opts.num_col_width) / win_opts.col_width + active_ctx.scroll_c;
+                        cellc = col_at_screen_x(c - 33);
                         cellr = (r - 33 - 2) / win_opts.row_width + active_ctx.scroll_r;
                         // int cellr_max = (active_ctx.ws.ws_row - 2) / win_opts.row_width + active_ctx.scroll_r;
                         // int cellc_max = (active_ctx.ws.ws_col - win_opts.num_col_width - 2) / win_opts.col_width + active_ctx.scroll_c;
@@ -195,14 +196,14 @@ get_input_at_cursor()
 
         cursor_gotocell(active_ctx.cursor_pos_c + 1, active_ctx.cursor_pos_r + 1);
         apply_color("insert");
-        printf("%*s", win_opts.col_width, "");
+        printf("%*s", col_width(active_ctx.cursor_pos_c), "");
         cursor_gotocell(active_ctx.cursor_pos_c + 1, active_ctx.cursor_pos_r + 1);
         T_CUSHW();
 
         int x, y;
         get_current_position(&x, &y);
         rlain_setwidth(active_ctx.ws.ws_col - x);
-        rlain_insert(get_cursor_cell()->input_repr);
+        rlain_insert(cm_input_repr(get_cursor_cell()));
         T_CUF(1);
         buf = readlain("");
 
@@ -212,6 +213,7 @@ get_input_at_cursor()
         if ((c = strchr(buf, '\t'))) *c = ' '; // change tab by space
 
         T_CUHDE();
+        render_invalidate(); // the input was drawn over the sheet
 
         return buf;
 }
@@ -219,48 +221,37 @@ get_input_at_cursor()
 void
 detect_cell_type(Cell *c)
 {
-        char *buf = c->repr;
-        if (*buf == '=') {
+        double d;
+        if (*c->repr == '=') {
                 cm_convert(c, TYPE_FORMULA);
                 return;
         }
-        bool is_numeric = true && *buf;
-        while (*buf && is_numeric) {
-                if (('0' <= *buf && *buf <= '9') || *buf == '.')
-                        ++buf;
-                else if (buf == c->repr && (*buf == '-' || *buf == '+'))
-                        ++buf;
-                else
-                        is_numeric = false;
-        }
-        if (is_numeric) {
-                cm_convert(c, TYPE_NUMBER);
+        if (num_parse(c->repr, strlen(c->repr), &d)) {
+                /* repr is still the text, it is formatted again on demand */
+                c->value = AS_NUMBER(d);
+                cm_invalidate_repr(c);
                 return;
         }
 
-        if (*c->repr == 0) c->value.type = TYPE_EMPTY;
+        if (*c->repr == 0) c->value = VALUE_EMPTY;
 }
 
 void
 set_cell_text(Cell *c, char *text)
 {
-        if (c->value.type == TYPE_FORMULA) {
+        if (VAL_TYPE(c->value) == TYPE_FORMULA) {
                 destroy_formula(c);
         }
 
         free(c->repr);
-        free(c->input_repr);
+        if (c->meta) c->meta->spilled = false;
 
-        c->value.as.text = text;
-        c->repr = text;
-        c->value.type = TYPE_TEXT;
-        c->input_repr = get_input_repr(c->value);
+        c->value = AS_TEXT(text);
+        cm_set_repr(c, text);
+        c->input_repr_dirty = true;
         detect_cell_type(c);
 
-        for_da_each(o, c->subscribers)
-        {
-                cm_notify(c, *o);
-        }
+        cm_notify_subscribers(c);
 }
 
 void
@@ -270,17 +261,110 @@ get_set_cell_input()
         set_cell_text(get_cursor_cell(), buf);
 }
 
+static APTree mappings;
+static char buf[MAX_MAPPING_LEN];
+static int read_index = 0;
+static char saved_buf[MAX_MAPPING_LEN] = { 0 };
+static int saved_read_index = 0;
+static int saved_repeat = 0;
+static int repeat = 0;
+
+static void
+kb_feed(char c)
+{
+        Action action;
+
+        buf[read_index] = c;
+        if (buf[read_index] < 0 || buf[read_index] >= 127) {
+                log_warn("Invalid char read: %d", buf[read_index]);
+                return;
+        }
+
+        ++read_index;
+
+        if (buf[0] == '.') {
+                strncpy(buf, saved_buf, MAX_MAPPING_LEN);
+                read_index = saved_read_index;
+                repeat = saved_repeat;
+        }
+
+        if (buf[0] >= '0' && buf[0] <= '9') {
+                read_index = 0;
+                repeat *= 10;
+                repeat += buf[0] - '0';
+        }
+
+        if (read_index && buf[read_index - 1] == '\033') {
+                buf[read_index - 1] = get_escape_sequence();
+                if (buf[read_index - 1] == 0) {
+                        read_index = 0;
+                        repeat = 0;
+                }
+        }
+
+        /* Buffer contains a valid action whose prefix is unique */
+        if ((action_is_valid(action = find_action(mappings, buf, read_index)))) {
+                strncpy(saved_buf, buf, read_index);
+                saved_read_index = read_index;
+                saved_repeat = repeat;
+                do {
+                        // report("Action on buffer: [%.*s]", read_index, buf);
+                        action.action();
+                } while (--repeat > 0);
+                read_index = 0;
+                repeat = 0;
+        }
+
+        /* Buffer contains an invalid action, but the previous buffered action was valid */
+        // Todo
+        /* Buffer is full */
+        else if (read_index == MAX_MAPPING_LEN) {
+                /* Get the action whose prefix is in buffer with or without shared prefix */
+                if ((action_is_valid(action = find_action_force(mappings, buf, read_index)))) {
+                        strncpy(saved_buf, buf, read_index);
+                        saved_read_index = read_index;
+                        saved_repeat = repeat;
+                        do {
+                                // report("Action on buffer: [%.*s]", read_index, buf);
+                                action.action();
+                        } while (--repeat > 0);
+                }
+                repeat = 0;
+                read_index = 0;
+        }
+
+        /* If buffer has no actions and no descents, invalidate buffer */
+        else if (read_index && !has_descents(mappings, buf, read_index)) {
+                read_index = 0;
+                repeat = 0;
+        }
+
+        print_mapping_buffer(buf, read_index, MAX_MAPPING_LEN, repeat);
+        loop_request_render(false);
+}
+
+static void
+on_stdin(int fd, void *data)
+{
+        char c;
+        (void) data;
+        switch (read(fd, &c, 1)) {
+        case 0:
+                loop_stop();
+                break;
+        case -1:
+                if (errno != EINTR && errno != EAGAIN) loop_stop();
+                break;
+        default:
+                kb_feed(c);
+                break;
+        }
+}
+
 void
 start_kbhandler()
 {
-        char buf[MAX_MAPPING_LEN];
-        int read_index = 0;
-        char saved_buf[MAX_MAPPING_LEN] = { 0 };
-        int saved_read_index = 0;
-        int saved_repeat = 0;
-        Action action;
-        APTree mappings = ap_init();
-        int repeat = 0;
+        mappings = ap_init();
 
         add_action(mappings, KEY_DOWN, ACTION(a_move_cursor_down));
         add_action(mappings, KEY_UP, ACTION(a_move_cursor_up));
@@ -332,6 +416,11 @@ start_kbhandler()
         MAP(func_a_delete_right_col, a_delete_right_col);
         MAP(func_a_col_increase, a_col_increase);
         MAP(func_a_col_decrease, a_col_decrease);
+        MAP(func_a_col_autofit, a_col_autofit);
+        MAP(func_a_profile_next, a_profile_next);
+        MAP(func_a_mem_stats, a_mem_stats);
+        MAP(func_a_sort_asc, a_sort_asc);
+        MAP(func_a_sort_desc, a_sort_desc);
         MAP(func_a_scroll_left, a_scroll_left);
         MAP(func_a_scroll_right, a_scroll_right);
 
@@ -345,87 +434,11 @@ start_kbhandler()
 
         print_mapping_buffer("", 0, MAX_MAPPING_LEN, repeat);
         toggle_raw_mode();
-        render();
-
-        while (!quit && read(STDIN_FILENO, buf + read_index, 1)) {
-                if (buf[read_index] < 0 || buf[read_index] >= 127) {
-                        report("Invalid char read: %d", buf[read_index]);
-                        continue;
-                }
-
-                ++read_index;
-
-                if (buf[0] == '.') {
-                        strncpy(buf, saved_buf, MAX_MAPPING_LEN);
-                        read_index = saved_read_index;
-                        repeat = saved_repeat;
-                }
-
-                if (buf[0] >= '0' && buf[0] <= '9') {
-                        read_index = 0;
-                        repeat *= 10;
-                        repeat += buf[0] - '0';
-                }
-
-                if (read_index && buf[read_index - 1] == '\033') {
-                        buf[read_index - 1] = get_escape_sequence();
-                        if (buf[read_index - 1] == 0) {
-                                read_index = 0;
-                                repeat = 0;
-                        }
-                }
-
-                /* Buffer contains a valid action whose prefix is unique */
-                if ((action_is_valid(action = find_action(mappings, buf, read_index)))) {
-                        strncpy(saved_buf, buf, read_index);
-                        saved_read_index = read_index;
-                        saved_repeat = repeat;
-                        do {
-                                // report("Action on buffer: [%.*s]", read_index, buf);
-                                action.action();
-                        } while (--repeat > 0);
-                        read_index = 0;
-                        repeat = 0;
-                }
 
-                /* Buffer contains an invalid action, but the previous buffered action was valid */
-                // Todo
-                /* Buffer is full */
-                else if (read_index == MAX_MAPPING_LEN) {
-                        /* Get the action whose prefix is in buffer with or without shared prefix */
-                        if ((action_is_valid(action = find_action_force(mappings, buf, read_index)))) {
-                                strncpy(saved_buf, buf, read_index);
-                                saved_read_index = read_index;
-                                saved_repeat = repeat;
-                                do {
-                                        // report("Action on buffer: [%.*s]", read_index, buf);
-                                        action.action();
-                                } while (--repeat > 0);
-                        }
-                        repeat = 0;
-                        read_index = 0;
-                }
-
-                /* If buffer has no actions and no descents, invalidate buffer */
-                else if (read_index && !has_descents(mappings, buf, read_index)) {
-                        read_index = 0;
-                        repeat = 0;
-                }
-
-                print_mapping_buffer(buf, read_index, MAX_MAPPING_LEN, repeat);
-
-                if (should_autosave) {
-                        should_autosave = 0;
-                        report("[Auto save]");
-                        set_ui_report("save");
-                        a_save();
-
-                } else
-                        /* Clear on 2 secs */
-                        clear_ui_report_ontimeout(2);
-
-                render();
-        }
+        loop_add_fd(STDIN_FILENO, on_stdin, NULL);
+        loop_request_render(false);
+        loop_run(); // until should_quit()
+        loop_del_fd(STDIN_FILENO);
 
         ap_destroy(mappings);
         toggle_raw_mode();
@@ -0,0 +1,316 @@
+/*
+ * VICEL - Visual Cell editor
+ * Copyright (C) 2025  Hugo Coto Florez
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * For questions or support, contact: me@hugocoto.com
+ */
+
+#define LOG_CAT LOG_FORMULA
+#define DA_MEM_CAT MEM_INDEXES
+
+#include "lookup.h"
+#include "common.h"
+#include "da.h"
+#include "debug.h"
+#include "formula.h"
+#include "mem.h"
+#include "trace.h"
+#include "window.h"
+#include <ctype.h>
+#include <stdint.h>
+
+/* Hash index of the values of a line. Cells with the same bucket are
+ * chained in ascending order, so the first match is the first cell of the
+ * line with that value. Hashes are only a filter: values are compared with
+ * the cells themselves */
+typedef struct LookupIndex {
+        CellMat *mat;
+        unsigned version; // cm_layout_version when it was built
+        struct Range line;
+        int len;
+        int mask;       // buckets - 1
+        int *head;      // bucket -> first offset, -1 if none
+        int *next;      // offset -> next offset in the same bucket
+        uint64_t *hash; // offset -> hash of its value, 0 if not indexed
+} LookupIndex;
+
+static DA(LookupIndex *) indexes = { 0 };
+int lookup_nindexes = 0;
+
+static bool
+is_vertical(struct Range *line)
+{
+        return line->startx == line->endx;
+}
+
+int
+lookup_line_len(struct Range *line)
+{
+        if (is_vertical(line)) return line->endy - line->starty + 1;
+        if (line->starty == line->endy) return line->endx - line->startx + 1;
+        return -1;
+}
+
+static Value
+cell_value(Cell *c)
+{
+        if (c == NULL) return VALUE_EMPTY;
+        if (VAL_TYPE(c->value) == TYPE_FORMULA) return VAL_FORMULA(c->value)->value;
+        return c->value;
+}
+
+Value
+lookup_value_at(struct Range *line, int i)
+{
+        if (is_vertical(line))
+                return cell_value(cm_get_cell_ptr(active_ctx.body, line->startx, line->starty + i));
+        return cell_value(cm_get_cell_ptr(active_ctx.body, line->startx + i, line->starty));
+}
+
+static int
+rank(Value v)
+{
+        switch (VAL_TYPE(v)) {
+        case TYPE_NUMBER: return 0;
+        case TYPE_TEXT: return 1;
+        case TYPE_BOOL: return 2;
+        default: return 3;
+        }
+}
+
+int
+lookup_cmp(Value a, Value b)
+{
+        if (rank(a) != rank(b)) return rank(a) - rank(b);
+        switch (VAL_TYPE(a)) {
+        case TYPE_NUMBER:
+                return (VAL_NUM(a) > VAL_NUM(b)) - (VAL_NUM(a) < VAL_NUM(b));
+        case TYPE_TEXT:
+                return strcasecmp(VAL_TEXT(a) ?: "", VAL_TEXT(b) ?: "");
+        case TYPE_BOOL:
+                return VAL_BOOL(a) - VAL_BOOL(b);
+        default:
+                return 0;
+        }
+}
+
+static uint64_t
+mix(uint64_t h)
+{
+        h ^= h >> 30;
+        h *= 0xbf58476d1ce4e5b9ull;
+        h ^= h >> 27;
+        h *= 0x94d049bb133111ebull;
+        h ^= h >> 31;
+        return h;
+}
+
+/* Equal values (as lookup_cmp sees them) have the same hash. 0 for values
+ * that are never searched */
+static uint64_t
+hash_value(Value v)
+{
+        uint64_t h = 0xcbf29ce484222325ull;
+        double d;
+
+        switch (VAL_TYPE(v)) {
+        case TYPE_NUMBER:
+                d = VAL_NUM(v) == 0 ? 0 : VAL_NUM(v); // -0 == 0
+                memcpy(&h, &d, sizeof h);
+                h = mix(h ^ 1);
+                break;
+        case TYPE_TEXT:
+                for (char *c = VAL_TEXT(v) ?: ""; *c; c++)
+                        h = (h ^ (unsigned char) tolower(*c)) * 0x100000001b3ull;
+                h = mix(h ^ 2);
+                break;
+        case TYPE_BOOL:
+                h = mix(VAL_BOOL(v) + 3);
+                break;
+        default:
+                return 0;
+        }
+        return h ?: 1;
+}
+
+static void
+link_offset(LookupIndex *ix, int i)
+{
+        int *p = &ix->head[ix->hash[i] & ix->mask];
+        while (*p != -1 && *p < i)
+                p = &ix->next[*p];
+        ix->next[i] = *p;
+        *p = i;
+}
+
+static void
+unlink_offset(LookupIndex *ix, int i)
+{
+        int *p = &ix->head[ix->hash[i] & ix->mask];
+        while (*p != i)
+                p = &ix->next[*p];
+        *p = ix->next[i];
+}
+
+static void
+free_index(LookupIndex *ix)
+{
+        mem_free(MEM_INDEXES, ix->head);
+        mem_free(MEM_INDEXES, ix->next);
+        mem_free(MEM_INDEXES, ix->hash);
+}
+
+static void
+build_index(LookupIndex *ix)
+{
+        TRACE_SPAN("lookup: index", "formula");
+        int buckets = 1;
+        uint64_t h;
+
+        free_index(ix);
+        ix->mat = active_ctx.body;
+        ix->version = cm_layout_version;
+        ix->len = lookup_line_len(&ix->line);
+        while (buckets < 2 * ix->len)
+                buckets *= 2;
+        ix->mask = buckets - 1;
+        ix->head = mem_malloc(MEM_INDEXES, sizeof *ix->head * buckets);
+        ix->next = mem_malloc(MEM_INDEXES, sizeof *ix->next * ix->len);
+        ix->hash = mem_malloc(MEM_INDEXES, sizeof *ix->hash * ix->len);
+        memset(ix->head, -1, sizeof *ix->head * buckets);
+
+        /* Backwards, so pushing to the front leaves chains in order */
+        for (int i = ix->len - 1; i >= 0; i--) {
+                h = ix->hash[i] = hash_value(lookup_value_at(&ix->line, i));
+                if (h == 0) continue;
+                ix->next[i] = ix->head[h & ix->mask];
+                ix->head[h & ix->mask] = i;
+        }
+        log_debug("Lookup index of %d cells built", ix->len);
+}
+
+static bool
+is_stale(LookupIndex *ix)
+{
+        return ix->mat != active_ctx.body || ix->version != cm_layout_version;
+}
+
+static LookupIndex *
+get_index(struct Range *line)
+{
+        LookupIndex *ix = NULL;
+        int n = 0;
+
+        /* Stale indexes are dropped on the way: they have to be built again
+         * anyway, and open ranges get a new key (endy) for every row added */
+        for_da_each(p, indexes)
+        {
+                if (ix == NULL && !memcmp(&(*p)->line, line, sizeof *line))
+                        ix = *p;
+                else if (is_stale(*p)) {
+                        free_index(*p);
+                        mem_free(MEM_INDEXES, *p);
+                        continue;
+                }
+                indexes.data[n++] = *p;
+        }
+        indexes.size = n;
+        lookup_nindexes = n;
+
+        if (ix == NULL) {
+                ix = mem_calloc(MEM_INDEXES, 1, sizeof *ix);
+                ix->line = *line;
+                da_append(&indexes, ix);
+                lookup_nindexes = indexes.size;
+        } else if (!is_stale(ix))
+                return ix;
+
+        build_index(ix);
+        return ix;
+}
+
+int
+lookup_exact(struct Range *line, Value key)
+{
+        LookupIndex *ix;
+        uint64_t h;
+
+        if (lookup_line_len(line) < 0 || (h = hash_value(key)) == 0) return -1;
+        ix = get_index(line);
+        for (int i = ix->head[h & ix->mask]; i != -1; i = ix->next[i]) {
+                if (ix->hash[i] == h && lookup_cmp(lookup_value_at(line, i), key) == 0)
+                        return i;
+        }
+        return -1;
+}
+
+int
+lookup_sorted(struct Range *line, Value key, int order)
+{
+        int lo = 0, hi = lookup_line_len(line), mid;
+
+        /* Lines usually go beyond the last value */
+        while (hi > 0 && VAL_TYPE(lookup_value_at(line, hi - 1)) == TYPE_EMPTY)
+                --hi;
+        /* First offset whose value goes after KEY */
+        while (lo < hi) {
+                mid = lo + (hi - lo) / 2;
+                if (order * lookup_cmp(lookup_value_at(line, mid), key) <= 0)
+                        lo = mid + 1;
+                else
+                        hi = mid;
+        }
+        return lo - 1;
+}
+
+void
+lookup_cell_changed(Cell *c)
+{
+        LookupIndex *ix;
+        uint64_t h;
+        int x, y, i;
+
+        if (!cm_get_cell_pos(active_ctx.body, c, &x, &y)) return;
+        h = hash_value(cell_value(c));
+
+        for_da_each(p, indexes)
+        {
+                ix = *p;
+                /* Stale indexes are built again when they are used */
+                if (is_stale(ix)) continue;
+                if (x < ix->line.startx || x > ix->line.endx ||
+                    y < ix->line.starty || y > ix->line.endy) continue;
+
+                i = is_vertical(&ix->line) ? y - ix->line.starty : x - ix->line.startx;
+                /* Same bucket: the chain stays valid */
+                if (ix->hash[i] == h) continue;
+                if (ix->hash[i]) unlink_offset(ix, i);
+                ix->hash[i] = h;
+                if (h) link_offset(ix, i);
+        }
+}
+
+void
+lookup_destroy()
+{
+        for_da_each(p, indexes)
+        {
+                free_index(*p);
+                mem_free(MEM_INDEXES, *p);
+        }
+        da_destroy(&indexes);
+        lookup_nindexes = 0;
+}
@@ -0,0 +1,53 @@
+/*
+ * VICEL - Visual Cell editor
+ * Copyright (C) 2025  Hugo Coto Florez
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * For questions or support, contact: me@hugocoto.com
+ */
+
+#ifndef LOOKUP_H_
+#define LOOKUP_H_
+
+#include "cellmap.h"
+
+/* Search of a value along a line of cells (a range one column wide or one
+ * row high). Exact searches use a hash index of the line, built the first
+ * time it is searched and updated when one of its cells changes. Sorted
+ * searches use a binary search over the cells. */
+
+/* Order of values in sorted lines: numbers, then text (case insensitive),
+ * then booleans. Empty cells go last */
+int lookup_cmp(Value a, Value b);
+
+/* Offset in LINE of the first cell equal to KEY, or -1 */
+int lookup_exact(struct Range *line, Value key);
+/* Offset in LINE, sorted in ascending order, of the last cell <= KEY. If
+ * ORDER is -1 LINE is in descending order and the last cell >= KEY is
+ * returned instead. -1 if there is none */
+int lookup_sorted(struct Range *line, Value key, int order);
+
+/* Value of the cell at offset I of LINE */
+Value lookup_value_at(struct Range *line, int i);
+/* Number of cells in LINE, or -1 if it is not a line */
+int lookup_line_len(struct Range *line);
+
+/* Called before the subscribers of C are notified of a change */
+void lookup_cell_changed(Cell *c);
+extern int lookup_nindexes;
+
+void lookup_destroy();
+
+#endif // !LOOKUP_H_
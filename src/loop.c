@@ -0,0 +1,254 @@
+/*
+ * VICEL - Visual Cell editor
+ * Copyright (C) 2025  Hugo Coto Florez
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * For questions or support, contact: me@hugocoto.com
+ */
+
+#include "loop.h"
+#include "common.h"
+#include "da.h"
+#include "debug.h"
+#include "escape_code.h"
+#include "window.h"
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+
+#define MAX_EVENTS 16
+
+struct Watch {
+        int fd;
+        LoopCallback cb;
+        void *data;
+};
+
+static DA(struct Watch) watches = { 0 };
+static int epfd = -1;
+static int sigfd = -1;
+static sigset_t sigmask;
+static void (*sig_handlers[NSIG])(int);
+static bool running = false;
+static bool render_requested = false;
+static bool full_render_requested = false;
+
+void
+loop_init()
+{
+        sigemptyset(&sigmask);
+        sigaddset(&sigmask, SIGWINCH);
+        sigaddset(&sigmask, SIGINT);
+        if (sigprocmask(SIG_BLOCK, &sigmask, NULL) == -1) {
+                log_error("loop_init: sigprocmask: %s", strerror(errno));
+                exit(1);
+        }
+        sigemptyset(&sigmask);
+
+        if ((epfd = epoll_create1(EPOLL_CLOEXEC)) == -1) {
+                log_error("loop_init: epoll_create1: %s", strerror(errno));
+                exit(1);
+        }
+}
+
+void
+loop_destroy()
+{
+        for_da_each(w, watches)
+        {
+                if (w->fd != STDIN_FILENO) close(w->fd);
+        }
+        da_destroy(&watches);
+        if (epfd >= 0) close(epfd);
+        epfd = -1;
+        sigfd = -1;
+}
+
+int
+loop_add_fd(int fd, LoopCallback cb, void *data)
+{
+        struct epoll_event ev = {
+                .events = EPOLLIN,
+                .data.fd = fd,
+        };
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+                log_error("loop_add_fd: epoll_ctl(%d): %s", fd, strerror(errno));
+                return -1;
+        }
+        da_append(&watches, ((struct Watch) { .fd = fd, .cb = cb, .data = data }));
+        return fd;
+}
+
+void
+loop_del_fd(int fd)
+{
+        epoll_ctl(epfd, EPOLL_CTL_DEL, fd, NULL);
+        for_da_each(w, watches)
+        {
+                if (w->fd == fd) {
+                        da_remove(&watches, da_index(w, watches));
+                        return;
+                }
+        }
+}
+
+static void
+on_signal(int fd, void *data)
+{
+        struct signalfd_siginfo si;
+        (void) data;
+        while (read(fd, &si, sizeof si) == sizeof si) {
+                if (si.ssi_signo < NSIG && sig_handlers[si.ssi_signo])
+                        sig_handlers[si.ssi_signo](si.ssi_signo);
+        }
+}
+
+int
+loop_add_signal(int sig, void (*handler)(int sig))
+{
+        sig_handlers[sig] = handler;
+        sigaddset(&sigmask, sig);
+        sigprocmask(SIG_BLOCK, &sigmask, NULL);
+
+        if (sigfd >= 0) {
+                /* Update the mask of the existing signalfd */
+                return signalfd(sigfd, &sigmask, 0);
+        }
+
+        if ((sigfd = signalfd(-1, &sigmask, SFD_NONBLOCK | SFD_CLOEXEC)) == -1) {
+                log_error("loop_add_signal: signalfd: %s", strerror(errno));
+                return -1;
+        }
+        return loop_add_fd(sigfd, on_signal, NULL);
+}
+
+void
+loop_arm_timer(int tfd, time_t secs, bool interval)
+{
+        struct itimerspec its = {
+                .it_value.tv_sec = secs,
+                .it_interval.tv_sec = interval ? secs : 0,
+        };
+        timerfd_settime(tfd, 0, &its, NULL);
+}
+
+void
+loop_disarm_timer(int tfd)
+{
+        struct itimerspec its = { 0 };
+        timerfd_settime(tfd, 0, &its, NULL);
+}
+
+struct Timer {
+        LoopCallback cb;
+        void *data;
+};
+
+static void
+on_timer(int fd, void *data)
+{
+        struct Timer *t = data;
+        uint64_t expirations;
+        if (read(fd, &expirations, sizeof expirations) != sizeof expirations)
+                return;
+        t->cb(fd, t->data);
+}
+
+int
+loop_add_timer(time_t secs, bool interval, LoopCallback cb, void *data)
+{
+        int tfd;
+        static struct Timer timers[8];
+        static int ntimers = 0;
+
+        assert(ntimers < (int) (sizeof timers / sizeof *timers));
+        if ((tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) == -1) {
+                log_error("loop_add_timer: timerfd_create: %s", strerror(errno));
+                return -1;
+        }
+        timers[ntimers] = (struct Timer) { .cb = cb, .data = data };
+        loop_add_fd(tfd, on_timer, timers + ntimers++);
+        if (secs > 0) loop_arm_timer(tfd, secs, interval);
+        return tfd;
+}
+
+int
+loop_add_event(LoopCallback cb, void *data)
+{
+        int efd;
+        if ((efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) == -1) {
+                log_error("loop_add_event: eventfd: %s", strerror(errno));
+                return -1;
+        }
+        return loop_add_fd(efd, cb, data);
+}
+
+/* Can be called from any thread */
+void
+loop_notify(int efd)
+{
+        uint64_t one = 1;
+        if (write(efd, &one, sizeof one) != sizeof one)
+                log_error("loop_notify: write failed");
+}
+
+void
+loop_request_render(bool full)
+{
+        render_requested = true;
+        full_render_requested |= full;
+}
+
+void
+loop_stop()
+{
+        running = false;
+}
+
+void
+loop_run()
+{
+        struct epoll_event events[MAX_EVENTS];
+        int n;
+
+        running = true;
+        while (running) {
+                if (render_requested) {
+                        if (full_render_requested)
+                                render_full();
+                        else
+                                render();
+                        render_requested = false;
+                        full_render_requested = false;
+                }
+
+                if ((n = epoll_wait(epfd, events, MAX_EVENTS, -1)) == -1) {
+                        if (errno == EINTR) continue;
+                        log_error("loop_run: epoll_wait: %s", strerror(errno));
+                        break;
+                }
+
+                for (int i = 0; i < n && running; i++) {
+                        for_da_each(w, watches)
+                        {
+                                if (w->fd == events[i].data.fd) {
+                                        w->cb(w->fd, w->data);
+                                        break;
+                                }
+                        }
+                }
+        }
+}
@@ -0,0 +1,64 @@
+/*
+ * VICEL - Visual Cell editor
+ * Copyright (C) 2025  Hugo Coto Florez
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * For questions or support, contact: me@hugocoto.com
+ */
+
+#ifndef LOOP_H_
+#define LOOP_H_
+
+#include "common.h"
+
+/* Main event loop. Everything that can wake the editor up (stdin, signals,
+ * timers and background workers) is a file descriptor watched by epoll.
+ * Callbacks run in the main thread and must not block. Render only happens
+ * from the loop, after callbacks have run, if someone asked for it. */
+
+typedef void (*LoopCallback)(int fd, void *data);
+
+/* Block SIGWINCH and SIGINT (so threads created later inherit the mask) and
+ * create the epoll instance. Call it before creating any thread. */
+void loop_init();
+void loop_destroy();
+
+/* Watch FD for input. CB is called each time FD is readable. */
+int loop_add_fd(int fd, LoopCallback cb, void *data);
+void loop_del_fd(int fd);
+
+/* Deliver signal SIG through the loop instead of a signal handler */
+int loop_add_signal(int sig, void (*handler)(int sig));
+
+/* Create a timer. It expires SECS seconds after being armed. If INTERVAL is
+ * true it is re-armed on expiration. Returns the timer fd */
+int loop_add_timer(time_t secs, bool interval, LoopCallback cb, void *data);
+void loop_arm_timer(int tfd, time_t secs, bool interval);
+void loop_disarm_timer(int tfd);
+
+/* Completion fds for background workers: the worker calls loop_notify() and
+ * CB is called from the main thread. */
+int loop_add_event(LoopCallback cb, void *data);
+void loop_notify(int efd);
+
+/* Ask for a render once the current callbacks have run. If FULL, the screen is
+ * cleared before drawing */
+void loop_request_render(bool full);
+
+/* Run until loop_stop() is called */
+void loop_run();
+void loop_stop();
+
+#endif // !LOOP_H_
@@ -23,9 +23,15 @@
 #include "escape_code.h"
 #include "flag.h"
 #include "keyboard.h"
+#include "loop.h"
+#include "lookup.h"
 #include "mappings.h"
+#include "mem.h"
 #include "options.h"
+#include "profile.h"
 #include "saving.h"
+#include "stats.h"
+#include "trace.h"
 #include "window.h"
 
 void
@@ -41,37 +47,32 @@ resize_handler(int s)
         }
 
         /* render again on resize */
-        clear_screen();
-        render();
+        loop_request_render(true);
 }
 
 void
 set_resize_handler()
 {
-        signal(SIGWINCH, resize_handler);
+        loop_add_signal(SIGWINCH, resize_handler);
         resize_handler(SIGWINCH); // get current winsize
 }
 
-int should_autosave = 0;
-int save_time = 0;
-
 void
-autosave_handler(int s)
+autosave_handler(int fd, void *data)
 {
-        if (s != SIGALRM) {
-                // shut up unused s
-        }
-        if (should_autosave) return;
-        should_autosave = 1;
-        alarm(save_time);
+        (void) fd;
+        (void) data;
+        log_info("[Auto save]");
+        set_ui_report("save");
+        a_save();
+        loop_request_render(false);
 }
 
 void
 set_autosave_handler()
 {
-        signal(SIGALRM, autosave_handler);
-        save_time = win_opts.save_time;
-        alarm(save_time);
+        /* save_time == 0 disables autosave */
+        loop_add_timer(win_opts.save_time, true, autosave_handler, NULL);
 }
 
 void
@@ -99,12 +100,25 @@ reset_at_exit()
         fflush(stdout);
 }
 
+static void
+print_mem_stats()
+{
+        mem_dump(stderr);
+}
+
 _Noreturn void
 safe_exit(int sig)
 {
         (void) sig;
+        /* Before freeing the sheet, --stats wants the memory it was using */
+        cm_mem_census(active_ctx.body);
+        mem_snapshot();
         cm_destroy(active_ctx.body);
+        lookup_destroy();
+        stats_destroy();
+        fw_destroy(&active_ctx.col_widths);
         a_free_yank_buffer();
+        loop_destroy();
         parse_options_destroy();
         exit(0);
 }
@@ -113,7 +127,7 @@ safe_exit(int sig)
 void
 catch_sigint()
 {
-        signal(SIGINT, safe_exit);
+        loop_add_signal(SIGINT, safe_exit);
 }
 
 char *
@@ -130,8 +144,13 @@ main(int argc, char *argv[])
 {
         char *filename = NULL;
         char *cfile;
+        char *log_lvl = NULL;
+        char *log_cats = NULL;
+        char *trace_out = NULL;
+        int level = LOG_DEBUG;
 
         flag_set(&argc, &argv);
+        loop_init(); // before any thread is created
 
         if (argc > 1 && *argv[1] != '-') {
                 filename = argv[1];
@@ -143,8 +162,20 @@ main(int argc, char *argv[])
         }
 
         if (flag_get("-D", "--debug")) debug_level = 1;
-
-        report("------| Starting |------");
+        flag_get_value(&log_cats, "--log-categories");
+        if (flag_get_value(&log_lvl, "--log-level") &&
+            (level = log_parse_level(log_lvl)) < 0) {
+                printf("Unknown log level: %s\n", log_lvl);
+                exit(ERR_NONE);
+        }
+        if (debug_level || log_lvl) log_init(level, log_cats);
+        if (flag_get_value(&trace_out, "--trace")) trace_open(trace_out);
+        if (flag_get("--profile")) profile_enabled = true;
+        /* Registered before reset_at_exit, so it runs after the terminal is
+         * restored */
+        if (flag_get("--stats")) atexit(print_mem_stats);
+
+        log_info("------| Starting |------");
 
         parse_options_init();
         options_init(.filename = filename,
@@ -23,8 +23,11 @@
 #include "common.h"
 // #include "escape_code.h"
 #include "keyboard.h"
+#include "mem.h"
 #include "options.h"
+#include "profile.h"
 #include "saving.h"
+#include "sort.h"
 #include "window.h"
 
 inline Cell *
@@ -54,6 +57,7 @@ void
 a_insert_zero_col()
 {
         cm_insert_col(active_ctx.body, 0);
+        col_insert(0);
 }
 
 
@@ -67,6 +71,7 @@ void
 a_insert_before_col()
 {
         cm_insert_col(active_ctx.body, active_ctx.cursor_pos_c);
+        col_insert(active_ctx.cursor_pos_c);
 }
 
 void
@@ -79,6 +84,7 @@ void
 a_insert_after_col()
 {
         cm_insert_col(active_ctx.body, active_ctx.cursor_pos_c + 1);
+        col_insert(active_ctx.cursor_pos_c + 1);
 }
 
 
@@ -87,9 +93,7 @@ a_move_cursor_left()
 {
         if (active_ctx.cursor_pos_c == 0) return;
         --active_ctx.cursor_pos_c;
-        if (active_ctx.scroll_c > active_ctx.cursor_pos_c) {
-                --active_ctx.scroll_c;
-        }
+        col_scroll_to(active_ctx.cursor_pos_c);
 }
 
 void
@@ -97,9 +101,7 @@ a_move_cursor_right()
 {
         if (active_ctx.cursor_pos_c >= active_ctx.body->data->size - 1) return;
         ++active_ctx.cursor_pos_c;
-        if (active_ctx.cursor_pos_c >= active_ctx.scroll_c + active_ctx.max_display_c) {
-                ++active_ctx.scroll_c;
-        }
+        col_scroll_to(active_ctx.cursor_pos_c);
 }
 
 void
@@ -234,8 +236,7 @@ void
 a_goto_max_right()
 {
         active_ctx.cursor_pos_c = active_ctx.body->data[0].size - 1;
-        active_ctx.scroll_c = active_ctx.cursor_pos_c - active_ctx.max_display_c + 1;
-        if (active_ctx.scroll_c < 0) active_ctx.scroll_c = 0;
+        col_scroll_to(active_ctx.cursor_pos_c);
 }
 
 void
@@ -265,9 +266,9 @@ char *yank_buffer = NULL;
 void
 a_yank()
 {
-        if (!get_cursor_cell()->input_repr) return;
+        if (!cm_input_repr(get_cursor_cell())) return;
         free(yank_buffer);
-        yank_buffer = strdup(get_cursor_cell()->input_repr);
+        yank_buffer = strdup(cm_input_repr(get_cursor_cell()));
 }
 
 void
@@ -295,6 +296,7 @@ a_delete_left_col()
 {
         if (active_ctx.body->data->size == 1) return;
         cm_delete_col(active_ctx.body, active_ctx.cursor_pos_c);
+        col_remove(active_ctx.cursor_pos_c);
         a_move_cursor_left();
 }
 
@@ -359,20 +361,140 @@ a_scroll_right()
                 a_move_cursor_right();
 }
 
+#define COL_WIDTH_MIN 3
+
 void
 a_col_increase()
 {
-        /* todo: check that the cursor is on the screen */
-        ++win_opts.col_width;
-        render();
+        int x = active_ctx.cursor_pos_c;
+        col_set_width(x, col_width(x) + 1);
+        col_scroll_to(x);
 }
 
-#define COL_WIDTH_MIN 3
-
 void
 a_col_decrease()
 {
-        if (win_opts.col_width == COL_WIDTH_MIN) return;
-        --win_opts.col_width;
-        render();
+        int x = active_ctx.cursor_pos_c;
+        if (col_width(x) <= COL_WIDTH_MIN) return;
+        col_set_width(x, col_width(x) - 1);
+}
+
+/* Fit the cursor column to its widest cell */
+void
+a_col_autofit()
+{
+        int x = active_ctx.cursor_pos_c;
+        int w = 0;
+
+        for_da_each(row, *active_ctx.body)
+        {
+                if (x >= row->size) continue;
+                cm_repr(row->data + x);
+                w = max(w, row->data[x].width);
+        }
+        w += win_opts.cell_l_sep_w + win_opts.cell_r_sep_w;
+        w = min(w, active_ctx.ws.ws_col - win_opts.num_col_width);
+        col_set_width(x, max(w, COL_WIDTH_MIN));
+        col_scroll_to(x);
+}
+
+/* Jump to the next of the most expensive formulas. The first call enables
+ * the profiler if it was not enabled with --profile */
+void
+a_profile_next()
+{
+        static int next = 0;
+        Cell *top[PROFILE_TOP];
+        FormulaProfile *p;
+        int n, x, y;
+
+        if (!profile_enabled) {
+                profile_enabled = true;
+                set_ui_report("Profiling formulas");
+                return;
+        }
+
+        /* Computed each time: cells may have changed since the last call */
+        if ((n = profile_top(active_ctx.body, top, PROFILE_TOP)) == 0) {
+                set_ui_report("No formula evaluated yet");
+                return;
+        }
+        next %= n;
+        if (!cm_get_cell_pos(active_ctx.body, top[next], &x, &y)) return;
+
+        active_ctx.cursor_pos_c = x;
+        active_ctx.cursor_pos_r = y;
+        col_scroll_to(x);
+        if (y < active_ctx.scroll_r || y >= active_ctx.scroll_r + active_ctx.max_display_r)
+                active_ctx.scroll_r = max(0, y - active_ctx.max_display_r / 2);
+
+        p = profile_of(top[next]);
+        set_ui_report("#%d: %.3f ms in %lu evals, %lu notifications, largest range %d",
+                      next + 1, p->ns / 1e6, (unsigned long) p->evals,
+                      (unsigned long) p->notifications, p->max_range);
+        ++next;
+}
+
+/* Show the memory stats of the next category, starting with the total */
+void
+a_mem_stats()
+{
+        static int next = MEM_LEN;
+        char buf[128];
+
+        cm_mem_census(active_ctx.body);
+        mem_format(buf, sizeof buf, next);
+        set_ui_report("%s", buf);
+        next = (next + 1) % (MEM_LEN + 1);
+}
+
+/* Sort by the cursor column, and then by the columns with selected cells,
+ * from left to right. The rows sorted are the ones between the first and the
+ * last with selected cells, or from the cursor to the last one if there are
+ * none */
+static void
+sort_from_cursor(bool desc)
+{
+        SortKey keys[16];
+        struct timespec t0, t1;
+        int w = active_ctx.body->data->size, nkeys = 0;
+        int r0 = -1, r1 = -1;
+        bool *selected = mem_calloc(MEM_MISC, w, sizeof *selected);
+
+        for (int y = 0; y < active_ctx.body->size; y++) {
+                for (int x = 0; x < w; x++) {
+                        if (!active_ctx.body->data[y].data[x].selected) continue;
+                        selected[x] = true;
+                        if (r0 < 0) r0 = y;
+                        r1 = y;
+                }
+        }
+        if (r0 < 0) {
+                r0 = active_ctx.cursor_pos_r;
+                r1 = active_ctx.body->size - 1;
+        }
+        keys[nkeys++] = (SortKey) { .col = active_ctx.cursor_pos_c, .desc = desc };
+        for (int x = 0; x < w && nkeys < 16; x++)
+                if (selected[x] && x != active_ctx.cursor_pos_c)
+                        keys[nkeys++] = (SortKey) { .col = x, .desc = desc };
+        mem_free(MEM_MISC, selected);
+
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        sort_rows(active_ctx.body, r0, r1, keys, nkeys);
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        set_ui_report("Sorted %d rows by %d column%s in %.1f ms", r1 - r0 + 1, nkeys,
+                      nkeys == 1 ? "" : "s",
+                      (t1.tv_sec - t0.tv_sec) * 1e3 + (t1.tv_nsec - t0.tv_nsec) / 1e6);
+}
+
+void
+a_sort_asc()
+{
+        sort_from_cursor(false);
+}
+
+void
+a_sort_desc()
+{
+        sort_from_cursor(true);
 }
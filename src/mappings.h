@@ -70,5 +70,10 @@ void a_scroll_left();
 void a_scroll_right();
 void a_col_decrease();
 void a_col_increase();
+void a_col_autofit();
+void a_profile_next();
+void a_mem_stats();
+void a_sort_asc();
+void a_sort_desc();
 
 #endif //! MAPPINGS_H
@@ -0,0 +1,195 @@
+/*
+ * VICEL - Visual Cell editor
+ * Copyright (C) 2025  Hugo Coto Florez
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * For questions or support, contact: me@hugocoto.com
+ */
+
+#include "mem.h"
+#include <malloc.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+static MemStat stats[MEM_LEN];
+static MemStat snapshot[MEM_LEN];
+static bool has_snapshot = false;
+
+static const char *names[] = {
+        [MEM_CELLS] = "cells",
+        [MEM_STRINGS] = "strings",
+        [MEM_SUBSCRIBERS] = "subscribers",
+        [MEM_FORMULAS] = "formulas",
+        [MEM_INDEXES] = "indexes",
+        [MEM_COLORS] = "colors",
+        [MEM_PYTHON] = "python",
+        [MEM_MISC] = "misc",
+        [MEM_LEN] = "total",
+};
+
+/* Counters are updated from any thread that allocates, peak can be off by a
+ * few bytes under contention */
+static void
+account(MemCat cat, ssize_t bytes, int allocs, int frees)
+{
+        MemStat *s = stats + cat;
+        size_t live = __atomic_add_fetch(&s->live, bytes, __ATOMIC_RELAXED);
+        if (live > __atomic_load_n(&s->peak, __ATOMIC_RELAXED))
+                __atomic_store_n(&s->peak, live, __ATOMIC_RELAXED);
+        if (allocs) __atomic_add_fetch(&s->allocs, allocs, __ATOMIC_RELAXED);
+        if (frees) __atomic_add_fetch(&s->frees, frees, __ATOMIC_RELAXED);
+}
+
+void *
+mem_malloc(MemCat cat, size_t size)
+{
+        void *p = malloc(size);
+        if (p) account(cat, malloc_usable_size(p), 1, 0);
+        return p;
+}
+
+void *
+mem_calloc(MemCat cat, size_t n, size_t size)
+{
+        void *p = calloc(n, size);
+        if (p) account(cat, malloc_usable_size(p), 1, 0);
+        return p;
+}
+
+void *
+mem_realloc(MemCat cat, void *ptr, size_t size)
+{
+        size_t old = ptr ? malloc_usable_size(ptr) : 0;
+        void *p = realloc(ptr, size);
+        if (p) account(cat, (ssize_t) malloc_usable_size(p) - (ssize_t) old, ptr == NULL, 0);
+        return p;
+}
+
+char *
+mem_strdup(MemCat cat, const char *s)
+{
+        char *p = strdup(s);
+        if (p) account(cat, malloc_usable_size(p), 1, 0);
+        return p;
+}
+
+void
+mem_free(MemCat cat, void *ptr)
+{
+        if (ptr == NULL) return;
+        account(cat, -(ssize_t) malloc_usable_size(ptr), 0, 1);
+        free(ptr);
+}
+
+void *
+mem_adopt(MemCat cat, void *ptr)
+{
+        if (ptr) account(cat, malloc_usable_size(ptr), 1, 0);
+        return ptr;
+}
+
+void
+mem_track(MemCat cat, ssize_t bytes)
+{
+        account(cat, bytes, bytes > 0, bytes < 0);
+}
+
+void
+mem_census(MemCat cat, size_t bytes, size_t blocks)
+{
+        MemStat *s = stats + cat;
+        s->live = bytes;
+        s->allocs = blocks;
+        s->frees = 0;
+        if (bytes > s->peak) s->peak = bytes;
+}
+
+const char *
+mem_cat_name(MemCat cat)
+{
+        return names[cat];
+}
+
+static MemStat
+stat_of(MemStat *from, MemCat cat)
+{
+        MemStat total = { 0 };
+        if (cat != MEM_LEN) return from[cat];
+        /* Categories do not peak at the same time, so there is no total peak */
+        for (int i = 0; i < MEM_LEN; i++) {
+                total.live += from[i].live;
+                total.allocs += from[i].allocs;
+                total.frees += from[i].frees;
+        }
+        return total;
+}
+
+MemStat
+mem_stat(MemCat cat)
+{
+        return stat_of(stats, cat);
+}
+
+static char *
+human(char *buf, size_t len, size_t bytes)
+{
+        if (bytes < 1024)
+                snprintf(buf, len, "%zu B", bytes);
+        else if (bytes < 1024 * 1024)
+                snprintf(buf, len, "%.1f KiB", bytes / 1024.0);
+        else
+                snprintf(buf, len, "%.1f MiB", bytes / (1024.0 * 1024.0));
+        return buf;
+}
+
+void
+mem_format(char *buf, size_t len, MemCat cat)
+{
+        MemStat s = mem_stat(cat);
+        char live[16], peak[16];
+        if (cat == MEM_LEN)
+                snprintf(buf, len, "%s: %s live, %zu allocs, %zu frees",
+                         names[cat], human(live, sizeof live, s.live),
+                         s.allocs, s.frees);
+        else
+                snprintf(buf, len, "%s: %s live, %s peak, %zu allocs, %zu frees",
+                         names[cat], human(live, sizeof live, s.live),
+                         human(peak, sizeof peak, s.peak), s.allocs, s.frees);
+}
+
+void
+mem_snapshot()
+{
+        memcpy(snapshot, stats, sizeof stats);
+        has_snapshot = true;
+}
+
+void
+mem_dump(FILE *f)
+{
+        MemStat *from = has_snapshot ? snapshot : stats;
+        char live[16], peak[16];
+        MemStat s;
+
+        fprintf(f, "%-12s %12s %12s %12s %12s\n", "category", "live", "peak", "allocs", "frees");
+        for (int i = 0; i <= MEM_LEN; i++) {
+                s = stat_of(from, i);
+                fprintf(f, "%-12s %12s %12s %12zu %12zu\n", names[i],
+                        human(live, sizeof live, s.live),
+                        i == MEM_LEN ? "-" : human(peak, sizeof peak, s.peak),
+                        s.allocs, s.frees);
+        }
+}
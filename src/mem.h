@@ -0,0 +1,76 @@
+/*
+ * VICEL - Visual Cell editor
+ * Copyright (C) 2025  Hugo Coto Florez
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * For questions or support, contact: me@hugocoto.com
+ */
+
+#ifndef MEM_H_
+#define MEM_H_
+
+#include <stddef.h>
+#include <stdio.h>
+#include <sys/types.h>
+
+/* Allocation accounting. Allocations done through these wrappers are counted
+ * in the category they are made for: live and peak bytes (as returned by
+ * malloc_usable_size) and number of allocations and frees. A pointer has to
+ * be freed in the same category it was allocated in. */
+
+typedef enum MemCat {
+        MEM_CELLS,       // rows, cell metadata
+        MEM_STRINGS,     // cell repr and input_repr, see mem_census
+        MEM_SUBSCRIBERS, // subscribers and subscribed arrays
+        MEM_FORMULAS,    // tokens, ast, ranges, formula profiles
+        MEM_INDEXES,     // lookup indexes
+        MEM_COLORS,      // color table
+        MEM_PYTHON,      // python interpreter (config file)
+        MEM_MISC,        // other dynamic arrays
+        MEM_LEN,
+} MemCat;
+
+typedef struct MemStat {
+        size_t live;
+        size_t peak;
+        size_t allocs;
+        size_t frees;
+} MemStat;
+
+void *mem_malloc(MemCat cat, size_t size);
+void *mem_calloc(MemCat cat, size_t n, size_t size);
+void *mem_realloc(MemCat cat, void *ptr, size_t size);
+char *mem_strdup(MemCat cat, const char *s);
+void mem_free(MemCat cat, void *ptr);
+/* Account PTR, allocated by plain malloc, in CAT. Returns PTR */
+void *mem_adopt(MemCat cat, void *ptr);
+
+/* Account for BYTES (negative on free) allocated by someone else */
+void mem_track(MemCat cat, ssize_t bytes);
+/* Set the stats of a category that is measured by walking its owner instead
+ * of being counted on every allocation. Peak is the largest census seen */
+void mem_census(MemCat cat, size_t bytes, size_t blocks);
+
+const char *mem_cat_name(MemCat cat);
+MemStat mem_stat(MemCat cat);
+/* Write a summary line of CAT (MEM_LEN for the total) to BUF */
+void mem_format(char *buf, size_t len, MemCat cat);
+/* Keep the current stats to be printed by mem_dump */
+void mem_snapshot();
+/* Print a table with the stats of every category. The last snapshot is used
+ * if there is one */
+void mem_dump(FILE *f);
+
+#endif // !MEM_H_
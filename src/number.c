@@ -0,0 +1,197 @@
+/*
+ * VICEL - Visual Cell editor
+ * Copyright (C) 2025  Hugo Coto Florez
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * For questions or support, contact: me@hugocoto.com
+ */
+
+#include "number.h"
+#include "common.h"
+#include <stdint.h>
+
+/* Powers of ten that are exact doubles */
+static const double pow10[] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+
+#define FORMAT_MAX_DECIMALS 17
+
+#define EXACT_INT_MAX 9007199254740992.0 // 2^53
+
+/* Write M with K fractional digits (M = 1234, K = 2 -> 12.34) */
+static int
+format_fixed(char *buf, bool neg, uint64_t m, int k)
+{
+        char digits[24];
+        char *p = digits + sizeof digits;
+        char *o = buf;
+        int nd;
+
+        do {
+                *--p = '0' + m % 10;
+                m /= 10;
+        } while (m);
+        nd = digits + sizeof digits - p;
+
+        if (neg) *o++ = '-';
+        if (nd <= k) {
+                *o++ = '0';
+                *o++ = '.';
+                memset(o, '0', k - nd);
+                o += k - nd;
+                memcpy(o, p, nd);
+                o += nd;
+        } else {
+                memcpy(o, p, nd - k);
+                o += nd - k;
+                if (k) {
+                        *o++ = '.';
+                        memcpy(o, p + nd - k, k);
+                        o += k;
+                }
+        }
+        *o = 0;
+        return o - buf;
+}
+
+int
+num_format(double d, char *buf)
+{
+        double a = fabs(d);
+        double s;
+        uint64_t m;
+
+        if (!isfinite(d) || d == 0)
+                return snprintf(buf, NUM_BUFSIZE, "%g", d);
+
+        /* Integers */
+        if (a < 1e15 && a == (double) (uint64_t) a)
+                return format_fixed(buf, d < 0, (uint64_t) a, 0);
+
+        /* Few decimals (the usual case for data typed by a human): find the
+         * smallest K such that round(A * 10^K) / 10^K is A again. Both the
+         * division and strtod round the same real number, so the result
+         * round trips. */
+        if (a >= 1e-5 && a < 1e15) {
+                for (int k = 1; k <= FORMAT_MAX_DECIMALS; k++) {
+                        s = a * pow10[k];
+                        if (s >= EXACT_INT_MAX) break;
+                        m = (uint64_t) (s + 0.5);
+                        if ((double) m / pow10[k] == a)
+                                return format_fixed(buf, d < 0, m, k);
+                }
+        }
+
+        /* Hard cases: 17 significant digits always round trip, but fewer may */
+        for (int p = 15; p < 17; p++) {
+                int n = snprintf(buf, NUM_BUFSIZE, "%.*g", p, d);
+                if (strtod(buf, NULL) == d) return n;
+        }
+        return snprintf(buf, NUM_BUFSIZE, "%.17g", d);
+}
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+/* Parse 8 digits at once (SWAR). Returns false if some of them is not a digit */
+static inline bool
+parse_eight_digits(const char *p, uint64_t *out)
+{
+        uint64_t v;
+        memcpy(&v, p, sizeof v);
+        if (((v & 0xF0F0F0F0F0F0F0F0) |
+             (((v + 0x0606060606060606) & 0xF0F0F0F0F0F0F0F0) >> 4)) !=
+            0x3333333333333333)
+                return false;
+        v -= 0x3030303030303030;
+        v = (v * 10) + (v >> 8);
+        v = (((v & 0x000000FF000000FF) * (100 + (1000000ULL << 32))) +
+             (((v >> 16) & 0x000000FF000000FF) * (1 + (10000ULL << 32)))) >>
+            32;
+        *out = v;
+        return true;
+}
+#else
+static inline bool
+parse_eight_digits(const char *p, uint64_t *out)
+{
+        (void) p;
+        (void) out;
+        return false;
+}
+#endif
+
+/* Accumulate the digits at *P into *M. Returns how many there were */
+static inline int
+parse_digits(const char **p, const char *end, uint64_t *m)
+{
+        const char *start = *p;
+        uint64_t v;
+
+        while (end - *p >= 8 && parse_eight_digits(*p, &v)) {
+                *m = *m * 100000000 + v;
+                *p += 8;
+        }
+        while (*p < end && isdigit(**p)) {
+                *m = *m * 10 + (**p - '0');
+                ++*p;
+        }
+        return *p - start;
+}
+
+bool
+num_parse(const char *s, int len, double *out)
+{
+        const char *p = s;
+        const char *end = s + len;
+        bool neg = false;
+        uint64_t m = 0;
+        int nd, nf = 0;
+        char *e;
+
+        if (p < end && (*p == '-' || *p == '+')) neg = *p++ == '-';
+        nd = parse_digits(&p, end, &m);
+        if (p < end && *p == '.') {
+                ++p;
+                nf = parse_digits(&p, end, &m);
+        }
+        if (nd + nf == 0) return false;
+
+        /* Clinger's fast path: both the mantissa and the power of ten are
+         * exact, so a single multiplication or division rounds correctly */
+        if (p == end && nd + nf <= 19 && m <= (uint64_t) EXACT_INT_MAX &&
+            nf < (int) (sizeof pow10 / sizeof *pow10)) {
+                *out = nf ? (double) m / pow10[nf] : (double) m;
+                if (neg) *out = -*out;
+                return true;
+        }
+
+        if (p < end && *p != 'e' && *p != 'E') return false;
+
+        /* Exponent, long mantissa... */
+        *out = strtod(s, &e);
+        return e == end;
+}
+
+void
+num_sum_add(NumSum *s, double x)
+{
+        double t = s->sum + x;
+        if (fabs(s->sum) >= fabs(x))
+                s->comp += (s->sum - t) + x;
+        else
+                s->comp += (x - t) + s->sum;
+        s->sum = t;
+}
@@ -0,0 +1,54 @@
+/*
+ * VICEL - Visual Cell editor
+ * Copyright (C) 2025  Hugo Coto Florez
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * For questions or support, contact: me@hugocoto.com
+ */
+
+#ifndef NUMBER_H_
+#define NUMBER_H_
+
+#include <stdbool.h>
+
+/* Enough for any double formatted by num_format, sign and exponent included */
+#define NUM_BUFSIZE 32
+
+/* Write into BUF (at least NUM_BUFSIZE bytes) the shortest decimal string
+ * that strtod reads back as D. Returns its length. It does not allocate. */
+int num_format(double d, char *buf);
+
+/* Parse S (LEN bytes, S[LEN] has to be 0) as a whole decimal number
+ * ([+-]digits[.digits][e[+-]digits]) into OUT. Returns false if S is not a
+ * number. Most inputs are parsed exactly without calling strtod. */
+bool num_parse(const char *s, int len, double *out);
+
+/* Running sum that keeps the low order bits plain addition drops (Neumaier
+ * summation): adding a big value and taking it out again leaves the small
+ * ones as they were. Its value is sum + comp */
+typedef struct NumSum {
+        double sum;
+        double comp;
+} NumSum;
+
+void num_sum_add(NumSum *s, double x);
+
+static inline double
+num_sum_value(const NumSum *s)
+{
+        return s->sum + s->comp;
+}
+
+#endif // !NUMBER_H_
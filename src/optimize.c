@@ -0,0 +1,194 @@
+/*
+ * VICEL - Visual Cell editor
+ * Copyright (C) 2025  Hugo Coto Florez
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * For questions or support, contact: me@hugocoto.com
+ */
+
+#define LOG_CAT LOG_FORMULA
+
+#include "optimize.h"
+#include "builtin.h"
+#include "common.h"
+#include "debug.h"
+#include "eval.h"
+#include "mem.h"
+
+static bool
+is_number(Expr *e)
+{
+        return e->type == EXPR_LITERAL && VAL_TYPE(e->as.literal.value) == TYPE_NUMBER;
+}
+
+static bool
+is_binop(Expr *e, char op)
+{
+        return e->type == EXPR_BIN && e->as.binop.op[0] == op && e->as.binop.op[1] == 0;
+}
+
+/* Whether E always evaluates to a number. Arithmetic returns the number of
+ * one side if the other is not a number, and x^2 returns 2 */
+static bool
+is_numeric(Expr *e)
+{
+        switch (e->type) {
+        case EXPR_LITERAL:
+                return is_number(e);
+        case EXPR_BIN:
+                if (!is_binop(e, '+') && !is_binop(e, '-') && !is_binop(e, '*') &&
+                    !is_binop(e, '/') && !is_binop(e, '^')) return false;
+                return is_numeric(e->as.binop.lhs) || is_numeric(e->as.binop.rhs);
+        case EXPR_UN:
+                return e->as.unop.op[0] == '^';
+        case EXPR_SUM:
+                for (Expr *t = e->as.sum.terms; t; t = t->next)
+                        if (is_numeric(t)) return true;
+                return false;
+        default:
+                return false;
+        }
+}
+
+/* E only has constant operands: replace it by its value */
+static Expr *
+fold(Expr *e)
+{
+        Value v = eval_expr(e);
+        Expr *l;
+
+        if (VAL_TYPE(v) != TYPE_NUMBER && VAL_TYPE(v) != TYPE_BOOL) return e;
+        free_expr(e);
+        l = new_literal(0);
+        l->as.literal.value = v;
+        return l;
+}
+
+/* Drop the unary operator E and keep its operand */
+static Expr *
+unwrap(Expr *e)
+{
+        Expr *rhs = e->as.unop.rhs;
+        e->as.unop.rhs = NULL;
+        free_expr(e);
+        return rhs;
+}
+
+static void
+sum_append(Expr *s, char op, Expr *term)
+{
+        Expr *t = s->as.sum.terms;
+        while (t->next)
+                t = t->next;
+        t->next = term;
+        s->as.sum.ops = mem_realloc(MEM_FORMULAS, s->as.sum.ops, s->as.sum.n + 1);
+        s->as.sum.ops[s->as.sum.n++] = op;
+}
+
+/* (a + b) - c as a single node. Only the left side is merged, so the
+ * operations are done in the same order */
+static Expr *
+flatten_sum(Expr *e)
+{
+        Expr *lhs = e->as.binop.lhs;
+        Expr *s;
+
+        if (lhs->type == EXPR_SUM) {
+                s = lhs;
+        } else if (is_binop(lhs, '+') || is_binop(lhs, '-')) {
+                s = new_expr();
+                s->type = EXPR_SUM;
+                s->as.sum.terms = lhs->as.binop.lhs;
+                s->as.sum.ops = mem_malloc(MEM_FORMULAS, 1);
+                s->as.sum.ops[0] = '+';
+                s->as.sum.n = 1;
+                sum_append(s, lhs->as.binop.op[0], lhs->as.binop.rhs);
+                lhs->as.binop.lhs = lhs->as.binop.rhs = NULL;
+                free_expr(lhs);
+        } else {
+                return e;
+        }
+
+        sum_append(s, e->as.binop.op[0], e->as.binop.rhs);
+        e->as.binop.lhs = e->as.binop.rhs = NULL;
+        free_expr(e);
+        return s;
+}
+
+static Expr *
+optimize_args(Expr *args)
+{
+        Expr *head = NULL, **link = &head, *next;
+
+        for (; args; args = next) {
+                next = args->next;
+                args->next = NULL;
+                *link = optimize_expr(args);
+                link = &(*link)->next;
+        }
+        return head;
+}
+
+Expr *
+optimize_expr(Expr *e)
+{
+        Expr *lhs, *rhs, *first;
+
+        if (e == NULL) return NULL;
+        switch (e->type) {
+        case EXPR_BIN:
+                lhs = e->as.binop.lhs = optimize_expr(e->as.binop.lhs);
+                rhs = e->as.binop.rhs = optimize_expr(e->as.binop.rhs);
+                if (is_number(lhs) && is_number(rhs)) return fold(e);
+                if (is_binop(e, '^') && is_number(rhs) && VAL_NUM(rhs->as.literal.value) == 2) {
+                        /* Squared by eval_unop */
+                        e->as.binop.lhs = NULL;
+                        free_expr(e);
+                        return new_unop("^2", lhs);
+                }
+                if (is_binop(e, '+') || is_binop(e, '-')) return flatten_sum(e);
+                return e;
+
+        case EXPR_UN:
+                rhs = e->as.unop.rhs = optimize_expr(e->as.unop.rhs);
+                if (rhs == NULL || e->as.unop.op[1]) return e;
+                if (is_number(rhs)) return fold(e);
+                /* Unary operators fail if it is not a number, as the inner
+                 * one does */
+                if (e->as.unop.op[0] == '+' && (is_numeric(rhs) || rhs->type == EXPR_UN))
+                        return unwrap(e);
+                if (e->as.unop.op[0] == '-' && rhs->type == EXPR_UN &&
+                    !strcmp(rhs->as.unop.op, "-") && is_numeric(rhs->as.unop.rhs))
+                        return unwrap(unwrap(e));
+                return e;
+
+        case EXPR_FUNC:
+                e->as.func.args = optimize_args(e->as.func.args);
+                first = e->as.func.args;
+                if (first && e->as.func.name->type == EXPR_LITERAL &&
+                    VAL_TYPE(e->as.func.name->as.literal.value) == TYPE_TEXT &&
+                    builtin_get(VAL_TEXT(e->as.func.name->as.literal.value)) == builtin_get("literal")) {
+                        /* literal(x) is x, the other arguments are ignored */
+                        e->as.func.args = first->next;
+                        first->next = NULL;
+                        free_expr(e);
+                        return first;
+                }
+                return e;
+
+        default:
+                return e;
+        }
+}
@@ -0,0 +1,33 @@
+/*
+ * VICEL - Visual Cell editor
+ * Copyright (C) 2025  Hugo Coto Florez
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * For questions or support, contact: me@hugocoto.com
+ */
+
+#ifndef OPTIMIZE_H_
+#define OPTIMIZE_H_
+
+#include "formula.h"
+
+/* Rewrite the body of a formula, once parsed, so it takes less work to
+ * evaluate it. Constant operations are folded, unary + and double - over
+ * numbers removed, literal(x) replaced by x, x^2 becomes a multiplication
+ * and chains of + and - are evaluated as a single node. The result is the
+ * same as the one of the given tree. Returns the new tree, E is consumed */
+Expr *optimize_expr(Expr *e);
+
+#endif //! OPTIMIZE_H_
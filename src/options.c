@@ -24,6 +24,8 @@
 #include "debug.h"
 #include "escape_code.h"
 #include "keyboard.h"
+#include "mem.h"
+#include "utf8.h"
 /*---*/
 
 #include <Python.h>
@@ -134,6 +136,11 @@ free_opts()
         free(user_mappings.func_a_delete_right_col);
         free(user_mappings.func_a_col_increase);
         free(user_mappings.func_a_col_decrease);
+        free(user_mappings.func_a_col_autofit);
+        free(user_mappings.func_a_profile_next);
+        free(user_mappings.func_a_mem_stats);
+        free(user_mappings.func_a_sort_asc);
+        free(user_mappings.func_a_sort_desc);
         free(user_mappings.func_a_scroll_up);
         free(user_mappings.func_a_scroll_down);
         free(user_mappings.func_a_scroll_left);
@@ -149,6 +156,14 @@ col_format(char *col)
         return new;
 }
 
+/* Measured once here instead of for every cell drawn */
+static void
+set_sep_widths()
+{
+        win_opts.cell_l_sep_w = utf8_width(win_opts.cell_l_sep);
+        win_opts.cell_r_sep_w = utf8_width(win_opts.cell_r_sep);
+}
+
 static void
 get_window_options()
 {
@@ -168,6 +183,7 @@ get_window_options()
         GET_STR("status_filename", win_opts.status_filename);
         GET_STR("status_r_end", win_opts.status_r_end);
         GET_STR("ui_status_bottom_end", win_opts.ui_status_bottom_end);
+        set_sep_widths();
 }
 
 static void
@@ -227,6 +243,11 @@ get_func_mappings_opts()
         GET_STR("func_a_delete_right_col", user_mappings.func_a_delete_right_col);
         GET_STR("func_a_col_increase", user_mappings.func_a_col_increase);
         GET_STR("func_a_col_decrease", user_mappings.func_a_col_decrease);
+        GET_STR("func_a_col_autofit", user_mappings.func_a_col_autofit);
+        GET_STR("func_a_profile_next", user_mappings.func_a_profile_next);
+        GET_STR("func_a_mem_stats", user_mappings.func_a_mem_stats);
+        GET_STR("func_a_sort_asc", user_mappings.func_a_sort_asc);
+        GET_STR("func_a_sort_desc", user_mappings.func_a_sort_desc);
         GET_STR("func_a_scroll_up", user_mappings.func_a_scroll_up);
         GET_STR("func_a_scroll_down", user_mappings.func_a_scroll_down);
         GET_STR("func_a_scroll_left", user_mappings.func_a_scroll_left);
@@ -242,17 +263,84 @@ options_get()
         get_func_mappings_opts();
 }
 
+/* The interpreter memory is accounted in MEM_PYTHON. Small objects live in
+ * arenas, everything else goes through the raw domain */
+static PyObjectArenaAllocator py_arena;
+
+static void *
+py_malloc(void *ctx, size_t size)
+{
+        (void) ctx;
+        return mem_malloc(MEM_PYTHON, size ?: 1);
+}
+
+static void *
+py_calloc(void *ctx, size_t n, size_t size)
+{
+        (void) ctx;
+        return mem_calloc(MEM_PYTHON, n ?: 1, size ?: 1);
+}
+
+static void *
+py_realloc(void *ctx, void *ptr, size_t size)
+{
+        (void) ctx;
+        return mem_realloc(MEM_PYTHON, ptr, size ?: 1);
+}
+
+static void
+py_free(void *ctx, void *ptr)
+{
+        (void) ctx;
+        mem_free(MEM_PYTHON, ptr);
+}
+
+static void *
+py_arena_alloc(void *ctx, size_t size)
+{
+        void *p = py_arena.alloc(ctx, size);
+        if (p) mem_track(MEM_PYTHON, size);
+        return p;
+}
+
+static void
+py_arena_free(void *ctx, void *ptr, size_t size)
+{
+        py_arena.free(ctx, ptr, size);
+        mem_track(MEM_PYTHON, -(ssize_t) size);
+}
+
+static void
+set_python_allocators()
+{
+        PyMemAllocatorEx raw = {
+                .malloc = py_malloc,
+                .calloc = py_calloc,
+                .realloc = py_realloc,
+                .free = py_free,
+        };
+        PyObjectArenaAllocator arena;
+
+        PyMem_SetAllocator(PYMEM_DOMAIN_RAW, &raw);
+        PyObject_GetArenaAllocator(&py_arena);
+        arena = py_arena;
+        arena.alloc = py_arena_alloc;
+        arena.free = py_arena_free;
+        PyObject_SetArenaAllocator(&arena);
+}
+
 void
 parse_options_init()
 {
+        set_python_allocators(); // before any python allocation
         Py_Initialize();
         if (!Py_IsInitialized()) {
-                report("Impossible to initiaze python interpreter");
+                log_error("Impossible to initiaze python interpreter");
                 exit(1);
         }
         globals = PyDict_New();
         if (!globals) {
-                report("Impossible to initiaze gobals dict");
+                log_error("Impossible to initiaze gobals dict");
                 exit(1);
         }
 }
@@ -335,6 +423,7 @@ __options_init(OptOpts opts)
         PyDict_SetItemString(globals, "use_cell_color_for_sep", PyBool_FromLong((win_opts.use_cell_color_for_sep = true)));
         PyDict_SetItemString(globals, "cell_l_sep", PyUnicode_FromString((win_opts.cell_l_sep = strdup(" "))));
         PyDict_SetItemString(globals, "cell_r_sep", PyUnicode_FromString((win_opts.cell_r_sep = strdup(" "))));
+        set_sep_widths();
         PyDict_SetItemString(globals, "save_time", PyLong_FromLong((win_opts.save_time = 10)));
         PyDict_SetItemString(globals, "status_l_stuff", PyUnicode_FromString((win_opts.status_l_stuff = strdup(""))));
         PyDict_SetItemString(globals, "status_filename", PyUnicode_FromString((win_opts.status_filename = strdup(" ./"))));
@@ -388,6 +477,11 @@ __options_init(OptOpts opts)
         PyDict_SetItemString(globals, "func_a_delete_right_col", PyUnicode_FromString((user_mappings.func_a_delete_right_col = strdup("gdl"))));
         PyDict_SetItemString(globals, "func_a_col_increase", PyUnicode_FromString((user_mappings.func_a_col_increase = strdup("+"))));
         PyDict_SetItemString(globals, "func_a_col_decrease", PyUnicode_FromString((user_mappings.func_a_col_decrease = strdup("-"))));
+        PyDict_SetItemString(globals, "func_a_col_autofit", PyUnicode_FromString((user_mappings.func_a_col_autofit = strdup("="))));
+        PyDict_SetItemString(globals, "func_a_profile_next", PyUnicode_FromString((user_mappings.func_a_profile_next = strdup("gp"))));
+        PyDict_SetItemString(globals, "func_a_mem_stats", PyUnicode_FromString((user_mappings.func_a_mem_stats = strdup("gm"))));
+        PyDict_SetItemString(globals, "func_a_sort_asc", PyUnicode_FromString((user_mappings.func_a_sort_asc = strdup("go"))));
+        PyDict_SetItemString(globals, "func_a_sort_desc", PyUnicode_FromString((user_mappings.func_a_sort_desc = strdup("gO"))));
         PyDict_SetItemString(globals, "func_a_scroll_up", PyUnicode_FromString((user_mappings.func_a_scroll_up = strdup("ej"))));
         PyDict_SetItemString(globals, "func_a_scroll_down", PyUnicode_FromString((user_mappings.func_a_scroll_down = strdup("ek"))));
         PyDict_SetItemString(globals, "func_a_scroll_left", PyUnicode_FromString((user_mappings.func_a_scroll_left = strdup("el"))));
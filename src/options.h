@@ -61,6 +61,11 @@ typedef struct {
         char *func_a_delete_right_col;
         char *func_a_col_increase;
         char *func_a_col_decrease;
+        char *func_a_col_autofit;
+        char *func_a_profile_next;
+        char *func_a_mem_stats;
+        char *func_a_sort_asc;
+        char *func_a_sort_desc;
         char *func_a_scroll_up;
         char *func_a_scroll_down;
         char *func_a_scroll_left;
@@ -86,6 +91,8 @@ typedef struct win_opts {
         bool use_cell_color_for_sep;
         char *cell_l_sep;
         char *cell_r_sep;
+        int cell_l_sep_w; // display width of cell_l_sep
+        int cell_r_sep_w;
         char *ui_celltext_l_sep;
         char *ui_celltext_m_sep;
         char *ui_celltext_r_sep;
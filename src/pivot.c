@@ -0,0 +1,732 @@
+/*
+ * VICEL - Visual Cell editor
+ * Copyright (C) 2025  Hugo Coto Florez
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * For questions or support, contact: me@hugocoto.com
+ */
+
+#define LOG_CAT LOG_FORMULA
+
+#include "pivot.h"
+#include "builtin.h"
+#include "common.h"
+#include "debug.h"
+#include "eval.h"
+#include "mem.h"
+#include "number.h"
+#include "profile.h"
+#include "trace.h"
+#include "window.h"
+#include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <unistd.h>
+
+/* Rows read by each thread. Smaller ranges are read by the calling thread */
+#define PIVOT_CHUNK_ROWS 32768
+#define PIVOT_MAX_THREADS 8
+#define PIVOT_MAX_COLS 16
+
+typedef enum PivotAgg {
+        PIVOT_SUM,
+        PIVOT_COUNT,
+        PIVOT_AVG,
+        PIVOT_MIN,
+        PIVOT_MAX,
+} PivotAgg;
+
+/* What the arguments ask for. Compared as a whole to know if the state of
+ * the call is still valid, so it is always zero initialized */
+typedef struct PivotSpec {
+        struct Range range;
+        int nkeys, nvals, nout;
+        int keys[PIVOT_MAX_COLS]; // columns of range, from 0
+        int vals[PIVOT_MAX_COLS]; // columns aggregated, without repetitions
+        int out_val[PIVOT_MAX_COLS]; // index in vals of each result column
+        PivotAgg out_agg[PIVOT_MAX_COLS];
+} PivotSpec;
+
+/* Aggregate of a value column in a group */
+typedef struct Acc {
+        NumSum sum;
+        double min, max;
+        int nnum;   // number cells
+        int nfill;  // non empty cells
+        bool stale; // min or max left the group, see group_minmax
+} Acc;
+
+typedef struct Group {
+        uint64_t hash;
+        int next;  // next group in the same bucket, -1 for none
+        int nrows; // groups are not removed, they are hidden if empty
+        int out;   // row in the result block, -1 if it is not there
+        int first; // first row of the group, see Pivot.row_next
+        Value *key;
+        Acc *acc;
+} Group;
+
+typedef struct GroupTable {
+        Group *groups;
+        int size, capacity;
+        int *head; // first group of each bucket
+        int mask;
+        bool own; // keys own their text, if not they point to the cells
+} GroupTable;
+
+enum {
+        ROW_EMPTY,
+        ROW_NUMBER,
+        ROW_OTHER,
+};
+
+typedef struct Pivot {
+        BuiltinState base;
+        PivotSpec spec;
+        int h;
+        GroupTable t;
+        int *row_group;          // group of each row
+        int *row_next, *row_prev; // rows of the same group, -1 at the ends
+        double *row_num;         // h * nvals values, as they were added
+        unsigned char *row_kind; // ROW_* of each of them
+        int nlive;               // groups shown in the result
+        /* Groups whose result row has to be written again */
+        int touched[2];
+        int ntouched;
+        bool relayout; // a group has been shown or hidden
+        /* Block written by the last evaluation, from the formula cell */
+        int spill_w, spill_h;
+        CellMat *mat;
+        unsigned version;
+        unsigned missed;
+} Pivot;
+
+typedef struct Chunk {
+        Pivot *p;
+        int lo, hi;
+        GroupTable t;
+} Chunk;
+
+static Value
+value_at(struct Range *r, int x, int y)
+{
+        Cell *c = cm_get_cell_ptr(active_ctx.body, r->startx + x, r->starty + y);
+        if (c == NULL) return VALUE_EMPTY;
+        if (VAL_TYPE(c->value) == TYPE_FORMULA) return VAL_FORMULA(c->value)->value;
+        return c->value;
+}
+
+/* Value of a key column. Empty text is the same as an empty cell */
+static Value
+key_at(Pivot *p, int k, int y)
+{
+        Value v = value_at(&p->spec.range, p->spec.keys[k], y);
+        if (VAL_TYPE(v) == TYPE_TEXT && (!VAL_TEXT(v) || !*VAL_TEXT(v))) return VALUE_EMPTY;
+        if (VAL_TYPE(v) == TYPE_NUMBER && VAL_NUM(v) == 0) v = AS_NUMBER(0); // no -0
+        return v;
+}
+
+static uint64_t
+hash_bytes(uint64_t h, const void *data, size_t len)
+{
+        const unsigned char *b = data;
+        for (size_t i = 0; i < len; i++) {
+                h ^= b[i];
+                h *= 0x100000001b3ULL;
+        }
+        return h;
+}
+
+static uint64_t
+hash_key(Value *key, int nkeys)
+{
+        uint64_t h = 0xcbf29ce484222325ULL;
+        for (int k = 0; k < nkeys; k++) {
+                CellType type = VAL_TYPE(key[k]);
+                bool b = VAL_BOOL(key[k]);
+                h = hash_bytes(h, &type, sizeof type);
+                switch (type) {
+                case TYPE_NUMBER: h = hash_bytes(h, &VAL_NUM(key[k]), sizeof(double)); break;
+                case TYPE_BOOL: h = hash_bytes(h, &b, sizeof b); break;
+                case TYPE_TEXT: h = hash_bytes(h, VAL_TEXT(key[k]), strlen(VAL_TEXT(key[k]))); break;
+                default: break;
+                }
+        }
+        return h;
+}
+
+static bool
+same_key(Value *a, Value *b, int nkeys)
+{
+        for (int k = 0; k < nkeys; k++) {
+                if (VAL_TYPE(a[k]) != VAL_TYPE(b[k])) return false;
+                switch (VAL_TYPE(a[k])) {
+                case TYPE_NUMBER:
+                        if (VAL_NUM(a[k]) != VAL_NUM(b[k])) return false;
+                        break;
+                case TYPE_BOOL:
+                        if (VAL_BOOL(a[k]) != VAL_BOOL(b[k])) return false;
+                        break;
+                case TYPE_TEXT:
+                        if (strcmp(VAL_TEXT(a[k]), VAL_TEXT(b[k]))) return false;
+                        break;
+                default: break;
+                }
+        }
+        return true;
+}
+
+static void
+table_init(GroupTable *t, bool own)
+{
+        *t = (GroupTable) { .own = own, .mask = 63 };
+        t->head = mem_malloc(MEM_FORMULAS, sizeof *t->head * (t->mask + 1));
+        memset(t->head, -1, sizeof *t->head * (t->mask + 1));
+}
+
+static void
+table_free(GroupTable *t, int nkeys)
+{
+        for (int g = 0; g < t->size; g++) {
+                if (t->own) {
+                        for (int k = 0; k < nkeys; k++)
+                                if (VAL_TYPE(t->groups[g].key[k]) == TYPE_TEXT)
+                                        mem_free(MEM_FORMULAS, VAL_TEXT(t->groups[g].key[k]));
+                }
+                mem_free(MEM_FORMULAS, t->groups[g].key);
+                mem_free(MEM_FORMULAS, t->groups[g].acc);
+        }
+        mem_free(MEM_FORMULAS, t->groups);
+        mem_free(MEM_FORMULAS, t->head);
+        *t = (GroupTable) { 0 };
+}
+
+static int
+table_find(GroupTable *t, Value *key, int nkeys, uint64_t hash)
+{
+        for (int g = t->head[hash & t->mask]; g >= 0; g = t->groups[g].next)
+                if (t->groups[g].hash == hash && same_key(t->groups[g].key, key, nkeys))
+                        return g;
+        return -1;
+}
+
+static void
+table_grow(GroupTable *t)
+{
+        mem_free(MEM_FORMULAS, t->head);
+        t->mask = t->mask * 2 + 1;
+        t->head = mem_malloc(MEM_FORMULAS, sizeof *t->head * (t->mask + 1));
+        memset(t->head, -1, sizeof *t->head * (t->mask + 1));
+        for (int g = 0; g < t->size; g++) {
+                t->groups[g].next = t->head[t->groups[g].hash & t->mask];
+                t->head[t->groups[g].hash & t->mask] = g;
+        }
+}
+
+/* Add an empty group with a copy of KEY */
+static int
+table_add(GroupTable *t, Value *key, int nkeys, int nvals, uint64_t hash)
+{
+        Group *g;
+
+        if (t->size == t->capacity) {
+                t->capacity = t->capacity ? t->capacity * 2 : 16;
+                t->groups = mem_realloc(MEM_FORMULAS, t->groups, sizeof *t->groups * t->capacity);
+        }
+        g = t->groups + t->size;
+        *g = (Group) { .hash = hash, .next = t->head[hash & t->mask], .out = -1, .first = -1 };
+        g->key = mem_malloc(MEM_FORMULAS, sizeof *g->key * nkeys);
+        for (int k = 0; k < nkeys; k++) {
+                g->key[k] = key[k];
+                if (t->own && VAL_TYPE(key[k]) == TYPE_TEXT)
+                        g->key[k] = AS_TEXT(mem_strdup(MEM_FORMULAS, VAL_TEXT(key[k])));
+        }
+        g->acc = mem_malloc(MEM_FORMULAS, sizeof *g->acc * nvals);
+        for (int v = 0; v < nvals; v++)
+                g->acc[v] = (Acc) { .min = INFINITY, .max = -INFINITY };
+        t->head[hash & t->mask] = t->size;
+        if (++t->size * 2 > t->mask + 1) table_grow(t);
+        return t->size - 1;
+}
+
+static int
+table_get(GroupTable *t, Value *key, int nkeys, int nvals)
+{
+        uint64_t hash = hash_key(key, nkeys);
+        int g = table_find(t, key, nkeys, hash);
+        return g >= 0 ? g : table_add(t, key, nkeys, nvals, hash);
+}
+
+static void
+acc_add(Acc *a, unsigned char kind, double num)
+{
+        if (kind != ROW_EMPTY) ++a->nfill;
+        if (kind != ROW_NUMBER) return;
+        ++a->nnum;
+        num_sum_add(&a->sum, num);
+        if (num < a->min) a->min = num;
+        if (num > a->max) a->max = num;
+}
+
+static void
+acc_remove(Acc *a, unsigned char kind, double num)
+{
+        if (kind != ROW_EMPTY) --a->nfill;
+        if (kind != ROW_NUMBER) return;
+        --a->nnum;
+        num_sum_add(&a->sum, -num);
+        if (num == a->min || num == a->max) a->stale = true;
+}
+
+static void
+acc_merge(Acc *a, Acc *b)
+{
+        num_sum_add(&a->sum, b->sum.sum);
+        num_sum_add(&a->sum, b->sum.comp);
+        a->nnum += b->nnum;
+        a->nfill += b->nfill;
+        if (b->min < a->min) a->min = b->min;
+        if (b->max > a->max) a->max = b->max;
+}
+
+/* Read the value columns of row Y */
+static void
+read_row(Pivot *p, int y)
+{
+        int i = y * p->spec.nvals;
+        Value v;
+
+        for (int k = 0; k < p->spec.nvals; k++, i++) {
+                v = value_at(&p->spec.range, p->spec.vals[k], y);
+                p->row_num[i] = 0;
+                if (VAL_TYPE(v) == TYPE_NUMBER) {
+                        p->row_kind[i] = ROW_NUMBER;
+                        p->row_num[i] = VAL_NUM(v);
+                } else if (VAL_TYPE(v) == TYPE_EMPTY || (VAL_TYPE(v) == TYPE_TEXT && (!VAL_TEXT(v) || !*VAL_TEXT(v))))
+                        p->row_kind[i] = ROW_EMPTY;
+                else
+                        p->row_kind[i] = ROW_OTHER;
+        }
+}
+
+static void
+group_add_row(Pivot *p, Group *g, int y)
+{
+        int i = y * p->spec.nvals;
+        ++g->nrows;
+        for (int k = 0; k < p->spec.nvals; k++, i++)
+                acc_add(g->acc + k, p->row_kind[i], p->row_num[i]);
+}
+
+static void
+group_remove_row(Pivot *p, Group *g, int y)
+{
+        int i = y * p->spec.nvals;
+        --g->nrows;
+        for (int k = 0; k < p->spec.nvals; k++, i++)
+                acc_remove(g->acc + k, p->row_kind[i], p->row_num[i]);
+}
+
+static void
+link_row(Pivot *p, int g, int y)
+{
+        Group *group = p->t.groups + g;
+        p->row_group[y] = g;
+        p->row_prev[y] = -1;
+        p->row_next[y] = group->first;
+        if (group->first >= 0) p->row_prev[group->first] = y;
+        group->first = y;
+}
+
+static void
+unlink_row(Pivot *p, int y)
+{
+        if (p->row_prev[y] >= 0)
+                p->row_next[p->row_prev[y]] = p->row_next[y];
+        else
+                p->t.groups[p->row_group[y]].first = p->row_next[y];
+        if (p->row_next[y] >= 0) p->row_prev[p->row_next[y]] = p->row_prev[y];
+}
+
+/* Aggregate the rows of C in its own table. Only reads cells, so chunks can
+ * run at the same time */
+static void *
+scan_chunk(void *arg)
+{
+        Chunk *c = arg;
+        Pivot *p = c->p;
+        Value key[PIVOT_MAX_COLS];
+        int g;
+
+        table_init(&c->t, false);
+        for (int y = c->lo; y < c->hi; y++) {
+                for (int k = 0; k < p->spec.nkeys; k++)
+                        key[k] = key_at(p, k, y);
+                g = table_get(&c->t, key, p->spec.nkeys, p->spec.nvals);
+                p->row_group[y] = g;
+                read_row(p, y);
+                group_add_row(p, c->t.groups + g, y);
+        }
+        return NULL;
+}
+
+static int
+thread_count(int rows)
+{
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        int n = rows / PIVOT_CHUNK_ROWS;
+        if (n > cpus) n = cpus;
+        if (n > PIVOT_MAX_THREADS) n = PIVOT_MAX_THREADS;
+        return n < 1 ? 1 : n;
+}
+
+/* Group every row. Chunks are merged in order, so groups keep the order in
+ * which their keys first appear */
+static void
+full_scan(Pivot *p)
+{
+        TRACE_SPAN("pivot: scan", "formula");
+        Chunk chunks[PIVOT_MAX_THREADS];
+        pthread_t threads[PIVOT_MAX_THREADS];
+        bool started[PIVOT_MAX_THREADS] = { 0 };
+        int n = thread_count(p->h), *remap, g;
+        Group *src;
+
+        if (profile_enabled) profile_range(p->h * (p->spec.nkeys + p->spec.nvals));
+        for (int i = 0; i < n; i++)
+                chunks[i] = (Chunk) { .p = p, .lo = p->h * (long) i / n, .hi = p->h * (long) (i + 1) / n };
+        for (int i = 1; i < n; i++)
+                started[i] = !pthread_create(threads + i, NULL, scan_chunk, chunks + i);
+        for (int i = 0; i < n; i++)
+                if (!started[i]) scan_chunk(chunks + i);
+
+        for (int i = 0; i < n; i++) {
+                if (started[i]) pthread_join(threads[i], NULL);
+                remap = mem_malloc(MEM_FORMULAS, sizeof *remap * (chunks[i].t.size ?: 1));
+                for (int j = 0; j < chunks[i].t.size; j++) {
+                        src = chunks[i].t.groups + j;
+                        g = table_find(&p->t, src->key, p->spec.nkeys, src->hash);
+                        if (g < 0) g = table_add(&p->t, src->key, p->spec.nkeys, p->spec.nvals, src->hash);
+                        p->t.groups[g].nrows += src->nrows;
+                        for (int k = 0; k < p->spec.nvals; k++)
+                                acc_merge(p->t.groups[g].acc + k, src->acc + k);
+                        remap[j] = g;
+                }
+                for (int y = chunks[i].lo; y < chunks[i].hi; y++)
+                        p->row_group[y] = remap[p->row_group[y]];
+                mem_free(MEM_FORMULAS, remap);
+                table_free(&chunks[i].t, p->spec.nkeys);
+        }
+        for (int y = p->h - 1; y >= 0; y--)
+                link_row(p, p->row_group[y], y);
+
+        p->relayout = true;
+        p->mat = active_ctx.body;
+        p->version = cm_layout_version;
+        p->missed = formula_missed;
+}
+
+static void
+touch(Pivot *p, int g)
+{
+        for (int i = 0; i < p->ntouched; i++)
+                if (p->touched[i] == g) return;
+        if (p->t.groups[g].out < 0 || p->t.groups[g].nrows == 0 || p->ntouched == 2)
+                p->relayout = true;
+        else
+                p->touched[p->ntouched++] = g;
+}
+
+/* Only the cell that notified the formula has changed since the last
+ * evaluation. Its row is taken out of its group and added again */
+static void
+update_notifier(Pivot *p)
+{
+        Value key[PIVOT_MAX_COLS];
+        struct Range *r = &p->spec.range;
+        bool used = false;
+        int x, y, g, old;
+
+        if (!cm_get_cell_pos(active_ctx.body, formula_notifier, &x, &y)) return;
+        if (x < r->startx || x > r->endx || y < r->starty || y > r->endy) return;
+        x -= r->startx;
+        y -= r->starty;
+        for (int k = 0; k < p->spec.nkeys; k++)
+                used |= p->spec.keys[k] == x;
+        for (int k = 0; k < p->spec.nvals; k++)
+                used |= p->spec.vals[k] == x;
+        if (!used) return;
+
+        old = p->row_group[y];
+        group_remove_row(p, p->t.groups + old, y);
+        unlink_row(p, y);
+        for (int k = 0; k < p->spec.nkeys; k++)
+                key[k] = key_at(p, k, y);
+        g = table_get(&p->t, key, p->spec.nkeys, p->spec.nvals);
+        link_row(p, g, y);
+        read_row(p, y);
+        group_add_row(p, p->t.groups + g, y);
+        touch(p, old);
+        touch(p, g);
+}
+
+/* Min and max can not be undone, they are found again from the rows of the
+ * group */
+static void
+group_minmax(Pivot *p, int g, int k)
+{
+        Acc *a = p->t.groups[g].acc + k;
+        int i;
+
+        a->min = INFINITY;
+        a->max = -INFINITY;
+        for (int y = p->t.groups[g].first; y >= 0; y = p->row_next[y]) {
+                i = y * p->spec.nvals + k;
+                if (p->row_kind[i] != ROW_NUMBER) continue;
+                if (p->row_num[i] < a->min) a->min = p->row_num[i];
+                if (p->row_num[i] > a->max) a->max = p->row_num[i];
+        }
+        a->stale = false;
+}
+
+/* Value of the column COL of the result row of group G */
+static Value
+result_at(Pivot *p, int g, int col)
+{
+        int j = col - p->spec.nkeys;
+        Acc *a;
+
+        if (j < 0) return p->t.groups[g].key[col];
+        a = p->t.groups[g].acc + p->spec.out_val[j];
+        switch (p->spec.out_agg[j]) {
+        case PIVOT_SUM: return AS_NUMBER(num_sum_value(&a->sum));
+        case PIVOT_COUNT: return AS_NUMBER(a->nfill);
+        case PIVOT_AVG: return a->nnum ? AS_NUMBER(num_sum_value(&a->sum) / a->nnum) : VALUE_EMPTY;
+        case PIVOT_MIN:
+        case PIVOT_MAX:
+                if (a->nnum == 0) return VALUE_EMPTY;
+                if (a->stale) group_minmax(p, g, p->spec.out_val[j]);
+                return AS_NUMBER(p->spec.out_agg[j] == PIVOT_MIN ? a->min : a->max);
+        }
+        return VALUE_ERROR;
+}
+
+/* Write the result row of group G, except the formula cell */
+static void
+spill_group(Pivot *p, int g, int x0, int y0)
+{
+        int y = y0 + p->t.groups[g].out;
+        for (int x = 0; x < p->spec.nkeys + p->spec.nout; x++) {
+                if (x == 0 && y == y0) continue;
+                cm_spill(cm_get_cell_ptr(active_ctx.body, x0 + x, y), result_at(p, g, x));
+        }
+}
+
+/* Write the groups that changed, or the whole block if the groups shown are
+ * not the same. Returns false if the block does not fit */
+static bool
+spill(Pivot *p)
+{
+        TRACE_SPAN("pivot: spill", "formula");
+        int x0, y0, w = p->spec.nkeys + p->spec.nout, h = 0;
+        Value *vals;
+        bool fits;
+
+        if (!cm_get_cell_pos(active_ctx.body, formula_cell, &x0, &y0)) return false;
+        if (!p->relayout) {
+                for (int i = 0; i < p->ntouched; i++)
+                        spill_group(p, p->touched[i], x0, y0);
+                p->ntouched = 0;
+                return true;
+        }
+
+        for (int g = 0; g < p->t.size; g++)
+                p->t.groups[g].out = p->t.groups[g].nrows ? h++ : -1;
+        p->nlive = h;
+        vals = mem_malloc(MEM_FORMULAS, sizeof *vals * w * (h ?: 1));
+        for (int g = 0; g < p->t.size; g++)
+                for (int x = 0; p->t.groups[g].out >= 0 && x < w; x++)
+                        vals[p->t.groups[g].out * w + x] = result_at(p, g, x);
+        fits = cm_spill_block(active_ctx.body, x0, y0, vals, w, h, &p->spill_w, &p->spill_h);
+        mem_free(MEM_FORMULAS, vals);
+        if (!fits) {
+                log_warn("pivot: the result (%dx%d) does not fit", w, h);
+                p->nlive = 0;
+                return false;
+        }
+        p->relayout = false;
+        p->ntouched = 0;
+        return true;
+}
+
+/* Columns as a number or a text list as "1,3", from 1 */
+static int
+parse_cols(Value v, int *cols, int w)
+{
+        char *s, *end;
+        long n;
+        int count = 0;
+
+        if (VAL_TYPE(v) == TYPE_NUMBER) {
+                if (VAL_NUM(v) < 1 || VAL_NUM(v) > w) return -1;
+                cols[0] = VAL_NUM(v) - 1;
+                return 1;
+        }
+        if (VAL_TYPE(v) != TYPE_TEXT) return -1;
+        for (s = VAL_TEXT(v); *s;) {
+                n = strtol(s, &end, 10);
+                if (end == s || n < 1 || n > w || count == PIVOT_MAX_COLS) return -1;
+                cols[count++] = n - 1;
+                for (s = end; *s == ',' || *s == ' '; s++)
+                        ;
+        }
+        return count;
+}
+
+static int
+parse_aggs(Value v, PivotAgg *aggs)
+{
+        static const struct {
+                const char *name;
+                PivotAgg agg;
+        } names[] = {
+                { "sum", PIVOT_SUM }, { "count", PIVOT_COUNT }, { "avg", PIVOT_AVG },
+                { "average", PIVOT_AVG }, { "min", PIVOT_MIN }, { "max", PIVOT_MAX },
+        };
+        char *s = VAL_TEXT(v);
+        size_t len;
+        int count = 0;
+        bool found;
+
+        if (VAL_TYPE(v) != TYPE_TEXT) return -1;
+        while (*s) {
+                len = strcspn(s, ", ");
+                found = false;
+                for (size_t i = 0; i < sizeof names / sizeof *names && !found; i++) {
+                        if (strlen(names[i].name) == len && !strncasecmp(s, names[i].name, len)) {
+                                if (count == PIVOT_MAX_COLS) return -1;
+                                aggs[count++] = names[i].agg;
+                                found = true;
+                        }
+                }
+                if (!found) return -1;
+                for (s += len; *s == ',' || *s == ' '; s++)
+                        ;
+        }
+        return count;
+}
+
+/* A single aggregation applies to every value column, and a single value
+ * column gets every aggregation. If not, they go in pairs */
+static bool
+parse_spec(PivotSpec *spec, Expr *args)
+{
+        PivotAgg aggs[PIVOT_MAX_COLS];
+        int cols[PIVOT_MAX_COLS], ncols, naggs = 1, w, col, k;
+        Value v;
+
+        memset(spec, 0, sizeof *spec);
+        aggs[0] = PIVOT_SUM;
+        if (!args || !args->next || !args->next->next) return false;
+        if (VAL_TYPE(v = eval_expr(args)) != TYPE_RANGE) return false;
+        spec->range = *VAL_RANGE(v);
+        w = spec->range.endx - spec->range.startx + 1;
+        if ((spec->nkeys = parse_cols(eval_expr(args->next), spec->keys, w)) <= 0) return false;
+        if ((ncols = parse_cols(eval_expr(args->next->next), cols, w)) <= 0) return false;
+        if (args->next->next->next && (naggs = parse_aggs(eval_expr(args->next->next->next), aggs)) <= 0)
+                return false;
+        if (naggs != 1 && ncols != 1 && naggs != ncols) return false;
+
+        spec->nout = naggs > ncols ? naggs : ncols;
+        if (spec->nkeys + spec->nout > PIVOT_MAX_COLS) return false;
+        for (int j = 0; j < spec->nout; j++) {
+                col = cols[ncols == 1 ? 0 : j];
+                for (k = 0; k < spec->nvals && spec->vals[k] != col; k++)
+                        ;
+                if (k == spec->nvals) spec->vals[spec->nvals++] = col;
+                spec->out_val[j] = k;
+                spec->out_agg[j] = aggs[naggs == 1 ? 0 : j];
+        }
+        return true;
+}
+
+static void
+destroy_pivot(BuiltinState *s)
+{
+        Pivot *p = (Pivot *) s;
+        builtin_unspill(&p->spill_w, &p->spill_h);
+        table_free(&p->t, p->spec.nkeys);
+        mem_free(MEM_FORMULAS, p->row_group);
+        mem_free(MEM_FORMULAS, p->row_next);
+        mem_free(MEM_FORMULAS, p->row_prev);
+        mem_free(MEM_FORMULAS, p->row_num);
+        mem_free(MEM_FORMULAS, p->row_kind);
+        mem_free(MEM_FORMULAS, p);
+}
+
+static Pivot *
+new_pivot(PivotSpec *spec)
+{
+        Pivot *p = mem_calloc(MEM_FORMULAS, 1, sizeof *p);
+        p->base.destroy = destroy_pivot;
+        p->spec = *spec;
+        p->h = spec->range.endy - spec->range.starty + 1;
+        table_init(&p->t, true);
+        p->row_group = mem_malloc(MEM_FORMULAS, sizeof *p->row_group * p->h);
+        p->row_next = mem_malloc(MEM_FORMULAS, sizeof *p->row_next * p->h);
+        p->row_prev = mem_malloc(MEM_FORMULAS, sizeof *p->row_prev * p->h);
+        p->row_num = mem_malloc(MEM_FORMULAS, sizeof *p->row_num * p->h * spec->nvals);
+        p->row_kind = mem_malloc(MEM_FORMULAS, sizeof *p->row_kind * p->h * spec->nvals);
+        return p;
+}
+
+static bool
+is_current(Pivot *p, PivotSpec *spec)
+{
+        return !memcmp(&p->spec, spec, sizeof *spec) && p->mat == active_ctx.body &&
+               p->version == cm_layout_version && p->missed == formula_missed;
+}
+
+Value
+pivot_eval(Expr *args)
+{
+        BuiltinState **state = builtin_state();
+        Pivot *p = (Pivot *) *state, *old = p;
+        PivotSpec spec;
+        bool current;
+
+        if (formula_cell == NULL || !parse_spec(&spec, args)) return VALUE_ERROR;
+
+        current = p && is_current(p, &spec) && builtin_state_followed(&p->base);
+        if (current && formula_notifier)
+                update_notifier(p);
+        else if (!current) {
+                *state = &(p = new_pivot(&spec))->base;
+                if (old) {
+                        /* The new result replaces the old block */
+                        p->spill_w = old->spill_w;
+                        p->spill_h = old->spill_h;
+                        old->spill_w = old->spill_h = 0;
+                        old->base.destroy(&old->base);
+                }
+                full_scan(p);
+        }
+        p->base.change = formula_change;
+
+        if (!spill(p)) return VALUE_ERROR;
+        for (int g = 0; g < p->t.size; g++)
+                if (p->t.groups[g].out == 0) return result_at(p, g, 0);
+        return VALUE_EMPTY;
+}
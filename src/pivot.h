@@ -0,0 +1,38 @@
+/*
+ * VICEL - Visual Cell editor
+ * Copyright (C) 2025  Hugo Coto Florez
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * For questions or support, contact: me@hugocoto.com
+ */
+
+#ifndef PIVOT_H_
+#define PIVOT_H_
+
+#include "cellmap.h"
+#include "formula.h"
+
+/* Group-by over a range. Rows are grouped by the values of the key columns
+ * with a hash table, and the value columns of each group are aggregated in a
+ * single pass. Big ranges are split between threads that aggregate their
+ * rows on their own, and the partial results are merged in order. The result
+ * is a block with a row per group, that starts at the formula cell and
+ * spills over the cells on its right and below it. After the first
+ * evaluation, a change in one cell only moves its row between groups. */
+
+/* Evaluate pivot(range, keys, values [, aggregations]) */
+Value pivot_eval(Expr *args);
+
+#endif // !PIVOT_H_
@@ -0,0 +1,103 @@
+/*
+ * VICEL - Visual Cell editor
+ * Copyright (C) 2025  Hugo Coto Florez
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * For questions or support, contact: me@hugocoto.com
+ */
+
+#define LOG_CAT LOG_FORMULA
+
+#include "profile.h"
+#include "debug.h"
+#include "eval.h"
+#include "formula.h"
+#include "mem.h"
+
+bool profile_enabled = false;
+
+/* Formula being evaluated, for profile_range */
+static Cell *current = NULL;
+
+static uint64_t
+now_ns()
+{
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+FormulaProfile *
+profile_of(Cell *c)
+{
+        Formula *f = VAL_FORMULA(c->value);
+        assert(VAL_TYPE(c->value) == TYPE_FORMULA);
+        if (!f->profile) f->profile = mem_calloc(MEM_FORMULAS, 1, sizeof *f->profile);
+        return f->profile;
+}
+
+Value
+profile_eval(Cell *c)
+{
+        FormulaProfile *p = profile_of(c);
+        Cell *outer = current;
+        uint64_t t;
+        Value v;
+
+        current = c;
+        t = now_ns();
+        v = eval_formula(VAL_FORMULA(c->value));
+        p->ns += now_ns() - t;
+        ++p->evals;
+        current = outer;
+        return v;
+}
+
+void
+profile_range(int cells)
+{
+        FormulaProfile *p;
+        if (!current) return;
+        p = profile_of(current);
+        if (cells > p->max_range) p->max_range = cells;
+}
+
+static uint64_t
+cost(Cell *c)
+{
+        Formula *f = VAL_FORMULA(c->value);
+        return f->profile ? f->profile->ns : 0;
+}
+
+int
+profile_top(CellMat *mat, Cell **top, int n)
+{
+        int size = 0, i;
+
+        for_da_each(row, *mat)
+        {
+                for_da_each(c, *row)
+                {
+                        if (VAL_TYPE(c->value) != TYPE_FORMULA || !cost(c)) continue;
+                        if (size == n && cost(top[n - 1]) >= cost(c)) continue;
+                        /* insertion into the sorted top N */
+                        i = size < n ? size++ : n - 1;
+                        for (; i > 0 && cost(top[i - 1]) < cost(c); i--)
+                                top[i] = top[i - 1];
+                        top[i] = c;
+                }
+        }
+        return size;
+}
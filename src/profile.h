@@ -0,0 +1,52 @@
+/*
+ * VICEL - Visual Cell editor
+ * Copyright (C) 2025  Hugo Coto Florez
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * For questions or support, contact: me@hugocoto.com
+ */
+
+#ifndef PROFILE_H_
+#define PROFILE_H_
+
+#include "cellmap.h"
+#include <stdint.h>
+
+/* Formula profiler. While enabled, every formula counts its evaluations, the
+ * time spent in eval_expr, how many times it was notified by a cell it depends
+ * on and the largest range it walked through rangemap. */
+
+#define PROFILE_TOP 10
+
+typedef struct FormulaProfile {
+        uint64_t evals;
+        uint64_t notifications;
+        uint64_t ns;
+        int max_range; // cells
+} FormulaProfile;
+
+extern bool profile_enabled;
+
+/* Stats of the formula in C, allocated on first use */
+FormulaProfile *profile_of(Cell *c);
+/* Evaluate the formula in C and account for it */
+Value profile_eval(Cell *c);
+/* The formula being evaluated touched a range of CELLS cells */
+void profile_range(int cells);
+/* Fill TOP with up to N formula cells of MAT, the most expensive first.
+ * Returns how many */
+int profile_top(CellMat *mat, Cell **top, int n);
+
+#endif // !PROFILE_H_
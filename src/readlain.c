@@ -18,6 +18,8 @@
  * For questions or support, contact: me@hugocoto.com
  */
 
+#define LOG_CAT LOG_INPUT
+
 #include "cellmap.h"
 #include "common.h"
 #include "debug.h"
@@ -64,7 +66,7 @@ static void
 rlinsert(char c)
 {
         if (rlindex >= (int) sizeof rline - 1) {
-                report("Invalid insert index: %d", rlindex);
+                log_warn("Invalid insert index: %d", rlindex);
                 return;
         }
 
@@ -76,7 +78,7 @@ rlinsert(char c)
         }
 
         if (strlen(rline) >= sizeof rline - 1) {
-                report("rline is full");
+                log_warn("rline is full");
                 return;
         }
 
@@ -141,7 +143,7 @@ handle_esc()
                 static Cell *selection_end;
                 if (sscanf(buf, "[M%c%c%c", &btn, &c, &r) == 3) {
                         static char hold = 0;
-                        int cellc = (c - 33 - win_opts.num_col_width) / win_opts.col_width + active_ctx.scroll_c;
+                        int cellc = col_at_screen_x(c - 33);
                         int cellr = (r - 33 - 2) / win_opts.row_width + active_ctx.scroll_r;
                         set_ui_report("mouse at %d/%d %d/%d", cellc, active_ctx.max_display_r, cellr, active_ctx.max_display_c);
                         switch (btn) {
@@ -0,0 +1,285 @@
+/*
+ * VICEL - Visual Cell editor
+ * Copyright (C) 2025  Hugo Coto Florez
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * For questions or support, contact: me@hugocoto.com
+ */
+
+#define LOG_CAT LOG_FORMULA
+
+#include "rolling.h"
+#include "builtin.h"
+#include "common.h"
+#include "debug.h"
+#include "eval.h"
+#include "mem.h"
+#include "profile.h"
+#include "trace.h"
+#include "window.h"
+#include <math.h>
+
+typedef struct Rolling {
+        BuiltinState base;
+        RollKind kind;
+        struct Range range;
+        double param; // k, or alpha for ewma
+        int h;
+        double *in;
+        unsigned char *is_num; // whether each input is a number
+        double *out;
+        unsigned char *has_out; // whether each result is not empty
+        int *deque;             // for min and max, a ring of dcap rows
+        int dcap;
+        bool relayout; // the whole column has to be written
+        /* Block written by the last evaluation, from the formula cell */
+        int spill_w, spill_h;
+        CellMat *mat;
+        unsigned version;
+        unsigned missed;
+} Rolling;
+
+static void
+read_row(Rolling *r, int y)
+{
+        Cell *c = cm_get_cell_ptr(active_ctx.body, r->range.startx, r->range.starty + y);
+        Value v = c ? c->value : VALUE_EMPTY;
+
+        if (VAL_TYPE(v) == TYPE_FORMULA) v = VAL_FORMULA(v)->value;
+        r->is_num[y] = VAL_TYPE(v) == TYPE_NUMBER && !isnan(VAL_NUM(v));
+        r->in[y] = r->is_num[y] ? VAL_NUM(v) : 0;
+}
+
+/* Sum and average of the results FROM to TO. The sum is added again from
+ * scratch every k rows, so rounding does not build up */
+static int
+roll_sums(Rolling *r, int from, int to)
+{
+        int k = r->param, count = 0;
+        double sum = 0;
+
+        for (int i = from; i <= to; i++) {
+                if ((i - from) % k == 0) {
+                        sum = 0;
+                        count = 0;
+                        for (int j = i - k + 1 < 0 ? 0 : i - k + 1; j <= i; j++) {
+                                sum += r->in[j];
+                                count += r->is_num[j];
+                        }
+                } else {
+                        sum += r->in[i];
+                        count += r->is_num[i];
+                        if (i - k >= 0) {
+                                sum -= r->in[i - k];
+                                count -= r->is_num[i - k];
+                        }
+                }
+                r->has_out[i] = i >= k - 1 && (r->kind == ROLL_SUM || count);
+                r->out[i] = r->kind == ROLL_SUM ? sum : sum / count;
+        }
+        return to;
+}
+
+/* Min or max of the results FROM to TO. The deque has the rows of the window
+ * that can still be the result, with their inputs in order */
+static int
+roll_extreme(Rolling *r, int from, int to)
+{
+        int k = r->param, *d = r->deque, head = 0, size = 0, last;
+        bool max = r->kind == ROLL_MAX;
+
+        for (int i = from - k + 1 < 0 ? 0 : from - k + 1; i <= to; i++) {
+                if (r->is_num[i]) {
+                        while (size) {
+                                last = d[(head + size - 1) % r->dcap];
+                                if (max ? r->in[last] > r->in[i] : r->in[last] < r->in[i]) break;
+                                size--;
+                        }
+                        d[(head + size++) % r->dcap] = i;
+                }
+                while (size && d[head] <= i - k) {
+                        head = (head + 1) % r->dcap;
+                        size--;
+                }
+                if (i < from) continue;
+                r->has_out[i] = i >= k - 1 && size;
+                r->out[i] = size ? r->in[d[head]] : 0;
+        }
+        return to;
+}
+
+/* Every result from FROM depends on the one before it, until one does not
+ * change. Returns the last one that may have changed */
+static int
+roll_ewma(Rolling *r, int from)
+{
+        double a = r->param, y = from ? r->out[from - 1] : 0;
+        bool has = from && r->has_out[from - 1];
+
+        for (int i = from; i < r->h; i++) {
+                if (r->is_num[i]) {
+                        y = has ? a * r->in[i] + (1 - a) * y : r->in[i];
+                        has = true;
+                }
+                if (i > from && has == r->has_out[i] && (!has || y == r->out[i])) return i - 1;
+                r->has_out[i] = has;
+                r->out[i] = y;
+        }
+        return r->h - 1;
+}
+
+/* Compute again the results that depend on the input at row Y, or on every
+ * input if Y < 0. Returns the last one that may have changed */
+static int
+compute(Rolling *r, int y)
+{
+        int from = y < 0 ? 0 : y, to = y < 0 ? r->h - 1 : y + (int) r->param - 1;
+
+        if (to >= r->h) to = r->h - 1;
+        switch (r->kind) {
+        case ROLL_SUM:
+        case ROLL_AVG: return roll_sums(r, from, to);
+        case ROLL_MIN:
+        case ROLL_MAX: return roll_extreme(r, from, to);
+        case ROLL_EWMA: return roll_ewma(r, from);
+        }
+        return to;
+}
+
+static Value
+result_at(Rolling *r, int i)
+{
+        return r->has_out[i] ? AS_NUMBER(r->out[i]) : VALUE_EMPTY;
+}
+
+static bool
+spill(Rolling *r, int x0, int y0, int from, int to)
+{
+        TRACE_SPAN("rolling: spill", "formula");
+        Value *vals;
+        bool fits;
+
+        if (!r->relayout) {
+                for (int i = from < 1 ? 1 : from; i <= to; i++)
+                        cm_spill(cm_get_cell_ptr(active_ctx.body, x0, y0 + i), result_at(r, i));
+                return true;
+        }
+        vals = mem_malloc(MEM_FORMULAS, sizeof *vals * r->h);
+        for (int i = 0; i < r->h; i++)
+                vals[i] = result_at(r, i);
+        fits = cm_spill_block(active_ctx.body, x0, y0, vals, 1, r->h, &r->spill_w, &r->spill_h);
+        mem_free(MEM_FORMULAS, vals);
+        if (!fits) {
+                log_warn("rolling: the result (1x%d) does not fit", r->h);
+                return false;
+        }
+        r->relayout = false;
+        return true;
+}
+
+static void
+destroy_rolling(BuiltinState *s)
+{
+        Rolling *r = (Rolling *) s;
+        builtin_unspill(&r->spill_w, &r->spill_h);
+        mem_free(MEM_FORMULAS, r->in);
+        mem_free(MEM_FORMULAS, r->is_num);
+        mem_free(MEM_FORMULAS, r->out);
+        mem_free(MEM_FORMULAS, r->has_out);
+        mem_free(MEM_FORMULAS, r->deque);
+        mem_free(MEM_FORMULAS, r);
+}
+
+static Rolling *
+new_rolling(RollKind kind, struct Range *range, double param)
+{
+        Rolling *r = mem_calloc(MEM_FORMULAS, 1, sizeof *r);
+        r->base.destroy = destroy_rolling;
+        r->kind = kind;
+        r->range = *range;
+        r->param = param;
+        r->h = range->endy - range->starty + 1;
+        r->in = mem_malloc(MEM_FORMULAS, sizeof *r->in * r->h);
+        r->is_num = mem_malloc(MEM_FORMULAS, sizeof *r->is_num * r->h);
+        r->out = mem_malloc(MEM_FORMULAS, sizeof *r->out * r->h);
+        r->has_out = mem_malloc(MEM_FORMULAS, sizeof *r->has_out * r->h);
+        if (kind == ROLL_MIN || kind == ROLL_MAX) {
+                r->dcap = (param < r->h ? (int) param : r->h) + 1;
+                r->deque = mem_malloc(MEM_FORMULAS, sizeof *r->deque * r->dcap);
+        }
+        r->relayout = true;
+        return r;
+}
+
+static bool
+is_current(Rolling *r, RollKind kind, struct Range *range, double param)
+{
+        return r->kind == kind && !memcmp(&r->range, range, sizeof *range) && r->param == param &&
+               r->mat == active_ctx.body && r->version == cm_layout_version && r->missed == formula_missed;
+}
+
+Value
+rolling_eval(RollKind kind, Expr *args)
+{
+        BuiltinState **state = builtin_state();
+        Rolling *r = (Rolling *) *state, *old = r;
+        struct Range *range;
+        int x0, y0, x, y, from = 0, to = -1;
+        Value v, p;
+
+        if (formula_cell == NULL || args == NULL || args->next == NULL) return VALUE_ERROR;
+        if (VAL_TYPE(v = eval_expr(args)) != TYPE_RANGE) return VALUE_ERROR;
+        range = VAL_RANGE(v);
+        p = eval_expr(args->next);
+        if (range->startx != range->endx || VAL_TYPE(p) != TYPE_NUMBER) return VALUE_ERROR;
+        if (kind == ROLL_EWMA ? !(VAL_NUM(p) > 0 && VAL_NUM(p) <= 1) : !(VAL_NUM(p) >= 1)) return VALUE_ERROR;
+        if (kind != ROLL_EWMA) p = AS_NUMBER(floor(VAL_NUM(p)));
+        if (!cm_get_cell_pos(active_ctx.body, formula_cell, &x0, &y0)) return VALUE_ERROR;
+        /* The result can not be written over the input */
+        if (x0 == range->startx && y0 <= range->endy &&
+            y0 + range->endy - range->starty >= range->starty) return VALUE_ERROR;
+
+        if (r && is_current(r, kind, range, VAL_NUM(p)) && builtin_state_followed(&r->base)) {
+                /* Only the cell that notified the formula has changed since
+                 * the last evaluation */
+                if (formula_notifier && cm_get_cell_pos(active_ctx.body, formula_notifier, &x, &y) &&
+                    x == range->startx && y >= range->starty && y <= range->endy) {
+                        read_row(r, y - range->starty);
+                        from = y - range->starty;
+                        to = compute(r, from);
+                }
+        } else {
+                TRACE_SPAN("rolling: full", "formula");
+                *state = &(r = new_rolling(kind, range, VAL_NUM(p)))->base;
+                if (old) {
+                        /* The new result replaces the old block */
+                        r->spill_w = old->spill_w;
+                        r->spill_h = old->spill_h;
+                        old->spill_w = old->spill_h = 0;
+                        old->base.destroy(&old->base);
+                }
+                if (profile_enabled) profile_range(r->h);
+                for (int i = 0; i < r->h; i++)
+                        read_row(r, i);
+                to = compute(r, -1);
+                r->mat = active_ctx.body;
+                r->version = cm_layout_version;
+                r->missed = formula_missed;
+        }
+        r->base.change = formula_change;
+
+        if (!spill(r, x0, y0, from, to)) return VALUE_ERROR;
+        return result_at(r, 0);
+}
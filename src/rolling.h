@@ -0,0 +1,45 @@
+/*
+ * VICEL - Visual Cell editor
+ * Copyright (C) 2025  Hugo Coto Florez
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * For questions or support, contact: me@hugocoto.com
+ */
+
+#ifndef ROLLING_H_
+#define ROLLING_H_
+
+#include "formula.h"
+
+/* Window functions over a column. The result is a column as tall as the
+ * input, that starts at the formula cell and spills over the cells below it.
+ * Row i of the result is the function of the last k input rows up to row i,
+ * and it is empty while there are less than k. The whole column is computed
+ * in a single pass: sums with a running sum, and min and max with a
+ * monotonic deque. A changed input cell only computes again the k results
+ * whose window has it (or the ones after it, for ewma) */
+
+typedef enum RollKind {
+        ROLL_SUM,
+        ROLL_AVG,
+        ROLL_MIN,
+        ROLL_MAX,
+        ROLL_EWMA,
+} RollKind;
+
+/* rolling_*(range, k) and ewma(range, alpha) */
+Value rolling_eval(RollKind kind, Expr *args);
+
+#endif // !ROLLING_H_
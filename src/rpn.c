@@ -0,0 +1,220 @@
+/*
+ * VICEL - Visual Cell editor
+ * Copyright (C) 2025  Hugo Coto Florez
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * For questions or support, contact: me@hugocoto.com
+ */
+
+#define LOG_CAT LOG_FORMULA
+
+#include "rpn.h"
+#include "common.h"
+#include "debug.h"
+#include "mem.h"
+#include <math.h>
+
+/* Deeper formulas take the generic path */
+#define RPN_STACK 32
+
+typedef enum {
+        OP_NUM,
+        OP_CELL,
+        OP_ADD,
+        OP_SUB,
+        OP_MUL,
+        OP_DIV,
+        OP_POW,
+        OP_NEG,
+        OP_SQUARE,
+} OpCode;
+
+typedef struct Op {
+        OpCode code;
+        union {
+                double num;
+                Cell *cell;
+        } as;
+} Op;
+
+struct RpnProgram {
+        int n;
+        Op ops[];
+};
+
+static int
+binop_code(char *op)
+{
+        if (op[1]) return -1;
+        switch (*op) {
+        case '+': return OP_ADD;
+        case '-': return OP_SUB;
+        case '*': return OP_MUL;
+        case '/': return OP_DIV;
+        case '^': return OP_POW;
+        default: return -1;
+        }
+}
+
+static int
+max(int a, int b)
+{
+        return a > b ? a : b;
+}
+
+/* Number of operations for E, or -1 if it is not arithmetic. *DEPTH is set
+ * to the stack it needs */
+static int
+measure(Expr *e, int *depth)
+{
+        int n, m, d;
+
+        switch (e->type) {
+        case EXPR_LITERAL:
+                *depth = 1;
+                return VAL_TYPE(e->as.literal.value) == TYPE_NUMBER ? 1 : -1;
+        case EXPR_IDENTIFIER:
+                *depth = 1;
+                return 1;
+        case EXPR_BIN:
+                if (binop_code(e->as.binop.op) < 0) return -1;
+                if ((n = measure(e->as.binop.lhs, depth)) < 0) return -1;
+                if ((m = measure(e->as.binop.rhs, &d)) < 0) return -1;
+                *depth = max(*depth, d + 1);
+                return n + m + 1;
+        case EXPR_UN:
+                if (e->as.unop.rhs == NULL) return -1;
+                if (strcmp(e->as.unop.op, "-") && strcmp(e->as.unop.op, "+") &&
+                    strcmp(e->as.unop.op, "^2")) return -1;
+                if ((n = measure(e->as.unop.rhs, depth)) < 0) return -1;
+                return n + (e->as.unop.op[0] != '+');
+        case EXPR_SUM:
+                if ((n = measure(e->as.sum.terms, depth)) < 0) return -1;
+                for (Expr *t = e->as.sum.terms->next; t; t = t->next) {
+                        if ((m = measure(t, &d)) < 0) return -1;
+                        *depth = max(*depth, d + 1);
+                        n += m + 1;
+                }
+                return n;
+        default:
+                return -1;
+        }
+}
+
+static Op *
+emit(Expr *e, Op *op)
+{
+        int i = 1;
+
+        switch (e->type) {
+        case EXPR_LITERAL:
+                *op = (Op) { .code = OP_NUM, .as.num = VAL_NUM(e->as.literal.value) };
+                return op + 1;
+        case EXPR_IDENTIFIER:
+                *op = (Op) { .code = OP_CELL, .as.cell = e->as.identifier.cell };
+                return op + 1;
+        case EXPR_BIN:
+                op = emit(e->as.binop.lhs, op);
+                op = emit(e->as.binop.rhs, op);
+                op->code = binop_code(e->as.binop.op);
+                return op + 1;
+        case EXPR_UN:
+                op = emit(e->as.unop.rhs, op);
+                /* Unary + does nothing to a number */
+                if (e->as.unop.op[0] == '+') return op;
+                op->code = e->as.unop.op[0] == '-' ? OP_NEG : OP_SQUARE;
+                return op + 1;
+        case EXPR_SUM:
+                op = emit(e->as.sum.terms, op);
+                for (Expr *t = e->as.sum.terms->next; t; t = t->next, i++) {
+                        op = emit(t, op);
+                        op->code = e->as.sum.ops[i] == '-' ? OP_SUB : OP_ADD;
+                        ++op;
+                }
+                return op;
+        default:
+                assert(!"rpn: not measured");
+                return op;
+        }
+}
+
+RpnProgram *
+rpn_compile(Expr *body)
+{
+        RpnProgram *p;
+        int n, depth;
+
+        if (body == NULL || (n = measure(body, &depth)) < 0 || depth > RPN_STACK) return NULL;
+        p = mem_malloc(MEM_FORMULAS, sizeof *p + sizeof *p->ops * n);
+        p->n = n;
+        emit(body, p->ops);
+        return p;
+}
+
+bool
+rpn_run(RpnProgram *p, double *result)
+{
+        double stack[RPN_STACK];
+        double *sp = stack;
+        Value v;
+
+        for (Op *op = p->ops, *end = p->ops + p->n; op < end; op++) {
+                switch (op->code) {
+                case OP_NUM:
+                        *sp++ = op->as.num;
+                        break;
+                case OP_CELL:
+                        v = op->as.cell->value;
+                        if (VAL_TYPE(v) == TYPE_FORMULA) v = VAL_FORMULA(v)->value;
+                        if (VAL_TYPE(v) != TYPE_NUMBER) return false;
+                        *sp++ = VAL_NUM(v);
+                        break;
+                case OP_ADD:
+                        --sp;
+                        sp[-1] += sp[0];
+                        break;
+                case OP_SUB:
+                        --sp;
+                        sp[-1] -= sp[0];
+                        break;
+                case OP_MUL:
+                        --sp;
+                        sp[-1] *= sp[0];
+                        break;
+                case OP_DIV:
+                        --sp;
+                        sp[-1] /= sp[0];
+                        break;
+                case OP_POW:
+                        --sp;
+                        sp[-1] = pow(sp[-1], sp[0]);
+                        break;
+                case OP_NEG:
+                        sp[-1] = -sp[-1];
+                        break;
+                case OP_SQUARE:
+                        sp[-1] *= sp[-1];
+                        break;
+                }
+        }
+        *result = stack[0];
+        return true;
+}
+
+void
+rpn_free(RpnProgram *p)
+{
+        mem_free(MEM_FORMULAS, p);
+}
@@ -0,0 +1,41 @@
+/*
+ * VICEL - Visual Cell editor
+ * Copyright (C) 2025  Hugo Coto Florez
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * For questions or support, contact: me@hugocoto.com
+ */
+
+#ifndef RPN_H_
+#define RPN_H_
+
+#include "formula.h"
+
+/* Formulas that only do arithmetic (+, -, *, /, ^) over numbers and cells
+ * are also compiled to a list of operations in reverse polish notation, run
+ * over a stack of doubles. It has the same result as the generic evaluation
+ * as long as every cell read holds a number. Each cell is checked when it is
+ * read and rpn_run fails on anything else, so the formula is evaluated by
+ * eval_expr instead */
+
+typedef struct RpnProgram RpnProgram;
+
+/* NULL if BODY is not plain arithmetic */
+RpnProgram *rpn_compile(Expr *body);
+/* Whether P could be run, leaving its value in RESULT */
+bool rpn_run(RpnProgram *p, double *result);
+void rpn_free(RpnProgram *p);
+
+#endif //! RPN_H_
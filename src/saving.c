@@ -18,14 +18,21 @@
  * For questions or support, contact: me@hugocoto.com
  */
 
+#define LOG_CAT LOG_IO
+#define DA_MEM_CAT MEM_CELLS
+
 #include "saving.h"
 #include "cellmap.h"
 #include "common.h"
 #include "da.h"
 #include "debug.h"
 #include "keyboard.h"
+#include "number.h"
+#include "trace.h"
 #include "window.h"
+#include <errno.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 
 void
@@ -75,25 +82,63 @@ get_sep(char **r, char **c, bool *last)
         return;
 }
 
+/* Column types are guessed from the first rows (after the header). Fields of
+ * text columns are not parsed as numbers here, detect_cell_type() does it
+ * once when the text is set. Fields of other columns are parsed straight
+ * into number cells, without building any string. */
+#define SAMPLE_ROWS 32
+
+enum {
+        HINT_NUMBER = 0,
+        HINT_TEXT,
+};
+
+typedef DA(char) ColumnHints;
+
+/* Strings are generated the first time someone reads them */
+static Cell
+number_cell(double d)
+{
+        return (Cell) {
+                .value = AS_NUMBER(d),
+                .repr = NULL,
+                .meta = NULL,
+                .repr_dirty = true,
+                .input_repr_dirty = true,
+        };
+}
+
 CellArr
-get_line_data(char *line)
+get_line_data(char *line, ColumnHints *hints, bool sample)
 {
         CellArr ca = (CellArr) { 0 };
         size_t len = strlen(line);
         bool last = false;
         Cell cell;
+        double d;
         char *r = line;
         char *c = line;
+        int x = 0;
 
         do {
                 get_sep(&r, &c, &last);
                 if (line + len == r) break;
                 *c = 0;
-                cell = EMPTY_CELL;
-                free(cell.repr);
-                cell.repr = strdup(r);
-                da_append(&ca, cell);
+                if (x >= hints->size) da_append(hints, HINT_NUMBER);
+
+                if (*r == 0) {
+                        da_append(&ca, EMPTY_CELL);
+                } else if (hints->data[x] == HINT_NUMBER && num_parse(r, strlen(r), &d)) {
+                        da_append(&ca, number_cell(d));
+                } else {
+                        if (sample) hints->data[x] = HINT_TEXT;
+                        cell = EMPTY_CELL;
+                        free(cell.repr);
+                        cell.repr = strdup(r);
+                        da_append(&ca, cell);
+                }
                 r = c + 1;
+                ++x;
         } while (!last);
         return ca;
 }
@@ -102,6 +147,7 @@ bool
 get_data(CellMat *cm, FILE *f, int *max_size)
 {
         char line[1024 * 1024];
+        ColumnHints hints = { 0 };
         CellArr ca;
         char *c;
         *max_size = 0;
@@ -110,18 +156,20 @@ get_data(CellMat *cm, FILE *f, int *max_size)
                 if ((c = strchr(line, '\n'))) *c = 0;
                 if ((c = strchr(line, '\r'))) *c = 0;
 
-                report("Line: `%s`", line);
+                log_trace("Line: `%s`", line);
                 remove_spaces(line);
-                ca = get_line_data(line);
+                ca = get_line_data(line, &hints, cm->size > 0 && cm->size <= SAMPLE_ROWS);
                 da_append(cm, ca);
                 *max_size = max(*max_size, ca.size);
         }
+        da_destroy(&hints);
         return *max_size == 0;
 }
 
 void
 load(char *filename, Context *ctx)
 {
+        TRACE_SPAN("load", "io");
         int max_size;
         FILE *f;
         ctx->cursor_pos_c = 0;
@@ -135,24 +183,42 @@ load(char *filename, Context *ctx)
         f = fopen(filename, "r");
 
         if (f == NULL) {
-                report("Fail to load from %s", filename);
+                log_warn("Fail to load from %s", filename);
                 goto load_blank;
         }
 
-        ctx->body = calloc(1, sizeof(CellMat));
-        if (get_data(ctx->body, f, &max_size)) {
-                free(ctx->body);
-                report("Load empty file");
-                goto load_blank;
+        ctx->body = mem_calloc(MEM_CELLS, 1, sizeof(CellMat));
+        {
+                TRACE_SPAN("load: read", "io");
+                if (get_data(ctx->body, f, &max_size)) {
+                        mem_free(MEM_CELLS, ctx->body);
+                        report("Load empty file");
+                        goto load_blank;
+                }
         }
 
+        /* Pad every row before parsing any formula: growing a row moves its
+         * cells, and formulas keep pointers to the cells they depend on */
         for_da_each(row, *ctx->body)
         {
                 while (row->size < max_size)
                         da_append(row, EMPTY_CELL);
-                for_da_each(c, *row)
+        }
+
+        /* Own block: the gotos above jump over it to load_blank */
+        {
+                TRACE_SPAN("load: cells", "io");
+                for_da_each(row, *ctx->body)
                 {
-                        set_cell_text(c, strdup(c->repr));
+                        for_da_each(c, *row)
+                        {
+                                if (VAL_TYPE(c->value) == TYPE_NUMBER || *c->repr == 0) continue;
+                                /* Written by a formula loaded before */
+                                if (c->meta && c->meta->spilled) continue;
+                                char *text = c->repr;
+                                c->repr = NULL;
+                                set_cell_text(c, text);
+                        }
                 }
         }
 
@@ -169,9 +235,62 @@ create_new_filename(Context *ctx)
         return mkstemp(ctx->filename);
 }
 
+/* The csv is formatted here and written in big blocks, not per cell */
+static struct {
+        int fd;
+        size_t len;
+        char data[1 << 16];
+} out;
+
+static void
+write_all(int fd, const char *s, size_t n)
+{
+        ssize_t w;
+        while (n > 0) {
+                if ((w = write(fd, s, n)) < 0) {
+                        if (errno == EINTR) continue;
+                        log_warn("save: write failed: %s", strerror(errno));
+                        return;
+                }
+                s += w;
+                n -= w;
+        }
+}
+
+static void
+out_flush()
+{
+        write_all(out.fd, out.data, out.len);
+        out.len = 0;
+}
+
+static void
+out_put(const char *s, size_t n)
+{
+        if (out.len + n > sizeof out.data) {
+                out_flush();
+                if (n > sizeof out.data) {
+                        write_all(out.fd, s, n);
+                        return;
+                }
+        }
+        memcpy(out.data + out.len, s, n);
+        out.len += n;
+}
+
+/* S between quotes, as a field */
+static void
+out_field(const char *s)
+{
+        out_put("\"", 1);
+        out_put(s, strlen(s));
+        out_put("\",", 2);
+}
+
 void
 save(Context *ctx)
 {
+        TRACE_SPAN("save", "io");
         int fd;
 
         fd = ctx->filename ?
@@ -179,25 +298,41 @@ save(Context *ctx)
              create_new_filename(ctx);
 
         if (fd < 0) {
-                report("Can't open %s to write", ctx->filename);
+                log_warn("Can't open %s to write", ctx->filename);
                 /* Its better to get it in the stdout than to lose the data */
                 fd = STDOUT_FILENO;
                 ctx->filename = NULL; // may cause a chain of errors
         }
 
+        out.fd = fd;
+        out.len = 0;
         for_da_each(row, *ctx->body)
         {
                 for_da_each(c, *row)
                 {
-                        if (c->input_repr && *c->input_repr)
-                                dprintf(fd, "\"%s\",", c->input_repr);
+                        if (c->meta && c->meta->spilled) {
+                                out_put(",", 1);
+                                continue;
+                        }
+                        if (VAL_TYPE(c->value) == TYPE_NUMBER) {
+                                /* Format it here instead of building input_repr */
+                                char buf[NUM_BUFSIZE];
+                                num_format(VAL_NUM(c->value), buf);
+                                out_field(buf);
+                                continue;
+                        }
+                        char *input_repr = cm_input_repr(c);
+                        if (input_repr && *input_repr)
+                                out_field(input_repr);
                         else
-                                dprintf(fd, "%s,", c->input_repr);
+                                out_put(",", 1);
                 }
-                dprintf(fd, "\n");
+                out_put("\n", 1);
         }
+        out_flush();
 
         if (ftruncate(fd, lseek(fd, 0, SEEK_CUR))) {
-                report("ftruncate failed: csv might be corrupted");
+                log_warn("ftruncate failed: csv might be corrupted");
         }
+        if (fd != STDOUT_FILENO) close(fd);
 }
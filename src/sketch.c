@@ -0,0 +1,745 @@
+/*
+ * VICEL - Visual Cell editor
+ * Copyright (C) 2025  Hugo Coto Florez
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * For questions or support, contact: me@hugocoto.com
+ */
+
+#define LOG_CAT LOG_FORMULA
+
+#include "sketch.h"
+#include "builtin.h"
+#include "common.h"
+#include "debug.h"
+#include "eval.h"
+#include "lookup.h"
+#include "mem.h"
+#include "profile.h"
+#include "trace.h"
+#include "window.h"
+#include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#define SKETCH_CHUNK_ROWS 32768
+#define SKETCH_MAX_THREADS 8
+/* Build again when the changes since the last build reach 1/SKETCH_DRIFT of
+ * what the sketch counts */
+#define SKETCH_DRIFT 64
+
+#define HLL_BITS 12 // 4096 registers, about 1.6% of error
+#define HLL_SIZE (1 << HLL_BITS)
+
+#define KLL_K 200 // size of the top level, about 1.7% of rank error
+#define KLL_MIN 8 // size of the lowest levels
+#define KLL_MAX_LEVELS 40
+
+#define TOPK_COUNTERS 256
+#define TOPK_MAX 64
+
+typedef enum SketchKind {
+        SKETCH_DISTINCT,
+        SKETCH_PERCENTILE,
+        SKETCH_TOPK,
+} SketchKind;
+
+typedef struct Hll {
+        unsigned char reg[HLL_SIZE];
+        /* Kept as registers change, for estimates without reading them */
+        double sum; // of 2^-reg
+        int zeros;  // registers at 0
+} Hll;
+
+typedef struct Kll {
+        struct {
+                double *data;
+                int size, capacity;
+        } level[KLL_MAX_LEVELS]; // items of level h weight 2^h
+        int capacity[KLL_MAX_LEVELS]; // items that make level h compact
+        int nlevels;
+        long n;       // items added
+        uint64_t rng; // which half a compaction keeps
+} Kll;
+
+typedef struct Counter {
+        Value key; // text owned by the counter
+        uint64_t hash;
+        long count; // may include values it replaced
+} Counter;
+
+/* Space saving: a value without counter takes the one with the lowest count
+ * when all of them are in use */
+typedef struct TopK {
+        Counter c[TOPK_COUNTERS];
+        int size;
+        int heap[TOPK_COUNTERS];     // counters by count, lowest first
+        int pos[TOPK_COUNTERS];      // place of each counter in heap
+        int slot[2 * TOPK_COUNTERS]; // counter + 1 by hash, 0 if free
+        long n;
+} TopK;
+
+typedef struct Sketch {
+        BuiltinState base;
+        SketchKind kind;
+        struct Range range;
+        void *part; // Hll, Kll or TopK
+        /* A bit for each cell of the range (by rows) whose value is in the
+         * sketch. Only changing those leaves a value that is no longer there */
+        unsigned char *seen;
+        long stale; // values counted that may no longer be in the range
+        /* Block written by the last evaluation, for approx_topk */
+        int spill_w, spill_h;
+        CellMat *mat;
+        unsigned version;
+        unsigned missed;
+} Sketch;
+
+typedef struct Chunk {
+        Sketch *s;
+        int lo, hi;
+        void *part;
+} Chunk;
+
+static Value
+value_at(struct Range *r, int x, int y)
+{
+        Cell *c = cm_get_cell_ptr(active_ctx.body, r->startx + x, r->starty + y);
+        if (c == NULL) return VALUE_EMPTY;
+        if (VAL_TYPE(c->value) == TYPE_FORMULA) return VAL_FORMULA(c->value)->value;
+        if (VAL_TYPE(c->value) == TYPE_TEXT && (!VAL_TEXT(c->value) || !*VAL_TEXT(c->value))) return VALUE_EMPTY;
+        return c->value;
+}
+
+static uint64_t
+hash_bytes(uint64_t h, const void *data, size_t len)
+{
+        const unsigned char *b = data;
+        for (size_t i = 0; i < len; i++) {
+                h ^= b[i];
+                h *= 0x100000001b3ULL;
+        }
+        return h;
+}
+
+/* FNV does not spread the bits of short keys, HyperLogLog needs all of them
+ * to look random */
+static uint64_t
+hash_value(Value v)
+{
+        uint64_t h = 0xcbf29ce484222325ULL;
+        CellType type = VAL_TYPE(v);
+        bool b = VAL_BOOL(v);
+        h = hash_bytes(h, &type, sizeof type);
+        switch (type) {
+        case TYPE_NUMBER:
+                if (VAL_NUM(v) == 0) v = AS_NUMBER(0); // no -0
+                h = hash_bytes(h, &VAL_NUM(v), sizeof(double));
+                break;
+        case TYPE_BOOL: h = hash_bytes(h, &b, sizeof b); break;
+        case TYPE_TEXT: h = hash_bytes(h, VAL_TEXT(v), strlen(VAL_TEXT(v))); break;
+        default: break;
+        }
+        h ^= h >> 30;
+        h *= 0xbf58476d1ce4e5b9ULL;
+        h ^= h >> 27;
+        h *= 0x94d049bb133111ebULL;
+        h ^= h >> 31;
+        return h;
+}
+
+static bool
+same_value(Value a, Value b)
+{
+        if (VAL_TYPE(a) != VAL_TYPE(b)) return false;
+        switch (VAL_TYPE(a)) {
+        case TYPE_NUMBER: return VAL_NUM(a) == VAL_NUM(b);
+        case TYPE_BOOL: return VAL_BOOL(a) == VAL_BOOL(b);
+        case TYPE_TEXT: return !strcmp(VAL_TEXT(a), VAL_TEXT(b));
+        default: return true;
+        }
+}
+
+/* HyperLogLog */
+
+static void
+hll_init(Hll *h)
+{
+        h->sum = HLL_SIZE;
+        h->zeros = HLL_SIZE;
+}
+
+static void
+hll_set(Hll *h, int i, int rank)
+{
+        if (rank <= h->reg[i]) return;
+        h->sum += ldexp(1, -rank) - ldexp(1, -h->reg[i]);
+        h->zeros -= h->reg[i] == 0;
+        h->reg[i] = rank;
+}
+
+static void
+hll_add(Hll *h, Value v)
+{
+        uint64_t x = hash_value(v), rest = x << HLL_BITS;
+        hll_set(h, x >> (64 - HLL_BITS), rest ? __builtin_clzll(rest) + 1 : 64 - HLL_BITS + 1);
+}
+
+static void
+hll_merge(Hll *h, Hll *o)
+{
+        for (int i = 0; i < HLL_SIZE; i++)
+                hll_set(h, i, o->reg[i]);
+}
+
+static double
+hll_estimate(Hll *h)
+{
+        double m = HLL_SIZE, e = 0.7213 / (1 + 1.079 / m) * m * m / h->sum;
+        /* Linear counting is better while many registers are empty */
+        if (e <= 2.5 * m && h->zeros) e = m * log(m / h->zeros);
+        return round(e);
+}
+
+/* KLL */
+
+/* Levels get smaller by 2/3 from the top one */
+static void
+kll_levels(Kll *k, int nlevels)
+{
+        double c = KLL_K;
+        k->nlevels = nlevels;
+        for (int h = nlevels - 1; h >= 0; h--, c *= 2.0 / 3.0)
+                k->capacity[h] = c < KLL_MIN ? KLL_MIN : (int) ceil(c);
+}
+
+static void
+kll_push(Kll *k, int h, double x)
+{
+        if (h >= k->nlevels) kll_levels(k, h + 1);
+        if (k->level[h].size == k->level[h].capacity) {
+                k->level[h].capacity = k->level[h].capacity ? k->level[h].capacity * 2 : 16;
+                k->level[h].data = mem_realloc(MEM_FORMULAS, k->level[h].data,
+                                               sizeof *k->level[h].data * k->level[h].capacity);
+        }
+        k->level[h].data[k->level[h].size++] = x;
+}
+
+static int
+cmp_double(const void *a, const void *b)
+{
+        double x = *(const double *) a, y = *(const double *) b;
+        return (x > y) - (x < y);
+}
+
+/* Half of the items of level H, the odd or the even ones once sorted, go up
+ * a level with twice the weight */
+static void
+kll_compact(Kll *k, int h)
+{
+        double *d = k->level[h].data;
+        int size = k->level[h].size, odd = size & 1, offset;
+
+        qsort(d, size, sizeof *d, cmp_double);
+        k->rng ^= k->rng << 13;
+        k->rng ^= k->rng >> 7;
+        k->rng ^= k->rng << 17;
+        offset = k->rng & 1;
+        for (int i = offset; i < size - odd; i += 2)
+                kll_push(k, h + 1, d[i]);
+        if (odd) d[0] = d[size - 1];
+        k->level[h].size = odd;
+}
+
+static void
+kll_compress(Kll *k)
+{
+        for (int h = 0; h < k->nlevels && h < KLL_MAX_LEVELS - 1; h++)
+                if (k->level[h].size >= k->capacity[h]) kll_compact(k, h);
+}
+
+static void
+kll_add(Kll *k, double x)
+{
+        kll_push(k, 0, x);
+        k->n++;
+        if (k->level[0].size >= k->capacity[0]) kll_compress(k);
+}
+
+static void
+kll_merge(Kll *k, Kll *o)
+{
+        for (int h = 0; h < o->nlevels; h++)
+                for (int i = 0; i < o->level[h].size; i++)
+                        kll_push(k, h, o->level[h].data[i]);
+        k->n += o->n;
+        kll_compress(k);
+}
+
+typedef struct Weighted {
+        double x;
+        long w;
+} Weighted;
+
+static int
+cmp_weighted(const void *a, const void *b)
+{
+        return cmp_double(&((const Weighted *) a)->x, &((const Weighted *) b)->x);
+}
+
+/* Percentile Q from 0 to 1. Without compactions there are all the numbers,
+ * and it is the same as percentile() */
+static Value
+kll_percentile(Kll *k, double q)
+{
+        Weighted *all;
+        double h = (k->n - 1) * q, *d, x;
+        long rank = 0;
+        int n = 0, i;
+
+        if (k->n == 0) return VALUE_ERROR;
+        if (k->nlevels == 1) {
+                d = k->level[0].data;
+                qsort(d, k->level[0].size, sizeof *d, cmp_double);
+                i = (int) h;
+                if (i + 1 >= k->level[0].size) return AS_NUMBER(d[i]);
+                return AS_NUMBER(d[i] + (h - i) * (d[i + 1] - d[i]));
+        }
+
+        for (int l = 0; l < k->nlevels; l++)
+                n += k->level[l].size;
+        all = mem_malloc(MEM_FORMULAS, sizeof *all * n);
+        n = 0;
+        for (int l = 0; l < k->nlevels; l++)
+                for (int j = 0; j < k->level[l].size; j++)
+                        all[n++] = (Weighted) { k->level[l].data[j], 1L << l };
+        qsort(all, n, sizeof *all, cmp_weighted);
+        for (i = 0; i < n - 1 && rank + all[i].w <= (long) h; i++)
+                rank += all[i].w;
+        x = all[i].x;
+        mem_free(MEM_FORMULAS, all);
+        return AS_NUMBER(x);
+}
+
+/* Space saving */
+
+static int
+topk_find(TopK *t, Value key, uint64_t hash)
+{
+        int mask = 2 * TOPK_COUNTERS - 1, i = hash & mask, c;
+        while ((c = t->slot[i] - 1) >= 0) {
+                if (t->c[c].hash == hash && same_value(t->c[c].key, key)) return i;
+                i = (i + 1) & mask;
+        }
+        return i;
+}
+
+/* Free slot I, moving back the ones after it that would be unreachable */
+static void
+topk_unslot(TopK *t, int i)
+{
+        int mask = 2 * TOPK_COUNTERS - 1, j = i, home;
+        for (;;) {
+                j = (j + 1) & mask;
+                if (t->slot[j] == 0) break;
+                home = t->c[t->slot[j] - 1].hash & mask;
+                if (((j - home) & mask) >= ((j - i) & mask)) {
+                        t->slot[i] = t->slot[j];
+                        i = j;
+                }
+        }
+        t->slot[i] = 0;
+}
+
+static void
+topk_swap(TopK *t, int a, int b)
+{
+        int c = t->heap[a];
+        t->heap[a] = t->heap[b];
+        t->heap[b] = c;
+        t->pos[t->heap[a]] = a;
+        t->pos[t->heap[b]] = b;
+}
+
+static void
+topk_sift_up(TopK *t, int i)
+{
+        while (i > 0 && t->c[t->heap[i]].count < t->c[t->heap[(i - 1) / 2]].count) {
+                topk_swap(t, i, (i - 1) / 2);
+                i = (i - 1) / 2;
+        }
+}
+
+static void
+topk_sift_down(TopK *t, int i)
+{
+        int child;
+        while ((child = 2 * i + 1) < t->size) {
+                if (child + 1 < t->size && t->c[t->heap[child + 1]].count < t->c[t->heap[child]].count)
+                        child++;
+                if (t->c[t->heap[i]].count <= t->c[t->heap[child]].count) break;
+                topk_swap(t, i, child);
+                i = child;
+        }
+}
+
+static void
+topk_set_key(Counter *c, Value key, uint64_t hash)
+{
+        if (VAL_TYPE(c->key) == TYPE_TEXT) mem_free(MEM_FORMULAS, VAL_TEXT(c->key));
+        c->key = key;
+        if (VAL_TYPE(key) == TYPE_TEXT) c->key = AS_TEXT(mem_strdup(MEM_FORMULAS, VAL_TEXT(key)));
+        c->hash = hash;
+}
+
+static void
+topk_add_weighted(TopK *t, Value key, uint64_t hash, long w)
+{
+        int s = topk_find(t, key, hash), c;
+
+        t->n += w;
+        if (t->slot[s]) {
+                c = t->slot[s] - 1;
+                t->c[c].count += w;
+                topk_sift_down(t, t->pos[c]);
+                return;
+        }
+        if (t->size < TOPK_COUNTERS) {
+                c = t->size++;
+                t->c[c] = (Counter) { .key = VALUE_EMPTY, .count = w };
+                topk_set_key(t->c + c, key, hash);
+                t->slot[s] = c + 1;
+                t->heap[t->size - 1] = c;
+                t->pos[c] = t->size - 1;
+                topk_sift_up(t, t->size - 1);
+                return;
+        }
+        c = t->heap[0];
+        topk_unslot(t, topk_find(t, t->c[c].key, t->c[c].hash));
+        topk_set_key(t->c + c, key, hash);
+        t->c[c].count += w;
+        t->slot[topk_find(t, key, hash)] = c + 1;
+        topk_sift_down(t, 0);
+}
+
+static void
+topk_add(TopK *t, Value v)
+{
+        topk_add_weighted(t, v, hash_value(v), 1);
+}
+
+static void
+topk_merge(TopK *t, TopK *o)
+{
+        for (int i = 0; i < o->size; i++)
+                topk_add_weighted(t, o->c[i].key, o->c[i].hash, o->c[i].count);
+}
+
+/* Whether X goes before Y in the result */
+static bool
+before(Counter *x, Counter *y)
+{
+        if (x->count != y->count) return x->count > y->count;
+        return lookup_cmp(x->key, y->key) < 0;
+}
+
+/* Put the first K counters in TOP, in order. Returns how many there are */
+static int
+topk_top(TopK *t, Counter **top, int k)
+{
+        int n = 0, j;
+        for (int i = 0; i < t->size; i++) {
+                if (n == k && !before(t->c + i, top[n - 1])) continue;
+                if (n < k) n++;
+                for (j = n - 1; j > 0 && before(t->c + i, top[j - 1]); j--)
+                        top[j] = top[j - 1];
+                top[j] = t->c + i;
+        }
+        return n;
+}
+
+/* Generic part of the sketch */
+
+static void *
+part_new(SketchKind kind)
+{
+        switch (kind) {
+        case SKETCH_DISTINCT: {
+                Hll *h = mem_calloc(MEM_FORMULAS, 1, sizeof *h);
+                hll_init(h);
+                return h;
+        }
+        case SKETCH_PERCENTILE: {
+                Kll *k = mem_calloc(MEM_FORMULAS, 1, sizeof *k);
+                kll_levels(k, 1);
+                k->rng = 0x9e3779b97f4a7c15ULL;
+                return k;
+        }
+        case SKETCH_TOPK: return mem_calloc(MEM_FORMULAS, 1, sizeof(TopK));
+        }
+        return NULL;
+}
+
+static void
+part_free(SketchKind kind, void *part)
+{
+        Kll *k = part;
+        TopK *t = part;
+
+        if (part == NULL) return;
+        if (kind == SKETCH_PERCENTILE)
+                for (int h = 0; h < k->nlevels; h++)
+                        mem_free(MEM_FORMULAS, k->level[h].data);
+        if (kind == SKETCH_TOPK)
+                for (int i = 0; i < t->size; i++)
+                        if (VAL_TYPE(t->c[i].key) == TYPE_TEXT) mem_free(MEM_FORMULAS, VAL_TEXT(t->c[i].key));
+        mem_free(MEM_FORMULAS, part);
+}
+
+/* Returns whether V counts for the sketch */
+static bool
+part_add(SketchKind kind, void *part, Value v)
+{
+        if (VAL_TYPE(v) == TYPE_EMPTY) return false;
+        switch (kind) {
+        case SKETCH_DISTINCT:
+                hll_add(part, v);
+                return true;
+        case SKETCH_PERCENTILE:
+                if (VAL_TYPE(v) != TYPE_NUMBER || isnan(VAL_NUM(v))) return false;
+                kll_add(part, VAL_NUM(v));
+                return true;
+        case SKETCH_TOPK:
+                topk_add(part, v);
+                return true;
+        }
+        return false;
+}
+
+static void
+part_merge(SketchKind kind, void *part, void *other)
+{
+        switch (kind) {
+        case SKETCH_DISTINCT: hll_merge(part, other); break;
+        case SKETCH_PERCENTILE: kll_merge(part, other); break;
+        case SKETCH_TOPK: topk_merge(part, other); break;
+        }
+}
+
+/* Number of values the sketch stands for, to know when it is too stale */
+static double
+part_weight(SketchKind kind, void *part)
+{
+        switch (kind) {
+        case SKETCH_DISTINCT: return hll_estimate(part);
+        case SKETCH_PERCENTILE: return ((Kll *) part)->n;
+        case SKETCH_TOPK: return ((TopK *) part)->n;
+        }
+        return 0;
+}
+
+/* Add the rows of C to its own part. Only reads cells, so chunks can run at
+ * the same time */
+static void *
+scan_chunk(void *arg)
+{
+        Chunk *c = arg;
+        struct Range *r = &c->s->range;
+        int w = r->endx - r->startx + 1;
+
+        long i;
+
+        c->part = part_new(c->s->kind);
+        for (int y = c->lo; y < c->hi; y++) {
+                for (int x = 0; x < w; x++) {
+                        i = (long) y * w + x;
+                        if (part_add(c->s->kind, c->part, value_at(r, x, y)))
+                                c->s->seen[i / 8] |= 1 << i % 8;
+                        else
+                                c->s->seen[i / 8] &= ~(1 << i % 8);
+                }
+        }
+        return NULL;
+}
+
+static int
+thread_count(int rows)
+{
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        int n = rows / SKETCH_CHUNK_ROWS;
+        if (n > cpus) n = cpus;
+        if (n > SKETCH_MAX_THREADS) n = SKETCH_MAX_THREADS;
+        return n < 1 ? 1 : n;
+}
+
+/* Build the sketch from every cell of the range. Chunks are merged in order,
+ * so the result does not depend on how threads run */
+static void
+full_scan(Sketch *s)
+{
+        TRACE_SPAN("sketch: scan", "formula");
+        Chunk chunks[SKETCH_MAX_THREADS];
+        pthread_t threads[SKETCH_MAX_THREADS];
+        bool started[SKETCH_MAX_THREADS] = { 0 };
+        int h = s->range.endy - s->range.starty + 1, n = thread_count(h);
+
+        if (profile_enabled) profile_range(h * (s->range.endx - s->range.startx + 1));
+        /* Chunks start at a multiple of 8 rows, so they do not share bytes of
+         * seen */
+        for (int i = 0; i < n; i++)
+                chunks[i] = (Chunk) { .s = s, .lo = (h * (long) i / n) & ~7, .hi = (h * (long) (i + 1) / n) & ~7 };
+        chunks[n - 1].hi = h;
+        for (int i = 1; i < n; i++)
+                started[i] = !pthread_create(threads + i, NULL, scan_chunk, chunks + i);
+        for (int i = 0; i < n; i++)
+                if (!started[i]) scan_chunk(chunks + i);
+
+        part_free(s->kind, s->part);
+        s->part = chunks[0].part;
+        for (int i = 1; i < n; i++) {
+                if (started[i]) pthread_join(threads[i], NULL);
+                part_merge(s->kind, s->part, chunks[i].part);
+                part_free(s->kind, chunks[i].part);
+        }
+
+        s->stale = 0;
+        s->mat = active_ctx.body;
+        s->version = cm_layout_version;
+        s->missed = formula_missed;
+}
+
+/* Only the cell that notified the formula has changed since the last
+ * evaluation. Its old value can not be taken out, so it is still counted
+ * until the next build */
+static void
+update_notifier(Sketch *s)
+{
+        struct Range *r = &s->range;
+        int x, y;
+        long i;
+
+        if (!cm_get_cell_pos(active_ctx.body, formula_notifier, &x, &y)) return;
+        if (x < r->startx || x > r->endx || y < r->starty || y > r->endy) return;
+        x -= r->startx;
+        y -= r->starty;
+        i = (long) y * (r->endx - r->startx + 1) + x;
+        if (s->seen[i / 8] & 1 << i % 8)
+                s->stale++;
+        if (part_add(s->kind, s->part, value_at(r, x, y)))
+                s->seen[i / 8] |= 1 << i % 8;
+}
+
+static void
+destroy_sketch(BuiltinState *b)
+{
+        Sketch *s = (Sketch *) b;
+        builtin_unspill(&s->spill_w, &s->spill_h);
+        part_free(s->kind, s->part);
+        mem_free(MEM_FORMULAS, s->seen);
+        mem_free(MEM_FORMULAS, s);
+}
+
+static bool
+is_current(Sketch *s, SketchKind kind, struct Range *r)
+{
+        return s->kind == kind && !memcmp(&s->range, r, sizeof *r) && s->mat == active_ctx.body &&
+               s->version == cm_layout_version && s->missed == formula_missed;
+}
+
+static Sketch *
+sketch_get(SketchKind kind, Expr *args)
+{
+        BuiltinState **state = builtin_state();
+        Sketch *s = (Sketch *) *state, *old = s;
+        Value v;
+        bool current;
+
+        if (args == NULL || VAL_TYPE(v = eval_expr(args)) != TYPE_RANGE) return NULL;
+
+        current = s && is_current(s, kind, VAL_RANGE(v)) && builtin_state_followed(&s->base);
+        if (current && formula_notifier)
+                update_notifier(s);
+        else if (!current) {
+                s = mem_calloc(MEM_FORMULAS, 1, sizeof *s);
+                s->base.destroy = destroy_sketch;
+                s->kind = kind;
+                s->range = *VAL_RANGE(v);
+                s->seen = mem_calloc(MEM_FORMULAS, ((long) (s->range.endx - s->range.startx + 1) *
+                                                            (s->range.endy - s->range.starty + 1) + 7) / 8, 1);
+                if (old) {
+                        /* The new result replaces the old block */
+                        s->spill_w = old->spill_w;
+                        s->spill_h = old->spill_h;
+                        old->spill_w = old->spill_h = 0;
+                        old->base.destroy(&old->base);
+                }
+                *state = &s->base;
+                full_scan(s);
+        }
+        s->base.change = formula_change;
+        if (s->stale && s->stale * SKETCH_DRIFT > part_weight(kind, s->part))
+                full_scan(s);
+        return s;
+}
+
+Value
+sketch_distinct(Expr *args)
+{
+        Sketch *s = sketch_get(SKETCH_DISTINCT, args);
+        if (s == NULL) return VALUE_ERROR;
+        return AS_NUMBER(hll_estimate(s->part));
+}
+
+Value
+sketch_percentile(Expr *args)
+{
+        Sketch *s;
+        Value q;
+
+        if (args == NULL || args->next == NULL) return VALUE_ERROR;
+        q = eval_expr(args->next);
+        if (VAL_TYPE(q) != TYPE_NUMBER || !(VAL_NUM(q) >= 0 && VAL_NUM(q) <= 1)) return VALUE_ERROR;
+        if ((s = sketch_get(SKETCH_PERCENTILE, args)) == NULL) return VALUE_ERROR;
+        return kll_percentile(s->part, VAL_NUM(q));
+}
+
+Value
+sketch_topk(Expr *args)
+{
+        Counter *top[TOPK_MAX];
+        Value vals[2 * TOPK_MAX], k;
+        Sketch *s;
+        TopK *t;
+        int n, x, y;
+
+        if (formula_cell == NULL || args == NULL || args->next == NULL) return VALUE_ERROR;
+        k = eval_expr(args->next);
+        if (VAL_TYPE(k) != TYPE_NUMBER || !(VAL_NUM(k) >= 1 && VAL_NUM(k) <= TOPK_MAX)) return VALUE_ERROR;
+        if ((s = sketch_get(SKETCH_TOPK, args)) == NULL) return VALUE_ERROR;
+        if (!cm_get_cell_pos(active_ctx.body, formula_cell, &x, &y)) return VALUE_ERROR;
+
+        t = s->part;
+        n = topk_top(t, top, (int) VAL_NUM(k));
+        for (int i = 0; i < n; i++) {
+                vals[2 * i] = top[i]->key;
+                vals[2 * i + 1] = AS_NUMBER(top[i]->count);
+        }
+        if (!cm_spill_block(active_ctx.body, x, y, vals, 2, n, &s->spill_w, &s->spill_h)) {
+                log_warn("approx_topk: the result (2x%d) does not fit", n);
+                return VALUE_ERROR;
+        }
+        return n ? vals[0] : VALUE_EMPTY;
+}
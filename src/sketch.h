@@ -0,0 +1,42 @@
+/*
+ * VICEL - Visual Cell editor
+ * Copyright (C) 2025  Hugo Coto Florez
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * For questions or support, contact: me@hugocoto.com
+ */
+
+#ifndef SKETCH_H_
+#define SKETCH_H_
+
+#include "formula.h"
+
+/* Approximate aggregates over big ranges. Each formula keeps a small sketch
+ * of fixed size of the values of its range: a HyperLogLog for the number of
+ * distinct values, a KLL sketch for percentiles and a space saving summary
+ * for the most frequent values. Sketches are mergeable, so big ranges are
+ * scanned in parallel. A changed cell adds its new value to the sketch. If
+ * the cell had a value counted (there is a bit per cell for that) the old
+ * one can not be taken out, and once those could make an error like the one
+ * of the sketch it is built again. Small ranges get exact results. */
+
+/* approx_distinct(range) */
+Value sketch_distinct(Expr *args);
+/* approx_percentile(range, k), with k from 0 to 1 */
+Value sketch_percentile(Expr *args);
+/* approx_topk(range, k): spills the k most frequent values and their counts */
+Value sketch_topk(Expr *args);
+
+#endif // !SKETCH_H_
@@ -0,0 +1,598 @@
+/*
+ * VICEL - Visual Cell editor
+ * Copyright (C) 2025  Hugo Coto Florez
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * For questions or support, contact: me@hugocoto.com
+ */
+
+#define LOG_CAT LOG_CELL
+
+#include "sort.h"
+#include "common.h"
+#include "debug.h"
+#include "formula.h"
+#include "lookup.h"
+#include "mem.h"
+#include "trace.h"
+#include "window.h"
+#include <pthread.h>
+#include <unistd.h>
+
+/* Rows sorted by each thread. Smaller ranges are sorted by the calling thread */
+#define SORT_CHUNK_ROWS 65536
+#define SORT_MAX_THREADS 8
+/* Runs this short are sorted by insertion */
+#define SORT_RUN 24
+
+/* The first key of a row, ready to be compared. Rows are sorted as an array
+ * of them, so most comparisons do not leave it */
+typedef struct SortItem {
+        /* Numbers and booleans as integers in the same order, and the first
+         * bytes of texts in lowercase. Texts that begin the same are
+         * compared whole */
+        uint64_t key;
+        int rank; // see RANK_NUMBER
+        int row;  // offset from the first row
+} SortItem;
+
+typedef struct SortCtx {
+        SortKey *keys;
+        int nkeys;
+        Value **vals; // value of each key in each row
+} SortCtx;
+
+typedef struct SortJob {
+        SortCtx *s;
+        SortItem *a, *tmp;
+        int lo, mid, hi;
+} SortJob;
+
+/* Formula that depends on the sorted rows or is in them */
+typedef struct Dependent {
+        Cell *c;
+        int moved;    // rows it moves
+        bool reparse; // its references have to be resolved again
+} Dependent;
+
+static bool
+is_empty(Value v)
+{
+        return VAL_TYPE(v) == TYPE_EMPTY || (VAL_TYPE(v) == TYPE_TEXT && (!VAL_TEXT(v) || !*VAL_TEXT(v)));
+}
+
+/* Order of lookup_cmp, and empty cells after everything else */
+enum {
+        RANK_NUMBER,
+        RANK_TEXT,
+        RANK_BOOL,
+        RANK_OTHER,
+        RANK_EMPTY,
+};
+
+static SortItem
+sort_item(Value v, int row)
+{
+        SortItem it = { .row = row, .rank = RANK_OTHER };
+        const char *text;
+        double num;
+
+        if (is_empty(v)) {
+                it.rank = RANK_EMPTY;
+                return it;
+        }
+        switch (VAL_TYPE(v)) {
+        case TYPE_NUMBER:
+                it.rank = RANK_NUMBER;
+                /* -0 is 0. Negative numbers have their bits reversed */
+                num = VAL_NUM(v) == 0 ? 0 : VAL_NUM(v);
+                memcpy(&it.key, &num, sizeof num);
+                it.key = it.key >> 63 ? ~it.key : it.key | 1ull << 63;
+                break;
+        case TYPE_TEXT:
+                it.rank = RANK_TEXT;
+                text = VAL_TEXT(v) ?: "";
+                for (int i = 0, end = 0; i < 8; i++) {
+                        end = end || !text[i];
+                        it.key = it.key << 8 | (end ? 0 : tolower((unsigned char) text[i]));
+                }
+                break;
+        case TYPE_BOOL:
+                it.rank = RANK_BOOL;
+                it.key = VAL_BOOL(v);
+                break;
+        default:
+                break;
+        }
+        return it;
+}
+
+static int
+cmp_rows(SortCtx *s, const SortItem *a, const SortItem *b)
+{
+        Value va, vb;
+        int c;
+
+        if (a->rank != b->rank) {
+                c = a->rank - b->rank;
+                if (a->rank == RANK_EMPTY || b->rank == RANK_EMPTY) return c;
+                return s->keys[0].desc ? -c : c;
+        }
+        c = (a->key > b->key) - (a->key < b->key);
+        if (c == 0 && a->rank == RANK_TEXT)
+                c = strcasecmp(VAL_TEXT(s->vals[0][a->row]) ?: "", VAL_TEXT(s->vals[0][b->row]) ?: "");
+        if (c) return s->keys[0].desc ? -c : c;
+
+        for (int k = 1; k < s->nkeys; k++) {
+                va = s->vals[k][a->row];
+                vb = s->vals[k][b->row];
+                if (is_empty(va) || is_empty(vb)) {
+                        if ((c = is_empty(va) - is_empty(vb))) return c;
+                        continue;
+                }
+                if ((c = lookup_cmp(va, vb))) return s->keys[k].desc ? -c : c;
+        }
+        return 0;
+}
+
+/* Merge the sorted runs A[lo, mid) and A[mid, hi), using TMP */
+static void
+merge(SortCtx *s, SortItem *a, SortItem *tmp, int lo, int mid, int hi)
+{
+        int i = lo, j = mid, k = lo;
+
+        if (cmp_rows(s, a + mid - 1, a + mid) <= 0) return;
+        while (i < mid && j < hi)
+                tmp[k++] = cmp_rows(s, a + j, a + i) < 0 ? a[j++] : a[i++];
+        while (i < mid)
+                tmp[k++] = a[i++];
+        /* What is left of the second run is already in place */
+        memcpy(a + lo, tmp + lo, sizeof *a * (k - lo));
+}
+
+static void
+merge_sort(SortCtx *s, SortItem *a, SortItem *tmp, int lo, int hi)
+{
+        SortItem x;
+        int mid, j;
+
+        if (hi - lo <= SORT_RUN) {
+                for (int i = lo + 1; i < hi; i++) {
+                        x = a[i];
+                        for (j = i; j > lo && cmp_rows(s, &x, a + j - 1) < 0; j--)
+                                a[j] = a[j - 1];
+                        a[j] = x;
+                }
+                return;
+        }
+        mid = lo + (hi - lo) / 2;
+        merge_sort(s, a, tmp, lo, mid);
+        merge_sort(s, a, tmp, mid, hi);
+        merge(s, a, tmp, lo, mid, hi);
+}
+
+static void *
+sort_job(void *arg)
+{
+        SortJob *j = arg;
+        merge_sort(j->s, j->a, j->tmp, j->lo, j->hi);
+        return NULL;
+}
+
+static void *
+merge_job(void *arg)
+{
+        SortJob *j = arg;
+        merge(j->s, j->a, j->tmp, j->lo, j->mid, j->hi);
+        return NULL;
+}
+
+/* Run N jobs, the first one in this thread */
+static void
+run_jobs(void *(*f)(void *), SortJob *jobs, int n)
+{
+        pthread_t threads[SORT_MAX_THREADS];
+        bool started[SORT_MAX_THREADS] = { 0 };
+
+        for (int i = 1; i < n; i++)
+                started[i] = !pthread_create(threads + i, NULL, f, jobs + i);
+        for (int i = 0; i < n; i++)
+                if (!started[i]) f(jobs + i);
+        for (int i = 1; i < n; i++)
+                if (started[i]) pthread_join(threads[i], NULL);
+}
+
+/* Each thread sorts a chunk, and then pairs of sorted chunks are merged
+ * until there is only one */
+static void
+parallel_sort(SortCtx *s, SortItem *a, SortItem *tmp, int n)
+{
+        SortJob jobs[SORT_MAX_THREADS];
+        int bounds[SORT_MAX_THREADS + 1];
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        int t = n / SORT_CHUNK_ROWS, m;
+
+        if (t > cpus) t = cpus;
+        if (t > SORT_MAX_THREADS) t = SORT_MAX_THREADS;
+        if (t < 1) t = 1;
+        for (int i = 0; i <= t; i++)
+                bounds[i] = (long) n * i / t;
+
+        for (int i = 0; i < t; i++)
+                jobs[i] = (SortJob) { .s = s, .a = a, .tmp = tmp, .lo = bounds[i], .hi = bounds[i + 1] };
+        run_jobs(sort_job, jobs, t);
+
+        for (int w = 1; w < t; w *= 2) {
+                m = 0;
+                for (int i = 0; i + w < t; i += 2 * w) {
+                        jobs[m++] = (SortJob) {
+                                .s = s,
+                                .a = a,
+                                .tmp = tmp,
+                                .lo = bounds[i],
+                                .mid = bounds[i + w],
+                                .hi = bounds[i + 2 * w < t ? i + 2 * w : t],
+                        };
+                }
+                run_jobs(merge_job, jobs, m);
+        }
+}
+
+static Value
+cell_value(Cell *c)
+{
+        if (c == NULL) return VALUE_EMPTY;
+        if (VAL_TYPE(c->value) == TYPE_FORMULA) return VAL_FORMULA(c->value)->value;
+        return c->value;
+}
+
+/* Set of cells, by address. Slots are -1 if empty or the offset of the
+ * cell in the array of cells */
+typedef struct CellSet {
+        Cell **cells;
+        int *slot;
+        int size, cap, mask;
+} CellSet;
+
+static unsigned
+hash_ptr(Cell *c)
+{
+        uint64_t h = (uintptr_t) c;
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdull;
+        h ^= h >> 33;
+        return h;
+}
+
+static int
+set_find(CellSet *s, Cell *c)
+{
+        int i = hash_ptr(c) & s->mask;
+        while (s->slot[i] >= 0 && s->cells[s->slot[i]] != c)
+                i = (i + 1) & s->mask;
+        return i;
+}
+
+static void
+set_grow(CellSet *s)
+{
+        int buckets = s->mask + 1;
+
+        s->cap = s->cap ? s->cap * 2 : 1024;
+        s->cells = mem_realloc(MEM_MISC, s->cells, sizeof *s->cells * s->cap);
+        while (buckets < 2 * s->cap)
+                buckets *= 2;
+        if (buckets == s->mask + 1) return;
+        mem_free(MEM_MISC, s->slot);
+        s->slot = mem_malloc(MEM_MISC, sizeof *s->slot * buckets);
+        s->mask = buckets - 1;
+        memset(s->slot, -1, sizeof *s->slot * buckets);
+        for (int i = 0; i < s->size; i++)
+                s->slot[set_find(s, s->cells[i])] = i;
+}
+
+/* Offset of C in S, added if it was not there */
+static int
+set_add(CellSet *s, Cell *c)
+{
+        int i;
+        if (s->size == s->cap) set_grow(s);
+        if (s->slot[i = set_find(s, c)] < 0) {
+                s->cells[s->size] = c;
+                s->slot[i] = s->size++;
+        }
+        return s->slot[i];
+}
+
+/* Offset of C in S, -1 if it is not there */
+static int
+set_offset(CellSet *s, Cell *c)
+{
+        return s->size ? s->slot[set_find(s, c)] : -1;
+}
+
+static bool
+set_has(CellSet *s, Cell *c)
+{
+        return set_offset(s, c) >= 0;
+}
+
+static void
+set_free(CellSet *s)
+{
+        mem_free(MEM_MISC, s->cells);
+        mem_free(MEM_MISC, s->slot);
+}
+
+static void
+add_dependent(Dependent **deps, int *n, int *cap, Cell *c, int moved)
+{
+        if (*n == *cap) {
+                *cap = *cap ? *cap * 2 : 64;
+                *deps = mem_realloc(MEM_MISC, *deps, sizeof **deps * *cap);
+        }
+        (*deps)[(*n)++] = (Dependent) { .c = c, .moved = moved };
+}
+
+/* Whether C is in rows R0 to R1. Formulas often read their own row ROW, if
+ * it is not NULL, and the whole sheet is often sorted */
+static bool
+in_rows(CellMat *mat, Cell *c, CellArr *row, int r0, int r1)
+{
+        int x, y;
+        if (row && c >= row->data && c < row->data + row->size) return true;
+        if (r0 == 0 && r1 == mat->size - 1) return true;
+        return cm_get_cell_pos(mat, c, &x, &y) && y >= r0 && y <= r1;
+}
+
+/* Add C, a formula out of the rows sorted, if it is in the sheet and it was
+ * not in SEEN */
+static void
+add_outer(CellMat *mat, CellSet *seen, Dependent **deps, int *n, int *cap, Cell *c)
+{
+        int x, y;
+        if (set_has(seen, c) || !cm_get_cell_pos(mat, c, &x, &y)) return;
+        set_add(seen, c);
+        add_dependent(deps, n, cap, c, 0);
+}
+
+/* Formulas in rows R0 to R1 or reading their cells. Row R0 + I goes to
+ * R0 + INV[I] */
+static Dependent *
+find_dependents(CellMat *mat, int r0, int r1, int *inv, int *n)
+{
+        TRACE_SPAN("sort_rows: dependents", "cell");
+        CellSet seen = { 0 };
+        Dependent *deps = NULL;
+        int cap = 0;
+
+        *n = 0;
+        for (int y = r0; y <= r1; y++) {
+                for_da_each(c, mat->data[y])
+                {
+                        if (VAL_TYPE(c->value) == TYPE_FORMULA) add_dependent(&deps, n, &cap, c, inv[y - r0] - (y - r0));
+                        if (c->meta == NULL) continue;
+                        for_da_each(o, c->meta->subscribers)
+                        {
+                                if (!in_rows(mat, *o, mat->data + y, r0, r1))
+                                        add_outer(mat, &seen, &deps, n, &cap, *o);
+                        }
+                }
+        }
+        for_da_each(w, cm_watchers)
+        {
+                if (w->starty <= r1 && w->endy >= r0 && !in_rows(mat, w->observer, NULL, r0, r1))
+                        add_outer(mat, &seen, &deps, n, &cap, w->observer);
+        }
+        set_free(&seen);
+        return deps;
+}
+
+/* formula_unsubscribe for the formulas of DEPS parsed again, walking each
+ * list of subscribers once: B0 in =B1*B0 can have a subscriber per row */
+static void
+unsubscribe(Dependent *deps, int ndeps)
+{
+        TRACE_SPAN("sort_rows: unsubscribe", "cell");
+        CellSet gone = { 0 }, actors = { 0 };
+        Formula *f;
+        int n;
+
+        for (int i = 0; i < ndeps; i++)
+                if (deps[i].reparse) set_add(&gone, deps[i].c);
+        for (int i = 0; i < gone.size; i++) {
+                f = VAL_FORMULA(gone.cells[i]->value);
+                for_da_each(a, f->subscribed) set_add(&actors, *a);
+                da_destroy_cat(MEM_SUBSCRIBERS, &f->subscribed);
+        }
+        for (int i = 0; i < actors.size; i++) {
+                CellMeta *m = actors.cells[i]->meta;
+                n = 0;
+                for_da_each(o, m->subscribers) if (!set_has(&gone, *o)) m->subscribers.data[n++] = *o;
+                m->subscribers.size = n;
+        }
+        n = 0;
+        for_da_each(w, cm_watchers) if (!set_has(&gone, w->observer)) cm_watchers.data[n++] = *w;
+        cm_watchers.size = n;
+        cm_recount_watchers();
+        set_free(&gone);
+        set_free(&actors);
+}
+
+/* Call F for each formula that reads the value of C: its subscribers and the
+ * formulas watching its column */
+static void
+for_each_reader(CellMat *mat, Cell *c, void (*f)(Cell *, void *), void *arg)
+{
+        int x, y;
+
+        if (c->meta)
+                for_da_each(o, c->meta->subscribers) f(*o, arg);
+        if (cm_watchers.size == 0 || !cm_get_cell_pos(mat, c, &x, &y)) return;
+        for_da_each(w, cm_watchers)
+        {
+                if (x >= w->startx && x <= w->endx && y >= w->starty && y <= w->endy) f(w->observer, arg);
+        }
+}
+
+/* Formulas that read others of the ones being evaluated. The rest do not
+ * have to wait for any */
+typedef struct Recompute {
+        CellSet set;
+        int *pending;  // formulas each one still has to wait for
+        bool *counted; // its readers are counted in pending
+        int cap;
+        int *ready;
+        int nready;
+} Recompute;
+
+static void
+add_reader(Cell *c, void *arg)
+{
+        Recompute *r = arg;
+        int i;
+
+        if (VAL_TYPE(c->value) != TYPE_FORMULA) return;
+        i = set_add(&r->set, c);
+        if (r->cap < r->set.cap) {
+                r->pending = mem_realloc(MEM_MISC, r->pending, sizeof *r->pending * r->set.cap);
+                r->counted = mem_realloc(MEM_MISC, r->counted, sizeof *r->counted * r->set.cap);
+                memset(r->pending + r->cap, 0, sizeof *r->pending * (r->set.cap - r->cap));
+                memset(r->counted + r->cap, 0, sizeof *r->counted * (r->set.cap - r->cap));
+                r->cap = r->set.cap;
+        }
+        ++r->pending[i];
+}
+
+static void
+done_reader(Cell *c, void *arg)
+{
+        Recompute *r = arg;
+        int i;
+
+        if (VAL_TYPE(c->value) != TYPE_FORMULA) return;
+        i = set_offset(&r->set, c);
+        if (--r->pending[i] == 0) r->ready[r->nready++] = i;
+}
+
+/* Evaluate DEPS and every formula that depends on them, each one once and
+ * after the formulas it reads. Formulas are not notified of the changes on
+ * the way, that would evaluate them again for each one */
+static void
+recompute(CellMat *mat, Dependent *deps, int ndeps)
+{
+        TRACE_SPAN("sort_rows: recompute", "cell");
+        Recompute r = { 0 };
+        int i, k, done = 0;
+
+        for (i = 0; i < ndeps; i++)
+                if (VAL_TYPE(deps[i].c->value) == TYPE_FORMULA) for_each_reader(mat, deps[i].c, add_reader, &r);
+        for (i = 0; r.set.size && i < ndeps; i++)
+                if ((k = set_offset(&r.set, deps[i].c)) >= 0) r.counted[k] = true;
+        /* The readers of the readers, until there are no more */
+        for (i = 0; i < r.set.size; i++) {
+                if (r.counted[i]) continue;
+                r.counted[i] = true;
+                for_each_reader(mat, r.set.cells[i], add_reader, &r);
+        }
+
+        r.ready = mem_malloc(MEM_MISC, sizeof *r.ready * (r.set.size ?: 1));
+        for (i = 0; i < ndeps; i++) {
+                if (VAL_TYPE(deps[i].c->value) != TYPE_FORMULA || set_offset(&r.set, deps[i].c) >= 0) continue;
+                formula_evaluate(deps[i].c);
+                if (r.set.size) for_each_reader(mat, deps[i].c, done_reader, &r);
+        }
+        for (k = 0; k < r.nready; k++) {
+                Cell *c = r.set.cells[r.ready[k]];
+                formula_evaluate(c);
+                ++done;
+                for_each_reader(mat, c, done_reader, &r);
+        }
+        /* What is left is in a cycle */
+        for (i = 0; done < r.set.size && i < r.set.size; i++)
+                if (r.pending[i] > 0) formula_evaluate(r.set.cells[i]);
+
+        mem_free(MEM_MISC, r.ready);
+        mem_free(MEM_MISC, r.pending);
+        mem_free(MEM_MISC, r.counted);
+        set_free(&r.set);
+}
+
+void
+sort_rows(CellMat *mat, int r0, int r1, SortKey *keys, int nkeys)
+{
+        TRACE_SPAN("sort_rows", "cell");
+        SortCtx s = { .keys = keys, .nkeys = nkeys };
+        int n = r1 - r0 + 1, *idx, *inv, ndeps;
+        SortItem *items, *tmp;
+        CellArr *rows;
+        Dependent *deps;
+
+        if (r0 < 0 || r1 >= mat->size || n < 2 || nkeys < 1) return;
+
+        {
+                TRACE_SPAN("sort_rows: sort", "cell");
+                s.vals = mem_calloc(MEM_MISC, nkeys, sizeof *s.vals);
+                for (int k = 0; k < nkeys; k++) {
+                        s.vals[k] = mem_malloc(MEM_MISC, sizeof **s.vals * n);
+                        for (int i = 0; i < n; i++)
+                                s.vals[k][i] = cell_value(cm_get_cell_ptr(mat, keys[k].col, r0 + i));
+                }
+                items = mem_malloc(MEM_MISC, sizeof *items * n);
+                tmp = mem_malloc(MEM_MISC, sizeof *tmp * n);
+                for (int i = 0; i < n; i++)
+                        items[i] = sort_item(s.vals[0][i], i);
+                parallel_sort(&s, items, tmp, n);
+                for (int k = 0; k < nkeys; k++)
+                        mem_free(MEM_MISC, s.vals[k]);
+                mem_free(MEM_MISC, s.vals);
+                mem_free(MEM_MISC, tmp);
+        }
+
+        /* Formulas are found while their cells are where they were */
+        idx = mem_malloc(MEM_MISC, sizeof *idx * n);
+        inv = mem_malloc(MEM_MISC, sizeof *inv * n);
+        for (int i = 0; i < n; i++) {
+                idx[i] = items[i].row;
+                inv[idx[i]] = i;
+        }
+        mem_free(MEM_MISC, items);
+        deps = find_dependents(mat, r0, r1, inv, &ndeps);
+        {
+                TRACE_SPAN("sort_rows: formulas", "cell");
+                for (int i = 0; i < ndeps; i++)
+                        deps[i].reparse = !formula_move(deps[i].c, deps[i].moved, r0, r1, inv);
+        }
+        unsubscribe(deps, ndeps);
+
+        /* Rows keep their cells, so only the rows are moved */
+        rows = mem_malloc(MEM_MISC, sizeof *rows * n);
+        for (int i = 0; i < n; i++)
+                rows[i] = mat->data[r0 + idx[i]];
+        memcpy(mat->data + r0, rows, sizeof *rows * n);
+        mem_free(MEM_MISC, rows);
+        mem_free(MEM_MISC, idx);
+        mem_free(MEM_MISC, inv);
+        ++cm_layout_version;
+
+        {
+                TRACE_SPAN("sort_rows: reparse", "cell");
+                for (int i = 0; i < ndeps; i++)
+                        if (deps[i].reparse) formula_reparse(deps[i].c, deps[i].moved, r0, r1);
+        }
+        recompute(mat, deps, ndeps);
+        mem_free(MEM_MISC, deps);
+        log_info("Sorted rows %d to %d, %d formulas updated", r0, r1, ndeps);
+}
@@ -0,0 +1,47 @@
+/*
+ * VICEL - Visual Cell editor
+ * Copyright (C) 2025  Hugo Coto Florez
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * For questions or support, contact: me@hugocoto.com
+ */
+
+#ifndef SORT_H_
+#define SORT_H_
+
+#include "cellmap.h"
+
+/* Sort of whole rows of the sheet. Rows are ordered by their values in the
+ * key columns, as lookup_cmp compares them, with empty cells always last.
+ * Equal rows keep their order. A merge sort of the row indices (split
+ * between threads for big ranges) is applied in one pass, moving the rows
+ * instead of their cells.
+ *
+ * References follow the address, not the value: after sorting, a formula
+ * that depends on B5 depends on what is in B5 then. Formulas in the sorted
+ * rows move with them. Their relative references into the sorted rows move
+ * the same rows, and the others keep their address. A reference that would
+ * move out of the sheet is kept, and the formula is an error until it is
+ * edited (see formula_reparse). */
+
+typedef struct SortKey {
+        int col;
+        bool desc;
+} SortKey;
+
+/* Sort rows R0 to R1 (both included) of MAT by NKEYS KEYS */
+void sort_rows(CellMat *mat, int r0, int r1, SortKey *keys, int nkeys);
+
+#endif // !SORT_H_
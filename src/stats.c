@@ -0,0 +1,389 @@
+/*
+ * VICEL - Visual Cell editor
+ * Copyright (C) 2025  Hugo Coto Florez
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * For questions or support, contact: me@hugocoto.com
+ */
+
+#define LOG_CAT LOG_FORMULA
+
+#include "stats.h"
+#include "common.h"
+#include "debug.h"
+#include "eval.h"
+#include "mem.h"
+#include "profile.h"
+#include "window.h"
+#include <math.h>
+
+/* Numbers of the calls being evaluated. A call pushes its numbers after the
+ * ones of the calls that are evaluating it, and pops them when it returns */
+static struct {
+        double *data;
+        int size;
+        int capacity;
+} scratch = { 0 };
+
+static void
+reserve(int n)
+{
+        if (scratch.size + n <= scratch.capacity) return;
+        if (scratch.capacity == 0) scratch.capacity = 256;
+        while (scratch.size + n > scratch.capacity)
+                scratch.capacity *= 2;
+        scratch.data = mem_realloc(MEM_MISC, scratch.data, sizeof *scratch.data * scratch.capacity);
+}
+
+static void
+push(void *data, double x)
+{
+        (void) data;
+        reserve(1);
+        scratch.data[scratch.size++] = x;
+}
+
+static Value
+cell_value(Cell *c)
+{
+        if (c == NULL) return VALUE_EMPTY;
+        if (VAL_TYPE(c->value) == TYPE_FORMULA) return VAL_FORMULA(c->value)->value;
+        return c->value;
+}
+
+static void
+visit_cell(Cell *c, void (*f)(void *, double), void *data)
+{
+        Value v = c->value;
+        if (VAL_TYPE(v) == TYPE_FORMULA) v = VAL_FORMULA(v)->value;
+        if (VAL_TYPE(v) == TYPE_NUMBER && !isnan(VAL_NUM(v))) f(data, VAL_NUM(v));
+}
+
+/* Call F with every number of V */
+static void
+visit(Value v, void (*f)(void *, double), void *data)
+{
+        struct Range *r;
+        const int *rows;
+        Cell *c;
+        int n;
+
+        if (VAL_TYPE(v) == TYPE_FORMULA) v = VAL_FORMULA(v)->value;
+        if (VAL_TYPE(v) == TYPE_NUMBER) {
+                if (!isnan(VAL_NUM(v))) f(data, VAL_NUM(v));
+                return;
+        }
+        if (VAL_TYPE(v) != TYPE_RANGE) return;
+
+        r = VAL_RANGE(v);
+        if (profile_enabled)
+                profile_range((r->endx - r->startx + 1) * (r->endy - r->starty + 1));
+        if (r->open) {
+                for (int x = r->startx; x <= r->endx; x++) {
+                        n = cm_column_rows(active_ctx.body, x, r->starty, r->endy, &rows);
+                        for (int i = 0; i < n; i++)
+                                visit_cell(active_ctx.body->data[rows[i]].data + x, f, data);
+                }
+                return;
+        }
+        for (int x = r->startx; x <= r->endx; x++) {
+                for (int y = r->starty; y <= r->endy; y++) {
+                        if (!(c = cm_get_cell_ptr(active_ctx.body, x, y))) break;
+                        visit_cell(c, f, data);
+                }
+        }
+}
+
+/* Push the numbers of E, and of the arguments after it if ALL, to the
+ * scratch buffer. Return where they start */
+static int
+collect(Expr *e, bool all)
+{
+        int base = scratch.size;
+        for (; e; e = all ? e->next : NULL)
+                visit(eval_expr(e), push, NULL);
+        return base;
+}
+
+typedef struct Moments {
+        int n;
+        double mean;
+        double m2; // sum of squared differences to the mean
+} Moments;
+
+static void
+welford(void *data, double x)
+{
+        Moments *m = data;
+        double d = x - m->mean;
+        m->n++;
+        m->mean += d / m->n;
+        m->m2 += d * (x - m->mean);
+}
+
+static void
+sift_down(double *a, int i, int n)
+{
+        double x = a[i];
+        int child;
+        while ((child = 2 * i + 1) < n) {
+                if (child + 1 < n && a[child + 1] > a[child]) child++;
+                if (a[child] <= x) break;
+                a[i] = a[child];
+                i = child;
+        }
+        a[i] = x;
+}
+
+static void
+heap_sort(double *a, int n)
+{
+        double t;
+        for (int i = n / 2 - 1; i >= 0; i--)
+                sift_down(a, i, n);
+        for (int i = n - 1; i > 0; i--) {
+                t = a[0], a[0] = a[i], a[i] = t;
+                sift_down(a, 0, i);
+        }
+}
+
+/* Move the K-th smallest number of A to A[K], with smaller or equal numbers
+ * before it and greater or equal ones after it. Quickselect with a median of
+ * three pivot, that sorts the part left with a heap if it goes too deep */
+static void
+select_nth(double *a, int n, int k)
+{
+        int lo = 0, hi = n - 1, i, j, depth = 0;
+        double p, t;
+
+        for (int m = n; m > 1; m >>= 1)
+                depth += 2;
+
+        while (hi > lo) {
+                if (depth-- == 0) {
+                        heap_sort(a + lo, hi - lo + 1);
+                        return;
+                }
+                i = lo + (hi - lo) / 2;
+                if (a[i] < a[lo]) t = a[i], a[i] = a[lo], a[lo] = t;
+                if (a[hi] < a[lo]) t = a[hi], a[hi] = a[lo], a[lo] = t;
+                if (a[hi] < a[i]) t = a[hi], a[hi] = a[i], a[i] = t;
+                p = a[i];
+
+                i = lo, j = hi;
+                while (i <= j) {
+                        while (a[i] < p) i++;
+                        while (a[j] > p) j--;
+                        if (i <= j) {
+                                t = a[i], a[i] = a[j], a[j] = t;
+                                i++, j--;
+                        }
+                }
+                /* a[lo, j] <= p, a[i, hi] >= p and the ones between are p */
+                if (k <= j)
+                        hi = j;
+                else if (k >= i)
+                        lo = i;
+                else
+                        return;
+        }
+}
+
+/* Percentile K (from 0 to 1) of the N numbers of A, interpolating between
+ * the two closest ones. A is reordered */
+static double
+percentile(double *a, int n, double k)
+{
+        double h = (n - 1) * k, next;
+        int i = (int) h;
+
+        select_nth(a, n, i);
+        if (i + 1 >= n || h == i) return a[i];
+        /* The next one is the smallest of the ones after it */
+        next = a[i + 1];
+        for (int j = i + 2; j < n; j++)
+                if (a[j] < next) next = a[j];
+        return a[i] + (h - i) * (next - a[i]);
+}
+
+/* var(...): sample variance */
+Value
+stats_var(Expr *args)
+{
+        Moments m = { 0 };
+        for (Expr *e = args; e; e = e->next)
+                visit(eval_expr(e), welford, &m);
+        if (m.n < 2) return VALUE_ERROR;
+        return AS_NUMBER(m.m2 / (m.n - 1));
+}
+
+/* stdev(...): sample standard deviation */
+Value
+stats_stdev(Expr *args)
+{
+        Value v = stats_var(args);
+        if (VAL_TYPE(v) != TYPE_NUMBER) return v;
+        return AS_NUMBER(sqrt(VAL_NUM(v)));
+}
+
+static Value
+percentile_of(Expr *e, double k)
+{
+        int base = collect(e, e != NULL && k < 0);
+        int n = scratch.size - base;
+        double x;
+
+        if (n == 0) return VALUE_ERROR;
+        x = percentile(scratch.data + base, n, k < 0 ? 0.5 : k);
+        scratch.size = base;
+        return AS_NUMBER(x);
+}
+
+/* median(...) */
+Value
+stats_median(Expr *args)
+{
+        return percentile_of(args, -1);
+}
+
+/* percentile(range, k): with k from 0 to 1 */
+Value
+stats_percentile(Expr *args)
+{
+        Value k;
+        if (args == NULL || args->next == NULL) return VALUE_ERROR;
+        k = eval_expr(args->next);
+        if (VAL_TYPE(k) != TYPE_NUMBER || !(VAL_NUM(k) >= 0 && VAL_NUM(k) <= 1)) return VALUE_ERROR;
+        return percentile_of(args, VAL_NUM(k));
+}
+
+/* quartile(range, q): with q from 0 (min) to 4 (max) */
+Value
+stats_quartile(Expr *args)
+{
+        Value q;
+        if (args == NULL || args->next == NULL) return VALUE_ERROR;
+        q = eval_expr(args->next);
+        if (VAL_TYPE(q) != TYPE_NUMBER || !(VAL_NUM(q) >= 0 && VAL_NUM(q) < 5)) return VALUE_ERROR;
+        return percentile_of(args, (int) VAL_NUM(q) / 4.0);
+}
+
+static int
+cmp_double(const void *a, const void *b)
+{
+        double x = *(const double *) a, y = *(const double *) b;
+        return (x > y) - (x < y);
+}
+
+/* Times X is in the sorted numbers A[0, n) */
+static int
+times_in(double *a, int n, double x)
+{
+        int lo = 0, hi = n, first;
+        while (lo < hi) {
+                int mid = lo + (hi - lo) / 2;
+                if (a[mid] < x)
+                        lo = mid + 1;
+                else
+                        hi = mid;
+        }
+        first = lo;
+        hi = n;
+        while (lo < hi) {
+                int mid = lo + (hi - lo) / 2;
+                if (a[mid] <= x)
+                        lo = mid + 1;
+                else
+                        hi = mid;
+        }
+        return lo - first;
+}
+
+/* mode(...): the number that repeats the most. On a tie, the one that comes
+ * first. Error if none repeats */
+Value
+stats_mode(Expr *args)
+{
+        int base = collect(args, true);
+        int n = scratch.size - base, most = 1, run = 1;
+        double *a, *sorted;
+        Value v = VALUE_ERROR;
+
+        reserve(n);
+        a = scratch.data + base;
+        sorted = a + n;
+        memcpy(sorted, a, sizeof *a * n);
+        qsort(sorted, n, sizeof *sorted, cmp_double);
+        for (int i = 1; i < n; i++) {
+                run = sorted[i] == sorted[i - 1] ? run + 1 : 1;
+                if (run > most) most = run;
+        }
+        if (most > 1) {
+                for (int i = 0; i < n; i++) {
+                        if (times_in(sorted, n, a[i]) == most) {
+                                v = AS_NUMBER(a[i]);
+                                break;
+                        }
+                }
+        }
+        scratch.size = base;
+        return v;
+}
+
+/* correl(xs, ys): Pearson correlation of the pairs of numbers at the same
+ * position of two ranges of the same size */
+Value
+stats_correl(Expr *args)
+{
+        Value xs, ys, x, y;
+        struct Range *a, *b;
+        double mx = 0, my = 0, sxx = 0, syy = 0, sxy = 0, dx, dy;
+        int n = 0;
+
+        if (args == NULL || args->next == NULL) return VALUE_ERROR;
+        xs = eval_expr(args);
+        ys = eval_expr(args->next);
+        if (VAL_TYPE(xs) != TYPE_RANGE || VAL_TYPE(ys) != TYPE_RANGE) return VALUE_ERROR;
+        a = VAL_RANGE(xs);
+        b = VAL_RANGE(ys);
+        if (a->endx - a->startx != b->endx - b->startx ||
+            a->endy - a->starty != b->endy - b->starty) return VALUE_ERROR;
+
+        for (int i = 0; i <= a->endx - a->startx; i++) {
+                for (int j = 0; j <= a->endy - a->starty; j++) {
+                        x = cell_value(cm_get_cell_ptr(active_ctx.body, a->startx + i, a->starty + j));
+                        y = cell_value(cm_get_cell_ptr(active_ctx.body, b->startx + i, b->starty + j));
+                        if (VAL_TYPE(x) != TYPE_NUMBER || VAL_TYPE(y) != TYPE_NUMBER) continue;
+                        n++;
+                        dx = VAL_NUM(x) - mx;
+                        dy = VAL_NUM(y) - my;
+                        mx += dx / n;
+                        my += dy / n;
+                        sxx += dx * (VAL_NUM(x) - mx);
+                        syy += dy * (VAL_NUM(y) - my);
+                        sxy += dx * (VAL_NUM(y) - my);
+                }
+        }
+        if (n < 2 || sxx == 0 || syy == 0) return VALUE_ERROR;
+        return AS_NUMBER(sxy / sqrt(sxx * syy));
+}
+
+void
+stats_destroy()
+{
+        mem_free(MEM_MISC, scratch.data);
+        scratch.data = NULL;
+        scratch.size = scratch.capacity = 0;
+}
@@ -0,0 +1,42 @@
+/*
+ * VICEL - Visual Cell editor
+ * Copyright (C) 2025  Hugo Coto Florez
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * For questions or support, contact: me@hugocoto.com
+ */
+
+#ifndef STATS_H_
+#define STATS_H_
+
+#include "formula.h"
+
+/* Statistics over the numbers of the arguments, ignoring text, booleans and
+ * empty cells. Variances and correlation are accumulated in a single pass.
+ * Median and percentiles copy the numbers to a scratch buffer and select the
+ * needed positions in it, without sorting it. The buffer is kept between
+ * evaluations, so it only grows with the largest call. */
+
+Value stats_var(Expr *args);
+Value stats_stdev(Expr *args);
+Value stats_median(Expr *args);
+Value stats_percentile(Expr *args);
+Value stats_quartile(Expr *args);
+Value stats_mode(Expr *args);
+Value stats_correl(Expr *args);
+
+void stats_destroy();
+
+#endif // !STATS_H_
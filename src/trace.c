@@ -0,0 +1,143 @@
+/*
+ * VICEL - Visual Cell editor
+ * Copyright (C) 2025  Hugo Coto Florez
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * For questions or support, contact: me@hugocoto.com
+ */
+
+#include "trace.h"
+#include "debug.h"
+#include <pthread.h>
+#include <sys/syscall.h>
+
+struct TraceEvent {
+        const char *name;
+        const char *cat;
+        uint64_t start;
+        uint64_t end;
+};
+
+/* Events of a thread. Only that thread appends to it */
+struct TraceBuffer {
+        pid_t tid;
+        int size;
+        int capacity;
+        struct TraceEvent *data;
+        struct TraceBuffer *next;
+};
+
+bool trace_enabled = false;
+static char *trace_file = NULL;
+static uint64_t trace_origin = 0;
+static struct TraceBuffer *buffers = NULL;
+static pthread_mutex_t buffers_lock = PTHREAD_MUTEX_INITIALIZER;
+static __thread struct TraceBuffer *buffer = NULL;
+
+uint64_t
+trace_now()
+{
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static struct TraceBuffer *
+thread_buffer()
+{
+        buffer = calloc(1, sizeof *buffer);
+        buffer->tid = syscall(SYS_gettid);
+        pthread_mutex_lock(&buffers_lock);
+        buffer->next = buffers;
+        buffers = buffer;
+        pthread_mutex_unlock(&buffers_lock);
+        return buffer;
+}
+
+void
+trace_end(TraceSpan *span)
+{
+        uint64_t end = trace_now();
+        struct TraceBuffer *b;
+
+        if (!trace_enabled) return;
+        b = buffer ?: thread_buffer();
+        /* Spans are short and there can be millions of them: grow by doubling
+         * instead of with da_append */
+        if (b->size == b->capacity) {
+                b->capacity = b->capacity ? b->capacity * 2 : 1024;
+                b->data = realloc(b->data, sizeof *b->data * b->capacity);
+        }
+        b->data[b->size++] = (struct TraceEvent) {
+                .name = span->name,
+                .cat = span->cat,
+                .start = span->start,
+                .end = end,
+        };
+}
+
+void
+trace_open(const char *file)
+{
+        trace_file = strdup(file);
+        trace_origin = trace_now();
+        trace_enabled = true;
+        atexit(trace_close);
+}
+
+/* Write every buffer. Must be called when no other thread is tracing */
+void
+trace_close()
+{
+        struct TraceBuffer *b, *next;
+        FILE *f;
+        pid_t pid = getpid();
+        bool first = true;
+
+        if (!trace_enabled) return;
+        trace_enabled = false;
+
+        if (!(f = fopen(trace_file, "w"))) {
+                log_error("Can not open trace file %s", trace_file);
+                return;
+        }
+
+        fprintf(f, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+        for (b = buffers; b; b = b->next) {
+                fprintf(f, "%s{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": %d, \"tid\": %d, "
+                           "\"args\": {\"name\": \"%s\"}}",
+                        first ? "" : ",\n", pid, b->tid, b->tid == pid ? "main" : "worker");
+                first = false;
+                for (int i = 0; i < b->size; i++) {
+                        struct TraceEvent *e = b->data + i;
+                        fprintf(f, ",\n{\"name\": \"%s\", \"cat\": \"%s\", \"ph\": \"X\", "
+                                   "\"ts\": %.3f, \"dur\": %.3f, \"pid\": %d, \"tid\": %d}",
+                                e->name, e->cat, (e->start - trace_origin) / 1e3,
+                                (e->end - e->start) / 1e3, pid, b->tid);
+                }
+        }
+        fprintf(f, "\n]}\n");
+        fclose(f);
+
+        for (b = buffers; b; b = next) {
+                next = b->next;
+                free(b->data);
+                free(b);
+        }
+        buffers = NULL;
+        buffer = NULL;
+        free(trace_file);
+        trace_file = NULL;
+}
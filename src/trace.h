@@ -0,0 +1,72 @@
+/*
+ * VICEL - Visual Cell editor
+ * Copyright (C) 2025  Hugo Coto Florez
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * For questions or support, contact: me@hugocoto.com
+ */
+
+#ifndef TRACE_H_
+#define TRACE_H_
+
+#include "common.h"
+#include <stdint.h>
+
+/* Tracing. With --trace FILE, scoped spans are recorded and written to FILE at
+ * exit in Chrome trace-event format (open it in chrome://tracing or
+ * ui.perfetto.dev). Each thread records into its own buffer and its events
+ * carry its thread id.
+ *
+ *     void load(...)
+ *     {
+ *             TRACE_SPAN("load", "io");
+ *             ...
+ *     } // span ends here
+ *
+ * When tracing is disabled a span costs a branch when it starts and another
+ * when it ends. */
+
+typedef struct TraceSpan {
+        const char *name;
+        const char *cat;
+        uint64_t start; // ns, 0 if tracing was disabled when the span started
+} TraceSpan;
+
+extern bool trace_enabled;
+
+/* Enable tracing. FILE is written at exit */
+void trace_open(const char *file);
+void trace_close();
+uint64_t trace_now();
+void trace_end(TraceSpan *span);
+
+static inline void
+trace_span_cleanup(TraceSpan *span)
+{
+        if (span->start) trace_end(span);
+}
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+
+#define TRACE_SPAN(_name_, _cat_)                                            \
+        TraceSpan TRACE_CONCAT(trace_span_, __LINE__)                        \
+        __attribute__((cleanup(trace_span_cleanup))) = {                     \
+                .name = (_name_),                                            \
+                .cat = (_cat_),                                              \
+                .start = __builtin_expect(trace_enabled, 0) ? trace_now() : 0, \
+        }
+
+#endif // !TRACE_H_
@@ -0,0 +1,161 @@
+/*
+ * VICEL - Visual Cell editor
+ * Copyright (C) 2025  Hugo Coto Florez
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * For questions or support, contact: me@hugocoto.com
+ */
+
+#include "utf8.h"
+#include "common.h"
+
+struct Interval {
+        int first;
+        int last;
+};
+
+/* Combining marks, format and zero width chars (Unicode Mn, Me and Cf
+ * categories, only the blocks that are likely to appear in a sheet) */
+static const struct Interval zero_width[] = {
+        { 0x0300, 0x036F }, { 0x0483, 0x0489 }, { 0x0591, 0x05BD },
+        { 0x05BF, 0x05BF }, { 0x05C1, 0x05C2 }, { 0x05C4, 0x05C5 },
+        { 0x05C7, 0x05C7 }, { 0x0610, 0x061A }, { 0x064B, 0x065F },
+        { 0x0670, 0x0670 }, { 0x06D6, 0x06DC }, { 0x06DF, 0x06E4 },
+        { 0x06E7, 0x06E8 }, { 0x06EA, 0x06ED }, { 0x0711, 0x0711 },
+        { 0x0730, 0x074A }, { 0x07A6, 0x07B0 }, { 0x0900, 0x0902 },
+        { 0x093A, 0x093A }, { 0x093C, 0x093C }, { 0x0941, 0x0948 },
+        { 0x094D, 0x094D }, { 0x0951, 0x0957 }, { 0x0962, 0x0963 },
+        { 0x0981, 0x0981 }, { 0x09BC, 0x09BC }, { 0x09C1, 0x09C4 },
+        { 0x09CD, 0x09CD }, { 0x0E31, 0x0E31 }, { 0x0E34, 0x0E3A },
+        { 0x0E47, 0x0E4E }, { 0x0EB1, 0x0EB1 }, { 0x0EB4, 0x0EBC },
+        { 0x0EC8, 0x0ECD }, { 0x1160, 0x11FF }, { 0x1AB0, 0x1AFF },
+        { 0x1DC0, 0x1DFF }, { 0x200B, 0x200F }, { 0x202A, 0x202E },
+        { 0x2060, 0x2064 }, { 0x20D0, 0x20FF }, { 0xFE00, 0xFE0F },
+        { 0xFE20, 0xFE2F }, { 0xFEFF, 0xFEFF }, { 0xE0001, 0xE007F },
+        { 0xE0100, 0xE01EF },
+};
+
+/* East Asian Wide and Fullwidth chars, and emoji with default emoji
+ * presentation */
+static const struct Interval wide[] = {
+        { 0x1100, 0x115F }, { 0x231A, 0x231B }, { 0x2329, 0x232A },
+        { 0x23E9, 0x23EC }, { 0x23F0, 0x23F0 }, { 0x23F3, 0x23F3 },
+        { 0x25FD, 0x25FE }, { 0x2614, 0x2615 }, { 0x2648, 0x2653 },
+        { 0x267F, 0x267F }, { 0x2693, 0x2693 }, { 0x26A1, 0x26A1 },
+        { 0x26AA, 0x26AB }, { 0x26BD, 0x26BE }, { 0x26C4, 0x26C5 },
+        { 0x26CE, 0x26CE }, { 0x26D4, 0x26D4 }, { 0x26EA, 0x26EA },
+        { 0x26F2, 0x26F3 }, { 0x26F5, 0x26F5 }, { 0x26FA, 0x26FA },
+        { 0x26FD, 0x26FD }, { 0x2705, 0x2705 }, { 0x270A, 0x270B },
+        { 0x2728, 0x2728 }, { 0x274C, 0x274C }, { 0x274E, 0x274E },
+        { 0x2753, 0x2755 }, { 0x2757, 0x2757 }, { 0x2795, 0x2797 },
+        { 0x27B0, 0x27B0 }, { 0x27BF, 0x27BF }, { 0x2B1B, 0x2B1C },
+        { 0x2B50, 0x2B50 }, { 0x2B55, 0x2B55 }, { 0x2E80, 0x303E },
+        { 0x3041, 0x33FF }, { 0x3400, 0x4DBF }, { 0x4E00, 0x9FFF },
+        { 0xA000, 0xA4CF }, { 0xA960, 0xA97F }, { 0xAC00, 0xD7A3 },
+        { 0xF900, 0xFAFF }, { 0xFE10, 0xFE19 }, { 0xFE30, 0xFE6F },
+        { 0xFF00, 0xFF60 }, { 0xFFE0, 0xFFE6 }, { 0x16FE0, 0x16FE4 },
+        { 0x17000, 0x18AFF }, { 0x1B000, 0x1B2FF }, { 0x1F004, 0x1F004 },
+        { 0x1F0CF, 0x1F0CF }, { 0x1F18E, 0x1F18E }, { 0x1F191, 0x1F19A },
+        { 0x1F200, 0x1F251 }, { 0x1F300, 0x1F64F }, { 0x1F680, 0x1F6FF },
+        { 0x1F7E0, 0x1F7EB }, { 0x1F90C, 0x1F9FF }, { 0x1FA70, 0x1FAFF },
+        { 0x20000, 0x2FFFD }, { 0x30000, 0x3FFFD },
+};
+
+static bool
+in_table(int cp, const struct Interval *table, int size)
+{
+        int lo = 0;
+        int hi = size - 1;
+        if (cp < table[0].first || cp > table[hi].last) return false;
+        while (lo <= hi) {
+                int mid = (lo + hi) / 2;
+                if (cp > table[mid].last)
+                        lo = mid + 1;
+                else if (cp < table[mid].first)
+                        hi = mid - 1;
+                else
+                        return true;
+        }
+        return false;
+}
+
+int
+utf8_decode(const char *s, int *cp)
+{
+        const unsigned char *u = (const unsigned char *) s;
+        int n;
+
+        if (u[0] < 0x80) {
+                *cp = u[0];
+                return 1;
+        }
+        if (u[0] >= 0xF8 || u[0] < 0xC0) goto invalid;
+
+        n = u[0] >= 0xF0 ? 4 : u[0] >= 0xE0 ? 3 : 2;
+        *cp = u[0] & (0x7F >> n);
+        for (int i = 1; i < n; i++) {
+                if ((u[i] & 0xC0) != 0x80) goto invalid;
+                *cp = (*cp << 6) | (u[i] & 0x3F);
+        }
+        return n;
+
+invalid:
+        *cp = 0xFFFD;
+        return 1;
+}
+
+int
+utf8_cp_width(int cp)
+{
+        if (cp < 0x300) return 1;
+        if (in_table(cp, zero_width, sizeof zero_width / sizeof *zero_width)) return 0;
+        if (in_table(cp, wide, sizeof wide / sizeof *wide)) return 2;
+        return 1;
+}
+
+int
+utf8_width(const char *s)
+{
+        int w = 0;
+        int cp;
+        while (*s) {
+                if ((unsigned char) *s < 0x80) {
+                        ++w;
+                        ++s;
+                        continue;
+                }
+                s += utf8_decode(s, &cp);
+                w += utf8_cp_width(cp);
+        }
+        return w;
+}
+
+int
+utf8_cut(const char *s, int w, int *cols)
+{
+        int len = 0;
+        int c = 0;
+        int cp, n, cw;
+
+        while (s[len]) {
+                n = utf8_decode(s + len, &cp);
+                cw = utf8_cp_width(cp);
+                if (c + cw > w) break;
+                c += cw;
+                len += n;
+        }
+        if (cols) *cols = c;
+        return len;
+}
@@ -0,0 +1,40 @@
+/*
+ * VICEL - Visual Cell editor
+ * Copyright (C) 2025  Hugo Coto Florez
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * For questions or support, contact: me@hugocoto.com
+ */
+
+#ifndef UTF8_H_
+#define UTF8_H_
+
+/* Decode the code point at S into CP. Returns the number of bytes used.
+ * Invalid sequences decode as U+FFFD using one byte. */
+int utf8_decode(const char *s, int *cp);
+
+/* Columns used by CP on the terminal: 0 (combining), 1 or 2 (wide) */
+int utf8_cp_width(int cp);
+
+/* Columns used by the string S */
+int utf8_width(const char *s);
+
+/* Number of bytes of S that fit in W columns. Zero width code points after
+ * the last one that fits are kept so a grapheme is not split from its marks.
+ * The columns actually used are stored in COLS (it can be W - 1 if a wide
+ * char does not fit). */
+int utf8_cut(const char *s, int w, int *cols);
+
+#endif // !UTF8_H_
@@ -18,6 +18,8 @@
  * For questions or support, contact: me@hugocoto.com
  */
 
+#define LOG_CAT LOG_RENDER
+
 #include "window.h"
 #include "cellmap.h"
 #include "color.h"
@@ -25,13 +27,27 @@
 #include "da.h"
 #include "debug.h"
 #include "escape_code.h"
+#include "loop.h"
 #include "mappings.h"
 #include "options.h"
+#include "trace.h"
+#include "utf8.h"
 #include <unistd.h>
 
 Context active_ctx = INIT_CONTEXT;
 char ui_report[64] = "";
-time_t ui_report_update_time = 0;
+static int ui_report_timer = -1;
+
+#define UI_REPORT_TIMEOUT 2 // seconds
+
+static void
+ui_report_timeout(int fd, void *data)
+{
+        (void) fd;
+        (void) data;
+        clear_ui_report();
+        loop_request_render(false);
+}
 
 void
 set_ui_report(const char *c, ...)
@@ -39,8 +55,11 @@ set_ui_report(const char *c, ...)
         va_list v;
         va_start(v, c);
         vsnprintf(ui_report, sizeof ui_report, c, v);
-        ui_report_update_time = time(NULL);
         va_end(v);
+
+        if (ui_report_timer < 0)
+                ui_report_timer = loop_add_timer(0, false, ui_report_timeout, NULL);
+        loop_arm_timer(ui_report_timer, UI_REPORT_TIMEOUT, false);
 }
 
 void
@@ -49,22 +68,98 @@ clear_ui_report()
         *ui_report = 0;
 }
 
+/* Column layout. Widths are kept in a Fenwick tree so that the offset of a
+ * column and the column at a given offset are O(log n). The tree only grows
+ * when a column gets a non default width. */
+
 int
-get_cell_screen_width(Cell *c)
+col_width(int x)
+{
+        Fenwick *f = &active_ctx.col_widths;
+        return x < f->size ? fw_get(f, x) : win_opts.col_width;
+}
+
+void
+col_set_width(int x, int w)
+{
+        Fenwick *f = &active_ctx.col_widths;
+        if (x >= f->size) fw_resize(f, x + 1, win_opts.col_width);
+        fw_set(f, x, w);
+}
+
+/* Sum of the widths of the columns before X */
+int
+col_offset(int x)
+{
+        Fenwick *f = &active_ctx.col_widths;
+        if (x <= f->size) return fw_prefix(f, x);
+        return fw_prefix(f, f->size) + (x - f->size) * win_opts.col_width;
+}
+
+/* Column that contains offset OFF (relative to the first column) */
+int
+col_at_offset(int off)
+{
+        Fenwick *f = &active_ctx.col_widths;
+        int total = fw_prefix(f, f->size);
+        if (off < total) return fw_search(f, off);
+        return f->size + (off - total) / win_opts.col_width;
+}
+
+/* Column under screen column SX (starting at 0) */
+int
+col_at_screen_x(int sx)
+{
+        sx = max(sx - win_opts.num_col_width, 0);
+        return col_at_offset(sx + col_offset(active_ctx.scroll_c));
+}
+
+void
+col_insert(int x)
+{
+        Fenwick *f = &active_ctx.col_widths;
+        if (x <= f->size) fw_insert(f, x, win_opts.col_width);
+}
+
+void
+col_remove(int x)
 {
-        /* TODO: handle the case when cell is the last one in the screen so it's
-         * smaller than usual. Also, return some error i cell is not in screen
-         * cell.width is not correct. Idk why. Fix this.
-         * */
-        c = (void *) c;
-        return 10;
+        Fenwick *f = &active_ctx.col_widths;
+        if (x < f->size) fw_remove(f, x);
 }
 
+/* Scroll horizontally the minimum needed to show the whole column X */
 void
-clear_ui_report_ontimeout(time_t maxtime)
+col_scroll_to(int x)
+{
+        int avail = active_ctx.ws.ws_col - win_opts.num_col_width;
+        int right = col_offset(x + 1);
+
+        if (x < active_ctx.scroll_c) {
+                active_ctx.scroll_c = x;
+                return;
+        }
+        if (right - col_offset(active_ctx.scroll_c) > avail)
+                active_ctx.scroll_c = min(x, col_at_offset(right - avail - 1) + 1);
+}
+
+/* Width C takes on the screen, 0 if it is not visible */
+int
+get_cell_screen_width(Cell *c)
 {
-        if (*ui_report && time(NULL) - ui_report_update_time > maxtime)
-                *ui_report = 0;
+        int avail = active_ctx.ws.ws_col - win_opts.num_col_width;
+        int last = min(active_ctx.scroll_r + active_ctx.max_display_r, active_ctx.body->size);
+        int x, off;
+
+        for (int y = active_ctx.scroll_r; y < last; y++) {
+                CellArr *row = active_ctx.body->data + y;
+                if (c < row->data || c >= row->data + row->size) continue;
+                x = c - row->data;
+                if (x < active_ctx.scroll_c) return 0;
+                off = col_offset(x) - col_offset(active_ctx.scroll_c);
+                return max(min(col_width(x), avail - off), 0);
+        }
+        return 0;
 }
 
 int
@@ -105,34 +200,24 @@ get_cell_from_coords(char *coords)
 {
         int x, y;
         if (parse_coords(coords, &x, &y, 0, 0)) {
-                report("Impossible to parse coords: %s", coords);
+                log_warn("Impossible to parse coords: %s", coords);
                 return NULL;
         }
         if (active_ctx.body == NULL) {
-                report("get_cell_from_coords: using no yet initialized body", x, coords);
+                log_error("get_cell_from_coords: using no yet initialized body (%s)", coords);
                 exit(ERR_INVBODY);
         }
         if (y < 0 || y >= active_ctx.body->size) {
-                report("Invalid y coord: %d from %s", y, coords);
+                log_warn("Invalid y coord: %d from %s", y, coords);
                 return NULL;
         }
         if (x < 0 || x >= active_ctx.body->data->size) {
-                report("Invalid x coord: %d from %s", x, coords);
+                log_warn("Invalid x coord: %d from %s", x, coords);
                 return NULL;
         }
         return cm_get_cell_ptr(active_ctx.body, x, y);
 }
 
-void
-set_cell_color(Cell *cell)
-{
-        if (cell->color.active) {
-                apply_color(cell->color.scolor);
-                return;
-        }
-        apply_color("cell");
-}
-
 // can block - it's better to throw an error I think
 void
 get_current_position(int *x, int *y)
@@ -140,15 +225,146 @@ get_current_position(int *x, int *y)
         // starting at 1,1
         T_DSR();
         fflush(stdout);
-        char buf[12];
+        char buf[32];
+        char *csi;
+        size_t len = 0;
         ssize_t n;
-repeat:
-        if ((n = read(STDIN_FILENO, buf, sizeof buf - 1)) < 0) {
-                report("Error reading stdin from get_current_position");
-                exit(ERR_STDIN);
+        /* The reply may come in more than one read */
+        for (;;) {
+                if ((n = read(STDIN_FILENO, buf + len, sizeof buf - 1 - len)) <= 0) {
+                        log_error("Error reading stdin from get_current_position");
+                        exit(ERR_STDIN);
+                }
+                len += n;
+                buf[len] = 0;
+                if ((csi = strstr(buf, T_CSI)) && strchr(csi, 'R') &&
+                    sscanf(csi, T_CSI "%d;%dR", y, x) == 2)
+                        return;
+                if (len == sizeof buf - 1) len = 0;
+        }
+}
+
+/* Screen lines. Everything render() draws is first built into LINE and then
+ * compared with what is already on the terminal (SCREEN, indexed by screen
+ * row). Only lines that changed are written. */
+static struct {
+        char *data;
+        int len;
+        int capacity;
+} line = { 0 };
+static char **screen = NULL;
+static int screen_rows = 0;
+
+/* What was on the screen the last time render() was called */
+static int last_scroll_r = -1;
+static int last_scroll_c = -1;
+
+static void
+line_printf(const char *format, ...)
+{
+        va_list v;
+        int n;
+
+        va_start(v, format);
+        n = vsnprintf(NULL, 0, format, v);
+        va_end(v);
+
+        if (line.len + n + 1 > line.capacity) {
+                line.capacity = (line.len + n + 1) * 2;
+                line.data = realloc(line.data, line.capacity);
+        }
+
+        va_start(v, format);
+        vsnprintf(line.data + line.len, n + 1, format, v);
+        va_end(v);
+        line.len += n;
+}
+
+/* Same as apply_color but into LINE */
+static void
+line_color(char *key)
+{
+        line_printf("%s%s", get_color(NULL), get_color(key) ?: get_color(NULL));
+}
+
+static void
+line_reset()
+{
+        line.len = 0;
+        if (line.data) *line.data = 0;
+}
+
+/* Write LINE at screen row Y (starting at 1) if it is not already there */
+static void
+line_flush(int y)
+{
+        if (y < 1 || y > screen_rows) return;
+        if (line.data == NULL) line_printf("");
+        if (screen[y - 1] && !strcmp(screen[y - 1], line.data)) {
+                line_reset();
+                return;
+        }
+        T_CUP(y, 1);
+        fwrite(line.data, 1, line.len, stdout);
+        free(screen[y - 1]);
+        screen[y - 1] = strdup(line.data);
+        line_reset();
+}
+
+/* Forget what is on the screen so next render() draws everything */
+void
+render_invalidate()
+{
+        for (int i = 0; i < screen_rows; i++) {
+                free(screen[i]);
+                screen[i] = NULL;
+        }
+        last_scroll_r = -1;
+        last_scroll_c = -1;
+}
+
+static void
+screen_resize(int rows)
+{
+        if (rows == screen_rows) return;
+        render_invalidate();
+        screen = realloc(screen, sizeof *screen * rows);
+        for (int i = 0; i < rows; i++)
+                screen[i] = NULL;
+        screen_rows = rows;
+}
+
+/* Move the lines in [TOP, BOTTOM] N lines up (or down if N < 0) using a
+ * scroll region, so only the exposed lines have to be drawn again. */
+static void
+screen_scroll(int top, int bottom, int n)
+{
+        int h = bottom - top + 1;
+        int i;
+
+        if (n == 0 || abs(n) >= h) return;
+
+        printf(T_CSI "%d;%dr", top, bottom); // DECSTBM
+        if (n > 0)
+                T_SU(n);
+        else
+                T_SD(-n);
+        printf(T_CSI "r");
+
+        if (n > 0) {
+                for (i = top; i < top + n; i++)
+                        free(screen[i - 1]);
+                memmove(screen + top - 1, screen + top - 1 + n, sizeof *screen * (h - n));
+                for (i = bottom - n + 1; i <= bottom; i++)
+                        screen[i - 1] = NULL;
+        } else {
+                n = -n;
+                for (i = bottom - n + 1; i <= bottom; i++)
+                        free(screen[i - 1]);
+                memmove(screen + top - 1 + n, screen + top - 1, sizeof *screen * (h - n));
+                for (i = top; i < top + n; i++)
+                        screen[i - 1] = NULL;
         }
-        buf[n] = 0;
-        if (sscanf(buf, T_CSI "%d;%dR", y, x) != 2) goto repeat;
 }
 
 void
@@ -156,10 +372,11 @@ print_status_bar2()
 {
         char buf[1024];
         bool has_ui_report = *ui_report;
+        char *input_repr = cm_input_repr(get_cursor_cell());
         int asize = strlen(win_opts.ui_celltext_l_sep) +
-                    strlen(get_cursor_cell()->input_repr) +
+                    strlen(input_repr) +
                     strlen(win_opts.ui_celltext_m_sep) +
-                    strlen(cm_type_repr(get_cursor_cell()->value.type)) +
+                    strlen(cm_type_repr(VAL_TYPE(get_cursor_cell()->value))) +
                     strlen(win_opts.ui_celltext_r_sep) >
                     active_ctx.ws.ws_col ?
                     0 :
@@ -168,32 +385,31 @@ print_status_bar2()
         buf[snprintf(buf, active_ctx.ws.ws_col + 1 + asize,
                      has_ui_report ? "%s%s%s%s%s%s%-*.*s" : "%s%s%s%s%s%s%*.*s",
                      win_opts.ui_celltext_l_sep,
-                     get_cursor_cell()->input_repr,
+                     input_repr,
                      win_opts.ui_celltext_m_sep,
-                     cm_type_repr(get_cursor_cell()->value.type),
+                     cm_type_repr(VAL_TYPE(get_cursor_cell()->value)),
                      win_opts.ui_celltext_r_sep,
                      get_color(has_ui_report ? "ui_report" : "ui"),
                      max((int) (active_ctx.ws.ws_col -
                                 +strlen(win_opts.ui_celltext_l_sep) -
                                 +strlen(win_opts.ui_celltext_m_sep) -
                                 +strlen(win_opts.ui_celltext_r_sep) -
-                                +strlen(get_cursor_cell()->input_repr) -
-                                +strlen(cm_type_repr(get_cursor_cell()->value.type))),
+                                +strlen(input_repr) -
+                                +strlen(cm_type_repr(VAL_TYPE(get_cursor_cell()->value)))),
                          0),
                      max((int) (active_ctx.ws.ws_col -
                                 +strlen(win_opts.ui_celltext_l_sep) -
                                 +strlen(win_opts.ui_celltext_m_sep) -
                                 +strlen(win_opts.ui_celltext_r_sep) -
-                                +strlen(get_cursor_cell()->input_repr) -
-                                +strlen(cm_type_repr(get_cursor_cell()->value.type))),
+                                +strlen(input_repr) -
+                                +strlen(cm_type_repr(VAL_TYPE(get_cursor_cell()->value)))),
                          0),
                      has_ui_report ? ui_report : win_opts.ui_status_bottom_end)] = 0;
 
         assert(active_ctx.status_bar_height == 1);
-        T_CUP(active_ctx.ws.ws_row, 1);
-
-        apply_color("ui_cell_text");
-        printf("%s", buf);
+        line_color("ui_cell_text");
+        line_printf("%s", buf);
+        line_flush(active_ctx.ws.ws_row);
 }
 
 char mappings_buffer[16];
@@ -221,12 +437,12 @@ print_status_bar()
                      win_opts.status_r_end)] = 0;
 
         assert(active_ctx.status_bar_height == 1);
-        T_CUP(1, 1);
-
-        apply_color("ui");
-        printf("%s", buf);
+        line_color("ui");
+        line_printf("%s", buf);
+        line_flush(1);
 }
 
+/* The status bar is drawn on next render */
 void
 print_mapping_buffer(char *buf, int len, int n, int repeat)
 {
@@ -239,7 +455,6 @@ print_mapping_buffer(char *buf, int len, int n, int repeat)
                 mappings_buffer, sizeof mappings_buffer,
                 " [x%2d %-*.*s] ", repeat, n, len, buf)] = 0;
         }
-        print_status_bar();
 }
 
 void
@@ -257,30 +472,23 @@ cursor_gotocell(int x, int y)
         int first_cell_col = 1;
         int first_cell_row = 2;
         T_CUP(first_cell_row + win_opts.row_width * y - active_ctx.scroll_r,
-              win_opts.num_col_width + first_cell_col + win_opts.col_width * (x - 1 - active_ctx.scroll_c));
+              win_opts.num_col_width + first_cell_col + col_offset(x - 1) - col_offset(active_ctx.scroll_c));
 }
 
+/* Column names (the ruler) at screen row Y0 */
 void
-display_add_names(CellMat *mat, int x_off, int y_off, int scr_w, int scr_h, int x0, int y0)
+display_add_names(CellMat *mat, int x_off, int scr_w, int y0)
 {
-        int _cy = y0;
-        int _cx = x0;
-        int avx = scr_w - _cx;
-        int avy = scr_h - _cy;
+        int avx = scr_w - 1;
         char *col = strdup("  "); // Up to ZZ
         int range = 'Z' - 'A' + 1;
         int xx = 0;
-        int n;
 
-        T_CUP(_cy, _cx);
-        apply_color("ln");
+        line_color("ln");
 
         /* The top left gap */
-        printf("%-*.*s", win_opts.num_col_width, win_opts.num_col_width, "");
-
-        _cx += win_opts.num_col_width;
+        line_printf("%-*.*s", win_opts.num_col_width, win_opts.num_col_width, "");
         avx -= win_opts.num_col_width;
-        avy -= win_opts.row_width;
 
         col[1] = 'A' + x_off % range;
         if (x_off / range) col[0] = 'A' + x_off / range - 1;
@@ -292,17 +500,16 @@ display_add_names(CellMat *mat, int x_off, int y_off, int scr_w, int scr_h, int
                         continue;
                 }
 
-                if (xx == active_ctx.cursor_pos_c) apply_color("ln_over");
+                if (xx == active_ctx.cursor_pos_c) line_color("ln_over");
 
-                int wwww = min(win_opts.col_width, avx);
+                int wwww = min(col_width(xx), avx);
                 int ww = (wwww + 1) / 2;
-                printf("%*.*s%*.*s", ww, ww, col,
-                       wwww - ww, wwww - ww, "");
+                line_printf("%*.*s%*.*s", ww, ww, col,
+                            wwww - ww, wwww - ww, "");
 
-                if (xx == active_ctx.cursor_pos_c) apply_color("ln");
+                if (xx == active_ctx.cursor_pos_c) line_color("ln");
 
-                _cx += win_opts.col_width;
-                avx -= win_opts.col_width;
+                avx -= col_width(xx);
                 xx++;
                 if (avx <= 0) break;
 
@@ -318,132 +525,119 @@ display_add_names(CellMat *mat, int x_off, int y_off, int scr_w, int scr_h, int
                 }
         }
 
-        if (avx > 0) T_EL(0);
+        if (avx > 0) line_printf(T_CSI "0K");
         free(col);
-        _cy = y0 += win_opts.row_width;
-        _cx = x0;
-        n = y_off;
-        int yy = 0;
-        for_da_each(_, *mat)
-        {
-                if (yy < y_off) {
-                        ++yy;
-                        continue;
-                }
-                T_CUP(_cy, _cx);
-
-                if (yy == active_ctx.cursor_pos_r) apply_color("ln_over");
-
-                printf("%*d ", win_opts.num_col_width - 1, n);
-
-                if (yy == active_ctx.cursor_pos_r) apply_color("ln");
-
-                _cy += win_opts.row_width;
-                avy -= win_opts.row_width;
-                if (avy <= 0) break;
-                n++;
-                yy++;
-        }
+        line_flush(y0);
 }
 
-void
-cm_display(CellMat *mat, int x_off, int y_off, int scr_w, int scr_h, int x0, int y0)
+/* Draw the row number and the cells of row YY */
+static int
+display_row(CellArr *ca, int yy, int x_off, int avx)
 {
-        int _cy = y0;
-        int _cx;
-        int avx;
-        int avy;
-        int xx;
-        int yy = 0;
-        int m_r = 0;
+        int xx = 0;
         int m_c = 0;
-        avy = scr_h - _cy;
-        for_da_each(ca, *mat)
+
+        line_color(yy == active_ctx.cursor_pos_r ? "ln_over" : "ln");
+        line_printf("%*d ", win_opts.num_col_width - 1, yy);
+        line_color("ln");
+        avx -= win_opts.num_col_width;
+
+        for_da_each(cell, *ca)
         {
-                if (yy < y_off) {
-                        ++yy;
+                if (xx < x_off) {
+                        ++xx;
                         continue;
                 }
-                ++m_r;
-                _cx = x0;
-                avx = scr_w - _cx;
-                xx = 0;
-                m_c = 0;
-                for_da_each(cell, *ca)
-                {
-                        if (xx < x_off) {
-                                ++xx;
-                                continue;
-                        }
-                        T_CUP(_cy, _cx);
-                        assert(cell->heigh == 1);
 
-                        int w = min(win_opts.col_width, avx) -
-                                strlen(win_opts.cell_l_sep) - strlen(win_opts.cell_r_sep);
+                int w = min(col_width(xx), avx) -
+                        win_opts.cell_l_sep_w - win_opts.cell_r_sep_w;
 
-                        if (w <= 0) {
-                                break;
-                        }
-                        ++m_c;
+                if (w <= 0) {
+                        break;
+                }
+                ++m_c;
 
-                        if (cell->selected) {
-                                apply_color("sheet_ui_selected");
-                                printf("%s", win_opts.cell_l_sep);
-                                apply_color("cell_selected");
-                        }
+                if (cell->selected) {
+                        line_color("sheet_ui_selected");
+                        line_printf("%s", win_opts.cell_l_sep);
+                        line_color("cell_selected");
+                }
 
-                        else if (active_ctx.cursor_pos_r == yy &&
-                                 active_ctx.cursor_pos_c == xx) {
-                                apply_color("sheet_ui_over");
-                                printf("%s", win_opts.cell_l_sep);
-                                apply_color("cell_over");
-                        }
+                else if (active_ctx.cursor_pos_r == yy &&
+                         active_ctx.cursor_pos_c == xx) {
+                        line_color("sheet_ui_over");
+                        line_printf("%s", win_opts.cell_l_sep);
+                        line_color("cell_over");
+                }
 
-                        else {
-                                if (!win_opts.use_cell_color_for_sep) {
-                                        apply_color("sheet_ui");
-                                        printf("%s", win_opts.cell_l_sep);
-                                }
-                                set_cell_color(cell);
-                                if (win_opts.use_cell_color_for_sep) {
-                                        printf("%s", win_opts.cell_l_sep);
-                                }
+                else {
+                        if (!win_opts.use_cell_color_for_sep) {
+                                line_color("sheet_ui");
+                                line_printf("%s", win_opts.cell_l_sep);
                         }
+                        line_color(cm_has_color(cell) ? cell->meta->color.scolor : "cell");
+                        if (win_opts.use_cell_color_for_sep) {
+                                line_printf("%s", win_opts.cell_l_sep);
+                        }
+                }
 
-                        printf("%-*.*s", w, w, cell->repr);
+                char *repr = cm_repr(cell);
+                if (cell->width <= w) {
+                        line_printf("%s%*s", repr, w - cell->width, "");
+                } else {
+                        int cols;
+                        int len = cm_repr_cut(cell, w, &cols);
+                        line_printf("%.*s%*s", len, repr, w - cols, "");
+                }
 
-                        if (active_ctx.cursor_pos_r == yy &&
-                            active_ctx.cursor_pos_c == xx) {
-                                apply_color("sheet_ui_over");
-                                printf("%s", win_opts.cell_r_sep);
-                        }
+                if (active_ctx.cursor_pos_r == yy &&
+                    active_ctx.cursor_pos_c == xx) {
+                        line_color("sheet_ui_over");
+                        line_printf("%s", win_opts.cell_r_sep);
+                }
 
-                        else if (cell->selected) {
-                                apply_color("sheet_ui_selected");
-                                printf("%s", win_opts.cell_r_sep);
-                        }
+                else if (cell->selected) {
+                        line_color("sheet_ui_selected");
+                        line_printf("%s", win_opts.cell_r_sep);
+                }
 
-                        else {
-                                if (!win_opts.use_cell_color_for_sep) {
-                                        apply_color("sheet_ui");
-                                }
-                                printf("%s", win_opts.cell_r_sep);
+                else {
+                        if (!win_opts.use_cell_color_for_sep) {
+                                line_color("sheet_ui");
                         }
+                        line_printf("%s", win_opts.cell_r_sep);
+                }
 
-                        _cx += win_opts.col_width;
-                        avx -= win_opts.col_width;
-                        if (avx <= 0) break;
-                        ++xx;
+                avx -= col_width(xx);
+                if (avx <= 0) break;
+                ++xx;
+        }
+        line_color(C_RESET);
+        if (avx > 0) line_printf(T_CSI "0K");
+        return m_c;
+}
+
+/* Draw the sheet rows between screen rows Y0 and LAST (both included) */
+void
+cm_display(CellMat *mat, int x_off, int y_off, int scr_w, int y0, int last)
+{
+        TRACE_SPAN("cm_display", "render");
+        int _cy = y0;
+        int yy = y_off;
+        int m_r = 0;
+        int m_c = 0;
+
+        for (; _cy <= last; _cy += win_opts.row_width, ++yy) {
+                if (yy < mat->size) {
+                        m_c = display_row(mat->data + yy, yy, x_off, scr_w - 1);
+                        ++m_r;
+                } else {
+                        line_color(C_RESET);
+                        line_printf(T_CSI "0K");
                 }
-                apply_color(C_RESET);
-                if (avx > 0) T_EL(0);
-                avy -= win_opts.row_width;
-                _cy += win_opts.row_width;
-                ++yy;
-                if (avy <= 0) break;
+                line_flush(_cy);
         }
 
-        if (avy > 0) T_ED(0);
         active_ctx.max_display_c = m_c;
         active_ctx.max_display_r = m_r;
 }
@@ -451,9 +645,32 @@ cm_display(CellMat *mat, int x_off, int y_off, int scr_w, int scr_h, int x0, int
 void
 render()
 {
+        TRACE_SPAN("render", "render");
+        int first = 3;                      // first sheet row
+        int last = active_ctx.ws.ws_row - 1; // last sheet row
+
+        screen_resize(active_ctx.ws.ws_row);
+
+        /* Vertical scroll: move what is already on the screen */
+        if (last_scroll_c == active_ctx.scroll_c && last_scroll_r >= 0 &&
+            last_scroll_r != active_ctx.scroll_r) {
+                screen_scroll(first, last, (active_ctx.scroll_r - last_scroll_r) * win_opts.row_width);
+        }
+        last_scroll_r = active_ctx.scroll_r;
+        last_scroll_c = active_ctx.scroll_c;
+
         print_status_bar();
-        display_add_names(active_ctx.body, active_ctx.scroll_c, active_ctx.scroll_r, active_ctx.ws.ws_col + 1, active_ctx.ws.ws_row, 1, 2);
-        cm_display(active_ctx.body, active_ctx.scroll_c, active_ctx.scroll_r, active_ctx.ws.ws_col + 1, active_ctx.ws.ws_row, win_opts.num_col_width + 1, 3);
+        display_add_names(active_ctx.body, active_ctx.scroll_c, active_ctx.ws.ws_col + 1, 2);
+        cm_display(active_ctx.body, active_ctx.scroll_c, active_ctx.scroll_r, active_ctx.ws.ws_col + 1, first, last);
         print_status_bar2();
         fflush(stdout);
 }
+
+/* Clear the screen and draw everything again */
+void
+render_full()
+{
+        clear_screen();
+        render_invalidate();
+        render();
+}
@@ -23,6 +23,7 @@
 
 #include "cellmap.h" /* shut up */
 #include "common.h"
+#include "fenwick.h"
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
 #define max(a, b) ((a) >= (b) ? (a) : (b))
@@ -41,6 +42,10 @@ typedef struct Context {
         int scroll_c;
         int max_display_r;
         int max_display_c;
+
+        /* Width of each column. Columns past the end of the tree have the
+         * default width (win_opts.col_width) */
+        Fenwick col_widths;
 } Context;
 
 #define INIT_CONTEXT ((Context) { \
@@ -54,18 +59,29 @@ typedef struct Context {
 .scroll_r = 0,                    \
 .max_display_c = 0,               \
 .max_display_r = 0,               \
+.col_widths = { 0 },              \
 })
 
 void print_at(int r, int c, char *buf, int buflen, int n);
 void render();
+void render_full();
+void render_invalidate();
 void cursor_gotocell(int x, int y);
 void print_mapping_buffer(char *buf, int len, int n, int repeat);
 Cell *get_cell_from_coords(char *coords);
 int parse_coords(char *c, int *x, int *y, bool *freeze_r, bool *freeze_c);
 void set_ui_report(const char *c, ...);
 void clear_ui_report();
-void clear_ui_report_ontimeout(time_t maxtime);
 int get_cell_screen_width(Cell *c);
+
+int col_width(int x);
+void col_set_width(int x, int w);
+int col_offset(int x);
+int col_at_offset(int off);
+int col_at_screen_x(int sx);
+void col_insert(int x);
+void col_remove(int x);
+void col_scroll_to(int x);
 void get_current_position(int *x, int *y);
 
 extern Context active_ctx;